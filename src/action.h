@@ -19,6 +19,8 @@ enum action
 	ACTION_DIFF,
 	ACTION_DIFF_LONG,
 	ACTION_MONITOR,
+	// An extra connection that sends protocol1 backup data.
+	ACTION_BACKUP_STREAM,
 };
 
 #endif
@@ -2,6 +2,13 @@
 #include "alloc.h"
 #include "log.h"
 
+#ifndef HAVE_WIN32
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif
+
 #ifdef UTEST
 int alloc_debug=0;
 /*
@@ -12,6 +19,9 @@ int alloc_debug=0;
 int alloc_errors=0;
 uint64_t alloc_count=0;
 uint64_t free_count=0;
+// The champ chooser threads allocate and free too.
+#define count_alloc()	__sync_fetch_and_add(&alloc_count, 1)
+#define count_free()	__sync_fetch_and_add(&free_count, 1)
 void alloc_counters_reset(void)
 {
 	alloc_count=0;
@@ -35,7 +45,7 @@ char *strdup_w(const char *s, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced s\n", ret);
 	}
 #endif
@@ -57,7 +67,7 @@ void *realloc_w(void *ptr, size_t size, const char *func)
 	if(!(ret=realloc(ptr, size))) log_oom_w(__func__, func);
 #ifdef UTEST
 	else if(!already_alloced)
-		alloc_count++;
+		count_alloc();
 	if(alloc_debug) printf("%p alloced r\n", ret);
 #endif
 	return ret;
@@ -73,7 +83,7 @@ void *malloc_w(size_t size, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced m\n", ret);
 	}
 #endif
@@ -90,7 +100,7 @@ void *calloc_w(size_t nmem, size_t size, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced c\n", ret);
 	}
 #endif
@@ -106,7 +116,7 @@ void free_v(void **ptr)
 	free(*ptr);
 	*ptr=NULL;
 #ifdef UTEST
-	free_count++;
+	count_free();
 #endif
 }
 
@@ -114,3 +124,38 @@ void free_w(char **str)
 {
 	free_v((void **)str);
 }
+
+// Zeroed memory that stays shared with processes forked after it was
+// created. The server parent uses this for state that all of its forked
+// children need to update, such as the global rate limit bucket.
+// There is no fork on Windows, so it is just ordinary memory there.
+void *calloc_shared_w(size_t size, const char *func)
+{
+	void *ret;
+#ifdef HAVE_WIN32
+	ret=calloc_w(1, size, func);
+#else
+	if((ret=mmap(NULL, size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	{
+		logp("mmap failed in %s: %s\n", func, strerror(errno));
+		return NULL;
+	}
+	memset(ret, 0, size);
+#endif
+	return ret;
+}
+
+#ifdef HAVE_WIN32
+void free_shared_v(void **ptr, __attribute__ ((unused)) size_t size)
+{
+	free_v(ptr);
+}
+#else
+void free_shared_v(void **ptr, size_t size)
+{
+	if(!ptr || !*ptr) return;
+	munmap(*ptr, size);
+	*ptr=NULL;
+}
+#endif
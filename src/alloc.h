@@ -16,5 +16,7 @@ extern void *malloc_w(size_t size, const char *func);
 extern void *calloc_w(size_t nmem, size_t size, const char *func);
 extern void free_v(void **ptr);
 extern void free_w(char **str);
+extern void *calloc_shared_w(size_t size, const char *func);
+extern void free_shared_v(void **ptr, size_t size);
 
 #endif
@@ -7,6 +7,7 @@
 #include "handy.h"
 #include "iobuf.h"
 #include "log.h"
+#include "ratelimit.h"
 #include "server/protocol2/champ_chooser/incoming.h"
 
 // For IPTOS / IPTOS_THROUGHPUT.
@@ -16,6 +17,10 @@
 #include <netinet/ip.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #ifdef HAVE_NCURSES_H
 #include <ncurses.h>
 #elif HAVE_NCURSES_NCURSES_H
@@ -24,10 +29,70 @@
 
 #include "protocol2/blist.h"
 
+// The read and write buffers are used from a moving start offset, so that
+// taking frames off the front, or writing part of the buffer, does not
+// have to shift what is left down each time. The data only gets moved back
+// to the beginning when there is not enough room left at the end.
+
 static void truncate_readbuf(struct asfd *asfd)
 {
 	asfd->readbuf[0]='\0';
 	asfd->readbuflen=0;
+	asfd->readbufstart=0;
+}
+
+static char *readbuf_data(struct asfd *asfd)
+{
+	return asfd->readbuf+asfd->readbufstart;
+}
+
+static void readbuf_consume(struct asfd *asfd, size_t len)
+{
+	asfd->readbufstart+=len;
+	asfd->readbuflen-=len;
+	if(!asfd->readbuflen)
+		asfd->readbufstart=0;
+}
+
+// Returns how much can be read in. There is always room for at least
+// another whole frame.
+static size_t readbuf_make_room(struct asfd *asfd)
+{
+	size_t room;
+	room=asfd->bufmaxsize-1-asfd->readbufstart-asfd->readbuflen;
+	if(asfd->readbufstart && room<asfd->frame_len+5)
+	{
+		memmove(asfd->readbuf, readbuf_data(asfd), asfd->readbuflen);
+		asfd->readbufstart=0;
+		room=asfd->bufmaxsize-1-asfd->readbuflen;
+	}
+	return room;
+}
+
+static char *writebuf_data(struct asfd *asfd)
+{
+	return asfd->writebuf+asfd->writebufstart;
+}
+
+static void writebuf_consume(struct asfd *asfd, size_t len)
+{
+	asfd->writebufstart+=len;
+	asfd->writebuflen-=len;
+	if(!asfd->writebuflen)
+		asfd->writebufstart=0;
+}
+
+// Returns non-zero if there is not room for len more bytes.
+static int writebuf_make_room(struct asfd *asfd, size_t len)
+{
+	if(asfd->writebufstart
+	  && asfd->writebufstart+asfd->writebuflen+len>=asfd->bufmaxsize-1)
+	{
+		memmove(asfd->writebuf, writebuf_data(asfd),
+			asfd->writebuflen);
+		asfd->writebufstart=0;
+	}
+	return asfd->writebuflen+len>=asfd->bufmaxsize-1;
 }
 
 static int asfd_alloc_buf(struct asfd *asfd, char **buf)
@@ -42,19 +107,9 @@ static int extract_buf(struct asfd *asfd,
 {
 	if(!(asfd->rbuf->buf=(char *)malloc_w(len+1, __func__)))
 		return -1;
-	if(!(memcpy(asfd->rbuf->buf, asfd->readbuf+offset, len)))
-	{
-		logp("%s: memcpy failed in %s\n", asfd->desc, __func__);
-		return -1;
-	}
+	memcpy(asfd->rbuf->buf, readbuf_data(asfd)+offset, len);
 	asfd->rbuf->buf[len]='\0';
-	if(!(memmove(asfd->readbuf,
-		asfd->readbuf+len+offset, asfd->readbuflen-len-offset)))
-	{
-		logp("%s: memmove failed in %s\n", asfd->desc, __func__);
-		return -1;
-	}
-	asfd->readbuflen-=len+offset;
+	readbuf_consume(asfd, len+offset);
 	asfd->rbuf->len=len;
 	return 0;
 }
@@ -79,7 +134,7 @@ static int parse_readbuf_line_buf(struct asfd *asfd)
 	{
 		// Only start from the beginning if we previously got something
 		// to extract.
-		cp=asfd->readbuf;
+		cp=readbuf_data(asfd);
 		len=0;
 	}
 	for(; len<asfd->readbuflen; cp++, len++)
@@ -98,24 +153,119 @@ static int parse_readbuf_line_buf(struct asfd *asfd)
 	return 0;
 }
 
+// Looks at the frame header at the start of the read buffer.
+// Returns 1 if the whole frame is there, 0 if not, and -1 on error.
+static int readbuf_frame(struct asfd *asfd, char *command, size_t *s)
+{
+	uint8_t *cp;
+	if(asfd->readbuflen<5) return 0;
+	cp=(uint8_t *)readbuf_data(asfd);
+	if(asfd->large_frames)
+	{
+		*command=(char)cp[0];
+		*s=((size_t)cp[1]<<24)
+		  | ((size_t)cp[2]<<16)
+		  | ((size_t)cp[3]<<8)
+		  | (size_t)cp[4];
+	}
+	else
+	{
+		unsigned int x=0;
+		if((sscanf((char *)cp, "%c%04X", command, &x))!=2)
+		{
+			logp("%s: sscanf of '%s' failed in %s\n",
+				asfd->desc, (char *)cp, __func__);
+			return -1;
+		}
+		*s=x;
+	}
+	// It would never fit in the read buffer.
+	if(*s+5>asfd->bufmaxsize-1)
+	{
+		logp("%s: frame of %zu bytes is too big in %s\n",
+			asfd->desc, *s, __func__);
+		return -1;
+	}
+	return asfd->readbuflen>=*s+5;
+}
+
 static int parse_readbuf_standard(struct asfd *asfd)
 {
-	unsigned int s=0;
+	size_t s=0;
 	char command;
-	if(asfd->readbuflen<5) return 0;
-	if((sscanf(asfd->readbuf, "%c%04X", &command, &s))!=2)
+	switch(readbuf_frame(asfd, &command, &s))
 	{
-		logp("%s: sscanf of '%s' failed in %s\n",
-			asfd->desc, asfd->readbuf, __func__);
+		case 0:
+			return 0;
+		case 1:
+			break;
+		default:
+			return -1;
+	}
+	asfd->rbuf->cmd=(enum cmd)command;
+	return extract_buf(asfd, s, 5);
+}
+
+// Gets the next frame from the read buffer without copying it. The view
+// points into the read buffer, is not null terminated, and is only good
+// until the asfd next goes round the async loop. Anything in rbuf came
+// before it, so has to be dealt with first.
+// Returns 1 if it got a frame, 0 if there is no whole frame yet, and -1 on
+// error.
+static int asfd_read_view(struct asfd *asfd, struct iobuf *view)
+{
+	size_t s=0;
+	char command;
+	if(asfd->streamtype!=ASFD_STREAM_STANDARD)
+	{
+		logp("%s: %s only works on standard streams\n",
+			asfd->desc, __func__);
 		return -1;
 	}
-	if(asfd->readbuflen>=s+5)
+	if(asfd->rbuf->buf)
 	{
-		asfd->rbuf->cmd=(enum cmd)command;
-		if(extract_buf(asfd, s, 5))
+		logp("%s: %s called with rbuf still set\n",
+			asfd->desc, __func__);
+		return -1;
+	}
+	switch(readbuf_frame(asfd, &command, &s))
+	{
+		case 0:
+			return 0;
+		case 1:
+			break;
+		default:
+			truncate_readbuf(asfd);
 			return -1;
 	}
-	return 0;
+	view->cmd=(enum cmd)command;
+	view->buf=readbuf_data(asfd)+5;
+	view->len=s;
+	readbuf_consume(asfd, s+5);
+	return 1;
+}
+
+// Gets every whole frame in the read buffer, up to 'max' of them, as views.
+// They all stay good until the asfd next goes round the async loop, so a
+// single read can be dealt with without copying each frame out.
+// Returns how many it got, or -1 on error.
+static int asfd_read_batch(struct asfd *asfd, struct iobuf *vec, size_t max)
+{
+	size_t n=0;
+	while(n<max)
+	{
+		switch(asfd_read_view(asfd, &vec[n]))
+		{
+			case 1:
+				n++;
+				break;
+			case 0:
+				return (int)n;
+			default:
+				return -1;
+		}
+	}
+	return (int)n;
 }
 
 static int asfd_parse_readbuf(struct asfd *asfd)
@@ -136,6 +286,7 @@ static int asfd_do_read_ncurses(struct asfd *asfd)
 {
 	static int i;
 	i=getch();
+	asfd->readbufstart=0;
 	asfd->readbuflen=sizeof(int);
 	memcpy(asfd->readbuf, &i, asfd->readbuflen);
 	return 0;
@@ -151,8 +302,8 @@ static int asfd_do_write_ncurses(__attribute__ ((unused)) struct asfd *asfd)
 static int asfd_do_read(struct asfd *asfd)
 {
 	ssize_t r;
-	r=read(asfd->fd,
-	  asfd->readbuf+asfd->readbuflen, asfd->bufmaxsize-asfd->readbuflen);
+	size_t room=readbuf_make_room(asfd);
+	r=read(asfd->fd, readbuf_data(asfd)+asfd->readbuflen, room);
 	if(r<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -185,18 +336,19 @@ static int asfd_do_read_ssl(struct asfd *asfd)
 {
 	int e;
 	ssize_t r;
+	size_t room;
 
 	asfd->read_blocked_on_write=0;
 
+	room=readbuf_make_room(asfd);
 	ERR_clear_error();
-	r=SSL_read(asfd->ssl,
-	  asfd->readbuf+asfd->readbuflen, asfd->bufmaxsize-asfd->readbuflen);
+	r=SSL_read(asfd->ssl, readbuf_data(asfd)+asfd->readbuflen, room);
 
 	switch((e=SSL_get_error(asfd->ssl, r)))
 	{
 		case SSL_ERROR_NONE:
 			asfd->readbuflen+=r;
-			asfd->readbuf[asfd->readbuflen]='\0';
+			readbuf_data(asfd)[asfd->readbuflen]='\0';
 			asfd->rcvd+=r;
 			break;
 		case SSL_ERROR_ZERO_RETURN:
@@ -229,48 +381,61 @@ error:
 	return -1;
 }
 
-// Return 0 for OK to write, non-zero for not OK to write.
-static int check_ratelimit(struct asfd *asfd)
+#ifdef HAVE_SYS_SENDFILE_H
+static ssize_t sendfile_some(struct asfd *asfd,
+	int fd, off_t *offset, size_t len)
 {
-	float f;
-	time_t diff;
-	if(!asfd->rlstart) asfd->rlstart=time(NULL);
-	if((diff=asfd->as->now-asfd->rlstart)<0)
+	ssize_t w=-1;
+	if(!asfd->ssl)
+		return sendfile(asfd->fd, fd, offset, len);
+#ifdef SSL_OP_ENABLE_KTLS
+	ERR_clear_error();
+	if((w=SSL_sendfile(asfd->ssl, fd, *offset, len, 0))>0)
+		*offset+=w;
+	else if(SSL_get_error(asfd->ssl, w)==SSL_ERROR_WANT_WRITE)
+		errno=EAGAIN;
+#endif
+	return w;
+}
+
+// Sends as much of the pending file data as the socket will take now. The
+// rest goes when the async loop next finds the socket writable.
+static int asfd_do_sendfile(struct asfd *asfd)
+{
+	ssize_t w;
+	w=sendfile_some(asfd, asfd->sendfile_fd,
+		&asfd->sendfile_offset, asfd->sendfile_len);
+	if(w<0)
 	{
-		// It is possible that the clock changed. Reset ourselves.
-		asfd->as->now=asfd->rlstart;
-		asfd->rlbytes=0;
-		logp("Looks like the clock went back in time since starting. "
-			"Resetting ratelimit\n");
-		return 0;
+		if(errno==EAGAIN || errno==EINTR)
+			return 0;
+		logp_ssl_err("%s: Got error in %s, (%d=%s)\n",
+			asfd->desc, __func__, errno, strerror(errno));
 	}
-	if(!diff) return 0; // Need to get started somehow.
-	f=(asfd->rlbytes)/diff; // Bytes per second.
-
-	if(f>=asfd->ratelimit)
+	else if(!w)
+		logp("%s: File ended early in %s\n", asfd->desc, __func__);
+	else
 	{
-#ifdef HAVE_WIN32
-		// Windows Sleep is milliseconds, usleep is microseconds.
-		// Do some conversion.
-		Sleep(asfd->rlsleeptime/1000);
-#else
-		usleep(asfd->rlsleeptime);
-#endif
-		// If sleeping, increase the sleep time.
-		if((asfd->rlsleeptime*=2)>=500000) asfd->rlsleeptime=500000;
-		return 1;
+		asfd->sent+=w;
+		asfd->sendfile_len-=w;
+		return 0;
 	}
-	// If not sleeping, decrease the sleep time.
-	if((asfd->rlsleeptime/=2)<=9999) asfd->rlsleeptime=10000;
-	return 0;
+	asfd->sendfile_len=0;
+	return -1;
 }
+#endif
 
 static int asfd_do_write(struct asfd *asfd)
 {
 	ssize_t w;
-	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
+	size_t len=asfd->writebuflen;
+#ifdef HAVE_SYS_SENDFILE_H
+	if(!len && asfd->sendfile_len)
+		return asfd_do_sendfile(asfd);
+#endif
+	if(asfd->rl && !(len=ratelimit_quota(asfd->rl, len))) return 0;
 
-	w=write(asfd->fd, asfd->writebuf, asfd->writebuflen);
+	w=write(asfd->fd, writebuf_data(asfd), len);
 	if(w<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -284,7 +449,7 @@ static int asfd_do_write(struct asfd *asfd)
 		logp("%s: Wrote nothing in %s\n", asfd->desc, __func__);
 		return -1;
 	}
-	if(asfd->ratelimit) asfd->rlbytes+=w;
+	if(asfd->rl) ratelimit_consume(asfd->rl, w);
 	asfd->sent+=w;
 /*
 {
@@ -294,8 +459,7 @@ printf("wrote %d: %s\n", w, buf);
 }
 */
 
-	memmove(asfd->writebuf, asfd->writebuf+w, asfd->writebuflen-w);
-	asfd->writebuflen-=w;
+	writebuf_consume(asfd, w);
 	return 0;
 }
 
@@ -303,12 +467,21 @@ static int asfd_do_write_ssl(struct asfd *asfd)
 {
 	int e;
 	ssize_t w;
+	size_t len=asfd->writebuflen;
 
+#ifdef HAVE_SYS_SENDFILE_H
+	if(!len && asfd->sendfile_len)
+		return asfd_do_sendfile(asfd);
+#endif
 	asfd->write_blocked_on_read=0;
 
-	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
+	if(asfd->ssl_write_retry)
+		len=asfd->ssl_write_retry;
+	else if(asfd->rl && !(len=ratelimit_quota(asfd->rl, len)))
+		return 0;
 	ERR_clear_error();
-	w=SSL_write(asfd->ssl, asfd->writebuf, asfd->writebuflen);
+	w=SSL_write(asfd->ssl, writebuf_data(asfd), len);
+	asfd->ssl_write_retry=0;
 
 	switch((e=SSL_get_error(asfd->ssl, w)))
 	{
@@ -320,15 +493,15 @@ snprintf(buf, w+1, "%s", asfd->writebuf);
 printf("wrote %d: %s\n", w, buf);
 }
 */
-			if(asfd->ratelimit) asfd->rlbytes+=w;
-			memmove(asfd->writebuf,
-				asfd->writebuf+w, asfd->writebuflen-w);
-			asfd->writebuflen-=w;
+			if(asfd->rl) ratelimit_consume(asfd->rl, w);
+			writebuf_consume(asfd, w);
 			asfd->sent+=w;
 			break;
 		case SSL_ERROR_WANT_WRITE:
+			asfd->ssl_write_retry=len;
 			break;
 		case SSL_ERROR_WANT_READ:
+			asfd->ssl_write_retry=len;
 			asfd->write_blocked_on_read=1;
 			break;
 		case SSL_ERROR_SYSCALL:
@@ -351,12 +524,37 @@ printf("wrote %d: %s\n", w, buf);
 static int append_to_write_buffer(struct asfd *asfd,
 	const char *buf, size_t len)
 {
-	memcpy(asfd->writebuf+asfd->writebuflen, buf, len);
+	memcpy(writebuf_data(asfd)+asfd->writebuflen, buf, len);
 	asfd->writebuflen+=len;
-	asfd->writebuf[asfd->writebuflen]='\0';
+	writebuf_data(asfd)[asfd->writebuflen]='\0';
 	return 0;
 }
 
+static int frame_too_big(struct asfd *asfd, size_t len, const char *func)
+{
+	if(len<=(asfd->large_frames?asfd->bufmaxsize/2:0xFFFF))
+		return 0;
+	logp("%s: frame of %zu bytes is too big in %s\n",
+		asfd->desc, len, func);
+	return 1;
+}
+
+static size_t frame_header(struct asfd *asfd,
+	char sbuf[], size_t sbuflen, enum cmd cmd, size_t len)
+{
+	if(asfd->large_frames)
+	{
+		sbuf[0]=(char)cmd;
+		sbuf[1]=(char)(len>>24);
+		sbuf[2]=(char)(len>>16);
+		sbuf[3]=(char)(len>>8);
+		sbuf[4]=(char)len;
+		return 5;
+	}
+	snprintf(sbuf, sbuflen, "%c%04X", cmd, (unsigned int)len);
+	return strlen(sbuf);
+}
+
 static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 	struct iobuf *wbuf)
 {
@@ -366,17 +564,18 @@ static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 		{
 			size_t sblen=0;
 			char sbuf[10]="";
-			if(asfd->writebuflen+6+(wbuf->len)>=asfd->bufmaxsize-1)
+			if(frame_too_big(asfd, wbuf->len, __func__))
+				return APPEND_ERROR;
+			if(writebuf_make_room(asfd, 6+wbuf->len))
 				return APPEND_BLOCKED;
 
-			snprintf(sbuf, sizeof(sbuf), "%c%04X",
-				wbuf->cmd, (unsigned int)wbuf->len);
-			sblen=strlen(sbuf);
+			sblen=frame_header(asfd, sbuf, sizeof(sbuf),
+				wbuf->cmd, wbuf->len);
 			append_to_write_buffer(asfd, sbuf, sblen);
 			break;
 		}
 		case ASFD_STREAM_LINEBUF:
-			if(asfd->writebuflen+wbuf->len>=asfd->bufmaxsize-1)
+			if(writebuf_make_room(asfd, wbuf->len))
 				return APPEND_BLOCKED;
 			break;
 		case ASFD_STREAM_NCURSES_STDIN:
@@ -431,6 +630,34 @@ static int asfd_set_bulk_packets(struct asfd *asfd)
 	return 0;
 }
 
+// Switches to the large frame extension, once both ends have agreed to it
+// in extra_comms. Frames that are already in the write buffer keep their
+// old headers, and the other end has to switch at the same point in the
+// stream.
+static int asfd_set_large_frames(struct asfd *asfd)
+{
+	char *buf;
+	size_t bufmaxsize=(ASFD_LARGE_FRAME_LEN*2)+32;
+	if(asfd->streamtype!=ASFD_STREAM_STANDARD)
+	{
+		logp("%s: %s only works on standard streams\n",
+			asfd->desc, __func__);
+		return -1;
+	}
+	if(asfd->large_frames)
+		return 0;
+	if(!(buf=(char *)realloc_w(asfd->readbuf, bufmaxsize, __func__)))
+		return -1;
+	asfd->readbuf=buf;
+	if(!(buf=(char *)realloc_w(asfd->writebuf, bufmaxsize, __func__)))
+		return -1;
+	asfd->writebuf=buf;
+	asfd->bufmaxsize=bufmaxsize;
+	asfd->frame_len=ASFD_LARGE_FRAME_LEN;
+	asfd->large_frames=1;
+	return 0;
+}
+
 static int asfd_read(struct asfd *asfd)
 {
 	if(asfd->as->doing_estimate) return 0;
@@ -466,6 +693,83 @@ static int asfd_write(struct asfd *asfd, struct iobuf *wbuf)
 	return 0;
 }
 
+// The data for a frame can be put straight into the write buffer, instead of
+// being copied in from somewhere else. This gives the space for up to len
+// bytes of it, after writing out what is already there if need be. The
+// header is always five bytes, and gets filled in by commit_write_buffer().
+static char *asfd_reserve_write_buffer(struct asfd *asfd, size_t len)
+{
+	if(asfd->streamtype!=ASFD_STREAM_STANDARD)
+	{
+		logp("%s: %s only works on standard streams\n",
+			asfd->desc, __func__);
+		return NULL;
+	}
+	if(frame_too_big(asfd, len, __func__))
+		return NULL;
+	while(writebuf_make_room(asfd, 6+len))
+		if(asfd->as->write(asfd->as)) return NULL;
+	return writebuf_data(asfd)+asfd->writebuflen+5;
+}
+
+static int asfd_commit_write_buffer(struct asfd *asfd, enum cmd cmd,
+	size_t len)
+{
+	char sbuf[10]="";
+	if(asfd->as->doing_estimate) return 0;
+	frame_header(asfd, sbuf, sizeof(sbuf), cmd, len);
+	memcpy(writebuf_data(asfd)+asfd->writebuflen, sbuf, 5);
+	asfd->writebuflen+=5+len;
+	writebuf_data(asfd)[asfd->writebuflen]='\0';
+	return asfd->as->write(asfd->as);
+}
+
+#ifdef HAVE_SYS_SENDFILE_H
+// Sends a frame whose data comes straight from a file, without it being
+// copied through the write buffer. With SSL, this needs the kernel to be
+// doing the encryption. Returns 1 if it cannot be done here, in which case
+// nothing has been sent.
+static int asfd_sendfile(struct asfd *asfd,
+	enum cmd cmd, int fd, off_t offset, size_t len)
+{
+	size_t sblen;
+	char sbuf[10]="";
+
+	if(asfd->as->doing_estimate
+	  || asfd->rl
+	  || asfd->streamtype!=ASFD_STREAM_STANDARD
+	  || (asfd->ssl && !ssl_ktls_send(asfd->ssl)))
+		return 1;
+	if(frame_too_big(asfd, len, __func__))
+		return -1;
+
+	// The header goes after anything that was already waiting to go, and
+	// the file data goes once the write buffer is empty.
+	sblen=frame_header(asfd, sbuf, sizeof(sbuf), cmd, len);
+	while(writebuf_make_room(asfd, sblen))
+		if(asfd->as->write(asfd->as)) return -1;
+	append_to_write_buffer(asfd, sbuf, sblen);
+	asfd->sendfile_fd=fd;
+	asfd->sendfile_offset=offset;
+	asfd->sendfile_len=len;
+
+	// Like asfd_write(), let the async loop send it as the socket becomes
+	// writable, along with whatever the other asfds have to write.
+	while(asfd->writebuflen || asfd->sendfile_len)
+		if(asfd->as->write(asfd->as)) return -1;
+	return 0;
+}
+#else
+static int asfd_sendfile(__attribute__ ((unused)) struct asfd *asfd,
+	__attribute__ ((unused)) enum cmd cmd,
+	__attribute__ ((unused)) int fd,
+	__attribute__ ((unused)) off_t offset,
+	__attribute__ ((unused)) size_t len)
+{
+	return 1;
+}
+#endif
+
 static int asfd_write_str(struct asfd *asfd, enum cmd wcmd, const char *wsrc)
 {
 	struct iobuf wbuf;
@@ -549,7 +853,6 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	asfd->port=port;
 	asfd->ssl=assl;
 	asfd->streamtype=streamtype;
-	asfd->rlsleeptime=10000;
 	asfd->pid=-1;
 	asfd->attempt_reads=1;
 	asfd->bufmaxsize=(ASYNC_BUF_LEN*2)+32;
@@ -563,9 +866,13 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	asfd->parse_readbuf=asfd_parse_readbuf;
 	asfd->append_all_to_write_buffer=asfd_append_all_to_write_buffer;
 	asfd->set_bulk_packets=asfd_set_bulk_packets;
+	asfd->set_large_frames=asfd_set_large_frames;
 	asfd->set_timeout=asfd_set_timeout;
 	if(asfd->ssl)
 	{
+		// The unwritten data can get moved back to the start of the
+		// write buffer between SSL_write() retries.
+		SSL_set_mode(asfd->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 		asfd->do_read=asfd_do_read_ssl;
 		asfd->do_write=asfd_do_write_ssl;
 	}
@@ -582,9 +889,14 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 #endif
 	}
 	asfd->read=asfd_read;
+	asfd->read_view=asfd_read_view;
+	asfd->read_batch=asfd_read_batch;
 	asfd->simple_loop=asfd_simple_loop;
 	asfd->write=asfd_write;
 	asfd->write_str=asfd_write_str;
+	asfd->sendfile=asfd_sendfile;
+	asfd->reserve_write_buffer=asfd_reserve_write_buffer;
+	asfd->commit_write_buffer=asfd_commit_write_buffer;
 
 	switch(asfd->streamtype)
 	{
@@ -618,7 +930,10 @@ struct asfd *asfd_alloc(void)
 	struct asfd *asfd;
 	asfd=(struct asfd *)calloc_w(1, sizeof(struct asfd), __func__);
 	if(asfd)
+	{
 		asfd->fd=-1;
+		asfd->frame_len=ZCHUNK;
+	}
 	return asfd;
 }
 
@@ -657,6 +972,7 @@ static void asfd_free_content(struct asfd *asfd)
 	free_w(&asfd->client);
 	incoming_free(&asfd->in);
 	blist_free(&asfd->blist);
+	ratelimit_free(&asfd->rl);
 }
 
 void asfd_free(struct asfd **asfd)
@@ -37,6 +37,14 @@ enum append_ret
 	APPEND_BLOCKED=1
 };
 
+// The most frames that callers ask read_batch() for at a time.
+#define ASFD_READ_BATCH		64
+
+// How much data goes in each frame once the large frame extension has been
+// negotiated in extra_comms. The length is then sent as a binary 32 bit
+// number instead of four hex digits.
+#define ASFD_LARGE_FRAME_LEN	(256*1024)
+
 // Async file descriptor. Can add these to a struct async.
 struct asfd
 {
@@ -50,10 +58,7 @@ struct asfd
 	int network_timeout;
 	int max_network_timeout;
 
-	float ratelimit;
-	time_t rlstart;
-	int rlsleeptime;
-	uint64_t rlbytes;
+	struct ratelimit *rl;
 
 	struct iobuf *rbuf;
 
@@ -61,22 +66,37 @@ struct asfd
 
 	int doread;
 	char *readbuf;
+	size_t readbufstart;
 	size_t readbuflen;
 	int read_blocked_on_write;
 	size_t bufmaxsize;
+	size_t frame_len; // How much data to put in each frame.
+	uint8_t large_frames;
 
 	int dowrite;
 	char *writebuf;
+	size_t writebufstart;
 	size_t writebuflen;
 	int write_blocked_on_read;
+	size_t ssl_write_retry; // SSL_write() has to be retried with this.
+	// File data that goes out by sendfile() after the write buffer.
+	int sendfile_fd;
+	off_t sendfile_offset;
+	size_t sendfile_len;
 
 	struct asfd *next;
 
+	// For the epoll backend.
+	uint8_t can_read;
+	uint8_t can_write;
+	uint8_t always_ready;
+
 	// Stuff for the champ chooser server.
 	struct incoming *in;
 	struct blist *blist;
 	int blkcnt;
 	uint64_t wrap_up;
+	uint8_t deduplicating; // A champ_workers thread has it.
 	uint8_t want_to_remove;
 
 	// For the champ chooser server main socket.
@@ -98,15 +118,21 @@ struct asfd
 	enum append_ret
 		(*append_all_to_write_buffer)(struct asfd *, struct iobuf *);
 	int (*set_bulk_packets)(struct asfd *);
+	int (*set_large_frames)(struct asfd *);
 	void (*set_timeout)(struct asfd *, int max_network_timeout);
 	int (*do_read)(struct asfd *);
 	int (*do_write)(struct asfd *);
 	int (*read)(struct asfd *);
+	int (*read_view)(struct asfd *, struct iobuf *);
+	int (*read_batch)(struct asfd *, struct iobuf *, size_t);
 	int (*simple_loop)(struct asfd *, struct conf **, void *,
 		const char *, enum asl_ret callback(struct asfd *,
 			struct conf **, void *));
 	int (*write)(struct asfd *, struct iobuf *);
 	int (*write_str)(struct asfd *, enum cmd, const char *);
+	int (*sendfile)(struct asfd *, enum cmd, int, off_t, size_t);
+	char *(*reserve_write_buffer)(struct asfd *, size_t);
+	int (*commit_write_buffer)(struct asfd *, enum cmd, size_t);
 
 #ifdef UTEST
 	// To assist mocking functions in unit tests.
@@ -2,13 +2,22 @@
 #include "alloc.h"
 #include "asfd.h"
 #include "async.h"
+#include "fsops.h"
 #include "handy.h"
 #include "iobuf.h"
 #include "log.h"
+#include "ratelimit.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 void async_free(struct async **as)
 {
 	if(!as || !*as) return;
+	// Do not remove anything from the interest set here. After a fork,
+	// the parent is still using it.
+	close_fd(&(*as)->epfd);
 	free_v((void **)as);
 }
 
@@ -80,13 +89,39 @@ static int windows_stupidity_hacks(struct asfd *asfd,
 }
 #endif
 
+// Returns non-zero if the rate limit is holding back writes on this asfd,
+// and brings 'throttle' down to when the soonest one can go ahead.
+static int write_throttled(struct asfd *asfd, uint64_t *throttle)
+{
+	uint64_t wait;
+	if(!asfd->rl || asfd->ssl_write_retry
+	  || !(wait=ratelimit_wait(asfd->rl)))
+		return 0;
+	if(!*throttle || wait<*throttle)
+		*throttle=wait;
+	return 1;
+}
+
+// Shorten the timeout so that the loop comes back round when a rate
+// limited write can go ahead.
+static void throttle_timeval(struct timeval *tval, uint64_t throttle)
+{
+	if(!throttle
+	  || (uint64_t)tval->tv_sec*1000000+tval->tv_usec<=throttle)
+		return;
+	tval->tv_sec=throttle/1000000;
+	tval->tv_usec=throttle%1000000;
+}
+
 static int async_io(struct async *as, int doread)
 {
 	int mfd=-1;
 	fd_set fsr;
 	fd_set fsw;
 	fd_set fse;
+	int ready=0;
 	int dosomething=0;
+	uint64_t throttle=0;
 	struct timeval tval;
 	struct asfd *asfd;
 	static int s=0;
@@ -114,13 +149,21 @@ static int async_io(struct async *as, int doread)
 
 		if(doread)
 		{
+			int waiting=asfd->rbuf->buf!=NULL;
 			if(asfd->parse_readbuf(asfd))
 				return asfd_problem(asfd);
 			if(asfd->rbuf->buf || asfd->read_blocked_on_write)
 				asfd->doread=0;
+			// A frame that was already in the read buffer can be
+			// dealt with straight away, whatever the other asfds
+			// are doing.
+			if(!waiting && asfd->rbuf->buf)
+				ready++;
 		}
 
-		if(asfd->writebuflen && !asfd->write_blocked_on_read)
+		if((asfd->writebuflen || asfd->sendfile_len)
+		  && !asfd->write_blocked_on_read
+		  && !write_throttled(asfd, &throttle))
 			asfd->dowrite++; // The write buffer is not yet empty.
 
 		if(!asfd->doread && !asfd->dowrite) continue;
@@ -139,7 +182,13 @@ static int async_io(struct async *as, int doread)
 
 		dosomething++;
 	}
-	if(!dosomething) goto end;
+	if(!dosomething && !throttle) goto end;
+	throttle_timeval(&tval, throttle);
+	if(ready)
+	{
+		tval.tv_sec=0;
+		tval.tv_usec=0;
+	}
 /*
 	for(asfd=as->asfd; asfd; asfd=asfd->next)
 	{
@@ -163,6 +212,15 @@ static int async_io(struct async *as, int doread)
 			return -1;
 		}
 	}
+	else if(throttle)
+	{
+		// Nothing to wait on but the rate limit.
+#ifdef HAVE_WIN32
+		Sleep(tval.tv_sec*1000+tval.tv_usec/1000);
+#else
+		select(0, NULL, NULL, NULL, &tval);
+#endif
+	}
 
 	for(asfd=as->asfd; asfd; asfd=asfd->next)
 	{
@@ -232,6 +290,245 @@ end:
 	return 0;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+// The epoll backend. Each fd is added to the interest set once, edge
+// triggered for both reading and writing, so epoll_wait() only costs
+// anything for the fds that something happened on. An edge sets can_read
+// or can_write, which stay set until a read or write makes no progress,
+// meaning that the fd has been drained (or filled up).
+
+#define ASYNC_EPOLL_EVENTS	256
+
+static int epoll_ctl_asfd(struct async *as, struct asfd *asfd, int op)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events=EPOLLIN|EPOLLOUT|EPOLLPRI|EPOLLET;
+	ev.data.ptr=asfd;
+	return epoll_ctl(as->epfd, op, asfd->fd, &ev);
+}
+
+// For when a read or write made no progress, but the fd might still be
+// ready - listening sockets, where the caller does the accept(), rate
+// limited writes, and SSL wanting to go the other way. Modifying the
+// registration makes epoll check the fd again, and give another edge if
+// it is still ready.
+static void epoll_rearm(struct async *as, struct asfd *asfd)
+{
+	if(asfd->always_ready)
+		return;
+	if(epoll_ctl_asfd(as, asfd, EPOLL_CTL_MOD))
+		logp("%s: epoll_ctl mod failed: %s\n",
+			asfd->desc, strerror(errno));
+}
+
+static int epoll_check_for_exception(struct asfd *asfd)
+{
+	switch(asfd->fdtype)
+	{
+		case ASFD_FD_SERVER_LISTEN_MAIN:
+		case ASFD_FD_SERVER_LISTEN_STATUS:
+			asfd->as->last_time=asfd->as->now;
+			return -1;
+		default:
+			logp("%s: had an exception\n", asfd->desc);
+			return asfd_problem(asfd);
+	}
+}
+
+static int epoll_do_read(struct async *as, struct asfd *asfd)
+{
+	uint64_t rcvd=asfd->rcvd;
+	switch(asfd->fdtype)
+	{
+		case ASFD_FD_SERVER_LISTEN_MAIN:
+		case ASFD_FD_SERVER_LISTEN_STATUS:
+			// Indicate to the caller that we have
+			// a new incoming client.
+			asfd->network_timeout=asfd->max_network_timeout;
+			asfd->new_client++;
+			asfd->can_read=0;
+			epoll_rearm(as, asfd);
+			return 1;
+		default:
+			break;
+	}
+	if(asfd->do_read(asfd)
+	  || asfd->parse_readbuf(asfd))
+		return asfd_problem(asfd);
+	if(asfd->rcvd!=rcvd)
+	{
+		asfd->network_timeout=asfd->max_network_timeout;
+		return 1;
+	}
+	if(!asfd->always_ready)
+		asfd->can_read=0;
+	if(asfd->read_blocked_on_write)
+		epoll_rearm(as, asfd);
+	return 0;
+}
+
+static int epoll_do_write(struct async *as, struct asfd *asfd)
+{
+	uint64_t sent=asfd->sent;
+	if(asfd->do_write(asfd))
+		return asfd_problem(asfd);
+	if(asfd->sent!=sent)
+	{
+		asfd->network_timeout=asfd->max_network_timeout;
+		return 1;
+	}
+	if(!asfd->always_ready)
+		asfd->can_write=0;
+	if(asfd->rl || asfd->write_blocked_on_read)
+		epoll_rearm(as, asfd);
+	return 0;
+}
+
+static int async_io_epoll(struct async *as, int doread)
+{
+	int e;
+	int n=0;
+	int timeout;
+	int ready=0;
+	int progress;
+	int exception=0;
+	int dosomething=0;
+	uint64_t throttle=0;
+	struct asfd *asfd;
+	struct epoll_event events[ASYNC_EPOLL_EVENTS];
+
+	as->now=time(NULL);
+	if(!as->last_time) as->last_time=as->now;
+
+	if(as->doing_estimate) goto end;
+
+	for(asfd=as->asfd; asfd; asfd=asfd->next)
+	{
+		if(asfd->attempt_reads)
+			asfd->doread=doread;
+		else
+			asfd->doread=0;
+
+		asfd->dowrite=0;
+
+		if(doread)
+		{
+			int waiting=asfd->rbuf->buf!=NULL;
+			if(asfd->parse_readbuf(asfd))
+				return asfd_problem(asfd);
+			if(asfd->rbuf->buf || asfd->read_blocked_on_write)
+				asfd->doread=0;
+			// As in async_io(), do not wait on the others.
+			if(!waiting && asfd->rbuf->buf)
+				ready++;
+		}
+
+		if((asfd->writebuflen || asfd->sendfile_len)
+		  && !asfd->write_blocked_on_read
+		  && !write_throttled(asfd, &throttle))
+			asfd->dowrite++; // The write buffer is not yet empty.
+
+		if(!asfd->doread && !asfd->dowrite) continue;
+
+		if((asfd->doread && asfd->can_read)
+		  || (asfd->dowrite && asfd->can_write))
+			ready++;
+		dosomething++;
+	}
+	if(!dosomething && !throttle) goto end;
+
+	// If something can already go ahead, just pick up any new edges.
+	timeout=0;
+	if(!ready)
+	{
+		struct timeval tval;
+		tval.tv_sec=as->setsec;
+		tval.tv_usec=as->setusec;
+		throttle_timeval(&tval, throttle);
+		timeout=tval.tv_sec*1000+(tval.tv_usec+999)/1000;
+	}
+
+	n=epoll_wait(as->epfd, events, ASYNC_EPOLL_EVENTS, timeout);
+	if(n<0)
+	{
+		if(errno==EINTR) goto end;
+		logp("epoll_wait error in %s: %s\n", __func__,
+			strerror(errno));
+		as->last_time=as->now;
+		return -1;
+	}
+	// Edges are not given again, so note every one of them before giving
+	// up because of an exception. The rest get dealt with next time.
+	for(e=0; e<n; e++)
+	{
+		asfd=(struct asfd *)events[e].data.ptr;
+		if((events[e].events & EPOLLPRI)
+		  && epoll_check_for_exception(asfd))
+			exception=-1;
+		// Errors and hang ups get found by the next read or write.
+		if(events[e].events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+			asfd->can_read=1;
+		if(events[e].events & (EPOLLOUT|EPOLLERR|EPOLLHUP))
+			asfd->can_write=1;
+	}
+	if(exception)
+		return exception;
+
+	for(asfd=as->asfd; asfd; asfd=asfd->next)
+	{
+		progress=0;
+		if(asfd->doread && asfd->can_read)
+		{
+			switch(epoll_do_read(as, asfd))
+			{
+				case 0: break;
+				case 1: progress++; break;
+				default: return -1;
+			}
+		}
+
+		if(asfd->dowrite && asfd->can_write)
+		{
+			switch(epoll_do_write(as, asfd))
+			{
+				case 0: break;
+				case 1: progress++; break;
+				default: return -1;
+			}
+		}
+
+		if(!progress)
+		{
+			// Be careful to avoid 'read quick' mode.
+			if((as->setsec || as->setusec)
+			  && asfd->max_network_timeout>0
+			  && as->now-as->last_time>0
+			  && asfd->network_timeout--<=0)
+			{
+				logp("%s: no activity for %d seconds.\n",
+					asfd->desc, asfd->max_network_timeout);
+				return asfd_problem(asfd);
+			}
+		}
+	}
+
+end:
+	as->last_time=as->now;
+	return 0;
+}
+
+static int async_read_write_epoll(struct async *as)
+{
+	return async_io_epoll(as, 1 /* Read too. */);
+}
+
+static int async_write_epoll(struct async *as)
+{
+	return async_io_epoll(as, 0 /* No read. */);
+}
+#endif
+
 static int async_read_write(struct async *as)
 {
 	return async_io(as, 1 /* Read too. */);
@@ -285,6 +582,36 @@ static void async_asfd_remove(struct async *as, struct asfd *asfd)
 	}
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static void async_asfd_add_epoll(struct async *as, struct asfd *asfd)
+{
+	async_asfd_add(as, asfd);
+	if(!epoll_ctl_asfd(as, asfd, EPOLL_CTL_ADD))
+		return;
+	if(errno!=EPERM)
+		logp("%s: epoll_ctl add failed: %s\n",
+			asfd->desc, strerror(errno));
+	// Things like regular files cannot be polled, but are always ready.
+	asfd->always_ready=1;
+	asfd->can_read=1;
+	asfd->can_write=1;
+}
+
+static void async_asfd_remove_epoll(struct async *as, struct asfd *asfd)
+{
+	if(!asfd) return;
+	async_asfd_remove(as, asfd);
+	// A closed fd has already gone from the interest set, and its
+	// number may now belong to somebody else.
+	if(asfd->fd>=0 && !asfd->always_ready)
+		epoll_ctl_asfd(as, asfd, EPOLL_CTL_DEL);
+	asfd->can_read=0;
+	asfd->can_write=0;
+	asfd->always_ready=0;
+}
+
+#endif
+
 void async_asfd_free_all(struct async **as)
 {
 	struct asfd *a=NULL;
@@ -316,11 +643,47 @@ static int async_init(struct async *as, int estimate)
 	return 0;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static int async_init_epoll(struct async *as, int estimate)
+{
+	if(async_init(as, estimate))
+		return -1;
+	if((as->epfd=epoll_create1(EPOLL_CLOEXEC))<0)
+	{
+		logp("epoll_create1 failed in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+
+	as->read_write=async_read_write_epoll;
+	as->write=async_write_epoll;
+
+	as->asfd_add=async_asfd_add_epoll;
+	as->asfd_remove=async_asfd_remove_epoll;
+
+	return 0;
+}
+#endif
+
 struct async *async_alloc(void)
 {
 	struct async *as;
 	if(!(as=(struct async *)calloc_w(1, sizeof(struct async), __func__)))
 		return NULL;
+	as->epfd=-1;
 	as->init=async_init;
 	return as;
 }
+
+// For processes that look after a lot of fds at once. Falls back to
+// select() where there is no epoll.
+struct async *async_alloc_epoll(void)
+{
+	struct async *as;
+	if(!(as=async_alloc()))
+		return NULL;
+#ifdef HAVE_SYS_EPOLL_H
+	as->init=async_init_epoll;
+#endif
+	return as;
+}
@@ -10,6 +10,8 @@ struct async
 
 	int doing_estimate;
 
+	int epfd; // Only used by the epoll backend.
+
 	int setsec;
 	int setusec;
 
@@ -31,6 +33,7 @@ struct async
 };
 
 extern struct async *async_alloc(void);
+extern struct async *async_alloc_epoll(void);
 extern void async_free(struct async **as);
 extern void async_asfd_free_all(struct async **as);
 
@@ -49,8 +49,8 @@
 // Encode a stat structure into a base64 character string.
 int attribs_encode(struct sbuf *sb)
 {
-	static char *p;
-	static struct stat *statp;
+	char *p;
+	struct stat *statp;
 
 	if(!sb->attr.buf)
 	{
@@ -139,9 +139,9 @@ int attribs_encode(struct sbuf *sb)
 // Decode a stat packet from base64 characters.
 void attribs_decode(struct sbuf *sb)
 {
-	static const char *p;
-	static int64_t val;
-	static struct stat *statp;
+	const char *p;
+	int64_t val;
+	struct stat *statp;
 
 	if(!(p=sb->attr.buf)) return;
 	statp=&sb->statp;
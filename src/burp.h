@@ -74,6 +74,14 @@
 #include <openssl/asn1t.h>
 #undef STORE
 
+// For state that each thread needs its own copy of, such as the buffers
+// that some functions return a pointer into.
+#ifdef HAVE_PTHREAD
+	#define THREAD_LOCAL __thread
+#else
+	#define THREAD_LOCAL
+#endif
+
 // Local Burp includes. Be sure to put all the system includes before these.
 #ifdef HAVE_WIN32
 	#include <windows.h>
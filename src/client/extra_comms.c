@@ -29,12 +29,46 @@ static const char *server_supports_autoupgrade(const char *feat)
 	return server_supports(feat, ":autoupgrade:");
 }
 
+// Protocol1 backups can send their phase2 data over more than one connection,
+// if the server allows it. The extra connections are made by forked child
+// processes, so Windows always uses one.
+static int set_backup_streams(struct asfd *asfd, struct conf **confs,
+	enum action action, const char *feat)
+{
+#ifndef HAVE_WIN32
+	char msg[64]="";
+	const char *cp=NULL;
+	int backup_streams=get_int(confs[OPT_BACKUP_STREAMS]);
+#endif
+
+	set_int(confs[OPT_BACKUP_STREAMS], 1);
+#ifndef HAVE_WIN32
+	if(backup_streams<=1
+	  || get_protocol(confs)!=PROTO_1
+	  || (action!=ACTION_BACKUP && action!=ACTION_BACKUP_TIMED)
+	  || !(cp=server_supports(feat, ":backup_streams=")))
+		return 0;
+	cp+=strlen(":backup_streams=");
+	if(backup_streams>atoi(cp))
+		backup_streams=atoi(cp);
+	if(backup_streams<=1)
+		return 0;
+	snprintf(msg, sizeof(msg), "backup_streams=%d", backup_streams);
+	if(asfd->write_str(asfd, CMD_GEN, msg))
+		return -1;
+	set_int(confs[OPT_BACKUP_STREAMS], backup_streams);
+	logp("Using backup_streams=%d\n", backup_streams);
+#endif
+	return 0;
+}
+
 #include <librsync.h>
 
 int extra_comms_client(struct async *as, struct conf **confs,
 	enum action *action, char **incexc)
 {
 	int ret=-1;
+	int large_frames=0;
 	char *feat=NULL;
 	struct asfd *asfd;
 	struct iobuf *rbuf;
@@ -82,6 +116,10 @@ int extra_comms_client(struct async *as, struct conf **confs,
 		{
 			logp("Client is in monitor mode, so ignoring\n");
 		}
+		else if(*action==ACTION_BACKUP_STREAM)
+		{
+			logp("Client is a backup stream, so ignoring\n");
+		}
 		else if(get_int(confs[OPT_SERVER_CAN_RESTORE]))
 		{
 			logp("Client accepts.\n");
@@ -246,6 +284,28 @@ int extra_comms_client(struct async *as, struct conf **confs,
 #endif
 		set_e_rshash(confs[OPT_RSHASH], RSHASH_MD4);
 
+	// The server decides the chunker, because it needs to be able to
+	// verify the blocks.
+	if(server_supports(feat, ":chunker=gear:"))
+	{
+		if(set_string(confs[OPT_CHUNKER], "gear")
+		  || asfd->write_str(asfd, CMD_GEN, "chunker=gear"))
+			goto end;
+	}
+	else if(set_string(confs[OPT_CHUNKER], NULL))
+		goto end;
+
+	if(set_backup_streams(asfd, confs, *action, feat))
+		goto end;
+
+	// Both ends switch to large frames after extra_comms_end.
+	if(server_supports(feat, ":large_frames:"))
+	{
+		if(asfd->write_str(asfd, CMD_GEN, "large_frames"))
+			goto end;
+		large_frames=1;
+	}
+
 	if(asfd->write_str(asfd, CMD_GEN, "extra_comms_end")
 	  || asfd_read_expect(asfd, CMD_GEN, "extra_comms_end ok"))
 	{
@@ -253,6 +313,13 @@ int extra_comms_client(struct async *as, struct conf **confs,
 		goto end;
 	}
 
+	if(large_frames)
+	{
+		if(asfd->set_large_frames(asfd))
+			goto end;
+		logp("Using large frames\n");
+	}
+
 	ret=0;
 end:
 	free_w(&feat);
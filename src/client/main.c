@@ -9,6 +9,7 @@
 #include "../handy.h"
 #include "../iobuf.h"
 #include "../log.h"
+#include "../ratelimit.h"
 #include "../run_script.h"
 #include "auth.h"
 #include "backup.h"
@@ -18,6 +19,7 @@
 #include "list.h"
 #include "monitor.h"
 #include "monitor/status_client_ncurses.h"
+#include "protocol1/backup_phase2.h"
 #include "protocol2/restore.h"
 #include "restore.h"
 #include "main.h"
@@ -199,14 +201,13 @@ timer_not_met:
 	return CLIENT_SERVER_TIMER_NOT_MET;
 }
 
-static int s_server_session_id_context=1;
-
 static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 	enum action action, struct conf **confs)
 {
 	int port=-1;
 	char portstr[8]="";
 	BIO *sbio=NULL;
+	SSL_SESSION *sess=NULL;
 	ssl_load_globals();
 	if(!(*ctx=ssl_initialise_ctx(confs)))
 	{
@@ -214,15 +215,12 @@ static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 		return -1;
 	}
 
-	SSL_CTX_set_session_id_context(*ctx,
-		(const uint8_t *)&s_server_session_id_context,
-		sizeof(s_server_session_id_context));
-
 	switch(action)
 	{
 		case ACTION_BACKUP:
 		case ACTION_BACKUP_TIMED:
 		case ACTION_TIMER_CHECK:
+		case ACTION_BACKUP_STREAM:
 			port=get_int(confs[OPT_PORT_BACKUP]);
 			break;
 		case ACTION_RESTORE:
@@ -262,8 +260,9 @@ static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 	}
 
 	snprintf(portstr, sizeof(portstr), "%d", port);
-	if((*rfd=init_client_socket(get_string(confs[OPT_SERVER]), portstr))<0)
-		return -1;
+	if((*rfd=init_client_socket(get_string(confs[OPT_SERVER]), portstr,
+		get_int(confs[OPT_NETWORK_BUFFER_SIZE])))<0)
+			return -1;
 
 	if(!(*ssl=SSL_new(*ctx))
 	  || !(sbio=BIO_new_socket(*rfd, BIO_NOCLOSE)))
@@ -272,11 +271,19 @@ static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 		return -1;
 	}
 	SSL_set_bio(*ssl, sbio, sbio);
+	// If the server does not accept it any more, the handshake is a full
+	// one instead.
+	if((sess=ssl_session_load(get_string(confs[OPT_SSL_SESSION_FILE]))))
+	{
+		SSL_set_session(*ssl, sess);
+		SSL_SESSION_free(sess);
+	}
 	if(SSL_connect(*ssl)<=0)
 	{
 		logp_ssl_err("SSL connect error\n");
 		return -1;
 	}
+	ssl_handshake_done(*ssl);
 	return 0;
 }
 
@@ -442,10 +449,10 @@ static enum cliret do_client(struct conf **confs,
 
 		if(!(as=async_alloc())
 		  || as->init(as, act==ACTION_ESTIMATE)
-		  || !(asfd=setup_asfd_ssl(as, "main socket", &rfd, ssl)))
+		  || !(asfd=setup_asfd_ssl(as, "main socket", &rfd, ssl))
+		  || ratelimit_setup(asfd, confs, NULL))
 			goto end;
 		asfd->set_timeout(asfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
-		asfd->ratelimit=get_float(confs[OPT_RATELIMIT]);
 
 		// Set quality of service bits on backup packets.
 		if(act==ACTION_BACKUP
@@ -528,6 +535,53 @@ end:
 	return ret;
 }
 
+// Runs in a child of a protocol1 backup, and sends some of the phase2 data
+// over a connection of its own.
+// The ratelimit is the one that the main connection was using, so that the
+// streams do not get a bucket each.
+int backup_stream_client(struct conf **confs, const char *token,
+	struct ratelimit *rl)
+{
+	int ret=-1;
+	int rfd=-1;
+	SSL *ssl=NULL;
+	SSL_CTX *ctx=NULL;
+	char msg[64]="";
+	char *incexc=NULL;
+	enum action act=ACTION_BACKUP_STREAM;
+	struct async *as=NULL;
+	struct asfd *asfd=NULL;
+
+	if(ssl_setup(&rfd, &ssl, &ctx, act, confs))
+		goto end;
+	if(!(as=async_alloc())
+	  || as->init(as, 0)
+	  || !(asfd=setup_asfd_ssl(as, "backup stream", &rfd, ssl)))
+		goto end;
+	asfd->rl=rl;
+	rl=NULL;
+	asfd->set_timeout(asfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
+	asfd->set_bulk_packets(asfd);
+
+	if(initial_comms(as, &act, &incexc, confs)!=CLIENT_OK)
+		goto end;
+
+	snprintf(msg, sizeof(msg), "backupstream %s", token);
+	if(asfd->write_str(asfd, CMD_GEN, msg)
+	  || backup_phase2_send_client_protocol1(asfd, confs)
+	  || asfd_flush_asio(asfd))
+		goto end;
+	ret=0;
+end:
+	close_fd(&rfd);
+	async_free(&as);
+	asfd_free(&asfd);
+	if(ctx) ssl_destroy_ctx(ctx);
+	free_w(&incexc);
+	ratelimit_free(&rl);
+	return ret;
+}
+
 int client(struct conf **confs, enum action action, int vss_restore)
 {
 	enum cliret ret=CLIENT_OK;
@@ -1,6 +1,10 @@
 #ifndef _CLIENT_MAIN_H
 #define _CLIENT_MAIN_H
 
+struct ratelimit;
+
 extern int client(struct conf **confs, enum action act, int vss_restore);
+extern int backup_stream_client(struct conf **confs, const char *token,
+	struct ratelimit *rl);
 
 #endif
@@ -7,11 +7,15 @@
 #include "../../cmd.h"
 #include "../../cntr.h"
 #include "../../conf.h"
+#include "../../fsops.h"
+#include "../../handy.h"
 #include "../../log.h"
 #include "../../protocol1/handy.h"
 #include "../../protocol1/msg.h"
+#include "../../ratelimit.h"
 #include "../extrameta.h"
 #include "../find.h"
+#include "../main.h"
 #include "backup_phase2.h"
 
 static int rs_loadsig_network_run(struct asfd *asfd,
@@ -24,7 +28,7 @@ static int rs_loadsig_network_run(struct asfd *asfd,
 	memset(&buf, 0, sizeof(buf));
 
 	if(!(in_fb=rs_filebuf_new(NULL,
-		NULL, asfd, ASYNC_BUF_LEN, -1)))
+		NULL, asfd, asfd->frame_len, -1)))
 		goto end;
 
 	while(1)
@@ -101,7 +105,7 @@ static int load_signature_and_send_delta(struct asfd *asfd,
 	if(!(infb=rs_filebuf_new(bfd,
 		NULL, NULL, ASYNC_BUF_LEN, bfd->datalen))
 	  || !(outfb=rs_filebuf_new(NULL,
-		NULL, asfd, ASYNC_BUF_LEN, -1)))
+		NULL, asfd, asfd->frame_len, -1)))
 	{
 		logp("could not rs_filebuf_new for delta\n");
 		goto end;
@@ -165,7 +169,7 @@ static enum send_e send_whole_file_w(struct asfd *asfd,
 		  sb->path.cmd,
 #endif
 		  datapth, quick_read, bytes,
-		  cntr, bfd, extrameta, elen);
+		  cntr, bfd, extrameta, elen, 0 /* use_sendfile */);
 }
 
 static int forget_file(struct asfd *asfd, struct sbuf *sb, struct conf **confs)
@@ -411,8 +415,10 @@ static int parse_rbuf(struct asfd *asfd, struct sbuf *sb,
 	return 0;
 }
 
-static int do_backup_phase2_client(struct asfd *asfd,
-	struct conf **confs, int resume)
+// Answers the requests from the server until it says that there are no
+// more. Also used by each extra backup stream.
+int backup_phase2_send_client_protocol1(struct asfd *asfd,
+	struct conf **confs)
 {
 	int ret=-1;
 	// For efficiency, open Windows files for the VSS data, and do not
@@ -420,36 +426,15 @@ static int do_backup_phase2_client(struct asfd *asfd,
 	// data is read.
 	struct BFILE *bfd=NULL;
 	struct sbuf *sb=NULL;
-	struct iobuf *rbuf=NULL;
+	struct iobuf *rbuf=asfd->rbuf;
 	struct cntr *cntr=NULL;
 	if(confs) cntr=get_cntr(confs);
 
-	if(!asfd)
-	{
-		logp("%s() called without asfd!\n", __func__);
-		goto end;
-	}
-	rbuf=asfd->rbuf;
-
 	if(!(bfd=bfile_alloc())
 	  || !(sb=sbuf_alloc(PROTO_1)))
 		goto end;
 	bfile_init(bfd, 0, cntr);
 
-	if(!resume)
-	{
-		// Only do this bit if the server did not tell us to resume.
-		if(asfd->write_str(asfd, CMD_GEN, "backupphase2")
-		  || asfd_read_expect(asfd, CMD_GEN, "ok"))
-			goto end;
-	}
-	else
-	{
-		// On resume, the server might update the client with cntr.
-		if(cntr_recv(asfd, confs))
-			goto end;
-	}
-
 	while(1)
 	{
 		iobuf_free_content(rbuf);
@@ -477,6 +462,133 @@ end:
 	return ret;
 }
 
+#ifndef HAVE_WIN32
+// The server says how the extra streams can join the backup. Each one is a
+// child process with a connection of its own.
+static int fork_backup_streams(struct asfd *asfd, struct conf **confs,
+	pid_t **pids)
+{
+	int i;
+	int n;
+	const char *token;
+	struct iobuf *rbuf=asfd->rbuf;
+
+	if(!confs || (n=get_int(confs[OPT_BACKUP_STREAMS]))<=1)
+		return 0;
+	if(asfd->read(asfd))
+		return -1;
+	if(rbuf->cmd!=CMD_GEN
+	  || strncmp_w(rbuf->buf, "backupstreams "))
+	{
+		iobuf_log_unexpected(rbuf, __func__);
+		iobuf_free_content(rbuf);
+		return -1;
+	}
+	token=rbuf->buf+strlen("backupstreams ");
+	// All of the streams are one backup, so they share the one limit.
+	if(asfd->rl && ratelimit_share(asfd->rl))
+		return -1;
+	if(!(*pids=(pid_t *)calloc_w(n-1, sizeof(pid_t), __func__)))
+		return -1;
+	for(i=0; i<n-1; i++)
+	{
+		switch(((*pids)[i]=fork()))
+		{
+			case -1:
+				// The streams that did start can carry on
+				// without this one.
+				logp("fork failed in %s: %s\n",
+					__func__, strerror(errno));
+				(*pids)[i]=0;
+				goto end;
+			case 0:
+			{
+				// Child. The parent connection is not ours to
+				// shut down, but its ratelimit is ours to use.
+				struct ratelimit *rl=asfd->rl;
+				asfd->rl=NULL;
+				close_fd(&asfd->fd);
+				exit(backup_stream_client(confs, token, rl)?1:0);
+			}
+			default:
+				logp("forked backup stream pid %d\n",
+					(int)(*pids)[i]);
+				break;
+		}
+	}
+end:
+	iobuf_free_content(rbuf);
+	return 0;
+}
+
+static void wait_backup_streams(struct conf **confs, pid_t **pids, int error)
+{
+	int i;
+	int n;
+	int status;
+
+	if(!*pids)
+		return;
+	n=get_int(confs[OPT_BACKUP_STREAMS]);
+	for(i=0; i<n-1 && (*pids)[i]>0; i++)
+	{
+		// The server will not finish with them if this side has
+		// already given up.
+		if(error)
+			kill((*pids)[i], SIGTERM);
+		if(waitpid((*pids)[i], &status, 0)<0)
+			logp("waitpid for backup stream pid %d failed: %s\n",
+				(int)(*pids)[i], strerror(errno));
+		else if(!WIFEXITED(status) || WEXITSTATUS(status))
+			logw(NULL, get_cntr(confs),
+				"backup stream pid %d did not finish ok\n",
+				(int)(*pids)[i]);
+	}
+	free_v((void **)pids);
+}
+#endif
+
+static int do_backup_phase2_client(struct asfd *asfd,
+	struct conf **confs, int resume)
+{
+	int ret=-1;
+#ifndef HAVE_WIN32
+	pid_t *pids=NULL;
+#endif
+
+	if(!asfd)
+	{
+		logp("%s() called without asfd!\n", __func__);
+		goto end;
+	}
+
+	if(!resume)
+	{
+		// Only do this bit if the server did not tell us to resume.
+		if(asfd->write_str(asfd, CMD_GEN, "backupphase2")
+		  || asfd_read_expect(asfd, CMD_GEN, "ok"))
+			goto end;
+#ifndef HAVE_WIN32
+		if(fork_backup_streams(asfd, confs, &pids))
+			goto end;
+#endif
+	}
+	else
+	{
+		// On resume, the server might update the client with cntr.
+		if(cntr_recv(asfd, confs))
+			goto end;
+	}
+
+	ret=backup_phase2_send_client_protocol1(asfd, confs);
+
+end:
+#ifndef HAVE_WIN32
+	wait_backup_streams(confs, &pids, ret);
+#endif
+	return ret;
+}
+
 int backup_phase2_client_protocol1(struct asfd *asfd,
 	struct conf **confs, int resume)
 {
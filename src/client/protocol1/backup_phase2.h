@@ -3,5 +3,7 @@
 
 extern int backup_phase2_client_protocol1(struct asfd *asfd,
 	struct conf **confs, int resume);
+extern int backup_phase2_send_client_protocol1(struct asfd *asfd,
+	struct conf **confs);
 
 #endif
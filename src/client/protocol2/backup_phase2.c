@@ -11,6 +11,7 @@
 #include "../../protocol2/blist.h"
 #include "../../protocol2/rabin/rabin.h"
 #include "../../slist.h"
+#include "md5_pool.h"
 #include "rabin_read.h"
 #include "backup_phase2.h"
 
@@ -38,7 +39,17 @@ static int add_to_data_requests(struct blist *blist, struct iobuf *rbuf)
 {
 	uint64_t index;
 	struct blk *blk;
-	index=base64_to_uint64(rbuf->buf);
+	char buf[32];
+
+	// Might be pointing into the read buffer, so not null terminated.
+	if(rbuf->len>=sizeof(buf))
+	{
+		iobuf_log_unexpected(rbuf, __func__);
+		return -1;
+	}
+	memcpy(buf, rbuf->buf, rbuf->len);
+	buf[rbuf->len]='\0';
+	index=base64_to_uint64(buf);
 
 //printf("last_requested: %d\n", blist->last_requested->index);
 
@@ -132,10 +143,46 @@ end:
 	return ret;
 }
 
+// Block requests can be dealt with straight from the read buffer.
+// Everything else gets its own copy first.
+static int deal_with_read_view(struct iobuf *view, struct slist *slist,
+	struct cntr *cntr, uint8_t *end_flags)
+{
+	struct iobuf rbuf;
+	if(view->cmd==CMD_DATA_REQ)
+		return add_to_data_requests(slist->blist, view);
+	if(iobuf_dup(&rbuf, view))
+		return -1;
+	return deal_with_read(&rbuf, slist, cntr, end_flags);
+}
+
+// Deals with everything that the last read brought in. The first frame is
+// already in rbuf, and the rest are taken from the read buffer in batches,
+// rather than going round the async loop for each one.
+static int deal_with_reads(struct asfd *asfd, struct slist *slist,
+	struct cntr *cntr, uint8_t *end_flags)
+{
+	int i;
+	int n;
+	struct iobuf vec[ASFD_READ_BATCH];
+
+	if(asfd->rbuf->buf
+	  && deal_with_read(asfd->rbuf, slist, cntr, end_flags))
+		return -1;
+	while((n=asfd->read_batch(asfd, vec, ASFD_READ_BATCH))>0)
+		for(i=0; i<n; i++)
+			if(deal_with_read_view(&vec[i],
+				slist, cntr, end_flags))
+					return -1;
+	return n;
+}
+
 static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 	struct slist *slist)
 {
 	int just_opened=0;
+	struct blk *blk;
+	struct blk *old_tail;
 	struct sbuf *sb=slist->last_requested;
 	if(!sb) return 0;
 
@@ -162,6 +209,7 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 		just_opened=1;
 	}
 
+	old_tail=slist->blist->tail;
 	switch(blks_generate(sb, slist->blist, just_opened))
 	{
 		case 0: // All OK.
@@ -179,6 +227,11 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 			return -1;
 	}
 
+	// Hand any new blocks over to get their md5sums done.
+	for(blk=old_tail?old_tail->next:slist->blist->head;
+		blk; blk=blk->next)
+			if(md5_pool_add(blk)) return -1;
+
 	return 0;
 }
 
@@ -242,7 +295,7 @@ static void get_wbuf_from_data(struct conf **confs,
 
 static int iobuf_from_blk_data(struct iobuf *wbuf, struct blk *blk)
 {
-	if(blk_md5_update(blk)) return -1;
+	if(md5_pool_wait(blk)) return -1;
 	blk_to_iobuf_sig(blk, wbuf);
 	return 0;
 }
@@ -292,7 +345,6 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 	int ret=-1;
 	uint8_t end_flags=0;
 	struct slist *slist=NULL;
-	struct iobuf *rbuf=NULL;
 	struct iobuf *wbuf=NULL;
 	struct cntr *cntr=NULL;
 
@@ -309,9 +361,12 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 
 	if(!(slist=slist_alloc())
 	  || !(wbuf=iobuf_alloc())
-	  || blks_generate_init())
+	  || blks_generate_init()
+	  || (confs && md5_pool_init(get_int(confs[OPT_MD5_THREADS]))))
 		goto end;
-	rbuf=asfd->rbuf;
+	if(confs)
+		blks_generate_set_chunker(
+			str_to_chunker(get_string(confs[OPT_CHUNKER])));
 
 	if(!resume)
 	{
@@ -352,7 +407,7 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 			goto end;
 		}
 
-		if(rbuf->buf && deal_with_read(rbuf, slist, cntr, &end_flags))
+		if(deal_with_reads(asfd, slist, cntr, &end_flags))
 			goto end;
 
 		if(slist->head
@@ -362,8 +417,16 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 			- slist->blist->head->index<BLKS_MAX_IN_MEM)
 		)
 		{
-			if(add_to_blks_list(asfd, confs, slist))
-				goto end;
+			// With md5 threads, read ahead until there is
+			// enough work queued to keep them busy.
+			do {
+				if(add_to_blks_list(asfd, confs, slist))
+					goto end;
+			} while(slist->last_requested
+			  && md5_pool_want_more()
+			  && slist->blist->head
+			  && slist->blist->tail->index
+				- slist->blist->head->index<BLKS_MAX_IN_MEM);
 		}
 
 		if(end_flags&END_BLK_REQUESTS)
@@ -390,6 +453,8 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 
 	ret=0;
 end:
+	// Threads may still be using blocks in the slist.
+	md5_pool_free();
 	slist_free(&slist);
 	blks_generate_free();
 	if(wbuf)
@@ -0,0 +1,176 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../log.h"
+#include "../../protocol2/blk.h"
+#include "md5_pool.h"
+
+// A pool of threads that calculate the md5sums of the blocks that the
+// client has chunked, so that the main thread can carry on reading files
+// and talking to the server. The main thread waits for the blocks in the
+// order that it sends their signatures, so the ordering of the blist is
+// unaffected.
+// If there are no threads, the md5sum is done inline in md5_pool_wait().
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+// Maximum number of blocks queued for the threads at once.
+#define MD5_POOL_QUEUE_MAX	1024
+
+static pthread_t *threads=NULL;
+static int thread_count=0;
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond=PTHREAD_COND_INITIALIZER;
+static struct blk *queue[MD5_POOL_QUEUE_MAX];
+static unsigned int qhead=0;
+static unsigned int qtail=0;
+static unsigned int pending=0; // Added, but not finished.
+static int stopping=0;
+static int failed=0;
+
+static void *md5_pool_worker(__attribute__ ((unused)) void *arg)
+{
+	int r;
+	struct blk *blk;
+
+	while(1)
+	{
+		pthread_mutex_lock(&lock);
+		while(qhead==qtail && !stopping)
+			pthread_cond_wait(&work_cond, &lock);
+		if(qhead==qtail)
+		{
+			// Stopping, and nothing left to do.
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		blk=queue[qhead++%MD5_POOL_QUEUE_MAX];
+		pthread_mutex_unlock(&lock);
+
+		r=blk_md5_update(blk);
+
+		pthread_mutex_lock(&lock);
+		if(r) failed=1;
+		blk->got_md5sum=1;
+		pending--;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+int md5_pool_init(int t)
+{
+	int i;
+	if(t<=0) return 0;
+
+	qhead=0;
+	qtail=0;
+	pending=0;
+	stopping=0;
+	failed=0;
+	if(!(threads=(pthread_t *)calloc_w(t, sizeof(pthread_t), __func__)))
+		return -1;
+	for(i=0; i<t; i++)
+	{
+		if(pthread_create(&threads[i], NULL, md5_pool_worker, NULL))
+		{
+			logp("Could not create md5 thread: %s\n",
+				strerror(errno));
+			md5_pool_free();
+			return -1;
+		}
+		thread_count++;
+	}
+	logp("Using %d md5 threads\n", thread_count);
+	return 0;
+}
+
+void md5_pool_free(void)
+{
+	int i;
+	if(!threads) return;
+
+	// The threads finish everything in the queue before exiting, so the
+	// blocks need to still exist at this point.
+	pthread_mutex_lock(&lock);
+	stopping=1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+	for(i=0; i<thread_count; i++)
+		pthread_join(threads[i], NULL);
+	free_v((void **)&threads);
+	thread_count=0;
+}
+
+int md5_pool_add(struct blk *blk)
+{
+	if(!thread_count) return 0;
+
+	pthread_mutex_lock(&lock);
+	while(pending>=MD5_POOL_QUEUE_MAX)
+		pthread_cond_wait(&done_cond, &lock);
+	blk->got_md5sum=0;
+	queue[qtail++%MD5_POOL_QUEUE_MAX]=blk;
+	pending++;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+int md5_pool_wait(struct blk *blk)
+{
+	int ret;
+	if(!thread_count) return blk_md5_update(blk);
+
+	pthread_mutex_lock(&lock);
+	while(!blk->got_md5sum)
+		pthread_cond_wait(&done_cond, &lock);
+	ret=failed?-1:0;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+// Whether it is worth chunking more data before going around the main loop
+// again, in order to keep the threads busy.
+int md5_pool_want_more(void)
+{
+	int ret;
+	if(!thread_count) return 0;
+
+	pthread_mutex_lock(&lock);
+	ret=pending<(unsigned int)thread_count*4;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+#else
+
+int md5_pool_init(int t)
+{
+	if(t>0)
+		logp("No thread support - md5sums will be done inline\n");
+	return 0;
+}
+
+void md5_pool_free(void)
+{
+}
+
+int md5_pool_add(__attribute__ ((unused)) struct blk *blk)
+{
+	return 0;
+}
+
+int md5_pool_wait(struct blk *blk)
+{
+	return blk_md5_update(blk);
+}
+
+int md5_pool_want_more(void)
+{
+	return 0;
+}
+
+#endif
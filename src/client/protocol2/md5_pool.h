@@ -0,0 +1,12 @@
+#ifndef _MD5_POOL_H
+#define _MD5_POOL_H
+
+struct blk;
+
+extern int md5_pool_init(int threads);
+extern void md5_pool_free(void);
+extern int md5_pool_add(struct blk *blk);
+extern int md5_pool_wait(struct blk *blk);
+extern int md5_pool_want_more(void);
+
+#endif
@@ -14,10 +14,14 @@ static char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "File attribute information preceding block signatures"); break;
 		case CMD_SIG:
 			snprintf(buf, len, "Block signature"); break;
+		case CMD_SIG_BIN:
+			snprintf(buf, len, "Block signature and save path, binary record"); break;
 		case CMD_DATA_REQ:
 			snprintf(buf, len, "Request for block of data"); break;
 		case CMD_DATA:
 			snprintf(buf, len, "Block data"); break;
+		case CMD_DATA_ZSTD:
+			snprintf(buf, len, "Block data, zstd compressed"); break;
 		case CMD_WRAP_UP:
 			snprintf(buf, len, "Control packet"); break;
 		case CMD_FILE:
@@ -79,6 +83,12 @@ static char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Bytes received"); break;
 		case CMD_BYTES_SENT:
 			snprintf(buf, len, "Bytes sent"); break;
+		case CMD_RBLK_HIT:
+			snprintf(buf, len, "Restore data cache hits"); break;
+		case CMD_RBLK_MISS:
+			snprintf(buf, len, "Restore data cache misses"); break;
+		case CMD_RBLK_EVICT:
+			snprintf(buf, len, "Restore data cache evictions"); break;
 
 		// Protocol1 only.
 		case CMD_DATAPTH:
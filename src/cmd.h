@@ -15,6 +15,8 @@ enum cmd
 	CMD_SIG		='S',	/* Signature of a block */
 	CMD_DATA_REQ	='D',	/* Request for block data */
 	CMD_DATA	='B',	/* Block data */
+	CMD_DATA_ZSTD	='J',	/* Block data, compressed with zstd. Only
+				   appears in protocol2 data files. */
 	CMD_WRAP_UP	='W',	/* Control packet - client can free blocks up
 				   to the given index. */
 
@@ -49,6 +51,9 @@ enum cmd
 	CMD_MANIFEST	='M',	/* Path to a manifest */
 	CMD_FINGERPRINT	='F',	/* Fingerprint part of a signature */
 	CMD_SAVE_PATH   ='q',   /* Save path part of a signature */
+	CMD_SIG_BIN	='K',	/* Signature and save path of a block, as a
+				   fixed width binary record. Only appears in
+				   protocol2 manifests. */
 
 
 // These things are for the status server/client
@@ -61,6 +66,9 @@ enum cmd
 	CMD_BYTES_RECV	='P',
 	CMD_BYTES_SENT	='Q',
 	CMD_TIMESTAMP_END='E',
+	CMD_RBLK_HIT	='H',	/* Restore data cache hits */
+	CMD_RBLK_MISS	='N',	/* Restore data cache misses */
+	CMD_RBLK_EVICT	='X',	/* Restore data cache evictions */
 
 // Protocol1 only.
 	CMD_DATAPTH	='t',	/* Path to data on the server */
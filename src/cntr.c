@@ -106,6 +106,12 @@ int cntr_init(struct cntr *cntr, const char *cname, pid_t pid)
 	// comes out in the right order.
 	if(
 	     add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_RBLK_EVICT, "cache_evictions", "Cache evictions")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_RBLK_MISS, "cache_misses", "Cache misses")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_RBLK_HIT, "cache_hits", "Cache hits")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_TIMESTAMP_END, "time_end", "End time")
 	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_TIMESTAMP, "time_start", "Start time")
@@ -537,6 +543,17 @@ static void bottom_part(struct cntr *c, enum action act)
 	l=get_count(e, CMD_BYTES_SENT);
 	logc("           Bytes sent:   %11" PRIu64, l);
 	logc("%s\n", bytes_to_human(l));
+
+	if(get_count(e, CMD_RBLK_HIT) || get_count(e, CMD_RBLK_MISS))
+	{
+		logc("\n");
+		logc("           Cache hits:   %11" PRIu64 "\n",
+			get_count(e, CMD_RBLK_HIT));
+		logc("         Cache misses:   %11" PRIu64 "\n",
+			get_count(e, CMD_RBLK_MISS));
+		logc("      Cache evictions:   %11" PRIu64 "\n",
+			get_count(e, CMD_RBLK_EVICT));
+	}
 }
 
 void cntr_print(struct cntr *cntr, enum action act, struct asfd *asfd)
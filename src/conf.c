@@ -418,10 +418,24 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "ssl_ciphers");
 	case OPT_SSL_COMPRESSION:
 	  return sc_int(c[o], 5, 0, "ssl_compression");
+	case OPT_SSL_SESSION_TIMEOUT:
+	  return sc_int(c[o], 60*60*2, 0, "ssl_session_timeout");
+	case OPT_SSL_KTLS:
+	  return sc_int(c[o], 0, 0, "ssl_ktls");
 	case OPT_RATELIMIT:
-	  return sc_flt(c[o], 0, 0, "ratelimit");
+	  return sc_flt(c[o], 0, CONF_FLAG_CC_OVERRIDE, "ratelimit");
+	case OPT_RATELIMIT_GLOBAL:
+	  return sc_flt(c[o], 0, 0, "ratelimit_global");
+	case OPT_RATELIMIT_SCHEDULE:
+	  return sc_lst(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE|CONF_FLAG_STRLIST_REPLACE,
+		"ratelimit_schedule");
 	case OPT_NETWORK_TIMEOUT:
 	  return sc_int(c[o], 60*60*2, 0, "network_timeout");
+	case OPT_NETWORK_BUFFER_SIZE:
+	  return sc_int(c[o], 0, 0, "network_buffer_size");
+	case OPT_BACKUP_STREAMS:
+	  return sc_int(c[o], 1, CONF_FLAG_CC_OVERRIDE, "backup_streams");
 	case OPT_CLIENT_IS_WINDOWS:
 	  return sc_int(c[o], 0, 0, "client_is_windows");
 	case OPT_PEER_VERSION:
@@ -450,6 +464,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_lst(c[o], 0, 0, "max_children");
 	case OPT_MAX_STATUS_CHILDREN:
 	  return sc_lst(c[o], 0, 0, "max_status_children");
+	case OPT_PREFORK:
+	  return sc_int(c[o], 0, 0, "prefork");
 	case OPT_CLIENT_LOCKDIR:
 	  return sc_str(c[o], 0, CONF_FLAG_CC_OVERRIDE, "client_lockdir");
 	case OPT_UMASK:
@@ -475,6 +491,11 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_RBLK_MEMORY_MAX:
 	  return sc_u64(c[o], 256*1024*1024, // 256 Mb.
 		CONF_FLAG_CC_OVERRIDE, "rblk_memory_max");
+	case OPT_CHAMP_CACHE_MAX:
+	  return sc_u64(c[o], 64*1024*1024, // 64 Mb.
+		0, "champ_cache_max");
+	case OPT_CHAMP_THREADS:
+	  return sc_int(c[o], 0, 0, "champ_threads");
 	case OPT_MONITOR_LOGFILE:
 	  return sc_str(c[o], 0, 0, "monitor_logfile");
 	case OPT_MONITOR_EXE:
@@ -499,6 +520,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "autoupgrade_dir");
 	case OPT_CA_CSR_DIR:
 	  return sc_str(c[o], 0, 0, "ca_csr_dir");
+	case OPT_SSL_SESSION_FILE:
+	  return sc_str(c[o], 0, 0, "ssl_session_file");
 	case OPT_RANDOMISE:
 	  return sc_int(c[o], 0, 0, "randomise");
 	case OPT_ENABLED:
@@ -653,6 +676,9 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_COMPRESSION:
 	  return sc_int(c[o], 9,
 		CONF_FLAG_CC_OVERRIDE, "compression");
+	case OPT_COMPRESSION_ZSTD:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "compression_zstd");
 	case OPT_VERSION_WARN:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "version_warn");
@@ -698,6 +724,11 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_DEDUP_GROUP:
 	  return sc_str(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "dedup_group");
+	case OPT_CHUNKER:
+	  return sc_str(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "chunker");
+	case OPT_MD5_THREADS:
+	  return sc_int(c[o], 0, 0, "md5_threads");
 	case OPT_CLIENT_CAN_DELETE:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "client_can_delete");
@@ -89,10 +89,16 @@ enum conf_opt
 	OPT_SSL_PEER_CN,
 	OPT_SSL_CIPHERS,
 	OPT_SSL_COMPRESSION,
+	OPT_SSL_SESSION_TIMEOUT,
+	OPT_SSL_KTLS,
 	OPT_USER,
 	OPT_GROUP,
 	OPT_RATELIMIT,
+	OPT_RATELIMIT_GLOBAL,
+	OPT_RATELIMIT_SCHEDULE,
 	OPT_NETWORK_TIMEOUT,
+	OPT_NETWORK_BUFFER_SIZE,
+	OPT_BACKUP_STREAMS,
 	OPT_CLIENT_IS_WINDOWS,
 	OPT_PEER_VERSION,
 	OPT_PROTOCOL,
@@ -112,6 +118,7 @@ enum conf_opt
 	OPT_SSL_DHFILE,
 	OPT_MAX_CHILDREN,
 	OPT_MAX_STATUS_CHILDREN,
+	OPT_PREFORK,
 	OPT_CLIENT_LOCKDIR,
 	OPT_UMASK,
 	OPT_MAX_HARDLINKS,
@@ -128,6 +135,8 @@ enum conf_opt
 	OPT_PASSWORD_CHECK,
 	OPT_MANUAL_DELETE,
 	OPT_RBLK_MEMORY_MAX,
+	OPT_CHAMP_CACHE_MAX,
+	OPT_CHAMP_THREADS,
 	OPT_MONITOR_LOGFILE, // An ncurses client option, from command line.
 	OPT_MONITOR_BROWSE_CACHE,
 	OPT_MONITOR_EXE,
@@ -147,6 +156,7 @@ enum conf_opt
 	OPT_AUTOUPGRADE_OS,
 	OPT_AUTOUPGRADE_DIR, // also a server option
 	OPT_CA_CSR_DIR,
+	OPT_SSL_SESSION_FILE,
 	OPT_RANDOMISE,
 	OPT_SERVER_CAN_OVERRIDE_INCLUDES,
 
@@ -241,6 +251,7 @@ enum conf_opt
 	OPT_LIBRSYNC_MAX_SIZE,
 
 	OPT_COMPRESSION,
+	OPT_COMPRESSION_ZSTD,
 	OPT_VERSION_WARN,
 	OPT_PATH_LENGTH_WARN,
 	OPT_HARD_QUOTA,
@@ -263,6 +274,8 @@ enum conf_opt
 	OPT_RESTORE_CLIENTS,
 
 	OPT_DEDUP_GROUP,
+	OPT_CHUNKER,
+	OPT_MD5_THREADS,
 
 	OPT_CLIENT_CAN_DELETE,
 	OPT_CLIENT_CAN_DIFF,
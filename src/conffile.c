@@ -11,6 +11,7 @@
 #include "strlist.h"
 #include "times.h"
 #include "client/glob_windows.h"
+#include "protocol2/rabin/rconf.h"
 #include "conffile.h"
 
 // This will strip off everything after the last quote. So, configs like this
@@ -242,6 +243,37 @@ static int get_compression(const char *v)
 	return -1;
 }
 
+// The zstd level for files stored on the server. The zlib level is left
+// alone, because it is also what the client uses on the network.
+static int get_compression_zstd(const char *v)
+{
+	const char *cp=v+strlen("zstd");
+	int level=3;
+	if(*cp)
+	{
+		if(strlen(cp)>2 || !isdigit(*cp) || (cp[1] && !isdigit(cp[1])))
+			return -1;
+		level=atoi(cp);
+	}
+	if(level<1 || level>19)
+		return -1;
+	return level;
+}
+
+static int get_ratelimit(struct conf *conf, const char *f, const char *v)
+{
+	float rate=atof(v);
+	// User is specifying Mega bits per second.
+	// Need to convert to bytes per second.
+	rate=(rate*1024*1024)/8;
+	if(!rate)
+	{
+		logp("%s should be greater than zero\n", f);
+		return -1;
+	}
+	return set_float(conf, rate);
+}
+
 static int load_conf_field_and_value(struct conf **c,
 	const char *f, // field
 	const char *v, // value
@@ -251,9 +283,18 @@ static int load_conf_field_and_value(struct conf **c,
 {
 	if(!strcmp(f, "compression"))
 	{
-		int compression=get_compression(v);
+		int compression;
+		if(!strncmp(v, "zstd", strlen("zstd")))
+		{
+			compression=get_compression_zstd(v);
+			if(compression<0) return -1;
+			set_int(c[OPT_COMPRESSION_ZSTD], compression);
+			return 0;
+		}
+		compression=get_compression(v);
 		if(compression<0) return -1;
 		set_int(c[OPT_COMPRESSION], compression);
+		set_int(c[OPT_COMPRESSION_ZSTD], 0);
 	}
 	else if(!strcmp(f, "ssl_compression"))
 	{
@@ -262,19 +303,9 @@ static int load_conf_field_and_value(struct conf **c,
 		set_int(c[OPT_SSL_COMPRESSION], compression);
 	}
 	else if(!strcmp(f, "ratelimit"))
-	{
-		float f=0;
-		f=atof(v);
-		// User is specifying Mega bits per second.
-		// Need to convert to bytes per second.
-		f=(f*1024*1024)/8;
-		if(!f)
-		{
-			logp("ratelimit should be greater than zero\n");
-			return -1;
-		}
-		set_float(c[OPT_RATELIMIT], f);
-	}
+		return get_ratelimit(c[OPT_RATELIMIT], f, v);
+	else if(!strcmp(f, "ratelimit_global"))
+		return get_ratelimit(c[OPT_RATELIMIT_GLOBAL], f, v);
 	else
 	{
 		int i=0;
@@ -449,6 +480,8 @@ static int server_conf_checks(struct conf **c, const char *path, int *r)
 		conf_problem(path, "dedup_group unset", r);
 	if(!get_string(c[OPT_CLIENTCONFDIR]))
 		conf_problem(path, "clientconfdir unset", r);
+	if(str_to_chunker(get_string(c[OPT_CHUNKER]))==CHUNKER_UNSET)
+		conf_problem(path, "chunker should be 'rabin' or 'gear'", r);
 	if(get_e_recovery_method(c[OPT_WORKING_DIR_RECOVERY_METHOD])==RECOVERY_METHOD_UNSET)
 		conf_problem(path, "working_dir_recovery_method unset", r);
 	if(!get_string(c[OPT_SSL_DHFILE]))
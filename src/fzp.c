@@ -9,6 +9,16 @@
 #include "server/compress.h"
 #include "server/protocol1/zlibio.h"
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ZSTD_MAGIC	"\x28\xB5\x2F\xFD"
+#define ZSTD_DEFAULT_LEVEL	3
+
+// When non-zero, fzp_zopen() creates new files with zstd at this level,
+// rather than with gzip.
+static int zstd_level=0;
 
 static struct fzp *fzp_alloc(void)
 {
@@ -71,6 +81,322 @@ static int close_zp(gzFile *zp)
 	return ret;
 }
 
+static const char *zs_fopen_mode(const char *mode)
+{
+	// Ignore any compression level that was given for gzip.
+	switch(*mode)
+	{
+		case 'a': return "ab";
+		case 'w': return "wb";
+		default: return "rb";
+	}
+}
+
+#ifdef HAVE_ZSTD
+// A zstd stream on top of a plain file. It is either read or written,
+// never both. Concatenated frames are read as one stream, so appending
+// works in the same way as it does for gzip.
+struct fzp_zstd
+{
+	FILE *fp;
+	int writing;
+	int pending; // Data written since the last frame was ended.
+	ZSTD_CStream *cs;
+	ZSTD_DStream *ds;
+	char *buf;
+	size_t bufsize;
+	ZSTD_inBuffer in;
+	size_t hint; // Last return of ZSTD_decompressStream(), 0 at frame end.
+	off_t pos; // Offset in the uncompressed data.
+	int eof;
+	int done;
+};
+
+static void zs_error(size_t r, const char *func)
+{
+	logp("zstd error in %s: %s\n", func, ZSTD_getErrorName(r));
+}
+
+static int zs_close(struct fzp_zstd **zs);
+
+static struct fzp_zstd *zs_open(FILE *fp, const char *mode)
+{
+	size_t r;
+	struct fzp_zstd *zs;
+	if(!(zs=(struct fzp_zstd *)
+		calloc_w(1, sizeof(struct fzp_zstd), __func__)))
+			return NULL;
+	zs->writing=(*mode!='r');
+	if(zs->writing)
+	{
+		zs->bufsize=ZSTD_CStreamOutSize();
+		if(!(zs->cs=ZSTD_createCStream()))
+			goto error;
+		r=ZSTD_CCtx_setParameter(zs->cs, ZSTD_c_compressionLevel,
+			zstd_level?zstd_level:ZSTD_DEFAULT_LEVEL);
+	}
+	else
+	{
+		zs->bufsize=ZSTD_DStreamInSize();
+		if(!(zs->ds=ZSTD_createDStream()))
+			goto error;
+		r=ZSTD_initDStream(zs->ds);
+	}
+	if(ZSTD_isError(r))
+	{
+		zs_error(r, __func__);
+		goto error;
+	}
+	if(!(zs->buf=(char *)malloc_w(zs->bufsize, __func__)))
+		goto error;
+	zs->fp=fp;
+	return zs;
+error:
+	zs_close(&zs);
+	return NULL;
+}
+
+static int zs_compress(struct fzp_zstd *zs, ZSTD_inBuffer *in,
+	ZSTD_EndDirective end)
+{
+	size_t r;
+	ZSTD_outBuffer out;
+	do
+	{
+		out.dst=zs->buf;
+		out.size=zs->bufsize;
+		out.pos=0;
+		r=ZSTD_compressStream2(zs->cs, &out, in, end);
+		if(ZSTD_isError(r))
+		{
+			zs_error(r, __func__);
+			return -1;
+		}
+		if(out.pos && fwrite(zs->buf, 1, out.pos, zs->fp)!=out.pos)
+		{
+			logp("short write in %s: %s\n",
+				__func__, strerror(errno));
+			return -1;
+		}
+	} while(end==ZSTD_e_end?r:in->pos<in->size);
+	return 0;
+}
+
+static int zs_end_frame(struct fzp_zstd *zs)
+{
+	ZSTD_inBuffer in={ NULL, 0, 0 };
+	if(zs_compress(zs, &in, ZSTD_e_end))
+		return -1;
+	zs->pending=0;
+	return 0;
+}
+
+static int zs_close(struct fzp_zstd **zs)
+{
+	int ret=0;
+	if(!*zs) return ret;
+	// Always leave at least one frame, so that empty files are valid.
+	if((*zs)->fp && (*zs)->writing
+	  && ((*zs)->pending || !(*zs)->pos)
+	  && zs_end_frame(*zs))
+		ret=-1;
+	ZSTD_freeCStream((*zs)->cs);
+	ZSTD_freeDStream((*zs)->ds);
+	if(close_fp(&(*zs)->fp))
+		ret=-1;
+	free_w(&(*zs)->buf);
+	free_v((void **)zs);
+	return ret;
+}
+
+static int zs_read(struct fzp_zstd *zs, void *ptr, size_t nmemb)
+{
+	size_t r;
+	size_t before;
+	size_t before_in;
+	ZSTD_outBuffer out={ ptr, nmemb, 0 };
+	if(zs->writing)
+	{
+		logp("%s called on a file opened for writing\n", __func__);
+		return -1;
+	}
+	while(out.pos<out.size && !zs->done)
+	{
+		if(zs->in.pos==zs->in.size && !zs->eof)
+		{
+			zs->in.src=zs->buf;
+			zs->in.pos=0;
+			zs->in.size=fread(zs->buf, 1, zs->bufsize, zs->fp);
+			if(!zs->in.size)
+			{
+				if(ferror(zs->fp))
+				{
+					logp("read error in %s: %s\n",
+						__func__, strerror(errno));
+					return -1;
+				}
+				zs->eof=1;
+			}
+		}
+		before=out.pos;
+		before_in=zs->in.pos;
+		r=ZSTD_decompressStream(zs->ds, &out, &zs->in);
+		if(ZSTD_isError(r))
+		{
+			zs_error(r, __func__);
+			return -1;
+		}
+		if(out.pos!=before || zs->in.pos!=before_in)
+			zs->hint=r;
+		else if(zs->eof)
+			// Nothing more came out, and nothing more can go in.
+			zs->done=1;
+	}
+	if(zs->done && zs->hint)
+	{
+		logp("truncated zstd frame in %s\n", __func__);
+		return -1;
+	}
+	zs->pos+=out.pos;
+	return (int)out.pos;
+}
+
+static size_t zs_write(struct fzp_zstd *zs, const void *ptr, size_t nmemb)
+{
+	ZSTD_inBuffer in={ ptr, nmemb, 0 };
+	if(!zs->writing)
+	{
+		logp("%s called on a file opened for reading\n", __func__);
+		return 0;
+	}
+	if(zs_compress(zs, &in, ZSTD_e_continue))
+		return 0;
+	zs->pending=1;
+	zs->pos+=nmemb;
+	return nmemb;
+}
+
+static int zs_eof(struct fzp_zstd *zs)
+{
+	return zs->done;
+}
+
+static int zs_flush(struct fzp_zstd *zs)
+{
+	if(!zs->writing)
+		return 0;
+	if(zs->pending && zs_end_frame(zs))
+		return EOF;
+	return fflush(zs->fp);
+}
+
+// Like gzseek(), going backwards while reading means starting again from the
+// beginning, and going forwards means decompressing up to the offset.
+static int zs_seek(struct fzp_zstd *zs, off_t offset, int whence)
+{
+	int r;
+	size_t len;
+	char skip[4096];
+	if(whence==SEEK_CUR)
+		offset+=zs->pos;
+	else if(whence!=SEEK_SET)
+		goto error;
+	if(zs->writing)
+	{
+		if(offset==zs->pos) return 0;
+		goto error;
+	}
+	if(offset<zs->pos)
+	{
+		if(fseeko(zs->fp, 0, SEEK_SET))
+			goto error;
+		ZSTD_DCtx_reset(zs->ds, ZSTD_reset_session_only);
+		zs->in.pos=zs->in.size=0;
+		zs->hint=0;
+		zs->pos=0;
+		zs->eof=0;
+		zs->done=0;
+	}
+	while(zs->pos<offset)
+	{
+		len=sizeof(skip);
+		if(offset-zs->pos<(off_t)len)
+			len=(size_t)(offset-zs->pos);
+		if((r=zs_read(zs, skip, len))<=0)
+			goto error;
+	}
+	return 0;
+error:
+	logp("Could not seek to %lu in %s\n", (unsigned long)offset, __func__);
+	return -1;
+}
+
+static off_t zs_tell(struct fzp_zstd *zs)
+{
+	return zs->pos;
+}
+
+static char *zs_gets(struct fzp_zstd *zs, char *s, int size)
+{
+	int i=0;
+	while(i<size-1)
+	{
+		if(zs_read(zs, s+i, 1)!=1)
+			break;
+		if(s[i++]=='\n')
+			break;
+	}
+	if(!i) return NULL;
+	s[i]='\0';
+	return s;
+}
+#else
+// Without libzstd, zstd files cannot be opened at all, so none of the
+// other functions can be reached.
+static struct fzp_zstd *zs_open(FILE *fp, const char *mode)
+{
+	logp("zstd support was not compiled in\n");
+	return NULL;
+}
+static int zs_close(struct fzp_zstd **zs) { return -1; }
+static int zs_read(struct fzp_zstd *zs, void *ptr, size_t nmemb)
+	{ return -1; }
+static size_t zs_write(struct fzp_zstd *zs, const void *ptr, size_t nmemb)
+	{ return 0; }
+static int zs_eof(struct fzp_zstd *zs) { return -1; }
+static int zs_flush(struct fzp_zstd *zs) { return EOF; }
+static int zs_seek(struct fzp_zstd *zs, off_t offset, int whence)
+	{ return -1; }
+static off_t zs_tell(struct fzp_zstd *zs) { return -1; }
+static char *zs_gets(struct fzp_zstd *zs, char *s, int size)
+	{ return NULL; }
+#endif
+
+static struct fzp_zstd *open_zs(const char *fname, const char *mode)
+{
+	FILE *fp=NULL;
+	struct fzp_zstd *zs=NULL;
+	if(!(fp=open_fp(fname, zs_fopen_mode(mode))))
+		return NULL;
+	if(!(zs=zs_open(fp, mode)))
+		close_fp(&fp);
+	return zs;
+}
+
+// Returns 1 if the file starts with the zstd magic number.
+static int is_zstd_file(const char *path)
+{
+	int ret=0;
+	FILE *fp;
+	char magic[4];
+	if(!(fp=fopen(path, "rb")))
+		return 0;
+	ret=fread(magic, 1, sizeof(magic), fp)==sizeof(magic)
+		&& !memcmp(magic, ZSTD_MAGIC, sizeof(magic));
+	fclose(fp);
+	return ret;
+}
+
 static void unknown_type(enum fzp_type type, const char *func)
 {
 	logp("unknown type in %s: %d\n", func, type);
@@ -98,6 +424,10 @@ static struct fzp *fzp_do_open(const char *path, const char *mode,
 			if(!(fzp->zp=open_zp(path, mode)))
 				goto error;
 			return fzp;
+		case FZP_ZSTD:
+			if(!(fzp->zs=open_zs(path, mode)))
+				goto error;
+			return fzp;
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -112,11 +442,50 @@ struct fzp *fzp_open(const char *path, const char *mode)
 	return fzp_do_open(path, mode, FZP_FILE);
 }
 
+// Files that are read this way may also be zstd.
 struct fzp *fzp_gzopen(const char *path, const char *mode)
 {
+	if(*mode=='r' && is_zstd_file(path))
+		return fzp_do_open(path, mode, FZP_ZSTD);
 	return fzp_do_open(path, mode, FZP_COMPRESSED);
 }
 
+struct fzp *fzp_zstdopen(const char *path, const char *mode)
+{
+	return fzp_do_open(path, mode, FZP_ZSTD);
+}
+
+// Like fzp_gzopen(), but new files are created with zstd if it has been
+// turned on with fzp_set_zstd_level(). When appending to a file that already
+// has something in it, the existing format is kept.
+struct fzp *fzp_zopen(const char *path, const char *mode)
+{
+	struct stat statp;
+	switch(*mode)
+	{
+		case 'w':
+			if(zstd_level)
+				return fzp_zstdopen(path, mode);
+			break;
+		case 'a':
+			if(!lstat(path, &statp) && statp.st_size)
+			{
+				if(is_zstd_file(path))
+					return fzp_zstdopen(path, mode);
+				break;
+			}
+			if(zstd_level)
+				return fzp_zstdopen(path, mode);
+			break;
+	}
+	return fzp_gzopen(path, mode);
+}
+
+void fzp_set_zstd_level(int level)
+{
+	zstd_level=level;
+}
+
 int fzp_close(struct fzp **fzp)
 {
 	int ret=-1;
@@ -129,6 +498,9 @@ int fzp_close(struct fzp **fzp)
 		case FZP_COMPRESSED:
 			ret=close_zp(&((*fzp)->zp));
 			break;
+		case FZP_ZSTD:
+			ret=zs_close(&((*fzp)->zs));
+			break;
 		default:
 			unknown_type((*fzp)->type, __func__);
 			break;
@@ -145,6 +517,8 @@ int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb)
 			return (int)fread(ptr, 1, nmemb, fzp->fp);
 		case FZP_COMPRESSED:
 			return gzread(fzp->zp, ptr, (unsigned)nmemb);
+		case FZP_ZSTD:
+			return zs_read(fzp->zs, ptr, nmemb);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -162,6 +536,8 @@ size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb)
 			return fwrite(ptr, 1, nmemb, fzp->fp);
 		case FZP_COMPRESSED:
 			return gzwrite(fzp->zp, ptr, (unsigned)nmemb);
+		case FZP_ZSTD:
+			return zs_write(fzp->zs, ptr, nmemb);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -179,6 +555,8 @@ int fzp_eof(struct fzp *fzp)
 			return feof(fzp->fp);
 		case FZP_COMPRESSED:
 			return gzeof(fzp->zp);
+		case FZP_ZSTD:
+			return zs_eof(fzp->zs);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -197,6 +575,8 @@ int fzp_flush(struct fzp *fzp)
 			return fflush(fzp->fp);
 		case FZP_COMPRESSED:
 			return gzflush(fzp->zp, Z_FINISH);
+		case FZP_ZSTD:
+			return zs_flush(fzp->zs);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -217,6 +597,8 @@ int fzp_seek(struct fzp *fzp, off_t offset, int whence)
 			if(gzseek(fzp->zp, offset, whence)==offset)
 				return 0;
 			goto error;
+		case FZP_ZSTD:
+			return zs_seek(fzp->zs, offset, whence);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -234,6 +616,8 @@ off_t fzp_tell(struct fzp *fzp)
 			return ftello(fzp->fp);
 		case FZP_COMPRESSED:
 			return gztell(fzp->zp);
+		case FZP_ZSTD:
+			return zs_tell(fzp->zs);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -342,6 +726,9 @@ int fzp_printf(struct fzp *fzp, const char *format, ...)
 		case FZP_COMPRESSED:
 			ret=gzprintf(fzp->zp, "%s", fzp->buf);
 			break;
+		case FZP_ZSTD:
+			ret=(int)zs_write(fzp->zs, fzp->buf, strlen(fzp->buf));
+			break;
 		default:
 			unknown_type(fzp->type, __func__);
 			break;
@@ -359,6 +746,7 @@ void fzp_setlinebuf(struct fzp *fzp)
 			setlinebuf(fzp->fp);
 			return;
 		case FZP_COMPRESSED:
+		case FZP_ZSTD:
 			logp("gzsetlinebuf() does not exist in %s\n", __func__);
 			return;
 		default:
@@ -377,6 +765,8 @@ char *fzp_gets(struct fzp *fzp, char *s, int size)
 			return fgets(s, size, fzp->fp);
 		case FZP_COMPRESSED:
 			return gzgets(fzp->zp, s, size);
+		case FZP_ZSTD:
+			return zs_gets(fzp->zs, s, size);
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -393,6 +783,7 @@ extern int fzp_fileno(struct fzp *fzp)
 		case FZP_FILE:
 			return fileno(fzp->fp);
 		case FZP_COMPRESSED:
+		case FZP_ZSTD:
 			logp("gzfileno() does not exist in %s\n", __func__);
 			goto error;
 		default:
@@ -448,6 +839,7 @@ void fzp_ERR_print_errors_fp(struct fzp *fzp)
 			ERR_print_errors_fp(fzp->fp);
 			break;
 		case FZP_COMPRESSED:
+		case FZP_ZSTD:
 			logp("ERR_print_errors_zp() does not exist in %s\n",
 				__func__);
 			break;
@@ -464,6 +856,7 @@ X509 *fzp_PEM_read_X509(struct fzp *fzp)
 		case FZP_FILE:
 			return PEM_read_X509(fzp->fp, NULL, NULL, NULL);
 		case FZP_COMPRESSED:
+		case FZP_ZSTD:
 			logp("PEM_read_X509() does not exist in %s\n",
 				__func__);
 			goto error;
@@ -484,10 +877,10 @@ static void pass_msg(size_t nmemb, size_t got, int pass)
 
 int fzp_read_ensure(struct fzp *fzp, void *ptr, size_t nmemb, const char *func)
 {
-	static int f;
-	static int r;
-	static size_t got;
-	static int pass;
+	int f;
+	int r;
+	size_t got;
+	int pass;
 	for(r=0, got=0, pass=0; got!=nmemb; pass++)
 	{
 		r=fzp_read(fzp, ((char *)ptr)+got, nmemb-got);
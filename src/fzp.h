@@ -6,9 +6,12 @@
 enum fzp_type
 {
 	FZP_FILE=0,
-	FZP_COMPRESSED
+	FZP_COMPRESSED,
+	FZP_ZSTD
 };
 
+struct fzp_zstd;
+
 struct fzp
 {
 	enum fzp_type type;
@@ -16,6 +19,7 @@ struct fzp
 	{
 		FILE *fp;
 		gzFile zp;
+		struct fzp_zstd *zs;
 	};
 	char *buf;
 	size_t s;
@@ -23,6 +27,9 @@ struct fzp
 
 extern struct fzp *fzp_open(const char *path, const char *mode);
 extern struct fzp *fzp_gzopen(const char *path, const char *mode);
+extern struct fzp *fzp_zstdopen(const char *path, const char *mode);
+extern struct fzp *fzp_zopen(const char *path, const char *mode);
+extern void fzp_set_zstd_level(int level);
 extern int fzp_close(struct fzp **fzp);
 
 extern int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb);
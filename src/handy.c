@@ -278,7 +278,7 @@ int set_keepalive(int fd, int value)
 	return 0;
 }
 
-int init_client_socket(const char *host, const char *port)
+int init_client_socket(const char *host, const char *port, int bufsize)
 {
 	int rfd=-1;
 	int gai_ret;
@@ -305,6 +305,11 @@ int init_client_socket(const char *host, const char *port)
 		rfd=socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
 		if(rfd<0) continue;
 		set_keepalive(rfd, 1);
+		if(set_network_buffers(rfd, bufsize))
+		{
+			close_fd(&rfd);
+			continue;
+		}
 		if(connect(rfd, rp->ai_addr, rp->ai_addrlen) != -1) break;
 		close_fd(&rfd);
 	}
@@ -339,6 +344,38 @@ void reuseaddr(int fd)
 				strerror(errno));
 }
 
+// A connection over a long, fast network path can only keep as much data in
+// flight as its socket buffers hold. Zero leaves the sizes to the operating
+// system. This needs to happen before connect() or listen(), because the TCP
+// window scaling gets agreed when the connection is opened.
+int set_network_buffers(int fd, int size)
+{
+	int got=0;
+	socklen_t len=sizeof(got);
+	if(size<=0) return 0;
+	if(setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+		(sockopt_val_t)&size, sizeof(size))
+	  || setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		(sockopt_val_t)&size, sizeof(size)))
+	{
+		logp("setsockopt network buffers=%d failed: %s\n",
+			size, strerror(errno));
+		return -1;
+	}
+	if(getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (sockopt_val_t)&got, &len))
+		return 0;
+#ifdef HAVE_LINUX_OS
+	// Linux doubles the size that it is given, to allow for its own
+	// overhead, and reports the doubled size back. It quietly caps what
+	// it is asked for at net.core.rmem_max.
+	got/=2;
+#endif
+	if(got<size)
+		logp("network buffers of %d were limited to %d by the operating system\n",
+			size, got);
+	return 0;
+}
+
 void setup_signal(int sig, void handler(int sig))
 {
 	struct sigaction sa;
@@ -22,8 +22,10 @@ extern void add_fd_to_sets(int fd,
 extern int log_peer_address(struct sockaddr_storage *addr);
 extern int set_peer_env_vars(struct sockaddr_storage *addr);
 extern int set_keepalive(int fd, int value);
-extern int init_client_socket(const char *host, const char *port);
+extern int init_client_socket(const char *host, const char *port,
+	int bufsize);
 extern void reuseaddr(int fd);
+extern int set_network_buffers(int fd, int size);
 extern int chuser_and_or_chgrp(const char *user, const char *group);
 extern int dpth_protocol1_is_compressed(int compressed, const char *datapath);
 #ifndef HAVE_WIN32
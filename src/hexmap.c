@@ -32,8 +32,8 @@ void hexmap_init(void)
 
 static void str_to_bytes(const char *str, uint8_t *bytes, size_t len)
 {
-	static uint8_t bpos;
-	static uint8_t spos;
+	uint8_t bpos;
+	uint8_t spos;
 
 	for(bpos=0, spos=0; bpos<len && str[spos]; )
 	{
@@ -58,6 +58,18 @@ void iobuf_move(struct iobuf *dst, struct iobuf *src)
 	src->buf=NULL;
 }
 
+// Gives dst its own null terminated copy of what src points to.
+int iobuf_dup(struct iobuf *dst, struct iobuf *src)
+{
+	char *buf;
+	if(!(buf=(char *)malloc_w(src->len+1, __func__)))
+		return -1;
+	memcpy(buf, src->buf, src->len);
+	buf[src->len]='\0';
+	iobuf_set(dst, src->cmd, buf, src->len);
+	return 0;
+}
+
 void iobuf_from_str(struct iobuf *iobuf, enum cmd cmd, char *str)
 {
 	iobuf_set(iobuf, cmd, str, strlen(str));
@@ -126,14 +138,34 @@ int iobuf_is_estimatable(struct iobuf *iobuf)
 	return cmd_is_estimatable(iobuf->cmd);
 }
 
+// If sig is given, the record goes into it, and 2 is returned. Otherwise,
+// it is turned into a CMD_SIG in iobuf, so that readers do not need to
+// know which way it was stored.
+static int fill_sig_bin(struct iobuf *iobuf, struct fzp *fzp, char *sig)
+{
+	char *buf=sig;
+	if(!buf && !(buf=(char *)malloc_w(IOBUF_SIG_BIN_LEN+1, __func__)))
+		return -1;
+	if(fzp_read_ensure(fzp, buf, IOBUF_SIG_BIN_LEN, __func__))
+	{
+		logp("Error reading binary signature in %s\n", __func__);
+		if(!sig) free_w(&buf);
+		return -1;
+	}
+	if(sig) return 2;
+	buf[IOBUF_SIG_BIN_LEN]='\0';
+	iobuf_set(iobuf, CMD_SIG, buf, IOBUF_SIG_BIN_LEN);
+	return 0;
+}
+
 static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
-	int extra_bytes)
+	int extra_bytes, char *sig)
 {
 	unsigned int s;
-	char lead[5]="";
+	char lead[6]="";
 	char command;
 
-	switch(fzp_read_ensure(fzp, lead, sizeof(lead), __func__))
+	switch(fzp_read_ensure(fzp, lead, 1, __func__))
 	{
 		case 0: break; // OK.
 		case 1: return 1; // Finished OK.
@@ -143,6 +175,13 @@ static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 			return -1; // Error.
 		}
 	}
+	if(*lead==CMD_SIG_BIN)
+		return fill_sig_bin(iobuf, fzp, sig);
+	if(fzp_read_ensure(fzp, lead+1, 4, __func__))
+	{
+		logp("Error reading lead in %s\n", __func__);
+		return -1; // Error.
+	}
 	if((sscanf(lead, "%c%04X", &command, &s))!=2)
 	{
 		logp("sscanf failed reading manifest: %s\n", lead);
@@ -168,12 +207,20 @@ static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 
 int iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp)
 {
-	return do_iobuf_fill_from_fzp(iobuf, fzp, 1 /*newline*/);
+	return do_iobuf_fill_from_fzp(iobuf, fzp, 1 /*newline*/, NULL);
+}
+
+// Like iobuf_fill_from_fzp(), except that a CMD_SIG_BIN record is copied
+// into sig, which needs to have room for IOBUF_SIG_BIN_LEN bytes, and 2 is
+// returned. Nothing gets allocated for it.
+int iobuf_fill_from_fzp_sig(struct iobuf *iobuf, struct fzp *fzp, char *sig)
+{
+	return do_iobuf_fill_from_fzp(iobuf, fzp, 1 /*newline*/, sig);
 }
 
 int iobuf_fill_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp)
 {
-	return do_iobuf_fill_from_fzp(iobuf, fzp, 0 /*no newline*/);
+	return do_iobuf_fill_from_fzp(iobuf, fzp, 0 /*no newline*/, NULL);
 }
 
 static int is_printable(struct iobuf *iobuf)
@@ -187,7 +234,7 @@ static int is_printable(struct iobuf *iobuf)
 
 const char *iobuf_to_printable(struct iobuf *iobuf)
 {
-	static char str[256]="";
+	static THREAD_LOCAL char str[256]="";
 	if(is_printable(iobuf))
 		snprintf(str, sizeof(str),
 			"%c:%04X:%s", iobuf->cmd, (int)iobuf->len, iobuf->buf);
@@ -21,6 +21,7 @@ extern void iobuf_log_unexpected(struct iobuf *iobuf, const char *func);
 extern void iobuf_set(struct iobuf *iobuf, enum cmd cmd, char *buf, size_t len);
 extern void iobuf_copy(struct iobuf *dst, struct iobuf *src);
 extern void iobuf_move(struct iobuf *dst, struct iobuf *src);
+extern int iobuf_dup(struct iobuf *dst, struct iobuf *src);
 extern void iobuf_from_str(struct iobuf *iobuf, enum cmd cmd, char *str);
 
 extern int iobuf_send_msg_fzp(struct iobuf *iobuf, struct fzp *fzp);
@@ -34,7 +35,14 @@ extern int iobuf_is_encrypted(struct iobuf *iobuf);
 extern int iobuf_is_metadata(struct iobuf *iobuf);
 extern int iobuf_is_estimatable(struct iobuf *iobuf);
 
+// A CMD_SIG_BIN record is the command byte followed by this many bytes,
+// which are the same as the payload of a CMD_SIG with a save path. There is
+// no length and no newline.
+#define IOBUF_SIG_BIN_LEN	32
+
 extern int iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp);
+extern int iobuf_fill_from_fzp_sig(struct iobuf *iobuf, struct fzp *fzp,
+	char *sig);
 extern int iobuf_fill_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp);
 
 extern const char *iobuf_to_printable(struct iobuf *iobuf);
@@ -9,6 +9,24 @@
 #include "strlist.h"
 #include "times.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+// The champ chooser threads log too. This stops them formatting the time or
+// writing to the log file at the same moment.
+static pthread_mutex_t log_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+static void log_lock(void)
+{
+	pthread_mutex_lock(&log_mutex);
+}
+
+static void log_unlock(void)
+{
+	pthread_mutex_unlock(&log_mutex);
+}
+#endif
+
 const char *prog="unknown";
 const char *prog_long="unknown";
 
@@ -27,6 +45,11 @@ void log_init(char *progname)
 	prog_long=progname;
 	if((prog=strrchr(progname, '/'))) prog++;
 	else prog=progname;
+#ifdef HAVE_PTHREAD
+	// A child forked while another thread was logging would otherwise
+	// start with the lock held.
+	pthread_atfork(log_lock, log_unlock, log_unlock);
+#endif
 }
 
 void logp(const char *fmt, ...)
@@ -38,6 +61,9 @@ void logp(const char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	pid=(int)getpid();
+#ifdef HAVE_PTHREAD
+	log_lock();
+#endif
 	if(logfzp)
 		fzp_printf(logfzp, "%s: %s[%d] %s",
 			gettimenow(), prog, pid, buf);
@@ -68,6 +94,9 @@ void logp(const char *fmt, ...)
 					gettimenow(), prog, pid, buf);
 		}
 	}
+#ifdef HAVE_PTHREAD
+	log_unlock();
+#endif
 	va_end(ap);
 #endif
 }
@@ -152,12 +152,14 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 	int have;
 	z_stream strm;
 	int flush=Z_NO_FLUSH;
-	uint8_t in[ZCHUNK];
-	uint8_t out[ZCHUNK];
+	// One frame's worth at a time.
+	size_t chunk=asfd->frame_len;
+	uint8_t *in=NULL;
+	uint8_t *out=NULL;
 	ssize_t r;
 
 	int eoutlen;
-	uint8_t eoutbuf[ZCHUNK+EVP_MAX_BLOCK_LENGTH];
+	uint8_t *eoutbuf=NULL;
 
 	EVP_CIPHER_CTX *enc_ctx=NULL;
 #ifdef HAVE_WIN32
@@ -173,7 +175,17 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 	if(!MD5_Init(&md5))
 	{
 		logp("MD5_Init() failed\n");
-		return SEND_FATAL;
+		ret=SEND_FATAL;
+		goto end;
+	}
+
+	if(!(in=(uint8_t *)malloc_w(chunk, __func__))
+	  || !(out=(uint8_t *)malloc_w(chunk, __func__))
+	  || !(eoutbuf=(uint8_t *)malloc_w(chunk+EVP_MAX_BLOCK_LENGTH,
+		__func__)))
+	{
+		ret=SEND_FATAL;
+		goto end;
 	}
 
 //logp("send_whole_file_gz: %s%s\n", fname, extrameta?" (meta)":"");
@@ -189,14 +201,17 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 	strm.opaque = Z_NULL;
 	if((zret=deflateInit2(&strm, compression, Z_DEFLATED, (15+16),
 		8, Z_DEFAULT_STRATEGY))!=Z_OK)
-			return SEND_FATAL;
+	{
+		ret=SEND_FATAL;
+		goto end;
+	}
 
 	do
 	{
 		if(metadata)
 		{
-			if(metalen>ZCHUNK)
-				strm.avail_in=ZCHUNK;
+			if(metalen>chunk)
+				strm.avail_in=chunk;
 			else
 				strm.avail_in=metalen;
 			memcpy(in, metadata, strm.avail_in);
@@ -215,14 +230,14 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 				else
 				{
 					r=bfd->read(bfd, in,
-						min((size_t)ZCHUNK, datalen));
+						min(chunk, datalen));
 					if(r>0)
 						datalen-=r;
 				}
 			}
 			else
 #endif
-				r=bfd->read(bfd, in, ZCHUNK);
+				r=bfd->read(bfd, in, chunk);
 
 			if(r<0)
 			{
@@ -266,7 +281,7 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 		{
 			if(compression)
 			{
-				strm.avail_out = ZCHUNK;
+				strm.avail_out = chunk;
 				strm.next_out = out;
 				zret = deflate(&strm, flush); /* no bad return value */
 				if(zret==Z_STREAM_ERROR) /* state not clobbered */
@@ -275,7 +290,7 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 					ret=SEND_ERROR;
 					break;
 				}
-				have = ZCHUNK-strm.avail_out;
+				have = chunk-strm.avail_out;
 			}
 			else
 			{
@@ -360,7 +375,7 @@ enum send_e send_whole_file_gzl(struct asfd *asfd, const char *datapth,
 
 cleanup:
 	deflateEnd(&strm);
-
+end:
 	if(enc_ctx)
 	{
 		EVP_CIPHER_CTX_cleanup(enc_ctx);
@@ -374,11 +389,14 @@ cleanup:
 		if(!MD5_Final(checksum, &md5))
 		{
 			logp("MD5_Final() failed\n");
-			return SEND_FATAL;
+			ret=SEND_FATAL;
 		}
-		if(write_endfile(asfd, *bytes, checksum))
-			return SEND_FATAL;
+		else if(write_endfile(asfd, *bytes, checksum))
+			ret=SEND_FATAL;
 	}
+	free_v((void **)&in);
+	free_v((void **)&out);
+	free_v((void **)&eoutbuf);
 	return ret;
 }
 
@@ -422,18 +440,48 @@ static DWORD WINAPI write_efs(PBYTE pbData,
 }
 #endif
 
+#ifndef HAVE_WIN32
+// Has the kernel send the data straight from the file, if it can. The data
+// was read in for the checksum, so it will come from the page cache. If it
+// cannot, the data is left in wbuf to be written in the usual way.
+// The kernel reads the file again, so this is only safe for files that
+// cannot change underneath us, like the server's stored data files. A live
+// file on the client could be rewritten or truncated between the read and
+// the send, and the data sent would not match the checksum.
+static int send_from_fd(struct asfd *asfd, struct BFILE *bfd,
+	off_t *offset, struct iobuf *wbuf)
+{
+	if(*offset<0)
+		return 0;
+	switch(asfd->sendfile(asfd, wbuf->cmd, bfd->fd, *offset, wbuf->len))
+	{
+		case 0:
+			*offset+=wbuf->len;
+			wbuf->len=0;
+			return 0;
+		case 1:
+			*offset=-1;
+			return 0;
+		default:
+			return -1;
+	}
+}
+#endif
+
 enum send_e send_whole_filel(struct asfd *asfd,
 #ifdef HAVE_WIN32
 	enum cmd cmd,
 #endif
 	const char *datapth,
 	int quick_read, uint64_t *bytes, struct cntr *cntr,
-	struct BFILE *bfd, const char *extrameta, size_t elen)
+	struct BFILE *bfd, const char *extrameta, size_t elen,
+	int use_sendfile)
 {
 	enum send_e ret=SEND_OK;
 	ssize_t s=0;
 	MD5_CTX md5;
-	char buf[4096]="";
+	char *buf=NULL;
+	size_t buflen=4096;
 	struct iobuf wbuf;
 
 	if(!bfd)
@@ -448,6 +496,13 @@ enum send_e send_whole_filel(struct asfd *asfd,
 		return SEND_FATAL;
 	}
 
+	// Peers without large frames have only ever been sent 4096 bytes at
+	// a time from here.
+	if(asfd->large_frames)
+		buflen=asfd->frame_len;
+	if(!(buf=(char *)malloc_w(buflen, __func__)))
+		return SEND_FATAL;
+
 	if(extrameta)
 	{
 		size_t metalen=0;
@@ -459,7 +514,7 @@ enum send_e send_whole_filel(struct asfd *asfd,
 		// Send metadata in chunks, rather than all at once.
 		while(metalen>0)
 		{
-			if(metalen>ZCHUNK) s=ZCHUNK;
+			if(metalen>asfd->frame_len) s=asfd->frame_len;
 			else s=metalen;
 
 			if(!MD5_Update(&md5, metadata, s))
@@ -505,25 +560,42 @@ enum send_e send_whole_filel(struct asfd *asfd,
 
 		if(ret==SEND_OK)
 		{
+		  off_t offset=-1;
 #ifdef HAVE_WIN32
 		  int do_known_byte_count=0;
 		  size_t datalen=bfd->datalen;
 		  if(datalen>0) do_known_byte_count=1;
+#else
+		  if(use_sendfile && !bfd->vss_strip)
+			offset=lseek(bfd->fd, 0, SEEK_CUR);
+#ifdef POSIX_FADV_SEQUENTIAL
+		  posix_fadvise(bfd->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 #endif
 		  while(1)
 		  {
+			// Unless the kernel is going to send the data from
+			// the file, read it straight into the write buffer,
+			// so that it does not have to be copied there.
+			char *dst=buf;
+			if(offset<0
+			  && !(dst=asfd->reserve_write_buffer(asfd, buflen)))
+			{
+				ret=SEND_FATAL;
+				break;
+			}
 #ifdef HAVE_WIN32
 			if(do_known_byte_count)
 			{
 				s=bfd->read(bfd,
-					buf, min((size_t)4096, datalen));
+					dst, min(buflen, datalen));
 				if(s>0)
 					datalen-=s;
 			}
 			else
 			{
 #endif
-				s=bfd->read(bfd, buf, 4096);
+				s=bfd->read(bfd, dst, buflen);
 #ifdef HAVE_WIN32
 			}
 #endif
@@ -539,17 +611,36 @@ enum send_e send_whole_filel(struct asfd *asfd,
 			}
 
 			*bytes+=s;
-			if(!MD5_Update(&md5, buf, s))
+			if(!MD5_Update(&md5, dst, s))
 			{
 				logp("MD5_Update() failed\n");
 				ret=SEND_FATAL;
 				break;
 			}
-			iobuf_set(&wbuf, CMD_APPEND, buf, s);
-			if(asfd->write(asfd, &wbuf))
+			if(dst!=buf)
 			{
-				ret=SEND_FATAL;
-				break;
+				if(asfd->commit_write_buffer(asfd,
+					CMD_APPEND, s))
+				{
+					ret=SEND_FATAL;
+					break;
+				}
+			}
+			else
+			{
+				iobuf_set(&wbuf, CMD_APPEND, buf, s);
+#ifndef HAVE_WIN32
+				if(send_from_fd(asfd, bfd, &offset, &wbuf))
+				{
+					ret=SEND_FATAL;
+					break;
+				}
+#endif
+				if(asfd->write(asfd, &wbuf))
+				{
+					ret=SEND_FATAL;
+					break;
+				}
 			}
 			if(quick_read)
 			{
@@ -579,10 +670,11 @@ enum send_e send_whole_filel(struct asfd *asfd,
 		if(!MD5_Final(checksum, &md5))
 		{
 			logp("MD5_Final() failed\n");
-			return SEND_FATAL;
+			ret=SEND_FATAL;
 		}
-		if(write_endfile(asfd, *bytes, checksum))
-			return SEND_FATAL;
+		else if(write_endfile(asfd, *bytes, checksum))
+			ret=SEND_FATAL;
 	}
+	free_w(&buf);
 	return ret;
 }
@@ -31,7 +31,7 @@ extern enum send_e send_whole_filel(struct asfd *asfd,
 	const char *datapth,
 	int quick_read, uint64_t *bytes, struct cntr *cntr,
 	struct BFILE *bfd,
-	const char *extrameta, size_t elen);
+	const char *extrameta, size_t elen, int use_sendfile);
 
 extern EVP_CIPHER_CTX *enc_setup(int encrypt, const char *encryption_password,
 	int key_deriv, uint64_t salt);
@@ -104,6 +104,7 @@ struct winbuf
 	uint64_t *sent;
 	struct cntr *cntr;
 	struct asfd *asfd;
+	size_t offset;
 };
 
 static DWORD WINAPI read_efs(PBYTE pbData, PVOID pvCallbackContext, PULONG ulLength)
@@ -114,18 +115,32 @@ static DWORD WINAPI read_efs(PBYTE pbData, PVOID pvCallbackContext, PULONG ulLen
 
 	while(1)
 	{
-		if(mybuf->asfd->read(mybuf->asfd))
-			return ERROR_FUNCTION_FAILED;
-		(*(mybuf->rcvd))+=rbuf->len;
+		// A large frame might not fit in the buffer that we were
+		// given, so the rest of it is left for the next call.
+		if(!mybuf->offset)
+		{
+			if(mybuf->asfd->read(mybuf->asfd))
+				return ERROR_FUNCTION_FAILED;
+			(*(mybuf->rcvd))+=rbuf->len;
+		}
 
 		switch(rbuf->cmd)
 		{
 			case CMD_APPEND:
-				memcpy(pbData, rbuf->buf, rbuf->len);
-				*ulLength=(ULONG)rbuf->len;
-				(*(mybuf->sent))+=rbuf->len;
+			{
+				size_t len=rbuf->len-mybuf->offset;
+				if(len>(size_t)*ulLength)
+					len=(size_t)*ulLength;
+				memcpy(pbData, rbuf->buf+mybuf->offset, len);
+				*ulLength=(ULONG)len;
+				(*(mybuf->sent))+=len;
+				mybuf->offset+=len;
+				if(mybuf->offset<rbuf->len)
+					return ERROR_SUCCESS;
+				mybuf->offset=0;
 				iobuf_free_content(rbuf);
 				return ERROR_SUCCESS;
+			}
 			case CMD_END_FILE:
 				*ulLength=0;
 				iobuf_free_content(rbuf);
@@ -159,6 +174,7 @@ static int transfer_efs_in(struct asfd *asfd,
 	mybuf.sent=sent;
 	mybuf.cntr=cntr;
 	mybuf.asfd=asfd;
+	mybuf.offset=0;
 	if((ret=WriteEncryptedFileRaw((PFE_IMPORT_FUNC)read_efs,
 		&mybuf, bfd->pvContext)))
 			logp("WriteEncryptedFileRaw returned %d\n", ret);
@@ -167,6 +183,22 @@ static int transfer_efs_in(struct asfd *asfd,
 
 #endif
 
+// Decrypting can give up to a block more than went in, and do_write() may
+// add a null terminator after that.
+static int doutbuf_make_room(uint8_t **doutbuf, size_t *doutbuf_len,
+	size_t len)
+{
+	uint8_t *tmp;
+	len+=EVP_MAX_BLOCK_LENGTH+1;
+	if(len<=*doutbuf_len)
+		return 0;
+	if(!(tmp=(uint8_t *)realloc_w(*doutbuf, len, __func__)))
+		return -1;
+	*doutbuf=tmp;
+	*doutbuf_len=len;
+	return 0;
+}
+
 int transfer_gzfile_inl(struct asfd *asfd,
 #ifdef HAVE_WIN32
 	struct sbuf *sb,
@@ -181,8 +213,8 @@ int transfer_gzfile_inl(struct asfd *asfd,
 	int ret=-1;
 	uint8_t out[ZCHUNK];
 	int doutlen=0;
-	//uint8_t doutbuf[1000+EVP_MAX_BLOCK_LENGTH];
-	uint8_t doutbuf[ZCHUNK-EVP_MAX_BLOCK_LENGTH];
+	uint8_t *doutbuf=NULL;
+	size_t doutbuf_len=0;
 	struct iobuf *rbuf=asfd->rbuf;
 
 	z_stream zstrm;
@@ -235,6 +267,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 				enc_ctx=NULL;
 			}
 			inflateEnd(&zstrm);
+			free_v((void **)&doutbuf);
 			return -1;
 		}
 		(*rcvd)+=rbuf->len;
@@ -276,6 +309,12 @@ int transfer_gzfile_inl(struct asfd *asfd,
 					  }
 					  else 
 */
+					  if(doutbuf_make_room(&doutbuf,
+						&doutbuf_len, rbuf->len))
+					  {
+						quit++; ret=-1;
+						break;
+					  }
 					  if(!EVP_CipherUpdate(enc_ctx,
 						doutbuf, &doutlen,
 						(uint8_t *)rbuf->buf,
@@ -310,6 +349,12 @@ int transfer_gzfile_inl(struct asfd *asfd,
 			case CMD_END_FILE: // finish up
 				if(enc_ctx)
 				{
+					if(doutbuf_make_room(&doutbuf,
+						&doutbuf_len, 0))
+					{
+						ret=-1; quit++;
+						break;
+					}
 					if(!EVP_CipherFinal_ex(enc_ctx,
 						doutbuf, &doutlen))
 					{
@@ -369,6 +414,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 		enc_ctx=NULL;
 	}
 
+	free_v((void **)&doutbuf);
 	iobuf_free_content(rbuf);
 	if(ret) logp("transfer file returning: %d\n", ret);
 	return ret;
@@ -151,6 +151,14 @@ rs_result rs_infilebuf_fill(__attribute__ ((unused)) rs_job_t *job,
 		switch(rbuf->cmd)
 		{
 			case CMD_APPEND:
+				if(rbuf->len>fb->buf_len)
+				{
+					logp("rbuf->len > fb->buf_len (%lu > %lu) in %s\n",
+						(unsigned long)rbuf->len,
+						(unsigned long)fb->buf_len,
+						__func__);
+					return RS_IO_ERROR;
+				}
 				memcpy(fb->buf, rbuf->buf, rbuf->len);
 				len=rbuf->len;
 				break;
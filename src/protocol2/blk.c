@@ -96,9 +96,18 @@ int blk_fingerprint_is_hook(struct blk *blk)
 //#define ETOH	be64toh
 //#define HTOE	htobe64
 
+// The buffer may be a view into the middle of a read buffer, so it is not
+// necessarily aligned for a uint64_t.
+static uint64_t get_uint64(const char *buf)
+{
+	uint64_t val;
+	memcpy(&val, buf, sizeof(val));
+	return ETOH(val);
+}
+
 static void set_fingerprint(struct blk *blk, struct iobuf *iobuf)
 {
-	blk->fingerprint=ETOH(*(uint64_t *)iobuf->buf);
+	blk->fingerprint=get_uint64(iobuf->buf);
 }
 
 static void set_sig(struct blk *blk, struct iobuf *iobuf)
@@ -110,7 +119,7 @@ static void set_sig(struct blk *blk, struct iobuf *iobuf)
 
 static void set_savepath(struct blk *blk, struct iobuf *iobuf, size_t offset)
 {
-	blk->savepath=ETOH(*(uint64_t *)(iobuf->buf+offset));
+	blk->savepath=get_uint64(iobuf->buf+offset);
 }
 
 int blk_set_from_iobuf_sig(struct blk *blk, struct iobuf *iobuf)
@@ -172,8 +181,8 @@ int blk_set_from_iobuf_index_and_savepath(struct blk *blk, struct iobuf *iobuf)
 			(unsigned long)iobuf->len);
 		return -1;
 	}
-	blk->index=ETOH(*(uint64_t *)iobuf->buf);
-	blk->savepath=ETOH(*(uint64_t *)(iobuf->buf+8));
+	blk->index=get_uint64(iobuf->buf);
+	blk->savepath=get_uint64(iobuf->buf+8);
 	return 0;
 }
 
@@ -186,13 +195,15 @@ int blk_set_from_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf)
 			(unsigned long)sizeof(blk->index));
 		return -1;
 	}
-	blk->index=ETOH(*(uint64_t *)iobuf->buf);
+	blk->index=get_uint64(iobuf->buf);
 	return 0;
 }
 
+// These leave the iobuf pointing at a buffer that each thread has its own
+// copy of, so it is only good until the next call from the same thread.
 void blk_to_iobuf_sig(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[24]; uint64_t v[3]; } buf;
+	static THREAD_LOCAL union { char c[24]; uint64_t v[3]; } buf;
 	buf.v[0]=HTOE(blk->fingerprint);
 	memcpy(&buf.c[8], blk->md5sum, 8);
 	memcpy(&buf.c[16], blk->md5sum+8, 8);
@@ -201,7 +212,7 @@ void blk_to_iobuf_sig(struct blk *blk, struct iobuf *iobuf)
 
 void blk_to_iobuf_sig_and_savepath(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[32]; uint64_t v[4]; } buf;
+	static THREAD_LOCAL union { char c[32]; uint64_t v[4]; } buf;
 	buf.v[0]=HTOE(blk->fingerprint);
 	memcpy(&buf.c[8], blk->md5sum, 8);
 	memcpy(&buf.c[16], blk->md5sum+8, 8);
@@ -211,7 +222,7 @@ void blk_to_iobuf_sig_and_savepath(struct blk *blk, struct iobuf *iobuf)
 
 static void to_iobuf_uint64(struct iobuf *iobuf, enum cmd cmd, uint64_t val)
 {
-	static union { char c[8]; uint64_t v; } buf;
+	static THREAD_LOCAL union { char c[8]; uint64_t v; } buf;
 	buf.v=HTOE(val);
 	iobuf_set(iobuf, cmd, buf.c, sizeof(buf));
 }
@@ -228,7 +239,7 @@ void blk_to_iobuf_savepath(struct blk *blk, struct iobuf *iobuf)
 
 void blk_to_iobuf_index_and_savepath(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[16]; uint64_t v[2]; } buf;
+	static THREAD_LOCAL union { char c[16]; uint64_t v[2]; } buf;
 	buf.v[0]=HTOE(blk->index);
 	buf.v[1]=HTOE(blk->savepath);
 	iobuf_set(iobuf, CMD_SIG, buf.c, sizeof(buf));
@@ -241,7 +252,25 @@ void blk_to_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf)
 
 int to_fzp_fingerprint(struct fzp *fzp, uint64_t fingerprint)
 {
-	static struct iobuf wbuf;
+	struct iobuf wbuf;
 	to_iobuf_uint64(&wbuf, CMD_FINGERPRINT, fingerprint);
 	return iobuf_send_msg_fzp(&wbuf, fzp);
 }
+
+// Write the signature and save path as a fixed width CMD_SIG_BIN record,
+// which is quicker to write and to read back than a CMD_SIG message.
+int to_fzp_sig_and_savepath(struct fzp *fzp, struct blk *blk)
+{
+	char rec[1+IOBUF_SIG_BIN_LEN];
+	struct iobuf wbuf;
+	blk_to_iobuf_sig_and_savepath(blk, &wbuf);
+	rec[0]=CMD_SIG_BIN;
+	memcpy(rec+1, wbuf.buf, IOBUF_SIG_BIN_LEN);
+	if(fzp_write(fzp, rec, sizeof(rec))!=sizeof(rec))
+	{
+		logp("Unable to write signature to file: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
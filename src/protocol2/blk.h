@@ -36,7 +36,7 @@ struct blk
 	uint8_t got;				// 1
 	uint8_t requested;			// 1
 	uint8_t got_save_path;			// 1
-	uint8_t pad;				// 1
+	uint8_t got_md5sum;			// 1
 	uint32_t length;			// 4
 	uint64_t fingerprint;			// 8
 	uint8_t md5sum[MD5_DIGEST_LENGTH];	// 16
@@ -74,5 +74,6 @@ extern void blk_to_iobuf_index_and_savepath(struct blk *blk,
 extern void blk_to_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf);
 
 extern int to_fzp_fingerprint(struct fzp *fzp, uint64_t fingerprint);
+extern int to_fzp_sig_and_savepath(struct fzp *fzp, struct blk *blk);
 
 #endif
@@ -15,10 +15,29 @@ static char *gbuf_end=NULL;
 static struct rconf rconf;
 static struct win *win=NULL; // Rabin sliding window.
 static int first=0;
+static uint64_t gear=0; // Gear rolling hash.
+static uint64_t gear_table[256];
+
+// The table has to be the same everywhere, otherwise the block boundaries
+// will not match and nothing will deduplicate. So, fill it from a fixed seed.
+static void gear_table_init(void)
+{
+	int i;
+	uint64_t x=0x6275727032ULL;
+	for(i=0; i<256; i++)
+	{
+		// splitmix64
+		uint64_t z=(x+=0x9E3779B97F4A7C15ULL);
+		z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+		z=(z^(z>>27))*0x94D049BB133111EBULL;
+		gear_table[i]=z^(z>>31);
+	}
+}
 
 int blks_generate_init(void)
 {
 	rconf_init(&rconf);
+	gear_table_init();
 	if(!(win=win_alloc(&rconf))
 	  || !(gbuf=(char *)malloc_w(rconf.blk_max, __func__)))
 		return -1;
@@ -27,6 +46,14 @@ int blks_generate_init(void)
 	return 0;
 }
 
+void blks_generate_set_chunker(enum chunker chunker)
+{
+	if(chunker==CHUNKER_GEAR)
+		rconf.chunker=CHUNKER_GEAR;
+	else
+		rconf.chunker=CHUNKER_RABIN;
+}
+
 void blks_generate_free(void)
 {
 	free_w(&gbuf);
@@ -34,9 +61,28 @@ void blks_generate_free(void)
 	win_free(&win);
 }
 
+// The same as doing 'fingerprint=fingerprint*prime+c' for each byte, but
+// with less of a dependency chain between iterations.
+static uint64_t fingerprint_update(uint64_t fingerprint,
+	const unsigned char *data, size_t length)
+{
+	const uint64_t p1=rconf.prime;
+	const uint64_t p2=p1*p1;
+	const uint64_t p3=p2*p1;
+	const uint64_t p4=p2*p2;
+	const unsigned char *end=data+length;
+
+	for(; data+4<=end; data+=4)
+		fingerprint=fingerprint*p4
+			+ data[0]*p3 + data[1]*p2 + data[2]*p1 + data[3];
+	for(; data<end; data++)
+		fingerprint=fingerprint*p1 + *data;
+	return fingerprint;
+}
+
 // This is where the magic happens.
 // Return 1 for got a block, 0 for no block got.
-static int blk_read(void)
+static int blk_read_rabin(void)
 {
 	unsigned char c;
 
@@ -68,8 +114,70 @@ static int blk_read(void)
 	return 0;
 }
 
+// Gear/FastCDC style chunking. Nothing before blk_min can be a boundary, so
+// skip straight past it, then roll the gear hash over each byte, with a
+// harder boundary condition before blk_avg than after it.
+// Return 1 for got a block, 0 for no block got.
+static int blk_read_gear(void)
+{
+	int got=0;
+	uint32_t i;
+	uint32_t n;
+	uint32_t len;
+	uint32_t skip=0;
+	const unsigned char *cp=(const unsigned char *)gcp;
+
+	n=rconf.blk_max-blk->length;
+	if(n>(uint32_t)(gbuf_end-gcp))
+		n=(uint32_t)(gbuf_end-gcp);
+	len=blk->length;
+
+	if(len<rconf.blk_min)
+	{
+		skip=rconf.blk_min-len;
+		if(skip>n)
+			skip=n;
+	}
+
+	for(i=skip; i<n && len+i<rconf.blk_avg; i++)
+	{
+		gear=(gear<<1)+gear_table[cp[i]];
+		if(!(gear&rconf.gear_mask_s))
+		{
+			i++;
+			got=1;
+			goto end;
+		}
+	}
+	for(; i<n; i++)
+	{
+		gear=(gear<<1)+gear_table[cp[i]];
+		if(!(gear&rconf.gear_mask_l))
+		{
+			i++;
+			got=1;
+			goto end;
+		}
+	}
+end:
+	memcpy(blk->data+blk->length, gcp, i);
+	blk->fingerprint=fingerprint_update(blk->fingerprint, cp, i);
+	blk->length+=i;
+	gcp+=i;
+
+	return got || blk->length==rconf.blk_max;
+}
+
+static int blk_read(void)
+{
+	if(rconf.chunker==CHUNKER_GEAR)
+		return blk_read_gear();
+	return blk_read_rabin();
+}
+
 static void win_reset(void)
 {
+	gear=0;
 	win->checksum=0;
 	win->pos=0;
 	memset(win->data, 0, rconf.win_size);
@@ -164,31 +272,12 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	return 1;
 }
 
+// The fingerprint does not depend on which chunker chose the block
+// boundaries, so blocks from either chunker can be verified here.
 int blk_verify_fingerprint(uint64_t fingerprint, char *data, size_t length)
 {
-	win_reset();
-
-	memcpy(gbuf, data, length);
-	gbuf_end=gbuf+length;
-	gcp=gbuf;
-	blk_free(&blk);
-	if(!blk && !(blk=blk_alloc())) return -1;
-	blk->length=0;
-	blk->fingerprint=0;
-
-	// FIX THIS: blk_read should return 1 when it has a block.
-	// But, if the block is too small (because the end of the file
-	// happened), it returns 0, and blks_generate treats it as having found
-	// a final block.
-	// So, here the return of blk_read is ignored and we look at the
-	// position of gcp instead.
-	blk_read();
-//printf("%d %d\n", blk->length, length);
-//printf("%016"PRIX64" %016"PRIX64" ",
-//	blk->fingerprint, fingerprint);
-//printf("%s\n", blk->fingerprint==fingerprint?"yes":"no");
-	if(gcp==gbuf_end
-	  && blk->fingerprint==fingerprint)
-		return 1;
-	return 0;
+	if(length>rconf.blk_max)
+		return 0;
+	return fingerprint_update(0,
+		(const unsigned char *)data, length)==fingerprint;
 }
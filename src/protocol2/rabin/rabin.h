@@ -1,12 +1,15 @@
 #ifndef __RABIN_H
 #define __RABIN_H
 
+#include "rconf.h"
+
 struct asfd;
 struct blist;
 struct conf;
 struct sbuf;
 
 extern int blks_generate_init(void);
+extern void blks_generate_set_chunker(enum chunker chunker);
 extern void blks_generate_free(void);
 extern int blks_generate(struct sbuf *sb, struct blist *blist,
 	int just_opened);
@@ -15,6 +15,8 @@ static uint64_t get_multiplier(uint32_t win, uint64_t prime)
 // Hey you. Probably best not fuck with these.
 void rconf_init(struct rconf *rconf)
 {
+	rconf->chunker=CHUNKER_RABIN;
+
 	rconf->prime=3;		// Not configurable.
 
 	rconf->win_min=17;	// Not configurable.
@@ -26,4 +28,30 @@ void rconf_init(struct rconf *rconf)
 	rconf->blk_max=RABIN_MAX; // Maximum block size.
 
 	rconf->multiplier=get_multiplier(rconf->win_size, rconf->prime);
+
+	// Top bits of the gear hash depend on the most input bytes.
+	// 12 bits gives 1/4096 chance of a boundary per byte, 10 bits 1/1024.
+	rconf->gear_mask_s=0xFFF0000000000000ULL;
+	rconf->gear_mask_l=0xFFC0000000000000ULL;
+}
+
+enum chunker str_to_chunker(const char *str)
+{
+	if(!str || !strcmp(str, "rabin"))
+		return CHUNKER_RABIN;
+	if(!strcmp(str, "gear"))
+		return CHUNKER_GEAR;
+	logp("Unknown chunker setting: %s\n", str);
+	return CHUNKER_UNSET;
+}
+
+const char *chunker_to_str(enum chunker c)
+{
+	switch(c)
+	{
+		case CHUNKER_UNSET: return "unset";
+		case CHUNKER_RABIN: return "rabin";
+		case CHUNKER_GEAR: return "gear";
+		default: return "unknown";
+	}
 }
@@ -7,8 +7,20 @@
 
 #include "../../burp.h"
 
+// How block boundaries are chosen. The block fingerprints are the same
+// whichever is used, so blocks from either can deduplicate against each
+// other.
+enum chunker
+{
+	CHUNKER_UNSET=0,
+	CHUNKER_RABIN,
+	CHUNKER_GEAR
+};
+
 struct rconf
 {
+	enum chunker chunker;
+
 	uint64_t prime;
 
 	uint32_t win_min;
@@ -20,9 +32,17 @@ struct rconf
 	uint32_t blk_max;
 
 	uint64_t multiplier;
+
+	// Gear chunker boundary masks. The harder mask is used before
+	// blk_avg, the easier one after it, which normalises the block sizes.
+	uint64_t gear_mask_s;
+	uint64_t gear_mask_l;
 };
 
 extern void rconf_init(struct rconf *rconf);
 extern int rconf_check(struct rconf *rconf);
 
+extern enum chunker str_to_chunker(const char *str);
+extern const char *chunker_to_str(enum chunker c);
+
 #endif
@@ -0,0 +1,281 @@
+#include "burp.h"
+#include "alloc.h"
+#include "asfd.h"
+#include "conf.h"
+#include "log.h"
+#include "ratelimit.h"
+#include "strlist.h"
+
+// Network write rate limiting.
+// Each bucket remembers the time at which it would be empty if the bytes
+// written so far had gone out at exactly the configured rate. A writer may
+// get up to RATELIMIT_BURST_USEC ahead of that. Instead of sleeping, the
+// async loop asks how long it is until the next write can go ahead, and uses
+// that as its select()/epoll_wait() timeout, so reads carry on while the
+// writes are held back.
+// The global bucket is in memory from calloc_shared_w(), so that all of the
+// forked children draw from it. The bucket for a connection can be moved
+// there too, so that the extra streams of a backup, which are forked
+// children on the client, draw from the same one.
+
+// If a bucket is further ahead of the clock than this, the clock must have
+// gone back in time.
+#define RATELIMIT_CLOCK_SLACK_USEC	(60*1000000ULL)
+
+uint64_t ratelimit_clock(void)
+{
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	if(!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+#endif
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+static uint64_t tat_load(struct rlbucket *bucket)
+{
+	if(bucket->shared)
+		return __sync_fetch_and_add(&bucket->tat, 0);
+	return bucket->tat;
+}
+
+static uint64_t tat_from(uint64_t tat, uint64_t now)
+{
+	if(tat<now
+	  || tat>now+RATELIMIT_BURST_USEC+RATELIMIT_CLOCK_SLACK_USEC)
+		return now;
+	return tat;
+}
+
+struct rlbucket *rlbucket_alloc_shared(float rate)
+{
+	struct rlbucket *bucket;
+	if(!(bucket=(struct rlbucket *)
+		calloc_shared_w(sizeof(struct rlbucket), __func__)))
+			return NULL;
+	bucket->rate=rate;
+	bucket->shared=1;
+	return bucket;
+}
+
+void rlbucket_free_shared(struct rlbucket **bucket)
+{
+	free_shared_v((void **)bucket, sizeof(struct rlbucket));
+}
+
+// How many bytes can be written now. Zero if the writer has to wait.
+size_t rlbucket_quota(struct rlbucket *bucket, uint64_t now)
+{
+	double bytes;
+	uint64_t tat;
+	if(!bucket->rate) return SIZE_MAX;
+	tat=tat_from(tat_load(bucket), now);
+	if(tat>now+RATELIMIT_BURST_USEC/2) return 0;
+	bytes=(double)(now+RATELIMIT_BURST_USEC-tat)*bucket->rate/1000000;
+	if(bytes<1) return 1;
+	return (size_t)bytes;
+}
+
+// How many microseconds until rlbucket_quota() is non-zero.
+uint64_t rlbucket_wait(struct rlbucket *bucket, uint64_t now)
+{
+	uint64_t tat;
+	if(!bucket->rate) return 0;
+	tat=tat_from(tat_load(bucket), now);
+	if(tat<=now+RATELIMIT_BURST_USEC/2) return 0;
+	return tat-(now+RATELIMIT_BURST_USEC/2);
+}
+
+void rlbucket_consume(struct rlbucket *bucket, uint64_t now, size_t bytes)
+{
+	uint64_t tat;
+	uint64_t cost;
+	if(!bucket->rate) return;
+	cost=(uint64_t)((double)bytes*1000000/bucket->rate);
+	if(!bucket->shared)
+	{
+		bucket->tat=tat_from(bucket->tat, now)+cost;
+		return;
+	}
+	do {
+		tat=tat_load(bucket);
+	} while(!__sync_bool_compare_and_swap(&bucket->tat,
+		tat, tat_from(tat, now)+cost));
+}
+
+static int contains(const char *str, const char *word)
+{
+	size_t len=strlen(word);
+	for(; *str; str++)
+		if(!strncasecmp(str, word, len))
+			return 1;
+	return 0;
+}
+
+// Schedule entries look like '<Mb/s>:<timeband>', where the timeband is in
+// the same form as the timer_arg ones. For example,
+// '2:Mon,Tue,Wed,Thu,Fri,09,10,11,12,13,14,15,16,17'.
+static int schedule_entry(const char *entry, float *rate, const char **band)
+{
+	double r;
+	char *cp=NULL;
+	r=strtod(entry, &cp);
+	if(cp==entry || *cp!=':' || r<0)
+	{
+		logp("Bad ratelimit_schedule entry: %s\n", entry);
+		return -1;
+	}
+	// User is specifying Mega bits per second.
+	*rate=(float)((r*1024*1024)/8);
+	*band=cp+1;
+	return 0;
+}
+
+// The first entry that matches wins. Otherwise, the rate is left as it is.
+int ratelimit_schedule_rate(struct strlist *schedule, float rate,
+	const char *day, const char *hour, float *result)
+{
+	float r;
+	const char *band;
+	struct strlist *s;
+
+	*result=rate;
+	for(s=schedule; s; s=s->next)
+	{
+		if(schedule_entry(s->path, &r, &band))
+			return -1;
+		if(strcasecmp(band, "always")
+		  && (!contains(band, day) || !contains(band, hour)))
+			continue;
+		*result=r;
+		break;
+	}
+	return 0;
+}
+
+static struct rlbucket *conn_bucket(struct ratelimit *rl)
+{
+	return rl->shared?rl->shared:&rl->bucket;
+}
+
+static void schedule_check(struct ratelimit *rl)
+{
+	float rate;
+	char day[4]="";
+	char hour[3]="";
+	const struct tm *ctm;
+	time_t now=time(NULL);
+
+	if(!rl->schedule
+	  || (rl->schedule_checked && now/60==rl->schedule_checked/60))
+		return;
+	rl->schedule_checked=now;
+	ctm=localtime(&now);
+	strftime(day, sizeof(day), "%a", ctm);
+	strftime(hour, sizeof(hour), "%H", ctm);
+	if(ratelimit_schedule_rate(rl->schedule, rl->rate, day, hour, &rate)
+	  || rate==conn_bucket(rl)->rate)
+		return;
+	logp("Changing ratelimit to %.2f Mb/s\n", (rate*8)/(1024*1024));
+	conn_bucket(rl)->rate=rate;
+}
+
+struct ratelimit *ratelimit_alloc(float rate,
+	struct strlist *schedule, struct rlbucket *global)
+{
+	float r;
+	const char *band;
+	struct strlist *s;
+	struct ratelimit *rl;
+
+	if(!(rl=(struct ratelimit *)
+		calloc_w(1, sizeof(struct ratelimit), __func__)))
+			return NULL;
+	rl->rate=rate;
+	rl->bucket.rate=rate;
+	rl->global=global;
+	for(s=schedule; s; s=s->next)
+	{
+		// Catch bad entries now, rather than each time it is checked.
+		if(schedule_entry(s->path, &r, &band)
+		  || strlist_add(&rl->schedule, s->path, 0))
+			goto error;
+	}
+	schedule_check(rl);
+	return rl;
+error:
+	ratelimit_free(&rl);
+	return NULL;
+}
+
+void ratelimit_free(struct ratelimit **rl)
+{
+	if(!rl || !*rl) return;
+	strlists_free(&(*rl)->schedule);
+	rlbucket_free_shared(&(*rl)->shared);
+	free_v((void **)rl);
+}
+
+// Move the bucket for this connection into shared memory. Children forked
+// after this, and given this ratelimit, draw from the same bucket.
+int ratelimit_share(struct ratelimit *rl)
+{
+	if(rl->shared)
+		return 0;
+	if(!(rl->shared=rlbucket_alloc_shared(rl->bucket.rate)))
+		return -1;
+	rl->shared->tat=rl->bucket.tat;
+	return 0;
+}
+
+size_t ratelimit_quota(struct ratelimit *rl, size_t want)
+{
+	size_t quota;
+	uint64_t now=ratelimit_clock();
+	schedule_check(rl);
+	if((quota=rlbucket_quota(conn_bucket(rl), now))<want)
+		want=quota;
+	if(rl->global
+	  && (quota=rlbucket_quota(rl->global, now))<want)
+		want=quota;
+	return want;
+}
+
+uint64_t ratelimit_wait(struct ratelimit *rl)
+{
+	uint64_t wait;
+	uint64_t gwait;
+	uint64_t now=ratelimit_clock();
+	schedule_check(rl);
+	wait=rlbucket_wait(conn_bucket(rl), now);
+	if(rl->global
+	  && (gwait=rlbucket_wait(rl->global, now))>wait)
+		wait=gwait;
+	return wait;
+}
+
+void ratelimit_consume(struct ratelimit *rl, size_t bytes)
+{
+	uint64_t now=ratelimit_clock();
+	rlbucket_consume(conn_bucket(rl), now, bytes);
+	if(rl->global)
+		rlbucket_consume(rl->global, now, bytes);
+}
+
+int ratelimit_setup(struct asfd *asfd, struct conf **confs,
+	struct rlbucket *global)
+{
+	float rate=get_float(confs[OPT_RATELIMIT]);
+	struct strlist *schedule=get_strlist(confs[OPT_RATELIMIT_SCHEDULE]);
+
+	ratelimit_free(&asfd->rl);
+	if(global && !global->rate)
+		global=NULL;
+	if(!rate && !schedule && !global)
+		return 0;
+	if(!(asfd->rl=ratelimit_alloc(rate, schedule, global)))
+		return -1;
+	return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef _RATELIMIT_H
+#define _RATELIMIT_H
+
+struct asfd;
+struct conf;
+struct strlist;
+
+// How far ahead of the rate a writer is allowed to get, in microseconds.
+// Writes wait until at least half of this is available, so that they do not
+// get chopped up into tiny pieces.
+#define RATELIMIT_BURST_USEC	100000
+
+// A token bucket, kept as the time at which it will next be empty.
+struct rlbucket
+{
+	float rate; // Bytes per second. Zero means no limit.
+	uint64_t tat; // Microseconds.
+	uint8_t shared;
+};
+
+struct ratelimit
+{
+	struct rlbucket bucket; // For this connection.
+	struct rlbucket *shared; // Used instead of bucket, if set.
+	struct rlbucket *global; // Shared with other server children.
+	float rate; // For when no schedule entry matches.
+	struct strlist *schedule;
+	time_t schedule_checked;
+};
+
+extern uint64_t ratelimit_clock(void);
+
+extern struct rlbucket *rlbucket_alloc_shared(float rate);
+extern void rlbucket_free_shared(struct rlbucket **bucket);
+extern size_t rlbucket_quota(struct rlbucket *bucket, uint64_t now);
+extern uint64_t rlbucket_wait(struct rlbucket *bucket, uint64_t now);
+extern void rlbucket_consume(struct rlbucket *bucket,
+	uint64_t now, size_t bytes);
+
+extern int ratelimit_schedule_rate(struct strlist *schedule, float rate,
+	const char *day, const char *hour, float *result);
+
+extern struct ratelimit *ratelimit_alloc(float rate,
+	struct strlist *schedule, struct rlbucket *global);
+extern void ratelimit_free(struct ratelimit **rl);
+extern int ratelimit_share(struct ratelimit *rl);
+extern size_t ratelimit_quota(struct ratelimit *rl, size_t want);
+extern uint64_t ratelimit_wait(struct ratelimit *rl);
+extern void ratelimit_consume(struct ratelimit *rl, size_t bytes);
+
+extern int ratelimit_setup(struct asfd *asfd, struct conf **confs,
+	struct rlbucket *global);
+
+#endif
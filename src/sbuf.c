@@ -307,11 +307,35 @@ static enum parse_ret parse_cmd(struct sbuf *sb, struct asfd *asfd,
 	return PARSE_RET_ERROR;
 }
 
+// A binary signature record from a manifest. It has not been allocated,
+// so there is nothing to free afterwards.
+static enum parse_ret parse_sig_bin(char *sig, struct blk *blk)
+{
+#ifndef HAVE_WIN32
+	struct iobuf tmp;
+	// Just fill in the sig details, if the caller provided a pointer for
+	// one. Server only.
+	if(!blk) return PARSE_RET_NEED_MORE;
+	iobuf_set(&tmp, CMD_SIG, sig, IOBUF_SIG_BIN_LEN);
+	if(blk_set_from_iobuf_sig_and_savepath(blk, &tmp))
+		return PARSE_RET_ERROR;
+	blk->got_save_path=1;
+	return PARSE_RET_COMPLETE;
+#else
+	logp("Unexpected binary signature in %s\n", __func__);
+	return PARSE_RET_ERROR;
+#endif
+}
+
 static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 	struct blk *blk, struct cntr *cntr)
 {
-	static struct iobuf *rbuf;
-	static struct iobuf localrbuf;
+	// Nothing is kept here between calls, so that the champ chooser
+	// threads can all read manifests at once.
+	struct iobuf *rbuf;
+	struct iobuf localrbuf;
+	char sig[IOBUF_SIG_BIN_LEN];
+	enum parse_ret pr;
 	int ret=-1;
 
 	if(asfd) rbuf=asfd->rbuf;
@@ -326,8 +350,12 @@ static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 		iobuf_free_content(rbuf);
 		if(fzp)
 		{
-			if((ret=iobuf_fill_from_fzp(rbuf, fzp)))
+			if((ret=iobuf_fill_from_fzp_sig(rbuf, fzp, sig))==2)
+				pr=parse_sig_bin(sig, blk);
+			else if(ret)
 				goto end;
+			else
+				pr=parse_cmd(sb, asfd, rbuf, blk, cntr);
 		}
 		else
 		{
@@ -336,8 +364,9 @@ static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 				logp("error in async_read\n");
 				break;
 			}
+			pr=parse_cmd(sb, asfd, rbuf, blk, cntr);
 		}
-		switch(parse_cmd(sb, asfd, rbuf, blk, cntr))
+		switch(pr)
 		{
 			case PARSE_RET_NEED_MORE:
 				continue;
@@ -0,0 +1,240 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../asfd.h"
+#include "../async.h"
+#include "../cmd.h"
+#include "../conf.h"
+#include "../fsops.h"
+#include "../handy.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "../ratelimit.h"
+#include "sdirs.h"
+#include "backup_streams.h"
+
+#include <sys/un.h>
+
+// Protocol1 clients can send their phase2 data over more than one
+// connection. Each extra connection is handed to its own child by the main
+// server process, like any other connection. That child passes the frames
+// through a unix socket in the working directory to the child that is doing
+// the backup.
+
+#define BACKUP_STREAMS_SOCK	"streams.sock"
+
+// sun_path is short, so bind or connect from inside the directory.
+static int streams_sock(const char *dir, int listening)
+{
+	int fd=-1;
+	int cwd=-1;
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path),
+		"%s", BACKUP_STREAMS_SOCK);
+
+	if((cwd=open(".", O_RDONLY))<0)
+	{
+		logp("could not open current directory in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+	if(chdir(dir))
+	{
+		logp("could not chdir to %s in %s: %s\n",
+			dir, __func__, strerror(errno));
+		goto end;
+	}
+	if((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0)
+	{
+		logp("could not create unix socket in %s: %s\n",
+			__func__, strerror(errno));
+		goto end;
+	}
+	if(listening)
+	{
+		unlink(BACKUP_STREAMS_SOCK);
+		if(bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+		  || listen(fd, 5))
+		{
+			logp("could not listen on %s/%s: %s\n",
+				dir, BACKUP_STREAMS_SOCK, strerror(errno));
+			close_fd(&fd);
+		}
+	}
+	else if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		logp("could not connect to %s/%s: %s\n",
+			dir, BACKUP_STREAMS_SOCK, strerror(errno));
+		close_fd(&fd);
+	}
+end:
+	if(fchdir(cwd))
+	{
+		logp("could not change back directory in %s: %s\n",
+			__func__, strerror(errno));
+		close_fd(&fd);
+	}
+	close_fd(&cwd);
+	return fd;
+}
+
+int backup_streams_listen(const char *dir)
+{
+	return streams_sock(dir, 1);
+}
+
+void backup_streams_unlink(const char *dir)
+{
+	char *path=NULL;
+	if(!(path=prepend_s(dir, BACKUP_STREAMS_SOCK)))
+		return;
+	unlink(path);
+	free_w(&path);
+}
+
+// The extra connections have to give this back, so that they can only join
+// the backup that they were told about.
+int backup_streams_token(char *token, size_t len)
+{
+	size_t i;
+	uint8_t r[BACKUP_STREAMS_TOKEN_LEN/2];
+
+	if(len<sizeof(r)*2+1)
+	{
+		logp("token buffer too short in %s\n", __func__);
+		return -1;
+	}
+	if(!RAND_bytes(r, sizeof(r)))
+	{
+		logp("RAND_bytes() failed in %s\n", __func__);
+		return -1;
+	}
+	for(i=0; i<sizeof(r); i++)
+		snprintf(token+i*2, 3, "%02x", r[i]);
+	return 0;
+}
+
+// The files that each stream writes on its own, such as its changed
+// manifest, are the usual path with the stream number on the end.
+char *backup_streams_path(const char *path, int i)
+{
+	char tmp[16]="";
+	snprintf(tmp, sizeof(tmp), ".%d", i);
+	return prepend(path, tmp);
+}
+
+// The per-stream changed manifests are only merged at the end of phase2, so
+// a backup that was interrupted while they were around cannot be resumed.
+int backup_streams_interrupted(struct sdirs *sdirs)
+{
+	int ret=0;
+	char *path=NULL;
+	struct stat statp;
+
+	if(!(path=backup_streams_path(sdirs->changed, 0)))
+		return -1;
+	if(!lstat(path, &statp))
+		ret=1;
+	free_w(&path);
+	return ret;
+}
+
+// Returns 0 if the frame went, or if there is no room for it yet. In the
+// latter case it stays in rbuf, which stops any more reads on that side.
+static int pass_on(struct asfd *from, struct asfd *to)
+{
+	struct iobuf wbuf;
+
+	if(!from->rbuf->buf)
+		return 0;
+	iobuf_set(&wbuf, from->rbuf->cmd, from->rbuf->buf, from->rbuf->len);
+	switch(to->append_all_to_write_buffer(to, &wbuf))
+	{
+		case APPEND_OK:
+			iobuf_free_content(from->rbuf);
+			return 0;
+		case APPEND_BLOCKED:
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+static int relay(struct async *as, struct asfd *cfd, struct asfd *bfd)
+{
+	int finished=0;
+
+	while(1)
+	{
+		if(as->read_write(as))
+		{
+			logp("error in %s\n", __func__);
+			return -1;
+		}
+
+		if(cfd->rbuf->buf)
+		{
+			finished=cfd->rbuf->cmd==CMD_GEN
+			  && !strcmp(cfd->rbuf->buf, "okbackupphase2end");
+			if(pass_on(cfd, bfd))
+				return -1;
+			if(finished && !cfd->rbuf->buf)
+				break;
+		}
+		if(pass_on(bfd, cfd))
+			return -1;
+	}
+
+	// Neither side has anything more to say, and the client might hang up
+	// before the last of it has got to the backup child.
+	cfd->attempt_reads=0;
+	bfd->attempt_reads=0;
+	return asfd_flush_asio(bfd);
+}
+
+// Runs in the child that was given an extra connection from the client.
+int run_backup_stream(struct async *as, struct conf **cconfs)
+{
+	int fd=-1;
+	int ret=-1;
+	char msg[64]="";
+	const char *token;
+	struct asfd *cfd=as->asfd;
+	struct asfd *bfd=NULL;
+	struct sdirs *sdirs=NULL;
+
+	token=cfd->rbuf->buf+strlen("backupstream ");
+	if(strlen(token)!=BACKUP_STREAMS_TOKEN_LEN)
+	{
+		log_and_send(cfd, "bad backup stream token");
+		goto end;
+	}
+	snprintf(msg, sizeof(msg), "stream %s", token);
+	iobuf_free_content(cfd->rbuf);
+	// The child doing the backup limits what it sends down all of the
+	// streams at once, so there is no separate limit here.
+	ratelimit_free(&cfd->rl);
+
+	if(!(sdirs=sdirs_alloc())
+	  || sdirs_init_from_confs(sdirs, cconfs))
+		goto end;
+	if((fd=streams_sock(sdirs->working, 0))<0)
+	{
+		log_and_send(cfd, "could not join the backup");
+		goto end;
+	}
+	if(!(bfd=setup_asfd(as, "backup stream", &fd, /*port*/-1))
+	  || bfd->set_large_frames(bfd)
+	  || bfd->write_str(bfd, CMD_GEN, msg))
+		goto end;
+
+	logp("Joined the backup of %s\n", get_string(cconfs[OPT_CNAME]));
+	ret=relay(as, cfd, bfd);
+end:
+	close_fd(&fd);
+	sdirs_free(&sdirs);
+	return ret;
+}
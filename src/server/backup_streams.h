@@ -0,0 +1,17 @@
+#ifndef _BACKUP_STREAMS_SERVER_H
+#define _BACKUP_STREAMS_SERVER_H
+
+#define BACKUP_STREAMS_TOKEN_LEN	32
+// How long to keep waiting for the extra streams, in seconds, once there are
+// no more files to hand out.
+#define BACKUP_STREAMS_JOIN_TIMEOUT	60
+
+extern int backup_streams_listen(const char *dir);
+extern void backup_streams_unlink(const char *dir);
+extern int backup_streams_token(char *token, size_t len);
+extern char *backup_streams_path(const char *path, int i);
+extern int backup_streams_interrupted(struct sdirs *sdirs);
+
+extern int run_backup_stream(struct async *as, struct conf **cconfs);
+
+#endif
@@ -11,6 +11,7 @@
 #include "../log.h"
 #include "../prepend.h"
 #include "../run_script.h"
+#include "backup_streams.h"
 #include "extra_comms.h"
 #include "monitor/status_server.h"
 #include "run_action.h"
@@ -184,6 +185,15 @@ int child(struct async *as, int is_status_server,
 		goto end;
 	}
 
+	// An extra connection for a protocol1 backup just joins the backup
+	// that is already running, which is the one that runs the scripts.
+	if(as->asfd->rbuf->cmd==CMD_GEN
+	  && !strncmp_w(as->asfd->rbuf->buf, "backupstream "))
+	{
+		ret=run_backup_stream(as, cconfs);
+		goto end;
+	}
+
 	ret=0;
 
 	s_script_pre=get_string(cconfs[OPT_S_SCRIPT_PRE]);
@@ -27,6 +27,8 @@ struct dpth
 	// Whether we need to lock another data file.
 	uint8_t need_data_lock;
 	int max_storage_subdirs;
+	// The zstd level for protocol2 blocks, or 0 to store them as they are.
+	int compression;
 	// Currently open data file. Only one is open at a time, while many
 	// may be locked.
 	struct fzp *fzp;
@@ -12,6 +12,7 @@
 #include "../iobuf.h"
 #include "../log.h"
 #include "../prepend.h"
+#include "../protocol2/rabin/rconf.h"
 #include "autoupgrade.h"
 #include "extra_comms.h"
 
@@ -108,7 +109,7 @@ struct vers
 };
 
 static int send_features(struct asfd *asfd, struct conf **cconfs,
-	struct vers *vers)
+	struct vers *vers, int backup_streams_max)
 {
 	int ret=-1;
 	char *feat=NULL;
@@ -174,6 +175,27 @@ static int send_features(struct asfd *asfd, struct conf **cconfs,
 		goto end;
 #endif
 
+	/* Tell protocol2 clients to use the gear chunker. Clients that do
+	   not know about it will just carry on with rabin. */
+	if(str_to_chunker(get_string(cconfs[OPT_CHUNKER]))==CHUNKER_GEAR
+	  && append_to_feat(&feat, "chunker=gear:"))
+		goto end;
+
+	/* Frames with a binary 32 bit length, so that bulk data can go in
+	   bigger pieces. */
+	if(append_to_feat(&feat, "large_frames:"))
+		goto end;
+
+	/* Protocol1 clients can send their phase2 data over more than one
+	   connection. Tell them the most that they can have. */
+	if(protocol!=PROTO_2 && backup_streams_max>1)
+	{
+		char b[32]="";
+		snprintf(b, sizeof(b), "backup_streams=%d:", backup_streams_max);
+		if(append_to_feat(&feat, b))
+			goto end;
+	}
+
 	//printf("feat: %s\n", feat);
 
 	if(asfd->write_str(asfd, CMD_GEN, feat))
@@ -213,9 +235,11 @@ end:
 
 static int extra_comms_read(struct async *as,
 	struct vers *vers, int *srestore,
-	char **incexc, struct conf **globalcs, struct conf **cconfs)
+	char **incexc, struct conf **globalcs, struct conf **cconfs,
+	int backup_streams_max)
 {
 	int ret=-1;
+	int large_frames=0;
 	struct asfd *asfd;
 	struct iobuf *rbuf;
 	asfd=as->asfd;
@@ -236,6 +260,13 @@ static int extra_comms_read(struct async *as,
 		{
 			if(asfd->write_str(asfd, CMD_GEN, "extra_comms_end ok"))
 				goto end;
+			// The client switches after reading the 'ok'.
+			if(large_frames)
+			{
+				if(asfd->set_large_frames(asfd))
+					goto end;
+				logp("Client is using large frames\n");
+			}
 			break;
 		}
 		else if(!strncmp_w(rbuf->buf, "autoupgrade:"))
@@ -401,6 +432,29 @@ static int extra_comms_read(struct async *as,
 			goto end;
 #endif
 		}
+		else if(!strncmp_w(rbuf->buf, "chunker=gear"))
+		{
+			logp("Client is using chunker=gear\n");
+		}
+		else if(!strcmp(rbuf->buf, "large_frames"))
+		{
+			large_frames=1;
+		}
+		else if(!strncmp_w(rbuf->buf, "backup_streams="))
+		{
+			int backup_streams;
+			backup_streams=atoi(rbuf->buf+strlen("backup_streams="));
+			if(backup_streams<1 || backup_streams>backup_streams_max)
+			{
+				char msg[128]="";
+				snprintf(msg, sizeof(msg), "Client is trying to use backup_streams=%d but server allows %d\n", backup_streams, backup_streams_max);
+				log_and_send(asfd, msg);
+				goto end;
+			}
+			set_int(cconfs[OPT_BACKUP_STREAMS], backup_streams);
+			logp("Client is using backup_streams=%d\n",
+				backup_streams);
+		}
 		else if(!strncmp_w(rbuf->buf, "msg"))
 		{
 			set_int(cconfs[OPT_MESSAGE], 1);
@@ -439,6 +493,11 @@ int extra_comms(struct async *as,
 	asfd=as->asfd;
 	//char *restorepath=NULL;
 	const char *peer_version=NULL;
+	int backup_streams_max=get_int(cconfs[OPT_BACKUP_STREAMS]);
+
+	// From here on, this is the number of backup streams that the client
+	// asked for, which is one unless it says otherwise.
+	set_int(cconfs[OPT_BACKUP_STREAMS], 1);
 
 	if(vers_init(&vers, cconfs))
 		goto error;
@@ -473,12 +532,13 @@ int extra_comms(struct async *as,
 	}
 	else
 	{
-		if(send_features(asfd, cconfs, &vers))
+		if(send_features(asfd, cconfs, &vers, backup_streams_max))
 			goto error;
 	}
 
-	if(extra_comms_read(as, &vers, srestore, incexc, confs, cconfs))
-		goto error;
+	if(extra_comms_read(as, &vers, srestore, incexc, confs, cconfs,
+		backup_streams_max))
+			goto error;
 
 	peer_version=get_string(cconfs[OPT_PEER_VERSION]);
 
@@ -10,10 +10,12 @@
 #include "../iobuf.h"
 #include "../lock.h"
 #include "../log.h"
+#include "../ratelimit.h"
 #include "auth.h"
 #include "ca.h"
 #include "child.h"
 #include "main.h"
+#include "prefork.h"
 #include "monitor/status_server.h"
 
 // FIX THIS: Should be able to configure multiple addresses and ports.
@@ -24,6 +26,9 @@ static int hupreload_logged=0;
 static int gentleshutdown=0;
 static int gentleshutdown_logged=0;
 
+// Shared by all the children, for the ratelimit_global option.
+static struct rlbucket *rlglobal=NULL;
+
 // These will also be used as the exit codes of the program and are therefore
 // unsigned integers.
 // Remember to update the man page if you update these.
@@ -65,6 +70,7 @@ static void chld_check_for_exiting(struct async *mainas)
 			asfd_free(&asfd);
 			break;
 		}
+		prefork_reaped(p);
 	}
 }
 
@@ -92,7 +98,8 @@ static void log_listen_socket(const char *desc,
 }
 
 static int init_listen_socket(const char *address, struct strlist *port,
-	struct async *mainas, enum asfd_fdtype fdtype, const char *desc)
+	struct async *mainas, enum asfd_fdtype fdtype, const char *desc,
+	int bufsize)
 {
 	int i;
 	int fd=-1;
@@ -141,6 +148,10 @@ static int init_listen_socket(const char *address, struct strlist *port,
 		}
 #endif
 		reuseaddr(fd);
+		// Accepted connections get the buffer sizes of the listening
+		// socket.
+		if(set_network_buffers(fd, bufsize))
+			continue;
 		if(bind(fd, rp->ai_addr, rp->ai_addrlen))
 		{
 			logp("unable to bind socket on port %s: %s\n",
@@ -180,7 +191,8 @@ static int init_listen_socket(const char *address, struct strlist *port,
 }
 
 static int init_listen_sockets(const char *address, struct strlist *ports,
-	struct async *mainas, enum asfd_fdtype fdtype, const char *desc)
+	struct async *mainas, enum asfd_fdtype fdtype, const char *desc,
+	int bufsize)
 {
 	struct strlist *p;
 	if(!strcmp(address, "localhost")) {
@@ -190,14 +202,16 @@ static int init_listen_sockets(const char *address, struct strlist *ports,
 		address="::1";
 		for(p=ports; p; p=p->next)
 			// Ignore errors for IPv6 attempt.
-			init_listen_socket(address, p, mainas, fdtype, desc);
+			init_listen_socket(address, p, mainas, fdtype, desc,
+				bufsize);
 #endif
 		address="127.0.0.1";
 	}
 	for(p=ports; p; p=p->next)
 	{
-		if(init_listen_socket(address, p, mainas, fdtype, desc))
-			return -1;
+		if(init_listen_socket(address, p, mainas, fdtype, desc,
+			bufsize))
+				return -1;
 	}
 	return 0;
 }
@@ -211,37 +225,55 @@ void setup_signals(void)
 	setup_signal(SIGUSR2, usr2handler);
 }
 
-static int run_child(int *cfd, SSL_CTX *ctx, struct sockaddr_storage *addr,
-	int status_wfd, int status_rfd, const char *conffile, int forking)
+// Reload global config, in case things have changed. This means that
+// the server does not need to be restarted for most conf changes.
+static int child_confs_load(struct conf ***confs, struct conf ***cconfs,
+	const char *conffile, int forking)
+{
+	if(!(*confs=confs_alloc())
+	  || !(*cconfs=confs_alloc()))
+		return -1;
+	confs_init(*confs);
+	confs_init(*cconfs);
+	if(conf_load_global_only(conffile, *confs))
+		return -1;
+
+	// Hack to keep forking turned off if it was specified as off on the
+	// command line.
+	if(!forking) set_int((*confs)[OPT_FORK], 0);
+	return 0;
+}
+
+static void child_confs_free(struct conf ***confs, struct conf ***cconfs)
+{
+	if(*confs)
+	{
+		set_cntr((*confs)[OPT_CNTR], NULL);
+		confs_free(confs);
+	}
+	if(*cconfs)
+	{
+		set_cntr((*cconfs)[OPT_CNTR], NULL);
+		confs_free(cconfs);
+	}
+}
+
+static int run_child_with_confs(int *cfd, SSL_CTX *ctx,
+	struct sockaddr_storage *addr, int status_wfd, int status_rfd,
+	struct conf **confs, struct conf **cconfs)
 {
 	int ret=-1;
 	int ca_ret=0;
 	SSL *ssl=NULL;
 	BIO *sbio=NULL;
-	struct conf **confs=NULL;
-	struct conf **cconfs=NULL;
 	struct cntr *cntr=NULL;
 	struct async *as=NULL;
 	const char *cname=NULL;
 	struct asfd *asfd=NULL;
 	int is_status_server=0;
 
-	if(!(confs=confs_alloc())
-	  || !(cconfs=confs_alloc()))
-		goto end;
-
 	set_peer_env_vars(addr);
 
-	// Reload global config, in case things have changed. This means that
-	// the server does not need to be restarted for most conf changes.
-	confs_init(confs);
-	confs_init(cconfs);
-	if(conf_load_global_only(conffile, confs)) goto end;
-
-	// Hack to keep forking turned off if it was specified as off on the
-	// command line.
-	if(!forking) set_int(confs[OPT_FORK], 0);
-
 	if(!(sbio=BIO_new_socket(*cfd, BIO_NOCLOSE))
 	  || !(ssl=SSL_new(ctx)))
 	{
@@ -258,12 +290,14 @@ static int run_child(int *cfd, SSL_CTX *ctx, struct sockaddr_storage *addr,
 
 	if(ssl_do_accept(ssl))
 		goto end;
+	ssl_handshake_done(ssl);
 	if(!(as=async_alloc())
 	  || as->init(as, 0)
 	  || !(asfd=setup_asfd_ssl(as, "main socket", cfd, ssl)))
 		goto end;
 	asfd->set_timeout(asfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
-	asfd->ratelimit=get_float(confs[OPT_RATELIMIT]);
+	if(ratelimit_setup(asfd, confs, rlglobal))
+		goto end;
 
 	if(authorise_server(as->asfd, confs, cconfs)
 	  || !(cname=get_string(cconfs[OPT_CNAME])) || !*cname)
@@ -275,6 +309,10 @@ static int run_child(int *cfd, SSL_CTX *ctx, struct sockaddr_storage *addr,
 		goto end;
 	}
 
+	// The client configuration files can override the rate limits.
+	if(ratelimit_setup(asfd, cconfs, rlglobal))
+		goto end;
+
 	if(!get_int(cconfs[OPT_ENABLED]))
 	{
 		log_and_send(as->asfd, "client not enabled on server");
@@ -331,16 +369,22 @@ end:
 	async_asfd_free_all(&as); // This closes cfd for us.
 	logp("exit child\n");
 	if(cntr) cntr_free(&cntr);
-	if(confs)
-	{
-		set_cntr(confs[OPT_CNTR], NULL);
-		confs_free(&confs);
-	}
-	if(cconfs)
-	{
-		set_cntr(cconfs[OPT_CNTR], NULL);
-		confs_free(&cconfs);
-	}
+	return ret;
+}
+
+static int run_child(int *cfd, SSL_CTX *ctx, struct sockaddr_storage *addr,
+	int status_wfd, int status_rfd, const char *conffile, int forking)
+{
+	int ret=-1;
+	struct conf **confs=NULL;
+	struct conf **cconfs=NULL;
+
+	if(child_confs_load(&confs, &cconfs, conffile, forking))
+		close_fd(cfd);
+	else
+		ret=run_child_with_confs(cfd, ctx, addr,
+			status_wfd, status_rfd, confs, cconfs);
+	child_confs_free(&confs, &cconfs);
 	return ret;
 }
 
@@ -451,6 +495,218 @@ static int setup_parent_child_pipes(struct asfd *asfd,
 	return 0;
 }
 
+// Called in a newly forked child to let go of everything that belongs to
+// the parent.
+static void child_setup(struct async **mainas, struct conf **confs,
+	int keep1, int keep2, int keep3)
+{
+	int p;
+	struct sigaction sa;
+	async_asfd_free_all(mainas);
+	prefork_free_all();
+
+	// Close unnecessary file descriptors.
+	// Go up to FD_SETSIZE and hope for the best.
+	// FIX THIS: Now that async_asfd_free_all() is doing
+	// everything, double check whether this is needed.
+	for(p=3; p<(int)FD_SETSIZE; p++)
+	{
+		if(p!=keep1
+		  && p!=keep2
+		  && p!=keep3)
+			close(p);
+	}
+
+	// Set SIGCHLD back to default, so that I
+	// can get sensible returns from waitpid.
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler=SIG_DFL;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	confs_free_content(confs);
+	confs_init(confs);
+}
+
+struct conffile_stamp
+{
+	time_t mtime;
+	long mtime_nsec;
+	off_t size;
+};
+
+// stat() rather than lstat(), so that edits to the file behind a symlink are
+// noticed. The size and nanoseconds catch edits made within the same second.
+static void conffile_stamp(const char *conffile, struct conffile_stamp *stamp)
+{
+	struct stat statp;
+	memset(stamp, 0, sizeof(*stamp));
+	if(stat(conffile, &statp))
+		return;
+	stamp->mtime=statp.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	stamp->mtime_nsec=statp.st_mtim.tv_nsec;
+#endif
+	stamp->size=statp.st_size;
+}
+
+static int conffile_changed(const char *conffile, struct conffile_stamp *old)
+{
+	struct conffile_stamp stamp;
+	conffile_stamp(conffile, &stamp);
+	return stamp.mtime!=old->mtime
+	  || stamp.mtime_nsec!=old->mtime_nsec
+	  || stamp.size!=old->size;
+}
+
+// A pre-forked worker. It gets the configuration loaded, and then waits
+// for the parent to give it a connection. If the configuration file was
+// changed while it was waiting, it loads it again, so that the server
+// does not need to be restarted for most conf changes.
+static int run_worker(int ctl, int status_wfd, SSL_CTX *ctx,
+	const char *conffile)
+{
+	int ret=-1;
+	int cfd=-1;
+	struct conffile_stamp stamp;
+	struct prefork_job job;
+	struct conf **confs=NULL;
+	struct conf **cconfs=NULL;
+
+	conffile_stamp(conffile, &stamp);
+	if(child_confs_load(&confs, &cconfs, conffile, 1 /* forking */))
+		goto end;
+	switch(prefork_recv(ctl, &cfd, &job))
+	{
+		case 0:
+			break;
+		case 1:
+			// Not wanted any more.
+			ret=0;
+			goto end;
+		default:
+			goto end;
+	}
+	close_fd(&ctl);
+	if(conffile_changed(conffile, &stamp))
+	{
+		child_confs_free(&confs, &cconfs);
+		if(child_confs_load(&confs, &cconfs, conffile, 1 /* forking */))
+		{
+			close_fd(&cfd);
+			goto end;
+		}
+	}
+	ret=run_child_with_confs(&cfd, ctx, &job.addr, status_wfd, -1,
+		confs, cconfs);
+end:
+	close_fd(&ctl);
+	close_fd(&status_wfd);
+	child_confs_free(&confs, &cconfs);
+	return ret;
+}
+
+static int prefork_spawn(struct async *mainas, SSL_CTX *ctx,
+	const char *conffile, struct conf **confs)
+{
+	int sv[2];
+	int pipe_rfd[2];
+	pid_t childpid;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+	{
+		logp("socketpair failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if(pipe(pipe_rfd)<0)
+	{
+		logp("pipe failed: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	switch((childpid=fork()))
+	{
+		case -1:
+			logp("fork failed: %s\n", strerror(errno));
+			close(sv[0]);
+			close(sv[1]);
+			close(pipe_rfd[0]);
+			close(pipe_rfd[1]);
+			return -1;
+		case 0:
+			// Child.
+			close(sv[0]);
+			close(pipe_rfd[0]); // close read end
+			child_setup(&mainas, confs, sv[1], pipe_rfd[1], -1);
+			exit(run_worker(sv[1], pipe_rfd[1], ctx, conffile));
+		default:
+			// Parent.
+			close(sv[1]);
+			close(pipe_rfd[1]); // close write end
+			return prefork_add(childpid, &sv[0], &pipe_rfd[0]);
+	}
+}
+
+// Keep up to 'prefork' workers waiting, as long as that does not take the
+// number of children past the total of the max_children settings.
+static int prefork_fill(struct async *mainas, SSL_CTX *ctx,
+	const char *conffile, struct conf **confs)
+{
+	long max=0;
+	long running=0;
+	struct asfd *a;
+	struct strlist *p;
+	int want=get_int(confs[OPT_PREFORK]);
+
+	if(!want || !get_int(confs[OPT_FORK]))
+		return 0;
+	for(p=get_strlist(confs[OPT_PORT]); p; p=p->next)
+		max+=p->flag;
+	for(a=mainas->asfd; a; a=a->next)
+		if(a->fdtype==ASFD_FD_SERVER_PIPE_READ)
+			running++;
+	while(prefork_idle()<want
+	  && running+prefork_idle()<max)
+		if(prefork_spawn(mainas, ctx, conffile, confs))
+			return -1;
+	return 0;
+}
+
+// Returns 1 if there was no worker that could take the connection.
+static int prefork_hand_over(struct asfd *asfd, int *cfd,
+	struct sockaddr_storage *client_name)
+{
+	int none=-1;
+	struct prefork_job job;
+	struct prefork_worker *worker;
+
+	memset(&job, 0, sizeof(job));
+	job.port=asfd->port;
+	memcpy(&job.addr, client_name, sizeof(job.addr));
+	while((worker=prefork_take()))
+	{
+		if(prefork_send(worker->ctl, *cfd, &job))
+		{
+			prefork_worker_free(&worker);
+			continue;
+		}
+		close_fd(cfd);
+		logp("passed connection on port %d to worker %d\n",
+			asfd->port, worker->pid);
+		if(!setup_parent_child_pipe(asfd->as, "pipe from child",
+			&worker->status_rfd, &none, worker->pid, asfd->port,
+			ASFD_FD_SERVER_PIPE_READ))
+		{
+			prefork_worker_free(&worker);
+			return -1;
+		}
+		prefork_worker_free(&worker);
+		return 0;
+	}
+	return 1;
+}
+
 static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 	const char *conffile, struct conf **confs)
 {
@@ -488,6 +744,17 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 		return 0;
 	}
 
+	if(fdtype==ASFD_FD_SERVER_LISTEN_MAIN)
+	{
+		switch(prefork_hand_over(asfd, &cfd, &client_name))
+		{
+			case 0: return 0;
+			case 1: break; // Fork one instead.
+			default: close_fd(&cfd);
+				return -1;
+		}
+	}
+
 	if(pipe(pipe_rfd)<0 || pipe(pipe_wfd)<0)
 	{
 		logp("pipe failed: %s", strerror(errno));
@@ -503,35 +770,11 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 		case 0:
 		{
 			// Child.
-			int p;
 			int ret;
-			struct sigaction sa;
 			struct async *as=asfd->as;
-			async_asfd_free_all(&as);
-
-			// Close unnecessary file descriptors.
-			// Go up to FD_SETSIZE and hope for the best.
-			// FIX THIS: Now that async_asfd_free_all() is doing
-			// everything, double check whether this is needed.
-			for(p=3; p<(int)FD_SETSIZE; p++)
-			{
-				if(p!=pipe_rfd[1]
-				  && p!=pipe_wfd[0]
-				  && p!=cfd)
-					close(p);
-			}
-
-			// Set SIGCHLD back to default, so that I
-			// can get sensible returns from waitpid.
-			memset(&sa, 0, sizeof(sa));
-			sa.sa_handler=SIG_DFL;
-			sigaction(SIGCHLD, &sa, NULL);
-
 			close(pipe_rfd[0]); // close read end
 			close(pipe_wfd[1]); // close write end
-
-			confs_free_content(confs);
-			confs_init(confs);
+			child_setup(&as, confs, pipe_rfd[1], pipe_wfd[0], cfd);
 
 			ret=run_child(&cfd, ctx, &client_name, pipe_rfd[1],
 			  fdtype==ASFD_FD_SERVER_LISTEN_STATUS?pipe_wfd[0]:-1,
@@ -733,16 +976,25 @@ static int run_server(struct conf **confs, const char *conffile)
 		goto end;
 	}
 
-	if(!(mainas=async_alloc())
+	if(get_float(confs[OPT_RATELIMIT_GLOBAL])
+	  && !(rlglobal=rlbucket_alloc_shared(
+		get_float(confs[OPT_RATELIMIT_GLOBAL]))))
+			goto end;
+
+	if(!(mainas=async_alloc_epoll())
 	  || mainas->init(mainas, 0))
 		goto end;
 
 	if(init_listen_sockets(address, ports, mainas,
-		ASFD_FD_SERVER_LISTEN_MAIN, "server")
+		ASFD_FD_SERVER_LISTEN_MAIN, "server",
+		get_int(confs[OPT_NETWORK_BUFFER_SIZE]))
 	  || init_listen_sockets(status_address, status_ports, mainas,
-		ASFD_FD_SERVER_LISTEN_STATUS, "server status"))
+		ASFD_FD_SERVER_LISTEN_STATUS, "server status", 0))
 			goto end;
 
+	if(prefork_fill(mainas, ctx, conffile, confs))
+		goto end;
+
 	while(!hupreload)
 	{
 		int removed;
@@ -813,6 +1065,10 @@ static int run_server(struct conf **confs, const char *conffile)
 
 		chld_check_for_exiting(mainas);
 
+		if(!gentleshutdown
+		  && prefork_fill(mainas, ctx, conffile, confs))
+			goto end;
+
 		// Leave if we had a SIGUSR1 and there are no children running.
 		if(gentleshutdown)
 		{
@@ -836,8 +1092,10 @@ static int run_server(struct conf **confs, const char *conffile)
 
 	ret=0;
 end:
+	prefork_free_all();
 	async_asfd_free_all(&mainas);
 	if(ctx) ssl_destroy_ctx(ctx);
+	rlbucket_free_shared(&rlglobal);
 	return ret;
 }
 
@@ -864,6 +1122,8 @@ int server(struct conf **confs, const char *conffile,
 	}
 
 	ssl_load_globals();
+	if(ssl_handshakes_alloc_shared())
+		goto error;
 
 	while(!gentleshutdown)
 	{
@@ -883,6 +1143,8 @@ int server(struct conf **confs, const char *conffile,
 end:
 	ret=SERVER_OK;
 error:
+	ssl_handshakes_log();
+	ssl_handshakes_free_shared();
 
 // FIX THIS: Have an enum for a return value, so that it is more obvious what
 // is happening, like client.c does.
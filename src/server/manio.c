@@ -11,6 +11,8 @@
 #include "../sbuf.h"
 #include "manio.h"
 #include "protocol2/champ_chooser/champ_chooser.h"
+#include "protocol2/champ_chooser/hash.h"
+#include "protocol2/champ_chooser/mindex.h"
 #include "protocol2/dpth.h"
 
 static void man_off_t_free_content(man_off_t *offset)
@@ -52,6 +54,16 @@ static int init_write_dindex(struct manio *manio, const char *dir)
 	return 0;
 }
 
+static int init_write_mindex(struct manio *manio, const char *dir)
+{
+	if(!(manio->mindex_dir=strdup_w(dir, __func__))
+	  || !(manio->mindex_blks=(struct hash_strong *)
+		calloc_w(MANIFEST_SIG_MAX,
+			sizeof(struct hash_strong), __func__)))
+				return -1;
+	return 0;
+}
+
 static int is_single_file(struct manio *manio)
 {
 	return manio->protocol==PROTO_1 || manio->phase==1;
@@ -91,7 +103,7 @@ static int manio_open_next_fpath(struct manio *manio)
 		case 1:
 		case 3:
 		default:
-			if(!(manio->fzp=fzp_gzopen(offset->fpath,
+			if(!(manio->fzp=fzp_zopen(offset->fpath,
 				manio->mode))) return -1;
 			return 0;
 	}
@@ -178,13 +190,17 @@ struct manio *manio_open_phase3(const char *manifest, const char *mode,
 	{
 		char *hooksdir=NULL;
 		char *dindexdir=NULL;
+		char *mindexdir=NULL;
 		if(!(hooksdir=prepend_s(manifest, "hooks"))
 		  || !(dindexdir=prepend_s(manifest, "dindex"))
+		  || !(mindexdir=prepend_s(manifest, "mindex"))
 		  || init_write_hooks(manio, hooksdir, rmanifest)
-		  || init_write_dindex(manio, dindexdir))
+		  || init_write_dindex(manio, dindexdir)
+		  || init_write_mindex(manio, mindexdir))
 			manio_close(&manio);
 		free_w(&hooksdir);
 		free_w(&dindexdir);
+		free_w(&mindexdir);
 	}
 
 end:
@@ -202,6 +218,8 @@ static void manio_free_content(struct manio *manio)
 	free_v((void **)&manio->hook_sort);
 	free_w(&manio->dindex_dir);
 	free_v((void **)&manio->dindex_sort);
+	free_w(&manio->mindex_dir);
+	free_v((void **)&manio->mindex_blks);
 	memset(manio, 0, sizeof(struct manio));
 }
 
@@ -305,7 +323,7 @@ static int sort_and_write_hooks(struct manio *manio)
 	snprintf(msg, sizeof(msg), "%08" PRIX64, manio->offset->fcount-1);
 	if(!(path=prepend_s(manio->hook_dir, msg))
 	  || build_path_w(path)
-	  || !(fzp=fzp_gzopen(path, MANIO_MODE_WRITE)))
+	  || !(fzp=fzp_zopen(path, MANIO_MODE_WRITE)))
 		goto end;
 
 	qsort(hook_sort, hook_count, sizeof(uint64_t), uint64_t_sort);
@@ -351,7 +369,7 @@ static int sort_and_write_dindex(struct manio *manio)
 	snprintf(msg, sizeof(msg), "%08" PRIX64, manio->offset->fcount-1);
 	if(!(path=prepend_s(manio->dindex_dir, msg))
 	  || build_path_w(path)
-	  || !(fzp=fzp_gzopen(path, MANIO_MODE_WRITE)))
+	  || !(fzp=fzp_zopen(path, MANIO_MODE_WRITE)))
 		goto end;
 
 	qsort(dindex_sort, dindex_count, sizeof(uint64_t), uint64_t_sort);
@@ -380,10 +398,31 @@ end:
 	return ret;
 }
 
+// Write a binary copy of the signatures in the manifest chunk, so that the
+// champ chooser can load it quickly if it becomes a champion.
+static int write_mindex(struct manio *manio)
+{
+	int ret=-1;
+	char msg[32]="";
+	char *path=NULL;
+	if(!manio->mindex_blks) return 0;
+
+	snprintf(msg, sizeof(msg), "%08" PRIX64, manio->offset->fcount-1);
+	if(!(path=prepend_s(manio->mindex_dir, msg))
+	  || mindex_write(path, manio->mindex_blks, manio->mindex_count))
+		goto end;
+	manio->mindex_count=0;
+	ret=0;
+end:
+	free_w(&path);
+	return ret;
+}
+
 static int sort_and_write_hooks_and_dindex(struct manio *manio)
 {
 	return sort_and_write_hooks(manio)
-	  || sort_and_write_dindex(manio);
+	  || sort_and_write_dindex(manio)
+	  || write_mindex(manio);
 }
 
 int manio_close(struct manio **manio)
@@ -513,10 +552,8 @@ static int check_sig_count(struct manio *manio, struct blk *blk)
 
 static int write_sig_msg(struct manio *manio, struct blk *blk)
 {
-	struct iobuf wbuf;
 	if(!manio->fzp && manio_open_next_fpath(manio)) return -1;
-	blk_to_iobuf_sig_and_savepath(blk, &wbuf);
-	if(iobuf_send_msg_fzp(&wbuf, manio->fzp)) return -1;
+	if(to_fzp_sig_and_savepath(manio->fzp, blk)) return -1;
 	return check_sig_count(manio, blk);
 }
 
@@ -540,6 +577,14 @@ int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
 			manio->dindex_sort[manio->dindex_count++]=savepath;
 		}
 	}
+	if(manio->mindex_blks)
+	{
+		struct hash_strong *m;
+		m=&manio->mindex_blks[manio->mindex_count++];
+		m->weak=blk->fingerprint;
+		m->savepath=blk->savepath;
+		memcpy(m->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
+	}
 	return write_sig_msg(manio, blk);
 }
 
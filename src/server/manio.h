@@ -10,6 +10,7 @@
 #define MANIO_MODE_APPEND	"ab"
 
 struct blk;
+struct hash_strong;
 struct sbuf;
 
 struct man_off
@@ -43,6 +44,9 @@ struct manio
 	char *dindex_dir;
 	uint64_t *dindex_sort;	// Array for sorting and writing dindex.
 	int dindex_count;
+	char *mindex_dir;
+	struct hash_strong *mindex_blks; // Array of sigs for the mindex.
+	int mindex_count;
 	enum protocol protocol;	// Whether running in protocol1/2 mode.
 	int phase;
 
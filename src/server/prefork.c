@@ -0,0 +1,169 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../fsops.h"
+#include "../log.h"
+#include "prefork.h"
+
+// The pool of pre-forked workers. Each one has already been forked and has
+// loaded the configuration, and is blocked waiting for the server parent to
+// hand it an accepted socket over a unix socket with SCM_RIGHTS. Once it has
+// one, it is the same as any other child, and it exits when the client is
+// done. The parent forks replacements from its main loop, so that does not
+// hold up the next connection.
+
+static struct prefork_worker *idle=NULL;
+static int idle_count=0;
+
+int prefork_add(pid_t pid, int *ctl, int *status_rfd)
+{
+	struct prefork_worker *worker;
+	if(!(worker=(struct prefork_worker *)
+		calloc_w(1, sizeof(struct prefork_worker), __func__)))
+			return -1;
+	worker->pid=pid;
+	worker->ctl=*ctl;
+	worker->status_rfd=*status_rfd;
+	*ctl=-1;
+	*status_rfd=-1;
+	worker->next=idle;
+	idle=worker;
+	idle_count++;
+	return 0;
+}
+
+struct prefork_worker *prefork_take(void)
+{
+	struct prefork_worker *worker;
+	if(!(worker=idle))
+		return NULL;
+	idle=worker->next;
+	worker->next=NULL;
+	idle_count--;
+	return worker;
+}
+
+void prefork_worker_free(struct prefork_worker **worker)
+{
+	if(!worker || !*worker) return;
+	// An idle worker sees the end of the socket, and exits.
+	close_fd(&(*worker)->ctl);
+	close_fd(&(*worker)->status_rfd);
+	free_v((void **)worker);
+}
+
+int prefork_idle(void)
+{
+	return idle_count;
+}
+
+// An idle worker died.
+void prefork_reaped(pid_t pid)
+{
+	struct prefork_worker **w;
+	struct prefork_worker *worker;
+	for(w=&idle; *w; w=&(*w)->next)
+	{
+		if((*w)->pid!=pid)
+			continue;
+		worker=*w;
+		*w=worker->next;
+		idle_count--;
+		prefork_worker_free(&worker);
+		return;
+	}
+}
+
+void prefork_free_all(void)
+{
+	struct prefork_worker *worker;
+	while((worker=prefork_take()))
+		prefork_worker_free(&worker);
+}
+
+int prefork_send(int ctl, int fd, struct prefork_job *job)
+{
+	ssize_t w;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base=job;
+	iov.iov_len=sizeof(struct prefork_job);
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+	cmsg=CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	while((w=sendmsg(ctl, &msg, 0))<0 && errno==EINTR) { }
+	if(w!=(ssize_t)sizeof(struct prefork_job))
+	{
+		logp("Could not pass connection to worker: %s\n",
+			w<0?strerror(errno):"short write");
+		return -1;
+	}
+	return 0;
+}
+
+// Returns 1 if the parent has closed its end, which means that the worker
+// is not wanted any more.
+int prefork_recv(int ctl, int *fd, struct prefork_job *job)
+{
+	ssize_t r;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	*fd=-1;
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base=job;
+	iov.iov_len=sizeof(struct prefork_job);
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+
+	while((r=recvmsg(ctl, &msg, 0))<0 && errno==EINTR) { }
+	if(!r)
+		return 1;
+	if(r<0)
+	{
+		logp("Worker could not receive connection: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	for(cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level!=SOL_SOCKET
+		  || cmsg->cmsg_type!=SCM_RIGHTS)
+			continue;
+		close_fd(fd);
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if(r!=(ssize_t)sizeof(struct prefork_job)
+	  || (msg.msg_flags & MSG_CTRUNC)
+	  || *fd<0)
+	{
+		logp("Worker received a bad connection\n");
+		close_fd(fd);
+		return -1;
+	}
+	return 0;
+}
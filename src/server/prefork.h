@@ -0,0 +1,31 @@
+#ifndef _PREFORK_H
+#define _PREFORK_H
+
+// What the server parent sends down to a worker along with the accepted
+// socket.
+struct prefork_job
+{
+	int port;
+	struct sockaddr_storage addr;
+};
+
+// A pre-forked worker, waiting to be given a connection.
+struct prefork_worker
+{
+	pid_t pid;
+	int ctl; // The socket that the connection gets passed down.
+	int status_rfd; // The pipe that the worker will write status to.
+	struct prefork_worker *next;
+};
+
+extern int prefork_add(pid_t pid, int *ctl, int *status_rfd);
+extern struct prefork_worker *prefork_take(void);
+extern void prefork_worker_free(struct prefork_worker **worker);
+extern int prefork_idle(void);
+extern void prefork_reaped(pid_t pid);
+extern void prefork_free_all(void);
+
+extern int prefork_send(int ctl, int fd, struct prefork_job *job);
+extern int prefork_recv(int ctl, int *fd, struct prefork_job *job);
+
+#endif
@@ -15,6 +15,7 @@
 #include "../../sbuf.h"
 #include "../child.h"
 #include "../compress.h"
+#include "../backup_streams.h"
 #include "../resume.h"
 #include "blocklen.h"
 #include "dpth.h"
@@ -199,7 +200,7 @@ static enum processed_e process_changed_file(struct asfd *asfd,
 		goto end;
 	}
 	if(!(p1b->protocol1->outfb=rs_filebuf_new(NULL, NULL,
-		asfd, ASYNC_BUF_LEN, -1)))
+		asfd, asfd->frame_len, -1)))
 	{
 		logp("could not rs_filebuf_new for in_outfb.\n");
 		goto end;
@@ -592,10 +593,12 @@ enum sts_e
 
 // Return 1 if there is still stuff needing to be sent.
 // FIX THIS: lots of repeated code.
-static enum sts_e do_stuff_to_send(struct asfd *asfd,
-	struct sbuf *p1b, char **last_requested)
+static enum sts_e do_stuff_to_send(struct stream *s)
 {
 	static struct iobuf wbuf;
+	struct asfd *asfd=s->asfd;
+	struct sbuf *p1b=s->p1b;
+	char **last_requested=&s->last_requested;
 	if(p1b->flags & SBUF_SEND_DATAPTH)
 	{
 		iobuf_copy(&wbuf, &p1b->protocol1->datapth);
@@ -628,6 +631,7 @@ static enum sts_e do_stuff_to_send(struct asfd *asfd,
 			default: return STS_ERROR;
 		}
 		p1b->flags &= ~SBUF_SEND_PATH;
+		s->outstanding++;
 		free_w(last_requested);
 		if(!(*last_requested=strdup_w(p1b->path.buf, __func__)))
 			return STS_ERROR;
@@ -666,17 +670,17 @@ static enum sts_e do_stuff_to_send(struct asfd *asfd,
 	return STS_OK;
 }
 
-static int start_to_receive_delta(struct sdirs *sdirs, struct sbuf *rb)
+static int start_to_receive_delta(const char *deltmppath, struct sbuf *rb)
 {
 	if(rb->compression)
 	{
-		if(!(rb->protocol1->fzp=fzp_gzopen(sdirs->deltmppath,
+		if(!(rb->protocol1->fzp=fzp_gzopen(deltmppath,
 			comp_level(rb->compression))))
 				return -1;
 	}
 	else
 	{
-		if(!(rb->protocol1->fzp=fzp_open(sdirs->deltmppath, "wb")))
+		if(!(rb->protocol1->fzp=fzp_open(deltmppath, "wb")))
 			return -1;
 	}
 	rb->flags |= SBUF_RECV_DELTA;
@@ -684,7 +688,8 @@ static int start_to_receive_delta(struct sdirs *sdirs, struct sbuf *rb)
 	return 0;
 }
 
-static int finish_delta(struct sdirs *sdirs, struct sbuf *rb)
+static int finish_delta(struct sdirs *sdirs, const char *deltmppath,
+	struct sbuf *rb)
 {
 	int ret=0;
 	char *deltmp=NULL;
@@ -694,7 +699,7 @@ static int finish_delta(struct sdirs *sdirs, struct sbuf *rb)
 	  || mkpath(&delpath, sdirs->working)
 	// Rename race condition is of no consequence here, as delpath will
 	// just get recreated.
-	  || do_rename(sdirs->deltmppath, delpath))
+	  || do_rename(deltmppath, delpath))
 		ret=-1;
 	free_w(&delpath);
 	free_w(&deltmp);
@@ -702,8 +707,8 @@ static int finish_delta(struct sdirs *sdirs, struct sbuf *rb)
 }
 
 static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
-	struct sbuf *rb, struct manio *chmanio, struct conf **cconfs,
-	char **last_requested)
+	const char *deltmppath, struct sbuf *rb, struct manio *chmanio,
+	struct conf **cconfs, char **last_requested)
 {
 	int ret=-1;
 	static char *cp=NULL;
@@ -720,7 +725,7 @@ static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
 		goto end;
 	}
 	iobuf_move(&rb->endfile, rbuf);
-	if(rb->flags & SBUF_RECV_DELTA && finish_delta(sdirs, rb))
+	if(rb->flags & SBUF_RECV_DELTA && finish_delta(sdirs, deltmppath, rb))
 		goto end;
 
 	if(manio_write_sbuf(chmanio, rb))
@@ -765,7 +770,7 @@ static int deal_with_receive_append(struct asfd *asfd, struct sbuf *rb)
 }
 
 static int deal_with_filedata(struct asfd *asfd,
-	struct sdirs *sdirs, struct sbuf *rb,
+	struct sdirs *sdirs, const char *deltmppath, struct sbuf *rb,
 	struct iobuf *rbuf, struct dpth *dpth, struct conf **cconfs)
 {
 	iobuf_move(&rb->path, rbuf);
@@ -773,7 +778,7 @@ static int deal_with_filedata(struct asfd *asfd,
 	if(rb->protocol1->datapth.buf)
 	{
 		// Receiving a delta.
-		if(start_to_receive_delta(sdirs, rb))
+		if(start_to_receive_delta(deltmppath, rb))
 		{
 			logp("error in start_to_receive_delta\n");
 			return -1;
@@ -798,11 +803,12 @@ enum str_e
 };
 
 // returns 1 for finished ok.
-static enum str_e do_stuff_to_receive(struct asfd *asfd,
-	struct sdirs *sdirs, struct conf **cconfs,
-	struct sbuf *rb, struct manio *chmanio,
-	struct dpth *dpth, char **last_requested)
+static enum str_e do_stuff_to_receive(struct stream *s,
+	struct sdirs *sdirs, struct conf **cconfs, struct dpth *dpth)
 {
+	struct asfd *asfd=s->asfd;
+	struct sbuf *rb=s->rb;
+	char **last_requested=&s->last_requested;
 	struct iobuf *rbuf=asfd->rbuf;
 
 	if(rbuf->cmd==CMD_MESSAGE
@@ -824,9 +830,12 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 					goto error;
 				return STR_OK;
 			case CMD_END_FILE:
-				if(deal_with_receive_end_file(asfd, sdirs, rb,
-					chmanio, cconfs, last_requested))
+				if(deal_with_receive_end_file(asfd, sdirs,
+					s->deltmppath, rb, s->chmanio,
+					cconfs, last_requested))
 						goto error;
+				if(s->outstanding)
+					s->outstanding--;
 				return STR_OK;
 			default:
 				iobuf_log_unexpected(rbuf, __func__);
@@ -857,6 +866,8 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 			if(*last_requested
 			  && !strcmp(rbuf->buf, *last_requested))
 				free_w(last_requested);
+			if(s->outstanding)
+				s->outstanding--;
 			return STR_OK;
 		default:
 			break;
@@ -864,8 +875,9 @@ static enum str_e do_stuff_to_receive(struct asfd *asfd,
 	if(iobuf_is_filedata(rbuf)
 	  || iobuf_is_vssdata(rbuf))
 	{
-		if(deal_with_filedata(asfd, sdirs, rb, rbuf, dpth, cconfs))
-			goto error;
+		if(deal_with_filedata(asfd, sdirs, s->deltmppath,
+			rb, rbuf, dpth, cconfs))
+				goto error;
 		return STR_OK;
 	}
 	iobuf_log_unexpected(rbuf, __func__);
@@ -970,8 +982,6 @@ static int process_next_file_from_manios(struct asfd *asfd,
 			break;
 		case 1:
 			manio_close(p1manio);
-			if(asfd->write_str(asfd, CMD_GEN, "backupphase2end"))
-				goto error;
 			sbuf_free(p1b);
 			break;
 		case -1:
@@ -1073,23 +1083,413 @@ p1b_done:
 	return 0;
 }
 
+#ifndef UTEST
+static
+#endif
+struct stream *streams_alloc(int n, struct asfd *asfd,
+	struct sdirs *sdirs)
+{
+	int i;
+	struct stream *streams=NULL;
+
+	if(!(streams=(struct stream *)
+		calloc_w(n, sizeof(struct stream), __func__)))
+			return NULL;
+	streams->asfd=asfd;
+	streams->joined=1;
+	for(i=0; i<n; i++)
+	{
+		struct stream *s=&streams[i];
+		if(!(s->rb=sbuf_alloc(PROTO_1)))
+			goto error;
+		if(n>1)
+		{
+			if(!(s->changed=backup_streams_path(sdirs->changed, i)))
+				goto error;
+		}
+		else if(!(s->changed=strdup_w(sdirs->changed, __func__)))
+			goto error;
+		if(i)
+		{
+			if(!(s->deltmppath=backup_streams_path(
+				sdirs->deltmppath, i)))
+					goto error;
+		}
+		else if(!(s->deltmppath=strdup_w(sdirs->deltmppath, __func__)))
+			goto error;
+		if(!(s->chmanio=manio_open_phase2(s->changed, "ab", PROTO_1)))
+			goto error;
+	}
+	return streams;
+error:
+	for(i=0; i<n; i++)
+	{
+		manio_close(&streams[i].chmanio);
+		sbuf_free(&streams[i].rb);
+		free_w(&streams[i].changed);
+		free_w(&streams[i].deltmppath);
+	}
+	free_v((void **)&streams);
+	return NULL;
+}
+
+static void stream_drop(struct async *as, struct stream *s)
+{
+	if(!s->asfd || s->asfd==as->asfd)
+		return;
+	// The ratelimit belongs to the main connection.
+	s->asfd->rl=NULL;
+	as->asfd_remove(as, s->asfd);
+	asfd_close(s->asfd);
+	asfd_free(&s->asfd);
+}
+
+#ifndef UTEST
+static
+#endif
+int streams_close(struct stream *streams, int n)
+{
+	int i;
+	int ret=0;
+	if(!streams)
+		return 0;
+	for(i=0; i<n; i++)
+	{
+		if(!manio_close(&streams[i].chmanio))
+			continue;
+		logp("error closing %s in %s\n", streams[i].changed, __func__);
+		ret=-1;
+	}
+	return ret;
+}
+
+#ifndef UTEST
+static
+#endif
+void streams_free(struct async *as, struct stream **streams, int n)
+{
+	int i;
+	if(!streams || !*streams)
+		return;
+	for(i=0; i<n; i++)
+	{
+		struct stream *s=&(*streams)[i];
+		if(as)
+			stream_drop(as, s);
+		manio_close(&s->chmanio);
+		sbuf_free(&s->p1b);
+		sbuf_free(&s->rb);
+		free_w(&s->changed);
+		free_w(&s->deltmppath);
+		free_w(&s->last_requested);
+	}
+	free_v((void **)streams);
+}
+
+// Tell the client how it can open the extra streams, and wait for them.
+static struct asfd *streams_listen(struct async *as, struct sdirs *sdirs,
+	char *token, size_t len)
+{
+	int fd=-1;
+	char msg[64]="";
+	struct asfd *lasfd=NULL;
+
+	if(backup_streams_token(token, len)
+	  || (fd=backup_streams_listen(sdirs->working))<0)
+		return NULL;
+	if(!(lasfd=setup_asfd(as, "backup streams", &fd, /*port*/-1)))
+	{
+		close_fd(&fd);
+		goto error;
+	}
+	lasfd->fdtype=ASFD_FD_SERVER_LISTEN_MAIN;
+	snprintf(msg, sizeof(msg), "backupstreams %s", token);
+	if(as->asfd->write_str(as->asfd, CMD_GEN, msg))
+		goto error;
+	return lasfd;
+error:
+	if(lasfd)
+	{
+		as->asfd_remove(as, lasfd);
+		asfd_close(lasfd);
+		asfd_free(&lasfd);
+	}
+	backup_streams_unlink(sdirs->working);
+	return NULL;
+}
+
+static void streams_unlisten(struct async *as, struct asfd **lasfd,
+	struct sdirs *sdirs)
+{
+	if(!*lasfd)
+		return;
+	as->asfd_remove(as, *lasfd);
+	asfd_close(*lasfd);
+	asfd_free(lasfd);
+	backup_streams_unlink(sdirs->working);
+}
+
+#ifndef UTEST
+static
+#endif
+int streams_accept(struct async *as, struct asfd *lasfd,
+	struct stream *streams, int n)
+{
+	int i;
+	int fd=-1;
+	struct asfd *asfd=NULL;
+
+	lasfd->new_client=0;
+	if((fd=accept(lasfd->fd, NULL, NULL))<0)
+	{
+		if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+			return 0;
+		logp("accept failed in %s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	for(i=1; i<n; i++)
+		if(!streams[i].asfd && !streams[i].finished)
+			break;
+	if(i>=n)
+	{
+		logp("Too many backup streams\n");
+		close_fd(&fd);
+		return 0;
+	}
+	if(!(asfd=setup_asfd(as, "backup stream", &fd, /*port*/-1))
+	  || asfd->set_large_frames(asfd))
+	{
+		close_fd(&fd);
+		return -1;
+	}
+	asfd->frame_len=as->asfd->frame_len;
+	asfd->set_timeout(asfd, as->asfd->max_network_timeout);
+	// Everything that goes to the client counts against the one limit,
+	// whichever stream it goes down.
+	asfd->rl=as->asfd->rl;
+	streams[i].asfd=asfd;
+	return 0;
+}
+
+// The first thing that an extra stream says has to be the token that the
+// client was given.
+#ifndef UTEST
+static
+#endif
+void stream_join(struct async *as, struct stream *s, int i,
+	const char *token)
+{
+	struct iobuf *rbuf=s->asfd->rbuf;
+
+	if(rbuf->cmd==CMD_GEN
+	  && !strncmp_w(rbuf->buf, "stream ")
+	  && !strcmp(rbuf->buf+strlen("stream "), token))
+	{
+		logp("Backup stream %d joined\n", i);
+		s->joined=1;
+		iobuf_free_content(rbuf);
+		return;
+	}
+	iobuf_log_unexpected(rbuf, __func__);
+	iobuf_free_content(rbuf);
+	stream_drop(as, s);
+}
+
+// Give the next file to whichever free stream has the fewest files that the
+// client has not finished sending yet, then the least waiting to go out,
+// taking turns when they are even.
+#ifndef UTEST
+static
+#endif
+struct stream *stream_next(struct stream *streams, int n, int *next)
+{
+	int i;
+	struct stream *s;
+	struct stream *best=NULL;
+
+	for(i=0; i<n; i++)
+	{
+		s=&streams[(*next+i)%n];
+		if(!s->asfd || !s->joined || s->p1b)
+			continue;
+		if(!best
+		  || s->outstanding<best->outstanding
+		  || (s->outstanding==best->outstanding
+			&& s->asfd->writebuflen<best->asfd->writebuflen))
+				best=s;
+	}
+	if(best)
+		*next=(best-streams+1)%n;
+	return best;
+}
+
+static int streams_waiting(struct stream *streams, int n)
+{
+	int i;
+	for(i=0; i<n; i++)
+		if(streams[i].last_requested
+		  || (streams[i].asfd && streams[i].asfd->writebuflen))
+			return 1;
+	return 0;
+}
+
+static int streams_end(struct stream *streams, int n)
+{
+	int i;
+	struct iobuf wbuf;
+
+	for(i=0; i<n; i++)
+	{
+		struct stream *s=&streams[i];
+		if(!s->asfd || !s->joined || s->p1b || s->ended)
+			continue;
+		iobuf_from_str(&wbuf, CMD_GEN, (char *)"backupphase2end");
+		switch(s->asfd->append_all_to_write_buffer(s->asfd, &wbuf))
+		{
+			case APPEND_OK:
+				s->ended=1;
+				break;
+			case APPEND_BLOCKED:
+				break;
+			default:
+				return -1;
+		}
+	}
+	return 0;
+}
+
+// Whether every stream that the client said it would open has turned up,
+// or it has had long enough to.
+#ifndef UTEST
+static
+#endif
+int streams_all_here(struct stream *streams, int n, time_t listened)
+{
+	int i;
+	for(i=0; i<n; i++)
+		if(!streams[i].asfd && !streams[i].finished)
+			return time(NULL)-listened>=BACKUP_STREAMS_JOIN_TIMEOUT;
+	return 1;
+}
+
+// The counters already cover all of the streams. Show a file that one of
+// them is in the middle of receiving.
+static const char *streams_status_path(struct stream *streams, int n)
+{
+	int i;
+	for(i=0; i<n; i++)
+		if(streams[i].rb->path.buf)
+			return streams[i].rb->path.buf;
+	return "";
+}
+
+static int streams_finished(struct stream *streams, int n)
+{
+	int i;
+	for(i=0; i<n; i++)
+		if(streams[i].asfd && !streams[i].finished)
+			return 0;
+	return 1;
+}
+
+static int merge_read(struct manio **manio, struct sbuf *sb)
+{
+	sbuf_free_content(sb);
+	if(!*manio)
+		return 0;
+	switch(manio_read(*manio, sb))
+	{
+		case 0:
+			return 0;
+		case 1:
+			return manio_close(manio);
+		default:
+			return -1;
+	}
+}
+
+// Each stream got its files in order, so merging them puts the changed
+// manifest back how phase3 expects it.
+#ifndef UTEST
+static
+#endif
+int merge_changed(struct sdirs *sdirs, struct stream *streams, int n)
+{
+	int i;
+	int ret=-1;
+	struct sbuf *min;
+	struct manio *dst=NULL;
+	struct manio **src=NULL;
+	struct sbuf **sb=NULL;
+
+	if(!(src=(struct manio **)calloc_w(n, sizeof(struct manio *), __func__))
+	  || !(sb=(struct sbuf **)calloc_w(n, sizeof(struct sbuf *), __func__))
+	  || !(dst=manio_open_phase2(sdirs->changed, "ab", PROTO_1)))
+		goto end;
+	for(i=0; i<n; i++)
+	{
+		if(!(sb[i]=sbuf_alloc(PROTO_1))
+		  || !(src[i]=manio_open_phase2(streams[i].changed,
+			"rb", PROTO_1))
+		  || merge_read(&src[i], sb[i]))
+			goto end;
+	}
+	while(1)
+	{
+		min=NULL;
+		for(i=0; i<n; i++)
+		{
+			if(!sb[i]->path.buf)
+				continue;
+			if(!min || sbuf_pathcmp(sb[i], min)<0)
+				min=sb[i];
+		}
+		if(!min)
+			break;
+		if(manio_write_sbuf(dst, min))
+			goto end;
+		for(i=0; i<n; i++)
+			if(sb[i]==min && merge_read(&src[i], sb[i]))
+				goto end;
+	}
+	ret=0;
+end:
+	if(manio_close(&dst))
+	{
+		logp("error closing %s in %s\n", sdirs->changed, __func__);
+		ret=-1;
+	}
+	for(i=0; i<n; i++)
+	{
+		if(src) manio_close(&src[i]);
+		if(sb) sbuf_free(&sb[i]);
+		if(!ret) unlink(streams[i].changed);
+	}
+	free_v((void **)&src);
+	free_v((void **)&sb);
+	return ret;
+}
+
 int backup_phase2_server_protocol1(struct async *as, struct sdirs *sdirs,
 	const char *incexc, int resume, struct conf **cconfs)
 {
+	int i;
 	int ret=0;
+	int next=0;
+	int nstreams=1;
+	time_t listened=0;
 	man_off_t *p1pos=NULL;
 	struct manio *p1manio=NULL;
 	struct dpth *dpth=NULL;
-	char *deltmppath=NULL;
-	char *last_requested=NULL;
-	struct manio *chmanio=NULL; // changed data
 	struct manio *ucmanio=NULL; // unchanged data
 	struct manio *cmanio=NULL; // previous (current) manifest
 	struct manio *hmanio=NULL; // to look up deleted hardlinks
 	struct sbuf *cb=NULL; // file list in current manifest
-	struct sbuf *p1b=NULL; // file list from client
-	struct sbuf *rb=NULL; // receiving file from client
+	struct stream *streams=NULL;
+	struct stream *s=NULL;
 	struct asfd *asfd=NULL;
+	struct asfd *lasfd=NULL; // for the extra streams to join on
+	char token[BACKUP_STREAMS_TOKEN_LEN+1]="";
 	int breaking=0;
 	int breakcount=0;
 	struct cntr *cntr=NULL;
@@ -1124,6 +1524,10 @@ int backup_phase2_server_protocol1(struct async *as, struct sdirs *sdirs,
 		breakcount=breaking-2000;
 	}
 
+	// A resumed backup carries on with the one connection.
+	if(!resume && get_int(cconfs[OPT_BACKUP_STREAMS])>1)
+		nstreams=get_int(cconfs[OPT_BACKUP_STREAMS]);
+
 	logp("Begin phase2 (receive file data)\n");
 
 	if(!(dpth=dpth_alloc())
@@ -1162,9 +1566,7 @@ int backup_phase2_server_protocol1(struct async *as, struct sdirs *sdirs,
 	if(!(p1manio=manio_open_phase1(sdirs->phase1data, "rb", PROTO_1))
 	  || (resume && manio_seek(p1manio, p1pos)))
 		goto error;
-	if(!(cb=sbuf_alloc(PROTO_1))
-	  || !(p1b=sbuf_alloc(PROTO_1))
-	  || !(rb=sbuf_alloc(PROTO_1)))
+	if(!(cb=sbuf_alloc(PROTO_1)))
 		goto error;
 
 	// Unchanged and changed should now be truncated correctly, we just
@@ -1172,76 +1574,121 @@ int backup_phase2_server_protocol1(struct async *as, struct sdirs *sdirs,
 	// Data is not getting written to a compressed file.
 	// This is important for recovery if the power goes.
 	if(!(ucmanio=manio_open_phase2(sdirs->unchanged, "ab", PROTO_1))
-	  || !(chmanio=manio_open_phase2(sdirs->changed, "ab", PROTO_1)))
+	  || !(streams=streams_alloc(nstreams, asfd, sdirs)))
 		goto error;
 
+	if(nstreams>1)
+	{
+		if(!(lasfd=streams_listen(as, sdirs, token, sizeof(token))))
+			goto error;
+		listened=time(NULL);
+	}
+
 	while(1)
 	{
 		if(breaking && breakcount--==0)
 			return breakpoint(breaking, __func__);
 
 		if(write_status(CNTR_STATUS_BACKUP,
-			rb->path.buf?rb->path.buf:"", cntr))
+			streams_status_path(streams, nstreams), cntr))
 				goto error;
-		if(last_requested
-		  || !p1manio
-		  || asfd->writebuflen)
+		if(!p1manio
+		  || streams_waiting(streams, nstreams))
 		{
-			iobuf_free_content(asfd->rbuf);
-			if(asfd->as->read_write(asfd->as))
+			for(i=0; i<nstreams; i++)
+				if(streams[i].asfd)
+					iobuf_free_content(streams[i].asfd->rbuf);
+			if(as->read_write(as))
 			{
 				logp("error in %s\n", __func__);
 				goto error;
 			}
 
-			if(asfd->rbuf->buf)
-			  switch(do_stuff_to_receive(asfd, sdirs,
-				cconfs, rb, chmanio, dpth, &last_requested))
+			if(lasfd && lasfd->new_client
+			  && streams_accept(as, lasfd, streams, nstreams))
+				goto error;
+
+			for(i=0; i<nstreams; i++)
+			{
+				s=&streams[i];
+				if(!s->asfd || !s->asfd->rbuf->buf)
+					continue;
+				if(!s->joined)
+				{
+					stream_join(as, s, i, token);
+					continue;
+				}
+				switch(do_stuff_to_receive(s,
+					sdirs, cconfs, dpth))
+				{
+					case STR_OK:
+						break;
+					case STR_FINISHED:
+						s->finished=1;
+						stream_drop(as, s);
+						break;
+					case STR_ERROR:
+						goto error;
+				}
+			}
+			if(!lasfd && streams_finished(streams, nstreams))
+				goto end;
+		}
+
+		for(i=0; i<nstreams; i++)
+		{
+			s=&streams[i];
+			if(!s->p1b)
+				continue;
+			switch(do_stuff_to_send(s))
 			{
-				case STR_OK:
+				case STS_OK:
+					sbuf_free(&s->p1b);
+					break;
+				case STS_BLOCKED:
 					break;
-				case STR_FINISHED:
-					goto end;
-				case STR_ERROR:
+				case STS_ERROR:
 					goto error;
 			}
 		}
 
-		if(p1b) switch(do_stuff_to_send(asfd, p1b, &last_requested))
+		if(p1manio)
 		{
-			case STS_OK:
-				sbuf_free(&p1b);
-				break;
-			case STS_BLOCKED:
+			if(!(s=stream_next(streams, nstreams, &next)))
 				continue;
-			case STS_ERROR:
+			if(process_next_file_from_manios(s->asfd, dpth, sdirs,
+				&p1manio, &cmanio, ucmanio, &hmanio, &s->p1b,
+				cb, cconfs))
+					goto error;
+		}
+		if(!p1manio)
+		{
+			// The client might still be starting some of the
+			// streams, and they would be refused if the socket
+			// went now.
+			if(lasfd && streams_all_here(streams, nstreams,
+				listened))
+					streams_unlisten(as, &lasfd, sdirs);
+			if(streams_end(streams, nstreams))
 				goto error;
 		}
-
-		if(p1manio
-		 && process_next_file_from_manios(asfd, dpth, sdirs,
-			&p1manio, &cmanio, ucmanio, &hmanio, &p1b, cb, cconfs))
-					goto error;
 	}
 
 error:
 	ret=-1;
 end:
-	if(manio_close(&chmanio))
-	{
-		logp("error closing %s in %s\n", sdirs->changed, __func__);
+	streams_unlisten(as, &lasfd, sdirs);
+	if(streams_close(streams, nstreams))
 		ret=-1;
-	}
 	if(manio_close(&ucmanio))
 	{
 		logp("error closing %s in %s\n", sdirs->unchanged, __func__);
 		ret=-1;
 	}
-	free_w(&deltmppath);
-	free_w(&last_requested);
+	if(!ret && nstreams>1 && merge_changed(sdirs, streams, nstreams))
+		ret=-1;
+	streams_free(as, &streams, nstreams);
 	sbuf_free(&cb);
-	sbuf_free(&p1b);
-	sbuf_free(&rb);
 	manio_close(&p1manio);
 	manio_close(&cmanio);
 	manio_close(&hmanio);
@@ -1,7 +1,40 @@
 #ifndef _BACKUP_PHASE2_SERVER_PROTOCOL1_H
 #define _BACKUP_PHASE2_SERVER_PROTOCOL1_H
 
+// The client can send phase2 data over more than one connection. Each one is
+// a stream, with its own file being requested and its own file being
+// received. The stream number goes on the end of the files that a stream
+// writes by itself.
+struct stream
+{
+	struct asfd *asfd;
+	struct sbuf *p1b; // file list from client
+	struct sbuf *rb; // receiving file from client
+	struct manio *chmanio; // changed data
+	char *changed;
+	char *deltmppath;
+	char *last_requested;
+	int outstanding; // Files asked for that have not come back yet.
+	uint8_t joined;
+	uint8_t ended; // Told the client that there are no more files.
+	uint8_t finished; // The client has agreed.
+};
+
 extern int backup_phase2_server_protocol1(struct async *as, struct sdirs *sdirs,
 	const char *incexc, int resume, struct conf **cconfs);
 
+#ifdef UTEST
+extern struct stream *streams_alloc(int n, struct asfd *asfd,
+	struct sdirs *sdirs);
+extern int streams_close(struct stream *streams, int n);
+extern void streams_free(struct async *as, struct stream **streams, int n);
+extern int streams_accept(struct async *as, struct asfd *lasfd,
+	struct stream *streams, int n);
+extern void stream_join(struct async *as, struct stream *s, int i,
+	const char *token);
+extern struct stream *stream_next(struct stream *streams, int n, int *next);
+extern int streams_all_here(struct stream *streams, int n, time_t listened);
+extern int merge_changed(struct sdirs *sdirs, struct stream *streams, int n);
+#endif
+
 #endif
@@ -525,7 +525,7 @@ static int maybe_delete_files_from_manifest(const char *manifesttmp,
 
         if(!(dfp=fzp_open(fdirs->deletionsfile, "rb"))
 	  || !(omzp=fzp_gzopen(fdirs->manifest, "rb"))
-	  || !(nmzp=fzp_gzopen(manifesttmp,
+	  || !(nmzp=fzp_zopen(manifesttmp,
 		comp_level(get_int(cconfs[OPT_COMPRESSION]))))
 	  || !(db=sbuf_alloc(PROTO_1))
 	  || !(mb=sbuf_alloc(PROTO_1)))
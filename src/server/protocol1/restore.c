@@ -113,7 +113,8 @@ static int do_send_file(struct asfd *asfd, struct sbuf *sb,
 				sb->path.cmd
 #endif
 				sb->protocol1->datapth.buf,
-				1, &bytes, cntr, &bfd, NULL, 0);
+				1, &bytes, cntr, &bfd, NULL, 0,
+				1 /* use_sendfile */);
 		}
 		// It might have been stored uncompressed. Gzip it during
 		// the send. If the client knew what kind of file it would be
@@ -145,7 +146,8 @@ static int do_send_file(struct asfd *asfd, struct sbuf *sb,
 				sb->path.cmd
 #endif
 				sb->protocol1->datapth.buf,
-				1, &bytes, cntr, &bfd, NULL, 0);
+				1, &bytes, cntr, &bfd, NULL, 0,
+				1 /* use_sendfile */);
 		}
 	}
 	bfd.close(&bfd, asfd);
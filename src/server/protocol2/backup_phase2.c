@@ -21,6 +21,7 @@
 #include "champ_chooser/champ_client.h"
 #include "champ_chooser/champ_server.h"
 #include "champ_chooser/hash.h"
+#include "blkz.h"
 #include "dpth.h"
 #include "backup_phase2.h"
 
@@ -359,6 +360,47 @@ end:
 	return ret;
 }
 
+// Data and signatures are only copied out of the frame, so they can be
+// dealt with straight from the read buffer. Everything else gets its own
+// copy first.
+static int deal_with_read_view(struct iobuf *view, struct slist *slist,
+	struct cntr *cntr, uint8_t *end_flags, struct dpth *dpth)
+{
+	struct iobuf rbuf;
+	switch(view->cmd)
+	{
+		case CMD_DATA:
+			return add_data_to_store(cntr, slist, view, dpth);
+		case CMD_SIG:
+			return add_to_sig_list(slist, view);
+		default:
+			break;
+	}
+	if(iobuf_dup(&rbuf, view))
+		return -1;
+	return deal_with_read(&rbuf, slist, cntr, end_flags, dpth);
+}
+
+// Deals with everything that the last read brought in. The first frame is
+// already in rbuf, and the rest are taken from the read buffer in batches.
+static int deal_with_reads(struct asfd *asfd, struct slist *slist,
+	struct cntr *cntr, uint8_t *end_flags, struct dpth *dpth)
+{
+	int i;
+	int n;
+	struct iobuf vec[ASFD_READ_BATCH];
+
+	if(asfd->rbuf->buf
+	  && deal_with_read(asfd->rbuf, slist, cntr, end_flags, dpth))
+		return -1;
+	while((n=asfd->read_batch(asfd, vec, ASFD_READ_BATCH))>0)
+		for(i=0; i<n; i++)
+			if(deal_with_read_view(&vec[i],
+				slist, cntr, end_flags, dpth))
+					return -1;
+	return n;
+}
+
 static int get_wbuf_from_sigs(struct iobuf *wbuf, struct slist *slist,
 	uint8_t *end_flags)
 {
@@ -716,11 +758,7 @@ static int mark_not_got(struct blk *blk, struct dpth *dpth)
 
 static struct hash_strong *in_local_hash(struct blk *blk)
 {
-	static struct hash_weak *hash_weak;
-
-	if(!(hash_weak=hash_weak_find(blk->fingerprint)))
-		return NULL;
-	return hash_strong_find(hash_weak, blk->md5sum);
+	return hash_strong_find(blk->fingerprint, blk->md5sum);
 }
 
 static int simple_deduplicate_blk(struct blk *blk)
@@ -910,6 +948,7 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 		sdirs->cfiles,
 		get_int(confs[OPT_MAX_STORAGE_SUBDIRS])))
 			goto end;
+	dpth->compression=get_int(confs[OPT_COMPRESSION_ZSTD]);
 	if(resume)
 	{
 		if(!(p1pos=do_resume(sdirs, dpth, confs)))
@@ -959,15 +998,8 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 			goto end;
 		}
 
-		while(asfd->rbuf->buf)
-		{
-			if(deal_with_read(asfd->rbuf, slist, cntr,
-				&end_flags, dpth))
-					goto end;
-			// Get as much out of the readbuf as possible.
-			if(asfd->parse_readbuf(asfd))
-				goto end;
-		}
+		if(deal_with_reads(asfd, slist, cntr, &end_flags, dpth))
+			goto end;
 		while(chfd->rbuf->buf)
 		{
 			if(deal_with_read_from_chfd(chfd,
@@ -1024,6 +1056,7 @@ end:
 	manios_close(&manios);
 	man_off_t_free(&p1pos);
 	blks_generate_free();
+	blkz_free();
 	hash_delete_all();
 	return ret;
 }
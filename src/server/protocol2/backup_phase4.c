@@ -14,8 +14,12 @@
 #include "../../server/manio.h"
 #include "../../server/sdirs.h"
 #include "champ_chooser/champ_chooser.h"
+#include "champ_chooser/sparse_file.h"
 #include "backup_phase4.h"
 
+// The most files that a merge will have open at once.
+#define MERGE_FAN_IN	256
+
 static int hookscmp(struct hooks *a, struct hooks *b)
 {
 	size_t i;
@@ -123,119 +127,6 @@ void hooks_free(struct hooks **hooks)
 	free_v((void **)hooks);
 }
 
-/* Merge two files of sorted sparse indexes into each other. */
-#ifndef UTEST
-static
-#endif
-int merge_sparse_indexes(const char *dst, const char *srca, const char *srcb)
-{
-	int fcmp;
-	int ret=-1;
-	struct sbuf *asb=NULL;
-	struct sbuf *bsb=NULL;
-	uint64_t *afingerprints=NULL;
-	uint64_t *bfingerprints=NULL;
-	size_t aflen=0;
-	size_t bflen=0;
-	struct fzp *azp=NULL;
-	struct fzp *bzp=NULL;
-	struct fzp *dzp=NULL;
-	struct hooks *anew=NULL;
-	struct hooks *bnew=NULL;
-	char *apath=NULL;
-	char *bpath=NULL;
-
-	if(!(asb=sbuf_alloc(PROTO_2))
-	  || (srcb && !(bsb=sbuf_alloc(PROTO_2))))
-		goto end;
-	if(build_path_w(dst))
-		goto end;
-	if((srca && !(azp=fzp_gzopen(srca, "rb")))
-	  || (srcb && !(bzp=fzp_gzopen(srcb, "rb")))
-	  || !(dzp=fzp_gzopen(dst, "wb")))
-		goto end;
-
-	while(azp || bzp || anew || bnew)
-	{
-		if(azp
-		  && asb
-		  && !anew)
-		{
-			switch(get_next_set_of_hooks(&anew, asb, azp,
-				&apath, &afingerprints, &aflen))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&azp); // Finished OK.
-			}
-		}
-
-		if(bzp
-		  && bsb
-		  && !bnew)
-		{
-			switch(get_next_set_of_hooks(&bnew, bsb, bzp,
-				&bpath, &bfingerprints, &bflen))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&bzp); // Finished OK.
-			}
-		}
-
-		if(anew && !bnew)
-		{
-			if(hooks_gzprintf(dzp, anew)) goto end;
-			hooks_free(&anew);
-		}
-		else if(!anew && bnew)
-		{
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&bnew);
-		}
-		else if(!anew && !bnew)
-		{
-			continue;
-		}
-		else if(!(fcmp=hookscmp(anew, bnew)))
-		{
-			// They were the same - write the new one.
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&anew);
-			hooks_free(&bnew);
-		}
-		else if(fcmp<0)
-		{
-			if(hooks_gzprintf(dzp, anew)) goto end;
-			hooks_free(&anew);
-		}
-		else
-		{
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&bnew);
-		}
-	}
-
-	if(fzp_close(&dzp))
-	{
-		logp("Error closing %s in %s\n", dst, __func__);
-		goto end;
-	}
-
-	ret=0;
-end:
-	fzp_close(&azp);
-	fzp_close(&bzp);
-	fzp_close(&dzp);
-	sbuf_free(&asb);
-	sbuf_free(&bsb);
-	hooks_free(&anew);
-	hooks_free(&bnew);
-	free_v((void **)&afingerprints);
-	free_v((void **)&bfingerprints);
-	free_w(&apath);
-	free_w(&bpath);
-	return ret;
-}
-
 #ifndef UTEST
 static
 #endif
@@ -263,9 +154,9 @@ static int get_next_dindex(uint64_t **dnew, struct sbuf *sb, struct fzp *fzp)
 	}
 	if(rbuf.cmd==CMD_SAVE_PATH)
 	{
-		if(blk_set_from_iobuf_savepath(&blk, &rbuf))
+		if(blk_set_from_iobuf_savepath(&blk, &rbuf)
+		  || !(*dnew=(uint64_t *)malloc_w(sizeof(uint64_t), __func__)))
 			goto error;
-		*dnew=(uint64_t *)malloc_w(sizeof(uint64_t), __func__);
 		**dnew=blk.savepath;
 		iobuf_free_content(&rbuf);
 		return 0;
@@ -278,141 +169,500 @@ error:
 	return -1;
 }
 
-/* Merge two files of sorted dindexes into each other. */
-int merge_dindexes(const char *dst, const char *srca, const char *srcb)
+// One of the sorted files being fed into a k-way merge, along with the
+// entry at the front of it.
+struct msrc
+{
+	int index;
+	struct fzp *fzp;
+	struct sbuf *sb;
+	void *entry;
+	// Read ahead state for get_next_set_of_hooks().
+	char *path;
+	uint64_t *fingerprints;
+	size_t len;
+};
+
+// What a k-way merge needs to know about the entries in the files.
+struct merge_ops
+{
+	// Return 0 for OK, -1 for error, 1 for finished reading the file.
+	int (*next)(struct msrc *src);
+	int (*cmp)(void *a, void *b);
+	int (*write)(struct fzp *fzp, void *entry);
+	void (*drop)(void **entry);
+};
+
+static int dindex_next(struct msrc *src)
+{
+	return get_next_dindex((uint64_t **)&src->entry, src->sb, src->fzp);
+}
+
+static int dindex_cmp(void *a, void *b)
+{
+	uint64_t *da=(uint64_t *)a;
+	uint64_t *db=(uint64_t *)b;
+	if(*da>*db) return 1;
+	if(*da<*db) return -1;
+	return 0;
+}
+
+static int dindex_write(struct fzp *fzp, void *entry)
+{
+	return dindex_gzprintf(fzp, (uint64_t *)entry);
+}
+
+static struct merge_ops dindex_ops={
+	dindex_next,
+	dindex_cmp,
+	dindex_write,
+	free_v
+};
+
+static int hooks_next(struct msrc *src)
+{
+	return get_next_set_of_hooks((struct hooks **)&src->entry, src->sb,
+		src->fzp, &src->path, &src->fingerprints, &src->len);
+}
+
+static int hooks_cmp(void *a, void *b)
 {
+	return hookscmp((struct hooks *)a, (struct hooks *)b);
+}
+
+static int hooks_write(struct fzp *fzp, void *entry)
+{
+	return hooks_gzprintf(fzp, (struct hooks *)entry);
+}
+
+static void hooks_drop(void **entry)
+{
+	hooks_free((struct hooks **)entry);
+}
+
+static struct merge_ops hooks_ops={
+	hooks_next,
+	hooks_cmp,
+	hooks_write,
+	hooks_drop
+};
+
+// Drop the entry at the front of the file, and read the next one.
+static int msrc_advance(struct msrc *src, struct merge_ops *ops)
+{
+	ops->drop(&src->entry);
+	while(src->fzp && !src->entry)
+	{
+		switch(ops->next(src))
+		{
+			case -1: return -1;
+			case 1: fzp_close(&src->fzp); // Finished OK.
+		}
+	}
+	return 0;
+}
+
+static void heap_sift_down(struct msrc **heap, int hlen, int i,
+	struct merge_ops *ops)
+{
+	int c;
+	struct msrc *tmp;
+	while((c=2*i+1)<hlen)
+	{
+		if(c+1<hlen
+		  && ops->cmp(heap[c+1]->entry, heap[c]->entry)<0)
+			c++;
+		if(ops->cmp(heap[c]->entry, heap[i]->entry)>=0)
+			break;
+		tmp=heap[i];
+		heap[i]=heap[c];
+		heap[c]=tmp;
+		i=c;
+	}
+}
+
+static void heap_sift_up(struct msrc **heap, int i, struct merge_ops *ops)
+{
+	int p;
+	struct msrc *tmp;
+	while(i>0)
+	{
+		p=(i-1)/2;
+		if(ops->cmp(heap[i]->entry, heap[p]->entry)>=0)
+			break;
+		tmp=heap[i];
+		heap[i]=heap[p];
+		heap[p]=tmp;
+		i=p;
+	}
+}
+
+static struct msrc *heap_pop(struct msrc **heap, int *hlen,
+	struct merge_ops *ops)
+{
+	struct msrc *top=heap[0];
+	heap[0]=heap[--(*hlen)];
+	heap_sift_down(heap, *hlen, 0, ops);
+	return top;
+}
+
+// Move on to the next entry in the file, and put it back in the heap if
+// there is one.
+static int heap_refill(struct msrc **heap, int *hlen, struct msrc *src,
+	struct merge_ops *ops)
+{
+	if(msrc_advance(src, ops))
+		return -1;
+	if(!src->entry)
+		return 0;
+	heap[*hlen]=src;
+	heap_sift_up(heap, (*hlen)++, ops);
+	return 0;
+}
+
+/* Merge any number of files of sorted entries into one, in a single pass.
+   Entries that are the same in more than one file are written once, and
+   the one from the latest file in the list wins. */
+static int kmerge(const char *dst, const char **srcs, int scount,
+	struct merge_ops *ops)
+{
+	int i;
 	int ret=-1;
-	struct sbuf *asb=NULL;
-	struct sbuf *bsb=NULL;
-	struct fzp *azp=NULL;
-	struct fzp *bzp=NULL;
+	int hlen=0;
+	struct msrc *best;
+	struct msrc *dup;
+	struct msrc *msrcs=NULL;
+	struct msrc **heap=NULL;
 	struct fzp *dzp=NULL;
-	uint64_t *anew=NULL;
-	uint64_t *bnew=NULL;
 
-	if(!(asb=sbuf_alloc(PROTO_2))
-	  || (srcb && !(bsb=sbuf_alloc(PROTO_2))))
-		goto end;
+	if(scount
+	  && (!(msrcs=(struct msrc *)
+		calloc_w(scount, sizeof(struct msrc), __func__))
+	    || !(heap=(struct msrc **)
+		calloc_w(scount, sizeof(struct msrc *), __func__))))
+			goto end;
 	if(build_path_w(dst))
 		goto end;
-	if((srca && !(azp=fzp_gzopen(srca, "rb")))
-	  || (srcb && !(bzp=fzp_gzopen(srcb, "rb")))
-	  || !(dzp=fzp_gzopen(dst, "wb")))
+	for(i=0; i<scount; i++)
+	{
+		msrcs[i].index=i;
+		if(!(msrcs[i].sb=sbuf_alloc(PROTO_2))
+		  || !(msrcs[i].fzp=fzp_gzopen(srcs[i], "rb")))
+			goto end;
+	}
+	if(!(dzp=fzp_zopen(dst, "wb")))
 		goto end;
 
-	while(azp || bzp || anew || bnew)
+	for(i=0; i<scount; i++)
+		if(heap_refill(heap, &hlen, &msrcs[i], ops))
+			goto end;
+
+	while(hlen)
 	{
-		if(azp
-		  && asb
-		  && !anew)
+		best=heap_pop(heap, &hlen, ops);
+		while(hlen && !ops->cmp(heap[0]->entry, best->entry))
 		{
-			switch(get_next_dindex(&anew, asb, azp))
+			dup=heap_pop(heap, &hlen, ops);
+			if(dup->index>best->index)
 			{
-				case -1: goto end;
-				case 1: fzp_close(&azp); // Finished OK.
+				struct msrc *tmp=best;
+				best=dup;
+				dup=tmp;
 			}
+			if(heap_refill(heap, &hlen, dup, ops))
+				goto end;
 		}
+		if(ops->write(dzp, best->entry)
+		  || heap_refill(heap, &hlen, best, ops))
+			goto end;
+	}
 
-		if(bzp
-		  && bsb
-		  && !bnew)
-		{
-			switch(get_next_dindex(&bnew, bsb, bzp))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&bzp); // Finished OK.
-			}
-		}
+	if(fzp_close(&dzp))
+	{
+		logp("Error closing %s in %s\n", dst, __func__);
+		goto end;
+	}
 
-		if(anew && !bnew)
-		{
-			if(dindex_gzprintf(dzp, anew)) goto end;
-			free_v((void **)&anew);
-		}
-		else if(!anew && bnew)
+	ret=0;
+end:
+	fzp_close(&dzp);
+	for(i=0; msrcs && i<scount; i++)
+	{
+		fzp_close(&msrcs[i].fzp);
+		sbuf_free(&msrcs[i].sb);
+		ops->drop(&msrcs[i].entry);
+		free_v((void **)&msrcs[i].fingerprints);
+		free_w(&msrcs[i].path);
+	}
+	free_v((void **)&msrcs);
+	free_v((void **)&heap);
+	return ret;
+}
+
+static int kmerge_pair(const char *dst, const char *srca, const char *srcb,
+	struct merge_ops *ops)
+{
+	int scount=0;
+	const char *srcs[2];
+	if(srca) srcs[scount++]=srca;
+	if(srcb) srcs[scount++]=srcb;
+	return kmerge(dst, srcs, scount, ops);
+}
+
+int kmerge_dindexes(const char *dst, const char **srcs, int scount)
+{
+	return kmerge(dst, srcs, scount, &dindex_ops);
+}
+
+int kmerge_sparse_indexes(const char *dst, const char **srcs, int scount)
+{
+	return kmerge(dst, srcs, scount, &hooks_ops);
+}
+
+/* Merge two files of sorted sparse indexes into each other. */
+#ifndef UTEST
+static
+#endif
+int merge_sparse_indexes(const char *dst, const char *srca, const char *srcb)
+{
+	return kmerge_pair(dst, srca, srcb, &hooks_ops);
+}
+
+/* Merge two files of sorted dindexes into each other. */
+int merge_dindexes(const char *dst, const char *srca, const char *srcb)
+{
+	return kmerge_pair(dst, srca, srcb, &dindex_ops);
+}
+
+static char *get_global_sparse_tmp(const char *global)
+{
+	return prepend_n(global, "tmp", strlen("tmp"), ".");
+}
+
+char *get_global_sparse_deltas_dir(const char *global)
+{
+	return prepend_n(global, "d", strlen("d"), ".");
+}
+
+static int check_sparse_lock(struct lock *lock, const char *func)
+{
+	if(lock->status==GET_LOCK_GOT)
+		return 0;
+	logp("Attempt to change sparse index without a lock in %s!\n", func);
+	return -1;
+}
+
+// Get the delta files of the global sparse index, oldest first. The flag
+// of each entry is its sequence number. Files whose names start with a dot
+// are still being written.
+int get_global_sparse_deltas(const char *global, struct strlist **deltas)
+{
+	int i=0;
+	int n=0;
+	int ret=-1;
+	char *dir=NULL;
+	char *path=NULL;
+	char *ep=NULL;
+	unsigned long long seq;
+	struct dirent **dp=NULL;
+
+	if(!(dir=get_global_sparse_deltas_dir(global)))
+		goto end;
+	if((n=scandir(dir, &dp, filter_dot, alphasort))<0)
+	{
+		n=0;
+		if(errno==ENOENT)
 		{
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&bnew);
+			ret=0;
+			goto end;
 		}
-		else if(!anew && !bnew)
-		{
+		logp("scandir failed for %s in %s: %s\n",
+			dir, __func__, strerror(errno));
+		goto end;
+	}
+	for(i=0; i<n; i++)
+	{
+		if(*dp[i]->d_name=='.')
 			continue;
-		}
-		else if(*anew==*bnew)
+		seq=strtoull(dp[i]->d_name, &ep, 16);
+		if(*ep)
 		{
-			// They were the same - write the new one.
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&anew);
-			free_v((void **)&bnew);
-		}
-		else if(*anew<*bnew)
-		{
-			if(dindex_gzprintf(dzp, anew)) goto end;
-			free_v((void **)&anew);
+			logp("Unexpected file in %s: %s\n",
+				dir, dp[i]->d_name);
+			continue;
 		}
-		else
+		free_w(&path);
+		if(!(path=prepend_s(dir, dp[i]->d_name))
+		  || strlist_add(deltas, path, (long)seq))
+			goto end;
+	}
+	ret=0;
+end:
+	if(ret)
+		strlists_free(deltas);
+	if(dp)
+	{
+		for(i=0; i<n; i++)
+			free(dp[i]);
+		free(dp);
+	}
+	free_w(&dir);
+	free_w(&path);
+	return ret;
+}
+
+static int copy_file(const char *src, const char *dst)
+{
+	int r;
+	int ret=-1;
+	char buf[65536];
+	struct fzp *szp=NULL;
+	struct fzp *dzp=NULL;
+
+	if(!(szp=fzp_open(src, "rb"))
+	  || !(dzp=fzp_open(dst, "wb")))
+		goto end;
+	while((r=fzp_read(szp, buf, sizeof(buf)))>0)
+	{
+		if(fzp_write(dzp, buf, (size_t)r)!=(size_t)r)
 		{
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&bnew);
+			logp("Short write to %s in %s\n", dst, __func__);
+			goto end;
 		}
 	}
-
+	if(!fzp_eof(szp))
+	{
+		logp("Error reading %s in %s\n", src, __func__);
+		goto end;
+	}
 	if(fzp_close(&dzp))
 	{
 		logp("Error closing %s in %s\n", dst, __func__);
 		goto end;
 	}
-
 	ret=0;
 end:
-	fzp_close(&azp);
-	fzp_close(&bzp);
+	fzp_close(&szp);
 	fzp_close(&dzp);
-	sbuf_free(&asb);
-	sbuf_free(&bsb);
-	free_v((void **)&anew);
-	free_v((void **)&bnew);
 	return ret;
 }
 
-static char *get_global_sparse_tmp(const char *global)
+/* Add the sparse index of one backup to the global sparse index, as a new
+   delta file. This only costs as much as the size of the backup's own
+   sparse index. compact_global_sparse() folds the deltas in later. */
+int append_to_global_sparse(const char *sparse, const char *global,
+	struct lock *lock)
 {
-	return prepend_n(global, "tmp", strlen("tmp"), ".");
+	int ret=-1;
+	long seq=0;
+	char *dir=NULL;
+	char *tmp=NULL;
+	char *dst=NULL;
+	char name[32]="";
+	struct strlist *s=NULL;
+	struct strlist *deltas=NULL;
+
+	if(check_sparse_lock(lock, __func__)
+	  || get_global_sparse_deltas(global, &deltas))
+		goto end;
+	for(s=deltas; s; s=s->next)
+		seq=s->flag+1;
+
+	if(!(dir=get_global_sparse_deltas_dir(global)))
+		goto end;
+	snprintf(name, sizeof(name), "%016lX", seq);
+	if(!(dst=prepend_s(dir, name))
+	  || !(tmp=prepend_n(dir, name, strlen(name), "/.")))
+		goto end;
+	if(build_path_w(dst)
+	  || copy_file(sparse, tmp)
+	  || do_rename(tmp, dst))
+		goto end;
+
+	ret=0;
+end:
+	if(ret && tmp)
+		unlink(tmp);
+	strlists_free(&deltas);
+	free_w(&dir);
+	free_w(&tmp);
+	free_w(&dst);
+	return ret;
 }
 
-int merge_into_global_sparse(const char *sparse, const char *global,
-	struct lock *lock)
+/* Fold all the delta files into the main global sparse index, making its
+   binary copy again afterwards. If this gets interrupted after the rename,
+   the deltas that were left behind just get merged in again next time,
+   which makes no difference to the result. */
+int compact_global_sparse(const char *global, struct lock *lock)
 {
+	int n;
 	int ret=-1;
+	int merged=0;
 	struct stat statp;
 	char *tmpfile=NULL;
-	const char *globalsrc=NULL;
+	const char *srcs[MERGE_FAN_IN];
+	struct strlist *s=NULL;
+	struct strlist *m=NULL;
+	struct strlist *deltas=NULL;
 
-	if(lock->status!=GET_LOCK_GOT)
+	if(check_sparse_lock(lock, __func__)
+	  || get_global_sparse_deltas(global, &deltas))
+		goto end;
+	if(!deltas)
 	{
-		logp("Attempt to merge into sparse index without a lock!\n");
+		ret=0;
 		goto end;
 	}
-
 	if(!(tmpfile=get_global_sparse_tmp(global)))
 		goto end;
 
-	if(!lstat(global, &statp)) globalsrc=global;
+	s=deltas;
+	while(s)
+	{
+		n=0;
+		if(!lstat(global, &statp))
+			srcs[n++]=global;
+		for(m=s; m && n<MERGE_FAN_IN; m=m->next)
+			srcs[n++]=m->path;
+		if(kmerge_sparse_indexes(tmpfile, srcs, n)
+		  || do_rename(tmpfile, global))
+			goto end;
+		for(; s!=m; s=s->next)
+		{
+			if(unlink_w(s->path, __func__))
+				goto end;
+			merged++;
+		}
+	}
+	logp("Compacted %d sparse index deltas into %s\n", merged, global);
 
-	if(merge_sparse_indexes(tmpfile, globalsrc, sparse))
-		goto end;
-
-	// FIX THIS: nasty race condition needs to be recoverable.
-	if(do_rename(tmpfile, global))
+	if(sparse_file_generate(global))
 		goto end;
 
 	ret=0;
 end:
+	strlists_free(&deltas);
 	free_w(&tmpfile);
 	return ret;
 }
 
-static int lock_and_merge_into_global_sparse(const char *sparse,
+// Return 1 if the global sparse index has enough deltas that it is worth
+// compacting, 0 if not, -1 for error.
+int global_sparse_needs_compacting(const char *global)
+{
+	int count=0;
+	struct strlist *s=NULL;
+	struct strlist *deltas=NULL;
+	if(get_global_sparse_deltas(global, &deltas))
+		return -1;
+	for(s=deltas; s; s=s->next)
+		count++;
+	strlists_free(&deltas);
+	return count>=SPARSE_DELTAS_MAX;
+}
+
+static int lock_and_append_to_global_sparse(const char *sparse,
 	const char *global)
 {
 	int ret=-1;
@@ -421,7 +671,7 @@ static int lock_and_merge_into_global_sparse(const char *sparse,
 	if(!(lock=try_to_get_sparse_lock(global)))
 		goto end;
 
-	if(merge_into_global_sparse(sparse, global, lock))
+	if(append_to_global_sparse(sparse, global, lock))
 		goto end;
 
 	ret=0;
@@ -431,74 +681,70 @@ end:
 	return ret;
 }
 
-int merge_files_in_dir(const char *final, const char *fmanifest,
-	const char *srcdir, uint64_t fcount,
-	int merge(const char *dst, const char *srca, const char *srcb))
+static void paths_free(char ***paths, uint64_t count)
+{
+	uint64_t i;
+	if(!*paths) return;
+	for(i=0; i<count; i++)
+		free_w(&(*paths)[i]);
+	free_v((void **)paths);
+}
+
+/* Merge a list of sorted files into final. No more than fan_in of them are
+   opened at once, so a long list gets merged into m1/m2 scratch directories
+   first, fan_in at a time. */
+#ifndef UTEST
+static
+#endif
+int merge_file_list(const char *final, const char *fmanifest,
+	char **srcs, uint64_t scount, uint64_t fan_in,
+	int merge(const char *dst, const char **srcs, int scount))
 {
 	int ret=-1;
 	uint64_t i=0;
+	uint64_t n=0;
 	uint64_t pass=0;
+	uint64_t dcount=0;
 	char *m1dir=NULL;
 	char *m2dir=NULL;
-	char *srca=NULL;
-	char *srcb=NULL;
-	char *dst=NULL;
-	char compa[32]="";
-	char compb[32]="";
+	char **cur=srcs;
+	char **dsts=NULL;
 	char compd[32]="";
-	char *fullsrcdir=NULL;
 
 	if(!(m1dir=prepend_s(fmanifest, "m1"))
-	  || !(m2dir=prepend_s(fmanifest, "m2"))
-	  || !(fullsrcdir=prepend_s(fmanifest, srcdir)))
+	  || !(m2dir=prepend_s(fmanifest, "m2")))
 		goto end;
 	if(recursive_delete(m1dir)
 	  || recursive_delete(m2dir))
 		goto end;
-	while(1)
+
+	while(scount)
 	{
-		const char *srcdir=NULL;
-		const char *dstdir=NULL;
-		if(!pass)
-		{
-			srcdir=fullsrcdir;
-			dstdir=m1dir;
-		}
-		else if(pass%2)
-		{
-			srcdir=m1dir;
-			dstdir=m2dir;
-		}
-		else
-		{
-			srcdir=m2dir;
-			dstdir=m1dir;
-		}
-		pass++;
-		for(i=0; i<fcount; i+=2)
+		const char *dstdir=(pass%2)?m2dir:m1dir;
+		dcount=(scount+fan_in-1)/fan_in;
+		if(!(dsts=(char **)calloc_w(dcount, sizeof(char *), __func__)))
+			goto end;
+		for(i=0; i<dcount; i++)
 		{
-			free_w(&srca);
-			free_w(&srcb);
-			free_w(&dst);
-			snprintf(compa, sizeof(compa), "%08" PRIX64, i);
-			snprintf(compb, sizeof(compb), "%08" PRIX64, i+1);
-			snprintf(compd, sizeof(compd), "%08" PRIX64, i/2);
-			if(!(srca=prepend_s(srcdir, compa))
-			  || !(dst=prepend_s(dstdir, compd)))
-				goto end;
-			if(i+1<fcount
-			  && !(srcb=prepend_s(srcdir, compb)))
+			snprintf(compd, sizeof(compd), "%08" PRIX64, i);
+			if(!(dsts[i]=prepend_s(dstdir, compd)))
 				goto end;
-			if(merge(dst, srca, srcb))
+			n=scount-i*fan_in;
+			if(n>fan_in) n=fan_in;
+			if(merge(dsts[i], (const char **)cur+i*fan_in, (int)n))
 				goto end;
 		}
-		fcount=i/2;
-		if(fcount<2) break;
+		if(cur!=srcs) paths_free(&cur, scount);
+		cur=dsts;
+		scount=dcount;
+		dsts=NULL;
+		pass++;
+		if(scount<2) break;
 	}
 
 	// FIX THIS: nasty race condition here needs to be automatically
 	// recoverable.
-	if(dst && do_rename(dst, final))
+	if(scount && do_rename(cur[0], final))
 		goto end;
 	if(recursive_delete(m1dir)
 	  || recursive_delete(m2dir))
@@ -506,34 +752,56 @@ int merge_files_in_dir(const char *final, const char *fmanifest,
 
 	ret=0;
 end:
+	if(cur!=srcs) paths_free(&cur, scount);
+	paths_free(&dsts, dcount);
 	free_w(&m1dir);
 	free_w(&m2dir);
-	free_w(&srca);
-	free_w(&srcb);
-	free_w(&dst);
+	return ret;
+}
+
+int merge_files_in_dir(const char *final, const char *fmanifest,
+	const char *srcdir, uint64_t fcount,
+	int merge(const char *dst, const char **srcs, int scount))
+{
+	int ret=-1;
+	uint64_t i=0;
+	char **srcs=NULL;
+	char compa[32]="";
+	char *fullsrcdir=NULL;
+
+	if(!(fullsrcdir=prepend_s(fmanifest, srcdir)))
+		goto end;
+	if(fcount
+	  && !(srcs=(char **)calloc_w(fcount, sizeof(char *), __func__)))
+		goto end;
+	for(i=0; i<fcount; i++)
+	{
+		snprintf(compa, sizeof(compa), "%08" PRIX64, i);
+		if(!(srcs[i]=prepend_s(fullsrcdir, compa)))
+			goto end;
+	}
+
+	if(merge_file_list(final, fmanifest, srcs, fcount,
+		MERGE_FAN_IN, merge))
+			goto end;
+
+	ret=0;
+end:
+	paths_free(&srcs, fcount);
 	free_w(&fullsrcdir);
 	return ret;
 }
 
 int merge_files_in_dir_no_fcount(const char *final, const char *fmanifest,
-	int merge(const char *dst, const char *srca, const char *srcb))
+	int merge(const char *dst, const char **srcs, int scount))
 {
 	int ret=-1;
 	int n=0;
 	int i=0;
-	char *dst=NULL;
-	char *dstdir=NULL;
-	char compd[32]="";
 	char *fullpath=NULL;
+	char **srcs=NULL;
 	uint64_t fcount=0;
 	struct dirent **dir=NULL;
-	struct strlist *s=NULL;
-	struct strlist *slist=NULL;
-
-	if(!(dstdir=prepend_s(fmanifest, "n1")))
-		goto end;
-	if(recursive_delete(dstdir))
-		goto end;
 
 	// Files are unsorted, and not named sequentially.
 	if((n=scandir(fmanifest, &dir, filter_dot, NULL))<0)
@@ -542,6 +810,8 @@ int merge_files_in_dir_no_fcount(const char *final, const char *fmanifest,
 			fmanifest, __func__, strerror(errno));
 		goto end;
 	}
+	if(n && !(srcs=(char **)calloc_w(n, sizeof(char *), __func__)))
+		goto end;
 	for(i=0; i<n; i++)
 	{
 		free_w(&fullpath);
@@ -557,33 +827,17 @@ int merge_files_in_dir_no_fcount(const char *final, const char *fmanifest,
 		}
 
 		// Have a good entry. Add it to the list.
-		if(strlist_add(&slist, fullpath, 0))
-			goto end;
-		fcount++;
+		srcs[fcount++]=fullpath;
+		fullpath=NULL;
 	}
 
-	// Merge them all into a directory, name the files sequentially.
-	i=0;
-	for(s=slist; s; s=s->next)
-	{
-		free_w(&dst);
-		snprintf(compd, sizeof(compd), "%08" PRIX64, (uint64_t)i++);
-		if(!(dst=prepend_s(dstdir, compd)))
-			goto end;
-		if(merge(dst, s->path, s->next?s->next->path:NULL))
+	if(merge_file_list(final, fmanifest, srcs, fcount,
+		MERGE_FAN_IN, merge))
 			goto end;
-	}
-
-	// Now do a normal merge.
-	if(merge_files_in_dir(final, fmanifest, "n1", fcount, merge))
-		goto end;
 
 	ret=0;
 end:
-	recursive_delete(dstdir);
-	strlists_free(&slist);
-	free_w(&dstdir);
-	free_w(&dst);
+	paths_free(&srcs, fcount);
 	free_w(&fullpath);
 	if(dir)
 	{
@@ -619,14 +873,14 @@ int backup_phase4_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 
 	if(merge_files_in_dir(dfiles, fmanifest, "dindex",
 		newmanio->offset->fcount,
-		merge_dindexes))
+		kmerge_dindexes))
 			goto end;
 	if(merge_files_in_dir(sparse, fmanifest, "hooks",
 		newmanio->offset->fcount,
-		merge_sparse_indexes))
+		kmerge_sparse_indexes))
 			goto end;
 
-	if(lock_and_merge_into_global_sparse(sparse, sdirs->global_sparse))
+	if(lock_and_append_to_global_sparse(sparse, sdirs->global_sparse))
 		goto end;
 
 	logp("End phase4 (sparse generation)\n");
@@ -716,7 +970,7 @@ int regenerate_client_dindex(struct sdirs *sdirs)
 	if(recursive_delete(dfiles_new))
 		goto end;
 	if(merge_files_in_dir(dfiles_new, sdirs->client,
-		"dindex", last_index, merge_dindexes))
+		"dindex", last_index, kmerge_dindexes))
 			goto end;
 
 	// If the champ chooser is deleting files, we do not want to mess with
@@ -747,6 +1001,7 @@ int remove_from_global_sparse(const char *global_sparse,
 	const char *candidate_str)
 {
 	int ret=-1;
+	struct stat statp;
 	struct lock *lock=NULL;
 	struct sbuf *asb=NULL;
 	uint64_t *afingerprints=NULL;
@@ -762,9 +1017,19 @@ int remove_from_global_sparse(const char *global_sparse,
 	if(!(lock=try_to_get_sparse_lock(global_sparse)))
 		goto end;
 
+	// The candidate might be in any of the deltas, so get them all into
+	// the main file first.
+	if(compact_global_sparse(global_sparse, lock))
+		goto end;
+	if(lstat(global_sparse, &statp))
+	{
+		ret=0;
+		goto end;
+	}
+
 	if(!(tmpfile=get_global_sparse_tmp(global_sparse))
 	  || !(azp=fzp_gzopen(global_sparse, "rb"))
-	  || !(dzp=fzp_gzopen(tmpfile, "wb"))
+	  || !(dzp=fzp_zopen(tmpfile, "wb"))
 	  || !(asb=sbuf_alloc(PROTO_2)))
 		goto end;
 
@@ -797,6 +1062,7 @@ int remove_from_global_sparse(const char *global_sparse,
 
 	// FIX THIS: nasty race condition needs to be recoverable.
 	if(do_rename(tmpfile, global_sparse)) goto end;
+	if(sparse_file_generate(global_sparse)) goto end;
 
 	ret=0;
 end:
@@ -4,6 +4,7 @@
 #include "../../fzp.h"
 #include "../../lock.h"
 #include "../../sbuf.h"
+#include "../../strlist.h"
 
 struct hooks
 {
@@ -17,15 +18,29 @@ extern int backup_phase4_server_protocol2(struct sdirs *sdirs,
 // Never call regenerate_client_dindex() outside of backup phases 2 to 4!
 extern int regenerate_client_dindex(struct sdirs *sdirs);
 extern int merge_dindexes(const char *dst, const char *srca, const char *srcb);
+extern int kmerge_dindexes(const char *dst, const char **srcs, int scount);
+extern int kmerge_sparse_indexes(const char *dst,
+	const char **srcs, int scount);
 extern int merge_files_in_dir(const char *final,
 	const char *fmanifest, const char *srcdir, uint64_t fcount,
-	int merge(const char *dst, const char *src, const char *srcb));
+	int merge(const char *dst, const char **srcs, int scount));
 extern int merge_files_in_dir_no_fcount(const char *final,
 	const char *fmanifest,
-	int merge(const char *dst, const char *srca, const char *srcb));
+	int merge(const char *dst, const char **srcs, int scount));
 
-extern int merge_into_global_sparse(const char *sparse, const char *global,
+// The global sparse index is the 'sparse' file, plus a delta file in
+// 'sparse.d' for each backup that has finished since the last time that
+// they were compacted into it. The champ chooser reads them all, and
+// compacts them when there are this many.
+#define SPARSE_DELTAS_MAX	32
+
+extern char *get_global_sparse_deltas_dir(const char *global);
+extern int get_global_sparse_deltas(const char *global,
+	struct strlist **deltas);
+extern int append_to_global_sparse(const char *sparse, const char *global,
 	struct lock *lock);
+extern int compact_global_sparse(const char *global, struct lock *lock);
+extern int global_sparse_needs_compacting(const char *global);
 
 #ifdef UTEST
 extern void hooks_free(struct hooks **hooks);
@@ -35,6 +50,9 @@ extern int merge_sparse_indexes(const char *dst,
 extern int dindex_gzprintf(struct fzp *fzp, uint64_t *dindex);
 extern int get_next_set_of_hooks(struct hooks **hnew, struct sbuf *sb,
 	struct fzp *spzp, char **path, uint64_t **fingerprints, size_t *len);
+extern int merge_file_list(const char *final, const char *fmanifest,
+	char **srcs, uint64_t scount, uint64_t fan_in,
+	int merge(const char *dst, const char **srcs, int scount));
 #endif
 
 extern int remove_from_global_sparse(const char *global_sparse,
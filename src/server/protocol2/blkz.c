@@ -0,0 +1,113 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../cmd.h"
+#include "../../iobuf.h"
+#include "../../log.h"
+#include "blkz.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+// The length of a block has to fit in the four hex digits of its frame.
+#define BLKZ_MAX	0xFFFF
+
+static ZSTD_CCtx *cctx=NULL;
+static ZSTD_DCtx *dctx=NULL;
+static char *zbuf_static=NULL;
+static size_t zbuf_static_len=0;
+
+// Returns 0 with zbuf set to the compressed block, or 1 if the block should
+// be stored as it is, because compressing it did not make it any smaller.
+int blkz_compress(const char *buf, size_t len, int level,
+	const char **zbuf, size_t *zlen)
+{
+	size_t r;
+	if(len<2)
+		return 1;
+	if(!cctx && !(cctx=ZSTD_createCCtx()))
+	{
+		logp("Could not create zstd context in %s\n", __func__);
+		return -1;
+	}
+	if(zbuf_static_len<len)
+	{
+		if(!(zbuf_static=(char *)
+			realloc_w(zbuf_static, len, __func__)))
+		{
+			zbuf_static_len=0;
+			return -1;
+		}
+		zbuf_static_len=len;
+	}
+	// There is only room for something smaller than the original, so
+	// anything else comes back as an error.
+	r=ZSTD_compressCCtx(cctx, zbuf_static, len-1, buf, len, level);
+	if(ZSTD_isError(r))
+		return 1;
+	*zbuf=zbuf_static;
+	*zlen=r;
+	return 0;
+}
+
+// Replaces a CMD_DATA_ZSTD block with the CMD_DATA block that it came from.
+int blkz_decompress(struct iobuf *iobuf)
+{
+	size_t r;
+	char *buf=NULL;
+	unsigned long long len;
+
+	len=ZSTD_getFrameContentSize(iobuf->buf, iobuf->len);
+	if(len==ZSTD_CONTENTSIZE_UNKNOWN
+	  || len==ZSTD_CONTENTSIZE_ERROR
+	  || len>BLKZ_MAX)
+	{
+		logp("Bad compressed block in %s\n", __func__);
+		return -1;
+	}
+	if(!dctx && !(dctx=ZSTD_createDCtx()))
+	{
+		logp("Could not create zstd context in %s\n", __func__);
+		return -1;
+	}
+	if(!(buf=(char *)malloc_w((size_t)len+1, __func__)))
+		return -1;
+	r=ZSTD_decompressDCtx(dctx, buf, (size_t)len, iobuf->buf, iobuf->len);
+	if(ZSTD_isError(r) || r!=len)
+	{
+		logp("Could not decompress block in %s: %s\n", __func__,
+			ZSTD_isError(r)?ZSTD_getErrorName(r):"short block");
+		free_w(&buf);
+		return -1;
+	}
+	buf[len]='\0';
+	iobuf_free_content(iobuf);
+	iobuf_set(iobuf, CMD_DATA, buf, (size_t)len);
+	return 0;
+}
+
+void blkz_free(void)
+{
+	ZSTD_freeCCtx(cctx);
+	ZSTD_freeDCtx(dctx);
+	cctx=NULL;
+	dctx=NULL;
+	free_w(&zbuf_static);
+	zbuf_static_len=0;
+}
+#else
+int blkz_compress(const char *buf, size_t len, int level,
+	const char **zbuf, size_t *zlen)
+{
+	return 1;
+}
+
+int blkz_decompress(struct iobuf *iobuf)
+{
+	logp("Cannot read compressed block, zstd support was not compiled in\n");
+	return -1;
+}
+
+void blkz_free(void)
+{
+}
+#endif
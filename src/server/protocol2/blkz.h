@@ -0,0 +1,15 @@
+#ifndef _BLKZ_H
+#define _BLKZ_H
+
+struct iobuf;
+
+// Compression of single blocks in the data files. A compressed block is
+// stored as CMD_DATA_ZSTD rather than CMD_DATA, so every block says for
+// itself how it needs to be read back, and data files can hold both.
+
+extern int blkz_compress(const char *buf, size_t len, int level,
+	const char **zbuf, size_t *zlen);
+extern int blkz_decompress(struct iobuf *iobuf);
+extern void blkz_free(void);
+
+#endif
@@ -232,7 +232,7 @@ static int merge_in_client_sparse_indexes(struct cstat *c,
 		if(!(sparse=prepend_s(b->path, "manifest/sparse")))
 			goto end;
 		logp("merge: %s\n", sparse);
-		if(merge_into_global_sparse(sparse,
+		if(append_to_global_sparse(sparse,
 			global_sparse, sparse_lock))
 				goto end;
 	}
@@ -245,6 +245,8 @@ end:
 
 static int merge_in_all_sparse_indexes(const char *global_sparse)
 {
+	int ret=-1;
+	char *deltas=NULL;
 	struct cstat *c;
 
 	if(!is_reg_lstat(global_sparse)
@@ -252,13 +254,22 @@ static int merge_in_all_sparse_indexes(const char *global_sparse)
 	{
 		logp("Could not delete %s: %s\n",
 			global_sparse, strerror(errno));
-		return -1;
+		goto end;
 	}
+	if(!(deltas=get_global_sparse_deltas_dir(global_sparse))
+	  || recursive_delete(deltas))
+		goto end;
 
+	// Add each backup as a delta, then merge them all in one go.
 	for(c=clist; c; c=c->next)
 		if(merge_in_client_sparse_indexes(c, global_sparse))
-			return -1;
-	return 0;
+			goto end;
+	if(compact_global_sparse(global_sparse, sparse_lock))
+		goto end;
+	ret=0;
+end:
+	free_w(&deltas);
+	return ret;
 }
 
 int run_bsparse(int argc, char *argv[])
@@ -303,6 +314,7 @@ int run_bsparse(int argc, char *argv[])
 	if(!(globalcs=load_conf(configfile, directory, dedup_group))
 	  || !(sdirs=get_sdirs(globalcs)))
 		goto end;
+	fzp_set_zstd_level(get_int(globalcs[OPT_COMPRESSION_ZSTD]));
 
 	logp("clients: %s\n", sdirs->clients);
 	logp("sparse file: %s\n", sdirs->global_sparse);
@@ -8,8 +8,6 @@
 #include "scores.h"
 #include "sparse.h"
 
-#include <assert.h>
-
 struct candidate **candidates=NULL;
 size_t candidates_len=0;
 
@@ -43,14 +41,7 @@ void candidates_free(void)
 	for(size_t c=0; c<candidates_len; c++)
 		candidate_free(&(candidates[c]));
 	free_v((void **)&candidates);
-}
-
-static void candidates_set_score_pointers(struct candidate **candidates,
-	struct scores *scores)
-{
-	size_t a;
-	for(a=0; candidates && a<candidates_len; a++)
-		candidates[a]->score=&(scores->scores[a]);
+	candidates_len=0;
 }
 
 struct candidate *candidates_add_new(void)
@@ -62,6 +53,7 @@ struct candidate *candidates_add_new(void)
 	if(!(candidates=(struct candidate **)realloc_w(candidates,
 		(candidates_len+1)*sizeof(struct candidate *), __func__)))
 			return NULL;
+	candidate->id=(uint32_t)candidates_len;
 	candidates[candidates_len++]=candidate;
 	return candidate;
 }
@@ -122,12 +114,12 @@ enum cand_ret candidate_load(struct candidate *candidate, const char *path,
 	}
 
 end:
-	if(scores_grow(scores, candidates_len))
+	if(scores_grow(scores, candidates_len)
+	  || sparse_prepare())
 	{
 		ret=CAND_RET_PERM;
 		goto error;
 	}
-	candidates_set_score_pointers(candidates, scores);
 	scores_reset(scores);
 	//logp("Now have %d candidates\n", (int)candidates_len);
 	ret=CAND_RET_OK;
@@ -174,78 +166,104 @@ error:
 	return -1;
 }
 
+// Whether the candidate is in a sorted posting list.
+static int postings_contain(uint32_t *ids, size_t len, uint32_t id)
+{
+	size_t lo=0;
+	size_t hi=len;
+	size_t mid;
+	while(lo<hi)
+	{
+		mid=lo+(hi-lo)/2;
+		if(ids[mid]<id)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo<len && ids[lo]==id;
+}
+
+// Find the candidate with the highest score. On a tie, prefer the newest
+// candidate, since it is the most likely to still have its data around.
+static struct candidate *scores_argmax(struct scores *scores)
+{
+	size_t a;
+	uint16_t max;
+	uint16_t *sc=scores->scores;
+
+	while((max=scores_max(scores)))
+	{
+		for(a=scores->size; a-->0; )
+		{
+			if(sc[a]!=max)
+				continue;
+			if(a<candidates_len && !candidates[a]->deleted
+			  && !scores_is_deleted(scores, a))
+				return candidates[a];
+			// Deleted candidates should not be chosen, so
+			// take them out of the running and try again.
+			sc[a]=0;
+		}
+	}
+	return NULL;
+}
+
+// Mark the candidates that deduplicate() found to be gone. The caller
+// must make sure that no other thread is reading the candidates.
+void candidates_set_deleted(uint32_t *ids, size_t len)
+{
+	size_t i;
+	for(i=0; i<len; i++)
+		if(ids[i]<candidates_len)
+			candidates[ids[i]]->deleted=1;
+}
+
 struct candidate *candidates_choose_champ(struct incoming *in,
 	struct candidate *champ_last, struct scores *scores)
 {
-	static uint16_t i;
-	static uint16_t s;
-	static struct sparse *sparse;
-	static struct candidate *best;
-	static struct candidate *candidate;
-	static uint16_t *score;
-
-	best=NULL;
+	int l;
+	size_t s;
+	uint16_t i;
+	uint16_t *sc;
+	uint32_t *ids[SPARSE_LEVELS];
+	size_t len[SPARSE_LEVELS];
 
 	//struct timespec tstart={0,0}, tend={0,0};
 	//clock_gettime(CLOCK_MONOTONIC, &tstart);
 
 	scores_reset(scores);
+	if(!scores || !scores->scores) return NULL;
+	sc=scores->scores;
 
 	for(i=0; i<in->size; i++)
 	{
 		if(in->found[i]) continue;
 
-		if(!(sparse=sparse_find(&in->fingerprints[i])))
-			continue;
-		for(s=0; s<sparse->size; s++)
+		for(l=0; l<SPARSE_LEVELS; l++)
+			ids[l]=sparse_find(in->fingerprints[i], l, &len[l]);
+
+		if(champ_last)
 		{
-			candidate=sparse->candidates[s];
-			if(candidate->deleted) continue;
-			if(candidate==champ_last)
+			// Want to exclude sparse entries that have
+			// already been found.
+			for(l=0; l<SPARSE_LEVELS; l++)
+				if(postings_contain(ids[l], len[l],
+					champ_last->id)) break;
+			if(l<SPARSE_LEVELS)
 			{
-				int t;
-				// Want to exclude sparse entries that have
-				// already been found.
 				in->found[i]=1;
-				// Need to go back up the list, subtracting
-				// scores.
-				for(t=s-1; t>=0; t--)
-				{
-					(*(sparse->candidates[t]->score))--;
-//	printf("%d %s   fix: %d\n", i, candidate->path, *(sparse->candidates[t]->score));
-				}
-				break;
+				continue;
 			}
-			score=candidate->score;
-			(*score)++;
-//			printf("%d %s score: %d\n", i, candidate->path, *score);
-			assert(*score<=in->size);
-			if(!best
-			// Maybe should check for candidate!=best here too.
-			  || *score>*(best->score))
-			{
-				best=candidate;
-/*
-				printf("%s is now best:\n",
-					best->path);
-				printf("    score %p %d\n",
-					best->score, *(best->score));
-*/
-			}
-			// FIX THIS: figure out a way of giving preference to
-			// newer candidates.
 		}
+
+		for(l=0; l<SPARSE_LEVELS; l++)
+			for(s=0; s<len[l]; s++)
+				sc[ids[l][s]]++;
 	}
 	//clock_gettime(CLOCK_MONOTONIC, &tend);
 	//printf("champ_chooser took about %.5f seconds\n",
 	//	((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - 
 	//	((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec));
 
-/*
-	if(best)
-		printf("%s is choice:\nscore %p %d\n", best->path, best->score, *(best->score));
-	else
-		printf("no choice\n");
-*/
-	return best;
+	return scores_argmax(scores);
 }
@@ -13,7 +13,7 @@ enum cand_ret
 
 struct candidate
 {
-	uint16_t *score;
+	uint32_t id; // Index into candidates, and into the scores array.
 	uint16_t deleted;
 	char *path;
 };
@@ -27,6 +27,7 @@ extern enum cand_ret candidate_load(struct candidate *candidate,
 	const char *path, struct scores *scores);
 extern int candidate_add_fresh(const char *path, const char *directory,
 	struct scores *scores);
+extern void candidates_set_deleted(uint32_t *ids, size_t len);
 extern struct candidate *candidates_choose_champ(struct incoming *in,
 	struct candidate *champ_last, struct scores *scores);
 
@@ -0,0 +1,191 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "champ_cache.h"
+#include "hash.h"
+
+#include <uthash.h>
+
+// Consecutive segments of a backup tend to choose the same champions, so
+// keep the blocks of recently loaded champions in memory, up to a budget,
+// and throw away the least recently used ones when it is exceeded.
+// Each champ_workers thread has its own cache.
+
+struct champ_cache
+{
+	char *path;
+	struct hash_strong *entries;
+	uint32_t count;
+	size_t bytes;
+	struct champ_cache *prev; // Towards the most recently used.
+	struct champ_cache *next; // Towards the least recently used.
+	UT_hash_handle hh;
+};
+
+static THREAD_LOCAL struct champ_cache *cache_table=NULL;
+static THREAD_LOCAL struct champ_cache *lru_head=NULL;
+static THREAD_LOCAL struct champ_cache *lru_tail=NULL;
+static THREAD_LOCAL size_t cache_bytes=0;
+static THREAD_LOCAL size_t cache_max=0;
+static THREAD_LOCAL uint64_t hits=0;
+static THREAD_LOCAL uint64_t misses=0;
+
+static void lru_unlink(struct champ_cache *c)
+{
+	if(c->prev) c->prev->next=c->next;
+	else lru_head=c->next;
+	if(c->next) c->next->prev=c->prev;
+	else lru_tail=c->prev;
+	c->prev=NULL;
+	c->next=NULL;
+}
+
+static void lru_push_head(struct champ_cache *c)
+{
+	c->prev=NULL;
+	c->next=lru_head;
+	if(lru_head) lru_head->prev=c;
+	lru_head=c;
+	if(!lru_tail) lru_tail=c;
+}
+
+static void champ_cache_entry_free(struct champ_cache **c)
+{
+	if(!c || !*c) return;
+	free_w(&(*c)->path);
+	free_v((void **)&(*c)->entries);
+	free_v((void **)c);
+}
+
+static void champ_cache_remove(struct champ_cache *c)
+{
+	lru_unlink(c);
+	HASH_DEL(cache_table, c);
+	cache_bytes-=c->bytes;
+	champ_cache_entry_free(&c);
+}
+
+void champ_cache_init(size_t max_bytes)
+{
+	cache_max=max_bytes;
+	hits=0;
+	misses=0;
+}
+
+void champ_cache_free(void)
+{
+	if(hits || misses)
+		logp("champ cache: %" PRIu64 " hits, %" PRIu64 " misses\n",
+			hits, misses);
+	while(lru_head)
+		champ_cache_remove(lru_head);
+	cache_max=0;
+}
+
+static int add_entries_to_hash(struct champ_cache *c)
+{
+	uint32_t i;
+	for(i=0; i<c->count; i++)
+		if(hash_add(c->entries[i].weak,
+			c->entries[i].md5sum, c->entries[i].savepath))
+				return -1;
+	return 0;
+}
+
+static enum hash_ret cache_hit(struct champ_cache *c,
+	const char *champ, const char *directory)
+{
+	char *path=NULL;
+	struct stat statp;
+
+	// Make sure that the champion has not been deleted since it was
+	// cached, or we might point at data files that no longer exist.
+	if(!(path=prepend_s(directory, champ)))
+		return HASH_RET_PERM;
+	if(lstat(path, &statp))
+	{
+		free_w(&path);
+		champ_cache_remove(c);
+		return HASH_RET_TEMP;
+	}
+	free_w(&path);
+
+	hits++;
+	lru_unlink(c);
+	lru_push_head(c);
+	if(add_entries_to_hash(c))
+		return HASH_RET_PERM;
+	return HASH_RET_OK;
+}
+
+static enum hash_ret cache_miss(const char *champ, const char *directory)
+{
+	enum hash_ret ret;
+	struct champ_cache *c=NULL;
+
+	misses++;
+	if(!(c=(struct champ_cache *)
+		calloc_w(1, sizeof(struct champ_cache), __func__))
+	  || !(c->path=strdup_w(champ, __func__)))
+	{
+		ret=HASH_RET_PERM;
+		goto error;
+	}
+	if((ret=hash_load_entries(champ, directory, &c->entries, &c->count))
+		!=HASH_RET_OK)
+			goto error;
+	if(add_entries_to_hash(c))
+	{
+		ret=HASH_RET_PERM;
+		goto error;
+	}
+	c->bytes=sizeof(struct champ_cache)+strlen(c->path)+1
+		+c->count*sizeof(struct hash_strong);
+	if(c->bytes>cache_max)
+	{
+		// Too big to ever fit.
+		champ_cache_entry_free(&c);
+		return HASH_RET_OK;
+	}
+
+	HASH_ADD_KEYPTR(hh, cache_table, c->path, strlen(c->path), c);
+	lru_push_head(c);
+	cache_bytes+=c->bytes;
+	while(cache_bytes>cache_max)
+		champ_cache_remove(lru_tail);
+	return HASH_RET_OK;
+error:
+	champ_cache_entry_free(&c);
+	return ret;
+}
+
+// Load the blocks of a champion into the hash table, from the cache if
+// possible.
+enum hash_ret champ_cache_load(const char *champ, const char *directory)
+{
+	struct champ_cache *c=NULL;
+
+	if(!cache_max)
+		return hash_load(champ, directory);
+
+	HASH_FIND_STR(cache_table, champ, c);
+	if(c)
+		return cache_hit(c, champ, directory);
+	return cache_miss(champ, directory);
+}
+
+uint64_t champ_cache_hits(void)
+{
+	return hits;
+}
+
+uint64_t champ_cache_misses(void)
+{
+	return misses;
+}
+
+size_t champ_cache_bytes(void)
+{
+	return cache_bytes;
+}
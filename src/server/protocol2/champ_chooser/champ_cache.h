@@ -0,0 +1,16 @@
+#ifndef _CHAMP_CHOOSER_CHAMP_CACHE_H
+#define _CHAMP_CHOOSER_CHAMP_CACHE_H
+
+#include "hash.h"
+
+extern void champ_cache_init(size_t max_bytes);
+extern void champ_cache_free(void);
+
+extern enum hash_ret champ_cache_load(const char *champ,
+	const char *directory);
+
+extern uint64_t champ_cache_hits(void);
+extern uint64_t champ_cache_misses(void);
+extern size_t champ_cache_bytes(void);
+
+#endif
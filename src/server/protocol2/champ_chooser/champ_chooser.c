@@ -6,12 +6,18 @@
 #include "../../../prepend.h"
 #include "../../../protocol2/blist.h"
 #include "../../../protocol2/blk.h"
+#include "../../../strlist.h"
+#include "../../sdirs.h"
+#include "../backup_phase4.h"
 #include "candidate.h"
+#include "champ_cache.h"
 #include "champ_chooser.h"
+#include "champ_workers.h"
 #include "hash.h"
 #include "incoming.h"
 #include "scores.h"
 #include "sparse.h"
+#include "sparse_file.h"
 
 static void try_lock_msg(int seconds)
 {
@@ -71,8 +77,27 @@ struct lock *try_to_get_sparse_lock(const char *sparse_path)
 	return lock;
 }
 
+// Read the deltas of the global sparse index after the main part of it,
+// so that the newest candidates get the highest ids.
+static int load_sparse_deltas(const char *sparse_path, struct scores *scores)
+{
+	int ret=-1;
+	struct strlist *s=NULL;
+	struct strlist *deltas=NULL;
+	if(get_global_sparse_deltas(sparse_path, &deltas))
+		goto end;
+	for(s=deltas; s; s=s->next)
+		if(candidate_load(NULL, s->path, scores)!=CAND_RET_OK)
+			goto end;
+	ret=0;
+end:
+	strlists_free(&deltas);
+	return ret;
+}
+
 static int load_existing_sparse(const char *datadir, struct scores *scores)
 {
+	int r;
 	int ret=-1;
 	struct stat statp;
 	struct lock *lock=NULL;
@@ -82,12 +107,35 @@ static int load_existing_sparse(const char *datadir, struct scores *scores)
 	// trying to read it.
 	if(!(lock=try_to_get_sparse_lock(sparse_path)))
 		goto end;
+	switch(global_sparse_needs_compacting(sparse_path))
+	{
+		case 0: break;
+		case 1:
+			if(compact_global_sparse(sparse_path, lock))
+				goto end;
+			break;
+		default: goto end;
+	}
 	if(lstat(sparse_path, &statp))
 	{
+		if(load_sparse_deltas(sparse_path, scores)
+		  || scores_grow(scores, candidates_len))
+			goto end;
 		ret=0;
 		goto end;
 	}
-	if(candidate_load(NULL, sparse_path, scores))
+	// Use the binary copy of the sparse index, making it first if it is
+	// missing or out of date. If that cannot be done, read the gzipped
+	// one into memory instead.
+	if((r=sparse_load_file(sparse_path))==1
+	  && !sparse_file_generate(sparse_path))
+		r=sparse_load_file(sparse_path);
+	if(r<0)
+		goto end;
+	if(r && candidate_load(NULL, sparse_path, scores))
+		goto end;
+	if(load_sparse_deltas(sparse_path, scores)
+	  || scores_grow(scores, candidates_len))
 		goto end;
 	ret=0;
 end:
@@ -112,20 +160,20 @@ error:
 void champ_chooser_free(struct scores **scores)
 {
 	candidates_free();
+	champ_cache_free();
 	sparse_delete_all();
 	scores_free(scores);
 }
 
 static int already_got_block(struct asfd *asfd, struct blk *blk)
 {
-	static struct hash_weak *hash_weak;
+	struct hash_strong *hash_strong;
 
 	// If already got, need to overwrite the references.
-	if((hash_weak=hash_weak_find(blk->fingerprint)))
+	if(hash_weak_find(blk->fingerprint))
 	{
-		static struct hash_strong *hash_strong;
 		if((hash_strong=hash_strong_find(
-			hash_weak, blk->md5sum)))
+			blk->fingerprint, blk->md5sum)))
 		{
 			blk->savepath=hash_strong->savepath;
 //printf("FOUND: %s %s\n", blk->weak, blk->strong);
@@ -148,11 +196,27 @@ static int already_got_block(struct asfd *asfd, struct blk *blk)
 
 #define CHAMPS_MAX 10
 
+// The candidates can change between calls, but a candidate is never freed
+// while deduplicate() might be using it, and its path and id never change.
+static int choose_champ(struct incoming *in, struct candidate *champ_last,
+	struct scores *scores, struct candidate **champ)
+{
+	int ret=0;
+	champ_workers_read_lock();
+	if(scores && scores->size<candidates_len
+	  && scores_grow(scores, candidates_len))
+		ret=-1;
+	else
+		*champ=candidates_choose_champ(in, champ_last, scores);
+	champ_workers_read_unlock();
+	return ret;
+}
+
 int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
 {
 	struct blk *blk;
 	struct incoming *in=asfd->in;
-	struct candidate *champ;
+	struct candidate *champ=NULL;
 	struct candidate *champ_last=NULL;
 	int count=0;
 	int blk_count=0;
@@ -161,11 +225,14 @@ int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
 
 	incoming_found_reset(in);
 	count=0;
-	while(count!=CHAMPS_MAX
-	  && (champ=candidates_choose_champ(in, champ_last, scores)))
+	while(count!=CHAMPS_MAX)
 	{
+		if(choose_champ(in, champ_last, scores, &champ))
+			return -1;
+		if(!champ)
+			break;
 //		printf("Got champ: %s %d\n", champ->path, *(champ->score));
-		switch(hash_load(champ->path, directory))
+		switch(champ_cache_load(champ->path, directory))
 		{
 			case HASH_RET_OK:
 				count++;
@@ -174,7 +241,8 @@ int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
 			case HASH_RET_PERM:
 				return -1;
 			case HASH_RET_TEMP:
-				champ->deleted=1;
+				if(scores_add_deleted(scores, champ->id))
+					return -1;
 				break;
 		}
 	}
@@ -14,8 +14,10 @@
 #include "../../../protocol2/blk.h"
 #include "../../sdirs.h"
 #include "candidate.h"
+#include "champ_cache.h"
 #include "champ_chooser.h"
 #include "champ_server.h"
+#include "champ_workers.h"
 #include "dindex.h"
 #include "incoming.h"
 #include "scores.h"
@@ -120,7 +122,7 @@ static int deduplicate_maybe(struct asfd *asfd,
 		return 0;
 	asfd->blkcnt=0;
 
-	if(deduplicate(asfd, directory, scores)<0)
+	if(champ_workers_dispatch(asfd, directory, scores)<0)
 		return -1;
 
 	return 0;
@@ -171,7 +173,7 @@ static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 		else if(!strncmp_w(asfd->rbuf->buf, "sigs_end"))
 		{
 			//printf("Was told no more sigs\n");
-			if(deduplicate(asfd, directory, scores)<0)
+			if(champ_workers_dispatch(asfd, directory, scores)<0)
 				goto error;
 		}
 		else
@@ -189,7 +191,8 @@ static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 	{
 		// Client has completed a manifest file. Want to start using
 		// it as a dedup candidate now.
-		if(candidate_add_fresh(asfd->rbuf->buf, directory, scores))
+		if(champ_workers_add_fresh(asfd->rbuf->buf,
+			directory, scores))
 			goto error;
 	}
 	else
@@ -204,6 +207,17 @@ error:
 	return -1;
 }
 
+// Whether there is nothing for the main loop to do until a champ_workers
+// thread finishes a job.
+static int all_clients_deduplicating(struct async *as)
+{
+	struct asfd *asfd;
+	for(asfd=as->asfd->next; asfd; asfd=asfd->next)
+		if(!asfd->deduplicating || asfd->writebuflen)
+			return 0;
+	return 1;
+}
+
 int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	int resume)
 {
@@ -260,7 +274,7 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 		goto end;
 	}
 
-	if(!(as=async_alloc())
+	if(!(as=async_alloc_epoll())
 	  || as->init(as, 0)
 	  || !(asfd=setup_asfd(as, "champ chooser main socket", &s,
 		/*port*/-1)))
@@ -278,12 +292,26 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	// Load the sparse indexes for this dedup group.
 	if(!(scores=champ_chooser_init(sdirs->data)))
 		goto end;
+	champ_cache_init(get_uint64_t(confs[OPT_CHAMP_CACHE_MAX]));
+	if(champ_workers_init(get_int(confs[OPT_CHAMP_THREADS]), directory,
+		get_uint64_t(confs[OPT_CHAMP_CACHE_MAX])))
+			goto end;
 
 	while(1)
 	{
+		if(champ_workers_collect(all_clients_deduplicating(as)))
+			goto end;
+		// Do not wait long in select for the clients if a thread
+		// might hand back results in the meantime.
+		if(champ_workers_outstanding())
+			as->settimers(as, 0, 10000);
+		else
+			as->settimers(as, 1, 0);
+
 		for(asfd=as->asfd->next; asfd; asfd=asfd->next)
 		{
-			if(!asfd->blist->head
+			if(asfd->deduplicating
+			  || !asfd->blist->head
 			  || asfd->blist->head->got==BLK_INCOMING) continue;
 			if(results_to_fd(asfd)) goto end;
 		}
@@ -297,7 +325,11 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 				// a new client to the list.
 				for(asfd=as->asfd->next; asfd; asfd=asfd->next)
 				{
-					while(asfd->rbuf->buf)
+					// Leave the rest of the input of
+					// clients that a thread is working on
+					// until it has finished.
+					while(!asfd->deduplicating
+					  && asfd->rbuf->buf)
 					{
 						if(deal_with_client_rbuf(asfd,
 							directory, scores))
@@ -319,6 +351,10 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 				break;
 			default:
 				removed=0;
+				// A thread might still be working on the fd
+				// that had the problem.
+				if(champ_workers_wait())
+					goto end;
 				// Maybe one of the fds had a problem.
 				// Find and remove it and carry on if possible.
 				for(asfd=as->asfd->next; asfd; )
@@ -353,6 +389,7 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 
 end:
 	logp("champ chooser exiting: %d\n", ret);
+	champ_workers_free();
 	champ_chooser_free(&scores);
 	log_fzp_set(NULL, confs);
 	async_free(&as);
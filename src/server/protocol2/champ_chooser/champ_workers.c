@@ -0,0 +1,356 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../asfd.h"
+#include "../../../log.h"
+#include "candidate.h"
+#include "champ_cache.h"
+#include "champ_chooser.h"
+#include "champ_workers.h"
+#include "hash.h"
+#include "scores.h"
+
+// Threads that run deduplicate() for the clients of the champ chooser, so
+// that the segments of several clients backing up at once are dealt with
+// in parallel.
+// The sparse index and the candidates are shared, and only change when a
+// client finishes a manifest, so they are protected by a read/write lock.
+// deduplicate() only holds it while it chooses each champion, and not while
+// it reads the champion in from disk.
+// Each thread has its own scores, and its own hash table and champ cache
+// (see THREAD_LOCAL).
+// The main thread hands over a whole asfd, and does not touch its blist
+// or incoming fingerprints until the job comes back from collect.
+// Candidates that a thread finds to be gone are passed back with the job,
+// and marked deleted by collect under the write lock.
+// If there are no threads, deduplicate() is done inline by dispatch.
+
+static void scores_take_deleted(struct scores *scores,
+	uint32_t **deleted, size_t *deleted_len)
+{
+	*deleted=NULL;
+	*deleted_len=0;
+	if(!scores) return;
+	*deleted=scores->deleted;
+	*deleted_len=scores->deleted_len;
+	scores->deleted=NULL;
+	scores->deleted_len=0;
+}
+
+static int deduplicate_inline(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	int ret;
+	uint32_t *deleted;
+	size_t deleted_len;
+	ret=deduplicate(asfd, directory, scores);
+	scores_take_deleted(scores, &deleted, &deleted_len);
+	candidates_set_deleted(deleted, deleted_len);
+	free_v((void **)&deleted);
+	return ret;
+}
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+struct champ_job
+{
+	struct asfd *asfd;
+	int ret;
+	uint32_t *deleted;
+	size_t deleted_len;
+	struct champ_job *next;
+};
+
+static pthread_t *threads=NULL;
+static struct scores **thread_scores=NULL;
+static int thread_slots=0;
+static int thread_count=0;
+static const char *thread_directory=NULL;
+static size_t thread_cache_max=0;
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond=PTHREAD_COND_INITIALIZER;
+static pthread_rwlock_t sparse_rwlock=PTHREAD_RWLOCK_INITIALIZER;
+static struct champ_job *todo_head=NULL;
+static struct champ_job *todo_tail=NULL;
+static struct champ_job *done=NULL;
+static int outstanding=0; // Dispatched, but not yet collected.
+static int stopping=0;
+
+static void *champ_worker(void *arg)
+{
+	struct champ_job *job;
+	struct scores *scores=(struct scores *)arg;
+
+	champ_cache_init(thread_cache_max);
+	while(1)
+	{
+		pthread_mutex_lock(&lock);
+		while(!todo_head && !stopping)
+			pthread_cond_wait(&work_cond, &lock);
+		if(stopping)
+		{
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		job=todo_head;
+		if(!(todo_head=job->next))
+			todo_tail=NULL;
+		pthread_mutex_unlock(&lock);
+
+		job->ret=deduplicate(job->asfd, thread_directory, scores);
+		scores_take_deleted(scores, &job->deleted, &job->deleted_len);
+
+		pthread_mutex_lock(&lock);
+		job->next=done;
+		done=job;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&lock);
+	}
+	champ_cache_free();
+	hash_delete_all();
+	return NULL;
+}
+
+int champ_workers_init(int t, const char *directory, size_t cache_max)
+{
+	int i;
+	if(t<=0) return 0;
+
+	todo_head=NULL;
+	todo_tail=NULL;
+	done=NULL;
+	outstanding=0;
+	stopping=0;
+	thread_directory=directory;
+	thread_cache_max=cache_max;
+	if(!(threads=(pthread_t *)calloc_w(t, sizeof(pthread_t), __func__))
+	  || !(thread_scores=(struct scores **)
+		calloc_w(t, sizeof(struct scores *), __func__)))
+			goto error;
+	thread_slots=t;
+	for(i=0; i<t; i++)
+		if(!(thread_scores[i]=scores_alloc()))
+			goto error;
+	for(i=0; i<t; i++)
+	{
+		if(pthread_create(&threads[i], NULL,
+			champ_worker, thread_scores[i]))
+		{
+			logp("Could not create champ chooser thread: %s\n",
+				strerror(errno));
+			goto error;
+		}
+		thread_count++;
+	}
+	logp("Using %d champ chooser threads\n", thread_count);
+	return 0;
+error:
+	champ_workers_free();
+	return -1;
+}
+
+static void job_list_free(struct champ_job **list)
+{
+	struct champ_job *j;
+	while((j=*list))
+	{
+		*list=j->next;
+		j->asfd->deduplicating=0;
+		free_v((void **)&j->deleted);
+		free_v((void **)&j);
+	}
+}
+
+void champ_workers_free(void)
+{
+	int i;
+	if(threads)
+	{
+		// Jobs that have not been started are dropped. Ones that are
+		// running are finished before the threads exit.
+		pthread_mutex_lock(&lock);
+		stopping=1;
+		pthread_cond_broadcast(&work_cond);
+		pthread_mutex_unlock(&lock);
+		for(i=0; i<thread_count; i++)
+			pthread_join(threads[i], NULL);
+		free_v((void **)&threads);
+	}
+	if(thread_scores)
+	{
+		for(i=0; i<thread_slots; i++)
+			scores_free(&thread_scores[i]);
+		free_v((void **)&thread_scores);
+	}
+	job_list_free(&todo_head);
+	todo_tail=NULL;
+	job_list_free(&done);
+	thread_slots=0;
+	thread_count=0;
+	outstanding=0;
+}
+
+int champ_workers_count(void)
+{
+	return thread_count;
+}
+
+int champ_workers_outstanding(void)
+{
+	return outstanding;
+}
+
+int champ_workers_dispatch(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	struct champ_job *job;
+	if(!thread_count)
+		return deduplicate_inline(asfd, directory, scores);
+
+	if(!(job=(struct champ_job *)
+		calloc_w(1, sizeof(struct champ_job), __func__)))
+			return -1;
+	job->asfd=asfd;
+	asfd->deduplicating=1;
+	outstanding++;
+
+	pthread_mutex_lock(&lock);
+	if(todo_tail)
+		todo_tail->next=job;
+	else
+		todo_head=job;
+	todo_tail=job;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+// Hand finished jobs back to the main thread. If block is set, and there
+// are jobs outstanding, wait for at least one of them.
+// Returns -1 if any of the jobs failed.
+int champ_workers_collect(int block)
+{
+	int ret=0;
+	struct champ_job *j;
+	struct champ_job *list;
+
+	if(!outstanding) return 0;
+
+	pthread_mutex_lock(&lock);
+	while(block && !done)
+		pthread_cond_wait(&done_cond, &lock);
+	list=done;
+	done=NULL;
+	pthread_mutex_unlock(&lock);
+
+	while((j=list))
+	{
+		list=j->next;
+		if(j->ret<0) ret=-1;
+		if(j->deleted_len)
+		{
+			// Waits for any thread that is choosing a champion.
+			pthread_rwlock_wrlock(&sparse_rwlock);
+			candidates_set_deleted(j->deleted, j->deleted_len);
+			pthread_rwlock_unlock(&sparse_rwlock);
+		}
+		j->asfd->deduplicating=0;
+		outstanding--;
+		free_v((void **)&j->deleted);
+		free_v((void **)&j);
+	}
+	return ret;
+}
+
+// Wait for all of the outstanding jobs, for example before an asfd that
+// one of them might be using is freed.
+int champ_workers_wait(void)
+{
+	int ret=0;
+	while(outstanding)
+		if(champ_workers_collect(1))
+			ret=-1;
+	return ret;
+}
+
+void champ_workers_read_lock(void)
+{
+	pthread_rwlock_rdlock(&sparse_rwlock);
+}
+
+void champ_workers_read_unlock(void)
+{
+	pthread_rwlock_unlock(&sparse_rwlock);
+}
+
+int champ_workers_add_fresh(const char *path,
+	const char *directory, struct scores *scores)
+{
+	int ret;
+	if(!thread_count)
+		return candidate_add_fresh(path, directory, scores);
+
+	// Waits for any thread that is choosing a champion.
+	pthread_rwlock_wrlock(&sparse_rwlock);
+	ret=candidate_add_fresh(path, directory, scores);
+	pthread_rwlock_unlock(&sparse_rwlock);
+	return ret;
+}
+
+#else
+
+int champ_workers_init(int t,
+	__attribute__ ((unused)) const char *directory,
+	__attribute__ ((unused)) size_t cache_max)
+{
+	if(t>0)
+		logp("No thread support - champ chooser will run in one thread\n");
+	return 0;
+}
+
+void champ_workers_free(void)
+{
+}
+
+int champ_workers_count(void)
+{
+	return 0;
+}
+
+int champ_workers_outstanding(void)
+{
+	return 0;
+}
+
+int champ_workers_dispatch(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	return deduplicate_inline(asfd, directory, scores);
+}
+
+int champ_workers_collect(__attribute__ ((unused)) int block)
+{
+	return 0;
+}
+
+int champ_workers_wait(void)
+{
+	return 0;
+}
+
+void champ_workers_read_lock(void)
+{
+}
+
+void champ_workers_read_unlock(void)
+{
+}
+
+int champ_workers_add_fresh(const char *path,
+	const char *directory, struct scores *scores)
+{
+	return candidate_add_fresh(path, directory, scores);
+}
+
+#endif
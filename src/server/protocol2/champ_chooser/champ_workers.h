@@ -0,0 +1,24 @@
+#ifndef _CHAMP_CHOOSER_WORKERS_H
+#define _CHAMP_CHOOSER_WORKERS_H
+
+struct asfd;
+struct scores;
+
+extern int champ_workers_init(int threads, const char *directory,
+	size_t cache_max);
+extern void champ_workers_free(void);
+extern int champ_workers_count(void);
+extern int champ_workers_outstanding(void);
+
+extern int champ_workers_dispatch(struct asfd *asfd,
+	const char *directory, struct scores *scores);
+extern int champ_workers_collect(int block);
+extern int champ_workers_wait(void);
+
+extern void champ_workers_read_lock(void);
+extern void champ_workers_read_unlock(void);
+
+extern int champ_workers_add_fresh(const char *path,
+	const char *directory, struct scores *scores);
+
+#endif
@@ -322,7 +322,7 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 		if(mkdir(cindex_tmp, 0777)
 		  || !(cindex_new=prepend_s(cindex_tmp, "cindex"))
 		  || merge_files_in_dir_no_fcount(cindex_new,
-			sdirs->cfiles, merge_dindexes))
+			sdirs->cfiles, kmerge_dindexes))
 				goto end;
 		if(!lstat(cindex_new, &statp))
 		{
@@ -369,7 +369,7 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 	if(!(dindex_new=prepend_s(dindex_tmp, "dindex")))
 		goto end;
 	if(merge_files_in_dir(dindex_new,
-		dindex_tmp, "hlinks", fcount, merge_dindexes))
+		dindex_tmp, "hlinks", fcount, kmerge_dindexes))
 			goto end;
 
 	if(!lstat(dindex_new, &statp))
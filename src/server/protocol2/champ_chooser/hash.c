@@ -5,102 +5,165 @@
 #include "../../../protocol2/blk.h"
 #include "../../../sbuf.h"
 #include "hash.h"
+#include "mindex.h"
 
-struct hash_weak *hash_table=NULL;
+#define HASH_SIZE_MIN	(1<<16)
 
-struct hash_weak *hash_weak_find(uint64_t weak)
+// The champ chooser can run deduplicate() in several threads at once, and
+// each of them needs its own table.
+static THREAD_LOCAL struct hash_strong *table=NULL;
+// One byte per slot saying whether it is in use, since there is no value
+// of the fingerprint or savepath that cannot turn up in a real block.
+static THREAD_LOCAL uint8_t *used=NULL;
+static THREAD_LOCAL uint64_t size=0; // Always a power of two.
+static THREAD_LOCAL uint64_t count=0;
+
+static uint64_t hash_slot(uint64_t weak)
+{
+	// Fibonacci hashing, so that fingerprints that only differ in their
+	// top bits still spread over the table.
+	return (weak*0x9E3779B97F4A7C15ULL)&(size-1);
+}
+
+int hash_weak_find(uint64_t weak)
 {
-	struct hash_weak *hash_weak;
-	HASH_FIND_INT(hash_table, &weak, hash_weak);
-	return hash_weak;
+	uint64_t i;
+	if(!count) return 0;
+	for(i=hash_slot(weak); used[i]; i=(i+1)&(size-1))
+		if(table[i].weak==weak) return 1;
+	return 0;
 }
 
-struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum)
+struct hash_strong *hash_strong_find(uint64_t weak, uint8_t *md5sum)
 {
-	struct hash_strong *s;
-	for(s=hash_weak->strong; s; s=s->next)
-		if(!memcmp(s->md5sum, md5sum, MD5_DIGEST_LENGTH)) return s;
+	uint64_t i;
+	if(!count) return NULL;
+	for(i=hash_slot(weak); used[i]; i=(i+1)&(size-1))
+	{
+		if(table[i].weak==weak
+		  && !memcmp(table[i].md5sum, md5sum, MD5_DIGEST_LENGTH))
+			return &table[i];
+	}
 	return NULL;
 }
 
-struct hash_weak *hash_weak_add(uint64_t weakint)
+uint64_t hash_count(void)
 {
-	struct hash_weak *newweak;
-	if(!(newweak=(struct hash_weak *)
-		malloc_w(sizeof(struct hash_weak), __func__)))
-			return NULL;
-	newweak->weak=weakint;
-//logp("addweak: %016lX\n", weakint);
-	newweak->strong=NULL;
-	HASH_ADD_INT(hash_table, weak, newweak);
-	return newweak;
+	return count;
 }
 
-static struct hash_strong *hash_strong_add(struct hash_weak *hash_weak,
-	struct blk *blk)
+static void hash_insert(uint64_t weak, uint64_t savepath, uint8_t *md5sum)
 {
-	struct hash_strong *newstrong;
-	if(!(newstrong=(struct hash_strong *)
-		malloc_w(sizeof(struct hash_strong), __func__)))
-			return NULL;
-	newstrong->savepath=blk->savepath;
-	memcpy(newstrong->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
-	newstrong->next=hash_weak->strong;
-	return newstrong;
+	uint64_t i;
+	for(i=hash_slot(weak); used[i]; i=(i+1)&(size-1)) { }
+	used[i]=1;
+	table[i].weak=weak;
+	table[i].savepath=savepath;
+	memcpy(table[i].md5sum, md5sum, MD5_DIGEST_LENGTH);
+	count++;
 }
 
-static void hash_strongs_free(struct hash_strong *shead)
+static int hash_grow(void)
 {
-	static struct hash_strong *s;
-	s=shead;
-	while(shead)
+	uint64_t i;
+	uint64_t old_size=size;
+	struct hash_strong *old_table=table;
+	uint8_t *old_used=used;
+	uint64_t new_size=size?size<<1:HASH_SIZE_MIN;
+
+	if(!(table=(struct hash_strong *)
+		malloc_w(new_size*sizeof(struct hash_strong), __func__)))
+			goto error;
+	if(!(used=(uint8_t *)calloc_w(new_size, sizeof(uint8_t), __func__)))
 	{
-		s=shead;
-		shead=shead->next;
-		free_v((void **)&s);
+		free_v((void **)&table);
+		goto error;
 	}
+	size=new_size;
+	count=0;
+	for(i=0; i<old_size; i++)
+		if(old_used[i])
+			hash_insert(old_table[i].weak,
+				old_table[i].savepath, old_table[i].md5sum);
+	free_v((void **)&old_table);
+	free_v((void **)&old_used);
+	return 0;
+error:
+	table=old_table;
+	used=old_used;
+	return -1;
 }
 
 void hash_delete_all(void)
 {
-	struct hash_weak *tmp;
-	struct hash_weak *hash_weak;
+	free_v((void **)&table);
+	free_v((void **)&used);
+	size=0;
+	count=0;
+}
 
-	HASH_ITER(hh, hash_table, hash_weak, tmp)
-	{
-		HASH_DEL(hash_table, hash_weak);
-		hash_strongs_free(hash_weak->strong);
-		free_v((void **)&hash_weak);
-	}
-	hash_table=NULL;
+int hash_add(uint64_t weak, uint8_t *md5sum, uint64_t savepath)
+{
+	if(hash_strong_find(weak, md5sum))
+		return 0;
+
+	// Keep the load factor under 3/4, so that probe sequences stay short.
+	if((count+1)*4>size*3 && hash_grow())
+		return -1;
+	hash_insert(weak, savepath, md5sum);
+
+	return 0;
 }
 
 int hash_load_blk(struct blk *blk)
 {
-	static struct hash_weak *hash_weak;
-
-	hash_weak=hash_weak_find(blk->fingerprint);
+	return hash_add(blk->fingerprint, blk->md5sum, blk->savepath);
+}
 
-	// Add to hash table.
-	if(!hash_weak && !(hash_weak=hash_weak_add(blk->fingerprint)))
-		return -1;
-	if(!hash_strong_find(hash_weak, blk->md5sum))
+static int entries_append(struct hash_strong **entries, uint32_t *count,
+	uint32_t *alloc, struct blk *blk)
+{
+	struct hash_strong *e;
+	if(*count==*alloc)
 	{
-		if(!(hash_weak->strong=hash_strong_add(hash_weak, blk)))
-			return -1;
+		*alloc=*alloc?*alloc*2:MANIFEST_SIG_MAX;
+		if(!(*entries=(struct hash_strong *)realloc_w(*entries,
+			*alloc*sizeof(struct hash_strong), __func__)))
+				return -1;
 	}
-
+	e=&(*entries)[(*count)++];
+	e->weak=blk->fingerprint;
+	e->savepath=blk->savepath;
+	memcpy(e->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
 	return 0;
 }
 
-enum hash_ret hash_load(const char *champ, const char *directory)
+// If entries is NULL, the blocks go straight into the hash table. Otherwise,
+// they are returned in an allocated array and the hash table is untouched.
+static enum hash_ret do_hash_load(const char *champ, const char *directory,
+	struct hash_strong **entries, uint32_t *count)
 {
 	enum hash_ret ret=HASH_RET_PERM;
 	char *path=NULL;
 	struct fzp *fzp=NULL;
 	struct sbuf *sb=NULL;
-	static struct blk *blk=NULL;
+	struct blk *blk=NULL;
+	uint32_t alloc=0;
+
+	// Try the binary copy first.
+	if(!(path=mindex_path_from_champ(directory, champ)))
+		goto end;
+	switch(entries?mindex_read(path, entries, count):mindex_load(path))
+	{
+		case 0:
+			ret=HASH_RET_OK;
+			goto end;
+		case 1:
+			break;
+		default:
+			goto end;
+	}
+	free_w(&path);
 
 	if(!(path=prepend_s(directory, champ)))
 		goto end;
@@ -110,8 +173,8 @@ enum hash_ret hash_load(const char *champ, const char *directory)
 		goto end;
 	}
 
-	if((!sb && !(sb=sbuf_alloc(PROTO_2)))
-	  || (!blk && !(blk=blk_alloc())))
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc()))
 		goto end;
 
 	while(1)
@@ -128,12 +191,37 @@ enum hash_ret hash_load(const char *champ, const char *directory)
 		}
 		if(!blk->got_save_path)
 			continue;
-		if(hash_load_blk(blk))
+		if(entries)
+		{
+			if(entries_append(entries, count, &alloc, blk))
+				goto end;
+		}
+		else if(hash_load_blk(blk))
 			goto end;
 		blk->got_save_path=0;
 	}
 end:
+	if(entries && ret!=HASH_RET_OK)
+	{
+		free_v((void **)entries);
+		*count=0;
+	}
+	sbuf_free(&sb);
+	blk_free(&blk);
 	free_w(&path);
 	fzp_close(&fzp);
 	return ret;
 }
+
+enum hash_ret hash_load(const char *champ, const char *directory)
+{
+	return do_hash_load(champ, directory, NULL, NULL);
+}
+
+enum hash_ret hash_load_entries(const char *champ, const char *directory,
+	struct hash_strong **entries, uint32_t *count)
+{
+	*entries=NULL;
+	*count=0;
+	return do_hash_load(champ, directory, entries, count);
+}
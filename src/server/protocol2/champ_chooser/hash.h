@@ -1,13 +1,10 @@
 #ifndef _CHAMP_CHOOSER_HASH_H
 #define _CHAMP_CHOOSER_HASH_H
 
-#include <uthash.h>
 #include <openssl/md5.h>
 
 struct blk;
 
-typedef struct hash_strong hash_strong_t;
-
 enum hash_ret
 {
 	HASH_RET_PERM=-2,
@@ -15,29 +12,25 @@ enum hash_ret
 	HASH_RET_OK=0
 };
 
+// One slot in the open-addressed block table. 32 bytes, so that two fit
+// in a cache line. Blocks with the same weak fingerprint but different
+// md5sums sit in neighbouring slots on the same probe sequence.
 struct hash_strong
-{
-	uint8_t md5sum[MD5_DIGEST_LENGTH];
-	hash_strong_t *next;
-	uint64_t savepath;
-};
-
-struct hash_weak
 {
 	uint64_t weak;
-	struct hash_strong *strong;
-	UT_hash_handle hh;
+	uint64_t savepath;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
 };
 
-extern struct hash_weak *hash_table;
-
-extern struct hash_weak *hash_weak_find(uint64_t weak);
-extern struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum);
-extern struct hash_weak *hash_weak_add(uint64_t weakint);
+extern int hash_weak_find(uint64_t weak);
+extern struct hash_strong *hash_strong_find(uint64_t weak, uint8_t *md5sum);
+extern uint64_t hash_count(void);
+extern int hash_add(uint64_t weak, uint8_t *md5sum, uint64_t savepath);
 
 extern void hash_delete_all(void);
 extern enum hash_ret hash_load(const char *champ, const char *directory);
+extern enum hash_ret hash_load_entries(const char *champ,
+	const char *directory, struct hash_strong **entries, uint32_t *count);
 
 extern int hash_load_blk(struct blk *blk);
 
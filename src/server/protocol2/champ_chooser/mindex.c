@@ -0,0 +1,176 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "hash.h"
+#include "mindex.h"
+
+#include <sys/mman.h>
+
+int mindex_write(const char *path,
+	struct hash_strong *entries, uint32_t count)
+{
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	struct mindex_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic=MINDEX_MAGIC;
+	header.version=MINDEX_VERSION;
+	header.count=count;
+
+	if(build_path_w(path)
+	  || !(fzp=fzp_open(path, "wb")))
+		goto end;
+	if(fzp_write(fzp, &header, sizeof(header))!=sizeof(header)
+	  || (count && fzp_write(fzp, entries,
+		count*sizeof(struct hash_strong))
+			!=count*sizeof(struct hash_strong)))
+	{
+		logp("Short write to %s\n", path);
+		goto end;
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+struct mindex_map
+{
+	int fd;
+	void *map;
+	size_t len;
+	struct mindex_header *header;
+	struct hash_strong *entries;
+};
+
+static void mindex_unmap(struct mindex_map *m)
+{
+	if(m->map!=MAP_FAILED)
+		munmap(m->map, m->len);
+	if(m->fd>=0)
+		close(m->fd);
+}
+
+// Return 0 for mapped OK, 1 if there is no usable mindex file (so the
+// caller should fall back to the manifest).
+static int mindex_map(const char *path, struct mindex_map *m)
+{
+	struct stat statp;
+
+	m->fd=-1;
+	m->map=MAP_FAILED;
+	if((m->fd=open(path, O_RDONLY))<0)
+	{
+		if(errno!=ENOENT)
+			logp("Could not open %s: %s\n",
+				path, strerror(errno));
+		return 1;
+	}
+	if(fstat(m->fd, &statp))
+	{
+		logp("Could not stat %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	m->len=(size_t)statp.st_size;
+	if(m->len<sizeof(struct mindex_header))
+		goto bad;
+	if((m->map=mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, m->fd, 0))
+		==MAP_FAILED)
+	{
+		logp("Could not mmap %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	m->header=(struct mindex_header *)m->map;
+	if(m->header->magic!=MINDEX_MAGIC
+	  || m->header->version!=MINDEX_VERSION
+	  || m->len!=sizeof(struct mindex_header)
+		+m->header->count*sizeof(struct hash_strong))
+			goto bad;
+	m->entries=(struct hash_strong *)(m->header+1);
+	return 0;
+bad:
+	logp("%s is not a valid mindex file\n", path);
+end:
+	mindex_unmap(m);
+	return 1;
+}
+
+// Return 0 for loaded OK, 1 if there is no usable mindex file (so the
+// caller should fall back to the manifest), -1 for error.
+int mindex_load(const char *path)
+{
+	int ret=-1;
+	uint32_t i;
+	struct mindex_map m;
+
+	if(mindex_map(path, &m))
+		return 1;
+	// The entries are already in the form that the hash table wants,
+	// so they go straight from the mapping into the table.
+	for(i=0; i<m.header->count; i++)
+		if(hash_add(m.entries[i].weak,
+			m.entries[i].md5sum, m.entries[i].savepath))
+				goto end;
+	ret=0;
+end:
+	mindex_unmap(&m);
+	return ret;
+}
+
+// Like mindex_load(), but gives back a copy of the entries instead of
+// adding them to the hash table.
+int mindex_read(const char *path, struct hash_strong **entries,
+	uint32_t *count)
+{
+	int ret=-1;
+	struct mindex_map m;
+
+	if(mindex_map(path, &m))
+		return 1;
+	*count=m.header->count;
+	if(*count)
+	{
+		if(!(*entries=(struct hash_strong *)malloc_w(
+			*count*sizeof(struct hash_strong), __func__)))
+				goto end;
+		memcpy(*entries, m.entries, *count*sizeof(struct hash_strong));
+	}
+	ret=0;
+end:
+	mindex_unmap(&m);
+	return ret;
+}
+
+// Champions are named after their manifest file. The mindex for
+// 'x/manifest/00000003' is 'x/manifest/mindex/00000003'.
+char *mindex_path_from_champ(const char *directory, const char *champ)
+{
+	char *cp;
+	char *tmp=NULL;
+	char *dir=NULL;
+	char *path=NULL;
+
+	if(!(tmp=prepend_s(directory, champ)))
+		return NULL;
+	if(!(cp=strrchr(tmp, '/')))
+	{
+		free_w(&tmp);
+		return prepend_s("mindex", champ);
+	}
+	*cp='\0';
+	if((dir=prepend_s(tmp, "mindex")))
+		path=prepend_s(dir, cp+1);
+	free_w(&dir);
+	free_w(&tmp);
+	return path;
+}
@@ -0,0 +1,30 @@
+#ifndef _MINDEX_H
+#define _MINDEX_H
+
+#include "hash.h"
+
+// A 'mindex' is a binary copy of the signatures in one manifest file, kept
+// next to the hooks and dindex files so that the champ chooser can load a
+// champion without gunzipping and parsing the manifest itself.
+// The file is a header followed by an array of struct hash_strong, in host
+// byte order. It is only ever read on the machine that wrote it.
+
+#define MINDEX_MAGIC	0x5844494E494D5242ULL // "BRMINIDX"
+#define MINDEX_VERSION	1
+
+struct mindex_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t count;
+};
+
+extern int mindex_write(const char *path,
+	struct hash_strong *entries, uint32_t count);
+extern int mindex_load(const char *path);
+extern int mindex_read(const char *path, struct hash_strong **entries,
+	uint32_t *count);
+
+extern char *mindex_path_from_champ(const char *directory, const char *champ);
+
+#endif
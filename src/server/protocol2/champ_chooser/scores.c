@@ -11,6 +11,7 @@ static void scores_free_content(struct scores *scores)
 {
 	if(!scores) return;
 	free_v((void **)&scores->scores);
+	free_v((void **)&scores->deleted);
 }
 
 void scores_free(struct scores **scores)
@@ -39,3 +40,37 @@ void scores_reset(struct scores *scores)
 		return;
 	memset(scores->scores, 0, sizeof(scores->scores[0])*scores->size);
 }
+
+// Kept as a plain loop over the array with no early exit, so that the
+// compiler can vectorise it.
+uint16_t scores_max(struct scores *scores)
+{
+	size_t i;
+	uint16_t max=0;
+	uint16_t *sc;
+	if(!scores || !scores->scores)
+		return 0;
+	sc=scores->scores;
+	for(i=0; i<scores->size; i++)
+		max=sc[i]>max?sc[i]:max;
+	return max;
+}
+
+int scores_add_deleted(struct scores *scores, uint32_t id)
+{
+	if(!(scores->deleted=(uint32_t *)realloc_w(scores->deleted,
+		sizeof(uint32_t)*(scores->deleted_len+1), __func__)))
+			return -1;
+	scores->deleted[scores->deleted_len++]=id;
+	return 0;
+}
+
+// There are only ever a few of these, so a linear search is fine.
+int scores_is_deleted(struct scores *scores, uint32_t id)
+{
+	size_t i;
+	for(i=0; i<scores->deleted_len; i++)
+		if(scores->deleted[i]==id)
+			return 1;
+	return 0;
+}
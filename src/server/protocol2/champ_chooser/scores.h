@@ -8,11 +8,20 @@ struct scores
 {
 	uint16_t *scores;
 	size_t size;
+	// Candidates that went missing while these scores were in use.
+	// They are kept here rather than marked on the shared candidates,
+	// which other threads may be reading, until the caller can set
+	// them with candidates_set_deleted().
+	uint32_t *deleted;
+	size_t deleted_len;
 };
 
 extern struct scores *scores_alloc(void);
 extern void scores_free(struct scores **scores);
 extern int scores_grow(struct scores *scores, size_t count);
 extern void scores_reset(struct scores *scores);
+extern uint16_t scores_max(struct scores *scores);
+extern int scores_add_deleted(struct scores *scores, uint32_t id);
+extern int scores_is_deleted(struct scores *scores, uint32_t id);
 
 #endif
@@ -2,75 +2,238 @@
 #include "../../../alloc.h"
 #include "candidate.h"
 #include "sparse.h"
+#include "sparse_file.h"
 
-static struct sparse *sparse_table=NULL;
+// Once there are this many additions waiting, merge them into the main
+// level.
+#define SPARSE_PENDING_MAX	65536
 
-static struct sparse *sparse_add(uint64_t fingerprint)
+struct sparse_pair
 {
-        struct sparse *sparse;
-        if(!(sparse=(struct sparse *)
-		calloc_w(1, sizeof(struct sparse), __func__)))
-			return NULL;
-        sparse->fingerprint=fingerprint;
-	HASH_ADD_INT(sparse_table, fingerprint, sparse);
-        return sparse;
-}
+	uint64_t fingerprint;
+	uint32_t id;
+};
+
+struct sparse_index
+{
+	uint64_t *fingerprints;	// Sorted, unique.
+	uint32_t *offsets;	// Where each posting list starts in ids.
+	uint32_t *ids;
+	size_t count;		// Number of fingerprints.
+};
 
-struct sparse *sparse_find(uint64_t *fingerprint)
+// The levels that are kept in memory. The last level is the mapped sparse
+// file, if there is one.
+static struct sparse_index levels[SPARSE_LEVEL_FILE];
+static struct sparse_file *sparse_file=NULL;
+
+// Additions since the last merge into the main level.
+static struct sparse_pair *pending=NULL;
+static size_t pending_len=0;
+static size_t pending_alloc=0;
+static int pending_dirty=0;
+
+static void sparse_index_free_content(struct sparse_index *si)
 {
-	struct sparse *sparse=NULL;
-	HASH_FIND_INT(sparse_table, fingerprint, sparse);
-	return sparse;
+	free_v((void **)&si->fingerprints);
+	free_v((void **)&si->offsets);
+	free_v((void **)&si->ids);
+	si->count=0;
 }
 
-void sparse_delete_all(void)
+static int sparse_index_alloc(struct sparse_index *si,
+	size_t fingerprints, size_t ids)
 {
-	struct sparse *tmp;
-	struct sparse *sparse;
+	if(!(si->fingerprints=(uint64_t *)malloc_w(
+		(fingerprints?fingerprints:1)*sizeof(uint64_t), __func__))
+	  || !(si->offsets=(uint32_t *)malloc_w(
+		(fingerprints+1)*sizeof(uint32_t), __func__))
+	  || !(si->ids=(uint32_t *)malloc_w(
+		(ids?ids:1)*sizeof(uint32_t), __func__)))
+	{
+		sparse_index_free_content(si);
+		return -1;
+	}
+	si->count=0;
+	si->offsets[0]=0;
+	return 0;
+}
 
-	HASH_ITER(hh, sparse_table, sparse, tmp)
+static void sparse_index_append(struct sparse_index *si,
+	uint64_t fingerprint, uint32_t id)
+{
+	uint32_t end=si->offsets[si->count];
+	if(!si->count || si->fingerprints[si->count-1]!=fingerprint)
 	{
-		HASH_DEL(sparse_table, sparse);
-		free_v((void **)&sparse->candidates);
-		free_v((void **)&sparse);
+		si->fingerprints[si->count++]=fingerprint;
+		si->offsets[si->count]=end;
 	}
-	sparse_table=NULL;
+	else if(si->ids[end-1]==id)
+		return; // Already got it.
+	si->ids[end]=id;
+	si->offsets[si->count]=end+1;
 }
 
-int sparse_add_candidate(uint64_t *fingerprint, struct candidate *candidate)
+static int pair_cmp(const void *a, const void *b)
+{
+	const struct sparse_pair *x=(const struct sparse_pair *)a;
+	const struct sparse_pair *y=(const struct sparse_pair *)b;
+	if(x->fingerprint>y->fingerprint) return 1;
+	if(x->fingerprint<y->fingerprint) return -1;
+	if(x->id>y->id) return 1;
+	if(x->id<y->id) return -1;
+	return 0;
+}
+
+static int build_from_pending(struct sparse_index *si)
+{
+	size_t p;
+	if(sparse_index_alloc(si, pending_len, pending_len))
+		return -1;
+	for(p=0; p<pending_len; p++)
+		sparse_index_append(si,
+			pending[p].fingerprint, pending[p].id);
+	return 0;
+}
+
+// Fold the pending additions into the main level. Pending ids are all
+// higher than the ids in the main level, so each merged posting list is
+// the old one followed by the new one.
+static int merge_pending(void)
 {
-	static size_t s;
-	static struct sparse *sparse;
+	size_t m=0;
+	size_t p=0;
+	uint32_t o;
+	struct sparse_index new;
+	struct sparse_index *old=&levels[0];
 
-	if((sparse=sparse_find(fingerprint)))
+	if(sparse_index_alloc(&new, old->count+pending_len,
+		(old->count?old->offsets[old->count]:0)+pending_len))
+			return -1;
+	while(m<old->count || p<pending_len)
 	{
-		// Do not add it to the list if it has already been added.
-		for(s=0; s<sparse->size; s++)
-			if(sparse->candidates[s]==candidate)
-				return 0;
+		if(p>=pending_len
+		  || (m<old->count
+			&& old->fingerprints[m]<=pending[p].fingerprint))
+		{
+			for(o=old->offsets[m]; o<old->offsets[m+1]; o++)
+				sparse_index_append(&new,
+					old->fingerprints[m], old->ids[o]);
+			m++;
+			continue;
+		}
+		sparse_index_append(&new, pending[p].fingerprint,
+			pending[p].id);
+		p++;
 	}
+	sparse_index_free_content(old);
+	*old=new;
+	sparse_index_free_content(&levels[1]);
+	pending_len=0;
+	return 0;
+}
 
-	if(!sparse && !(sparse=sparse_add(*fingerprint)))
-		return -1;
-	if(!(sparse->candidates=(struct candidate **)
-		realloc_w(sparse->candidates,
-			(sparse->size+1)*sizeof(struct candidate *), __func__)))
+int sparse_add_candidate(uint64_t *fingerprint, struct candidate *candidate)
+{
+	// Hooks before the first manifest line have nothing to belong to.
+	if(!candidate) return 0;
+	if(pending_len==pending_alloc)
+	{
+		pending_alloc=pending_alloc?pending_alloc*2:1024;
+		if(!(pending=(struct sparse_pair *)realloc_w(pending,
+			pending_alloc*sizeof(struct sparse_pair), __func__)))
 				return -1;
-	sparse->candidates[sparse->size++]=candidate;
-	
+	}
+	pending[pending_len].fingerprint=*fingerprint;
+	pending[pending_len].id=candidate->id;
+	pending_len++;
+	pending_dirty=1;
 	return 0;
 }
 
 void sparse_delete_fresh_candidate(struct candidate *candidate)
 {
-	struct sparse *tmp;
-	struct sparse *sparse;
+	// Only works if the candidate being deleted is the most recent
+	// one added. Which is fine for candidate_add_fresh().
+	while(pending_len && pending[pending_len-1].id==candidate->id)
+		pending_len--;
+}
+
+// Get the index ready for lookups after candidates have been added.
+int sparse_prepare(void)
+{
+	if(!pending_dirty) return 0;
+	qsort(pending, pending_len, sizeof(struct sparse_pair), pair_cmp);
+	pending_dirty=0;
+	if(!levels[0].count || pending_len>=SPARSE_PENDING_MAX)
+		return merge_pending();
+	sparse_index_free_content(&levels[1]);
+	return build_from_pending(&levels[1]);
+}
+
+// Map the binary copy of the sparse index at sparse_path, and add its
+// candidates. This has to be done before any other candidates are added,
+// so that their ids match up.
+// Return 0 for loaded OK, 1 if there is no up to date sparse file, -1 for
+// error.
+int sparse_load_file(const char *sparse_path)
+{
+	int ret;
+	uint32_t c;
+	const char *cp;
+	struct candidate *candidate;
+
+	if(sparse_file || candidates_len)
+		return 1;
+	if((ret=sparse_file_open(sparse_path, &sparse_file)))
+		return ret;
+	cp=sparse_file_paths(sparse_file);
+	for(c=0; c<sparse_file_candidates(sparse_file); c++)
+	{
+		if(!(candidate=candidates_add_new())
+		  || !(candidate->path=strdup_w(cp, __func__)))
+			return -1;
+		cp+=strlen(cp)+1;
+	}
+	return 0;
+}
+
+uint32_t *sparse_find(uint64_t fingerprint, int level, size_t *len)
+{
+	size_t lo=0;
+	size_t hi;
+	size_t mid;
+	struct sparse_index *si;
 
-	HASH_ITER(hh, sparse_table, sparse, tmp)
+	if(level==SPARSE_LEVEL_FILE)
+		return sparse_file_find(sparse_file, fingerprint, len);
+	si=&levels[level];
+	hi=si->count;
+	while(lo<hi)
 	{
-		// Only works if the candidate being deleted is the most recent
-		// one added. Which is fine for candidate_add_fresh().
-		if(sparse->candidates[sparse->size-1]==candidate)
-			sparse->size--;
+		mid=lo+(hi-lo)/2;
+		if(si->fingerprints[mid]<fingerprint)
+			lo=mid+1;
+		else
+			hi=mid;
 	}
+	if(lo>=si->count || si->fingerprints[lo]!=fingerprint)
+	{
+		*len=0;
+		return NULL;
+	}
+	*len=si->offsets[lo+1]-si->offsets[lo];
+	return si->ids+si->offsets[lo];
+}
+
+void sparse_delete_all(void)
+{
+	int l;
+	for(l=0; l<SPARSE_LEVEL_FILE; l++)
+		sparse_index_free_content(&levels[l]);
+	sparse_file_close(&sparse_file);
+	free_v((void **)&pending);
+	pending_len=0;
+	pending_alloc=0;
+	pending_dirty=0;
 }
@@ -1,20 +1,27 @@
 #ifndef _CHAMP_CHOOSER_SPARSE_H
 #define _CHAMP_CHOOSER_SPARSE_H
 
-#include <uthash.h>
+struct candidate;
 
-struct sparse
-{
-	uint64_t fingerprint;
-	size_t size;
-	struct candidate **candidates;
-	UT_hash_handle hh;
-};
+// The sparse index maps hook fingerprints to the ids of the candidates
+// that contain them. It is kept as a sorted array of fingerprints, each
+// with a posting list of candidate ids in ascending order.
+// New candidates go into a second, smaller level, which is folded into the
+// main level once it gets big enough. So a fingerprint can have a posting
+// list in each level, and the ids in the second level are always higher.
+// The global sparse index that existed when the champ chooser started is a
+// third level, searched in place in its mmapped binary copy. Its ids are
+// lower than all of the others.
+
+#define SPARSE_LEVELS		3
+#define SPARSE_LEVEL_FILE	2
 
-extern struct sparse *sparse_find(uint64_t *fingerprint);
-extern void sparse_delete_all(void);
 extern int sparse_add_candidate(uint64_t *fingerprint,
 	struct candidate *candidate);
 extern void sparse_delete_fresh_candidate(struct candidate *candidate);
+extern int sparse_prepare(void);
+extern int sparse_load_file(const char *sparse_path);
+extern uint32_t *sparse_find(uint64_t fingerprint, int level, size_t *len);
+extern void sparse_delete_all(void);
 
 #endif
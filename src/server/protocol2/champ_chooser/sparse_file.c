@@ -0,0 +1,482 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "../../../sbuf.h"
+#include "../../../protocol2/blk.h"
+#include "sparse_file.h"
+
+#include <sys/mman.h>
+
+struct sparse_file
+{
+	int fd;
+	void *map;
+	size_t len;
+	struct sparse_file_header *header;
+	uint64_t *block_first;
+	uint64_t *block_offset;
+	uint64_t *block_ids;
+	uint32_t *ids;
+	uint8_t *deltas;
+	char *paths;
+};
+
+struct gen_pair
+{
+	uint64_t fingerprint;
+	uint32_t id;
+};
+
+// Everything needed to write out a sparse file.
+struct sparse_gen
+{
+	struct sparse_file_header header;
+	struct gen_pair *pairs;
+	size_t pairs_len;
+	size_t pairs_alloc;
+	char *paths;
+	size_t paths_alloc;
+	uint64_t *block_first;
+	uint64_t *block_offset;
+	uint64_t *block_ids;
+	uint32_t *ids;
+	uint8_t *deltas;
+	size_t deltas_alloc;
+};
+
+static char *get_idx_path(const char *sparse_path)
+{
+	return prepend_n(sparse_path, "idx", strlen("idx"), ".");
+}
+
+static void sparse_gen_free_content(struct sparse_gen *g)
+{
+	free_v((void **)&g->pairs);
+	free_w(&g->paths);
+	free_v((void **)&g->block_first);
+	free_v((void **)&g->block_offset);
+	free_v((void **)&g->block_ids);
+	free_v((void **)&g->ids);
+	free_v((void **)&g->deltas);
+}
+
+static int gen_add_pair(struct sparse_gen *g, uint64_t fingerprint)
+{
+	if(g->pairs_len==g->pairs_alloc)
+	{
+		g->pairs_alloc=g->pairs_alloc?g->pairs_alloc*2:1024;
+		if(!(g->pairs=(struct gen_pair *)realloc_w(g->pairs,
+			g->pairs_alloc*sizeof(struct gen_pair), __func__)))
+				return -1;
+	}
+	g->pairs[g->pairs_len].fingerprint=fingerprint;
+	g->pairs[g->pairs_len].id=g->header.candidates-1;
+	g->pairs_len++;
+	return 0;
+}
+
+static int gen_add_path(struct sparse_gen *g, const char *path)
+{
+	size_t len=strlen(path)+1;
+	while(g->header.paths_len+len>g->paths_alloc)
+	{
+		g->paths_alloc=g->paths_alloc?g->paths_alloc*2:4096;
+		if(!(g->paths=(char *)realloc_w(g->paths,
+			g->paths_alloc, __func__)))
+				return -1;
+	}
+	memcpy(g->paths+g->header.paths_len, path, len);
+	g->header.paths_len+=len;
+	g->header.candidates++;
+	return 0;
+}
+
+static int gen_add_varint(struct sparse_gen *g, uint64_t v)
+{
+	// A 64 bit number takes at most ten bytes.
+	if(g->header.deltas_len+10>g->deltas_alloc)
+	{
+		g->deltas_alloc=g->deltas_alloc?g->deltas_alloc*2:65536;
+		if(!(g->deltas=(uint8_t *)realloc_w(g->deltas,
+			g->deltas_alloc, __func__)))
+				return -1;
+	}
+	while(v>=0x80)
+	{
+		g->deltas[g->header.deltas_len++]=(uint8_t)(v|0x80);
+		v>>=7;
+	}
+	g->deltas[g->header.deltas_len++]=(uint8_t)v;
+	return 0;
+}
+
+// Read the gzipped sparse index in the same way as candidate_load().
+static int gen_read_source(struct sparse_gen *g, const char *sparse_path)
+{
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc())
+	  || !(fzp=fzp_gzopen(sparse_path, "rb")))
+		goto end;
+	while(1)
+	{
+		sbuf_free_content(sb);
+		switch(sbuf_fill_from_file(sb, fzp, blk))
+		{
+			case 1: ret=0;
+				goto end;
+			case -1:
+				logp("Error reading %s in %s\n",
+					sparse_path, __func__);
+				goto end;
+		}
+		if(blk_fingerprint_is_hook(blk))
+		{
+			// Hooks before the first manifest line have
+			// nothing to belong to.
+			if(g->header.candidates
+			  && gen_add_pair(g, blk->fingerprint))
+				goto end;
+		}
+		else if(sb->path.cmd==CMD_MANIFEST)
+		{
+			if(gen_add_path(g, sb->path.buf))
+				goto end;
+		}
+		blk->fingerprint=0;
+	}
+end:
+	fzp_close(&fzp);
+	sbuf_free(&sb);
+	blk_free(&blk);
+	return ret;
+}
+
+static int pair_cmp(const void *a, const void *b)
+{
+	const struct gen_pair *x=(const struct gen_pair *)a;
+	const struct gen_pair *y=(const struct gen_pair *)b;
+	if(x->fingerprint>y->fingerprint) return 1;
+	if(x->fingerprint<y->fingerprint) return -1;
+	if(x->id>y->id) return 1;
+	if(x->id<y->id) return -1;
+	return 0;
+}
+
+static int gen_build(struct sparse_gen *g)
+{
+	size_t p=0;
+	size_t q;
+	size_t max_blocks;
+	uint64_t last=0;
+	struct sparse_file_header *h=&g->header;
+
+	qsort(g->pairs, g->pairs_len, sizeof(struct gen_pair), pair_cmp);
+
+	max_blocks=g->pairs_len/SPARSE_FILE_BLOCK+1;
+	if(!(g->block_first=(uint64_t *)malloc_w(
+		max_blocks*sizeof(uint64_t), __func__))
+	  || !(g->block_offset=(uint64_t *)malloc_w(
+		(max_blocks+1)*sizeof(uint64_t), __func__))
+	  || !(g->block_ids=(uint64_t *)malloc_w(
+		max_blocks*sizeof(uint64_t), __func__))
+	  || !(g->ids=(uint32_t *)malloc_w(
+		(g->pairs_len?g->pairs_len:1)*sizeof(uint32_t), __func__)))
+			return -1;
+
+	while(p<g->pairs_len)
+	{
+		uint64_t fingerprint=g->pairs[p].fingerprint;
+		uint64_t start=h->ids;
+
+		for(q=p; q<g->pairs_len
+		  && g->pairs[q].fingerprint==fingerprint; q++)
+		{
+			if(q>p && g->pairs[q].id==g->pairs[q-1].id)
+				continue;
+			g->ids[h->ids++]=g->pairs[q].id;
+		}
+
+		if(!(h->fingerprints%SPARSE_FILE_BLOCK))
+		{
+			g->block_first[h->blocks]=fingerprint;
+			g->block_offset[h->blocks]=h->deltas_len;
+			g->block_ids[h->blocks]=start;
+			h->blocks++;
+		}
+		else if(gen_add_varint(g, fingerprint-last))
+			return -1;
+		if(gen_add_varint(g, h->ids-start))
+			return -1;
+
+		last=fingerprint;
+		h->fingerprints++;
+		p=q;
+	}
+	g->block_offset[h->blocks]=h->deltas_len;
+	return 0;
+}
+
+static int gen_write(struct sparse_gen *g, const char *path)
+{
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	struct sparse_file_header *h=&g->header;
+
+	if(!(fzp=fzp_open(path, "wb")))
+		goto end;
+	if(fzp_write(fzp, h, sizeof(*h))!=sizeof(*h)
+	  || fzp_write(fzp, g->block_first, h->blocks*sizeof(uint64_t))
+		!=h->blocks*sizeof(uint64_t)
+	  || fzp_write(fzp, g->block_offset, (h->blocks+1)*sizeof(uint64_t))
+		!=(h->blocks+1)*sizeof(uint64_t)
+	  || fzp_write(fzp, g->block_ids, h->blocks*sizeof(uint64_t))
+		!=h->blocks*sizeof(uint64_t)
+	  || fzp_write(fzp, g->ids, h->ids*sizeof(uint32_t))
+		!=h->ids*sizeof(uint32_t)
+	  || fzp_write(fzp, g->deltas, h->deltas_len)!=h->deltas_len
+	  || fzp_write(fzp, g->paths, h->paths_len)!=h->paths_len)
+	{
+		logp("Short write to %s\n", path);
+		goto end;
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+// Make the binary copy of the gzipped sparse index at sparse_path. The
+// caller should hold the sparse lock.
+int sparse_file_generate(const char *sparse_path)
+{
+	int ret=-1;
+	struct stat statp;
+	struct sparse_gen g;
+	char *path=NULL;
+	char *tmp=NULL;
+
+	memset(&g, 0, sizeof(g));
+	g.header.magic=SPARSE_FILE_MAGIC;
+	g.header.version=SPARSE_FILE_VERSION;
+
+	if(lstat(sparse_path, &statp))
+	{
+		logp("Could not lstat %s: %s\n", sparse_path, strerror(errno));
+		goto end;
+	}
+	g.header.source_size=(uint64_t)statp.st_size;
+	g.header.source_mtime=(int64_t)statp.st_mtime;
+	g.header.source_ino=(uint64_t)statp.st_ino;
+
+	if(!(path=get_idx_path(sparse_path))
+	  || !(tmp=prepend_n(path, "tmp", strlen("tmp"), "."))
+	  || gen_read_source(&g, sparse_path)
+	  || gen_build(&g)
+	  || gen_write(&g, tmp)
+	  || do_rename(tmp, path))
+		goto end;
+	logp("Wrote %s: %" PRIu64 " hooks, %u candidates\n",
+		path, g.header.fingerprints, g.header.candidates);
+	ret=0;
+end:
+	if(ret && tmp)
+		unlink(tmp);
+	sparse_gen_free_content(&g);
+	free_w(&path);
+	free_w(&tmp);
+	return ret;
+}
+
+void sparse_file_close(struct sparse_file **sf)
+{
+	if(!sf || !*sf) return;
+	if((*sf)->map!=MAP_FAILED)
+		munmap((*sf)->map, (*sf)->len);
+	if((*sf)->fd>=0)
+		close((*sf)->fd);
+	free_v((void **)sf);
+}
+
+static int sparse_file_valid(struct sparse_file *sf, struct stat *source)
+{
+	char *cp;
+	uint32_t c=0;
+	struct sparse_file_header *h;
+
+	if(sf->len<sizeof(struct sparse_file_header))
+		return 0;
+	h=sf->header;
+	if(h->magic!=SPARSE_FILE_MAGIC
+	  || h->version!=SPARSE_FILE_VERSION
+	  || h->blocks!=(h->fingerprints+SPARSE_FILE_BLOCK-1)
+		/SPARSE_FILE_BLOCK
+	  || sf->len!=sizeof(struct sparse_file_header)
+		+h->blocks*sizeof(uint64_t)*3+sizeof(uint64_t)
+		+h->ids*sizeof(uint32_t)
+		+h->deltas_len
+		+h->paths_len)
+			return 0;
+
+	sf->block_first=(uint64_t *)(h+1);
+	sf->block_offset=sf->block_first+h->blocks;
+	sf->block_ids=sf->block_offset+h->blocks+1;
+	sf->ids=(uint32_t *)(sf->block_ids+h->blocks);
+	sf->deltas=(uint8_t *)(sf->ids+h->ids);
+	sf->paths=(char *)(sf->deltas+h->deltas_len);
+
+	if(h->paths_len && sf->paths[h->paths_len-1])
+		return 0;
+	for(cp=sf->paths; cp<sf->paths+h->paths_len; cp+=strlen(cp)+1)
+		c++;
+	if(c!=h->candidates)
+		return 0;
+
+	// Not much use if the gzipped version has changed since.
+	if(h->source_size!=(uint64_t)source->st_size
+	  || h->source_mtime!=(int64_t)source->st_mtime
+	  || h->source_ino!=(uint64_t)source->st_ino)
+		return 0;
+	return 1;
+}
+
+// Return 0 for opened OK, 1 if there is no up to date sparse file (so the
+// caller should make one, or fall back to the gzipped sparse index), -1
+// for error.
+int sparse_file_open(const char *sparse_path, struct sparse_file **sf)
+{
+	int ret=-1;
+	struct stat statp;
+	struct stat source;
+	char *path=NULL;
+
+	if(!(path=get_idx_path(sparse_path))
+	  || !(*sf=(struct sparse_file *)
+		calloc_w(1, sizeof(struct sparse_file), __func__)))
+			goto end;
+	(*sf)->fd=-1;
+	(*sf)->map=MAP_FAILED;
+
+	ret=1;
+	if(lstat(sparse_path, &source))
+		goto end;
+	if(((*sf)->fd=open(path, O_RDONLY))<0)
+	{
+		if(errno!=ENOENT)
+			logp("Could not open %s: %s\n",
+				path, strerror(errno));
+		goto end;
+	}
+	if(fstat((*sf)->fd, &statp))
+	{
+		logp("Could not stat %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	if(!((*sf)->len=(size_t)statp.st_size))
+		goto end;
+	if(((*sf)->map=mmap(NULL, (*sf)->len, PROT_READ, MAP_SHARED,
+		(*sf)->fd, 0))==MAP_FAILED)
+	{
+		logp("Could not mmap %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	(*sf)->header=(struct sparse_file_header *)(*sf)->map;
+	if(!sparse_file_valid(*sf, &source))
+	{
+		logp("%s is out of date or not valid\n", path);
+		goto end;
+	}
+	ret=0;
+end:
+	if(ret)
+		sparse_file_close(sf);
+	free_w(&path);
+	return ret;
+}
+
+static uint64_t get_varint(uint8_t **p, uint8_t *end)
+{
+	int shift=0;
+	uint64_t v=0;
+	while(*p<end)
+	{
+		uint8_t b=*((*p)++);
+		v|=(uint64_t)(b&0x7F)<<shift;
+		if(!(b&0x80)) break;
+		shift+=7;
+	}
+	return v;
+}
+
+// Find the block that the fingerprint would be in, then walk through the
+// deltas in it.
+uint32_t *sparse_file_find(struct sparse_file *sf,
+	uint64_t fingerprint, size_t *len)
+{
+	size_t lo=0;
+	size_t hi;
+	size_t mid;
+	size_t b;
+	uint8_t *p;
+	uint8_t *end;
+	uint64_t f;
+	uint64_t id;
+	uint64_t n;
+
+	*len=0;
+	if(!sf) return NULL;
+
+	hi=sf->header->blocks;
+	while(lo<hi)
+	{
+		mid=lo+(hi-lo)/2;
+		if(sf->block_first[mid]<=fingerprint)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	if(!lo) return NULL;
+	b=lo-1;
+
+	p=sf->deltas+sf->block_offset[b];
+	end=sf->deltas+sf->block_offset[b+1];
+	f=sf->block_first[b];
+	id=sf->block_ids[b];
+	while(1)
+	{
+		n=get_varint(&p, end);
+		if(f==fingerprint)
+		{
+			*len=(size_t)n;
+			return sf->ids+id;
+		}
+		if(p>=end) break;
+		id+=n;
+		f+=get_varint(&p, end);
+		if(f>fingerprint) break;
+	}
+	return NULL;
+}
+
+uint32_t sparse_file_candidates(struct sparse_file *sf)
+{
+	return sf->header->candidates;
+}
+
+const char *sparse_file_paths(struct sparse_file *sf)
+{
+	return sf->paths;
+}
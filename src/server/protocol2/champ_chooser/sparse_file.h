@@ -0,0 +1,54 @@
+#ifndef _CHAMP_CHOOSER_SPARSE_FILE_H
+#define _CHAMP_CHOOSER_SPARSE_FILE_H
+
+// A binary copy of the global sparse index, kept next to it as 'sparse.idx'
+// so that the champ chooser can mmap it and search it in place, instead of
+// gunzipping and parsing the whole thing into memory when it starts.
+//
+// After the header come:
+//  - the first fingerprint of each block of SPARSE_FILE_BLOCK fingerprints,
+//  - where each block starts in the delta stream,
+//  - where the posting lists of each block start in the ids,
+//  - the candidate ids of all the posting lists, one after the other,
+//  - the delta stream: for each fingerprint in a block, the difference from
+//    the previous one (except for the first, which is in the block array)
+//    and the length of its posting list, as varints,
+//  - the candidate paths, each terminated by a '\0', in id order.
+// Numbers are in host byte order. The file is only ever read on the
+// machine that wrote it.
+// The posting lists are left as plain arrays, so that they can be handed
+// out directly from the mapping. Most hooks are only in one or two
+// candidates, so there is little to gain from compressing them.
+
+#define SPARSE_FILE_MAGIC	0x5844495053425242ULL // "BRBSPIDX"
+#define SPARSE_FILE_VERSION	1
+#define SPARSE_FILE_BLOCK	32
+
+struct sparse_file_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t candidates;
+	// The gzipped sparse index that this was made from, so that a stale
+	// copy can be spotted.
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_ino;
+	uint64_t fingerprints;
+	uint64_t ids;
+	uint64_t blocks;
+	uint64_t deltas_len;
+	uint64_t paths_len;
+};
+
+struct sparse_file;
+
+extern int sparse_file_generate(const char *sparse_path);
+extern int sparse_file_open(const char *sparse_path, struct sparse_file **sf);
+extern void sparse_file_close(struct sparse_file **sf);
+extern uint32_t *sparse_file_find(struct sparse_file *sf,
+	uint64_t fingerprint, size_t *len);
+extern uint32_t sparse_file_candidates(struct sparse_file *sf);
+extern const char *sparse_file_paths(struct sparse_file *sf);
+
+#endif
@@ -8,6 +8,7 @@
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol2/blk.h"
+#include "blkz.h"
 #include "dpth.h"
 
 static int get_data_lock(struct lock *lock, const char *path)
@@ -354,5 +355,21 @@ int dpth_protocol2_fwrite(struct dpth *dpth,
 	if(!dpth->fzp
 	  && !(dpth->fzp=open_data_file_for_write(dpth, blk))) return -1;
 
+	if(dpth->compression)
+	{
+		size_t zlen=0;
+		const char *zbuf=NULL;
+		switch(blkz_compress(iobuf->buf, iobuf->len,
+			dpth->compression, &zbuf, &zlen))
+		{
+			case 0:
+				return fwrite_buf(CMD_DATA_ZSTD,
+					zbuf, zlen, dpth->fzp);
+			case 1:
+				break; // Store it as it is.
+			default:
+				return -1;
+		}
+	}
 	return fwrite_buf(CMD_DATA, iobuf->buf, iobuf->len, dpth->fzp);
 }
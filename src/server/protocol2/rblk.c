@@ -1,23 +1,32 @@
 #include "../../burp.h"
 #include "../../alloc.h"
 #include "../../cmd.h"
+#include "../../cntr.h"
 #include "../../fzp.h"
 #include "../../hexmap.h"
 #include "../../iobuf.h"
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol2/blk.h"
+#include "blkz.h"
 #include "rblk.h"
 
 static ssize_t rblk_mem=0;
 static ssize_t rblk_mem_max=0;
 
+// Blocks found in memory, blocks that needed reading from a data file, and
+// data files dropped to stay under rblk_memory_max.
+static uint64_t rblk_hits=0;
+static uint64_t rblk_misses=0;
+static uint64_t rblk_evictions=0;
+
 // For retrieving stored data.
 struct rblk
 {
 	uint64_t hash_key;
 	struct iobuf readbuf[DATA_FILE_SIG_MAX];
 	uint16_t rlen;
+	size_t mem;
 	struct fzp *fzp;
 	UT_hash_handle hh;
 };
@@ -25,10 +34,9 @@ struct rblk
 static void rblk_free_content(struct rblk *rblk)
 {
 	for(int j=0; j<rblk->rlen; j++)
-	{
-		rblk_mem-=rblk->readbuf[j].len;
 		iobuf_free_content(&rblk->readbuf[j]);
-	}
+	rblk_mem-=rblk->mem;
+	rblk->mem=0;
 	fzp_close(&rblk->fzp);
 }
 
@@ -45,18 +53,29 @@ logp("close: %s\n", x);
 	free_v((void **)rblk);
 }
 
+// The hash also keeps its entries in the order that they were added, so
+// moving an entry to the end each time that it is used leaves the least
+// recently used data file at the start.
 static struct rblk *rblk_hash=NULL;
 
 static struct rblk *rblk_hash_find(uint64_t savepath)
 {
 	struct rblk *rblk;
-	HASH_FIND_INT(rblk_hash, &savepath, rblk);
+	HASH_FIND(hh, rblk_hash, &savepath, sizeof(savepath), rblk);
 	return rblk;
 }
 
 static void rblk_hash_add(struct rblk *rblk)
 {
-	HASH_ADD_INT(rblk_hash, hash_key, rblk);
+	HASH_ADD(hh, rblk_hash, hash_key, sizeof(rblk->hash_key), rblk);
+}
+
+static void rblk_hash_touch(struct rblk *rblk)
+{
+	if(!rblk->hh.next)
+		return;
+	HASH_DEL(rblk_hash, rblk);
+	rblk_hash_add(rblk);
 }
 
 static struct rblk *rblk_alloc(void)
@@ -71,6 +90,9 @@ static struct rblk *rblk_alloc(void)
 void rblks_init(ssize_t rblk_memory_max)
 {
 	rblk_mem_max=rblk_memory_max;
+	rblk_hits=0;
+	rblk_misses=0;
+	rblk_evictions=0;
 }
 
 void rblks_free(void)
@@ -78,30 +100,35 @@ void rblks_free(void)
 	struct rblk *tmp;
 	struct rblk *rblk;
 
+	if(rblk_hits || rblk_misses)
+		logp("Restore data cache: %" PRIu64 " hits, %" PRIu64
+			" misses, %" PRIu64 " evictions\n",
+			rblk_hits, rblk_misses, rblk_evictions);
+
 	HASH_ITER(hh, rblk_hash, rblk, tmp)
 	{
 		HASH_DEL(rblk_hash, rblk);
 		rblk_free(&rblk);
 	}
 	rblk_hash=NULL;
+	blkz_free();
 }
 
 static int rblks_free_one_except(struct rblk *keep)
 {
-	uint64_t before=rblk_mem;
 	struct rblk *tmp;
 	struct rblk *rblk;
 
+	// Least recently used first.
 	HASH_ITER(hh, rblk_hash, rblk, tmp)
 	{
 		if(rblk==keep)
 			continue;
 		HASH_DEL(rblk_hash, rblk);
 		rblk_free(&rblk);
-		break;
-	}
-	if(before!=rblk_mem)
+		rblk_evictions++;
 		return 0;
+	}
 	return -1;
 }
 
@@ -139,6 +166,9 @@ static int rblk_load_more_chunks(struct rblk *rblk, uint16_t datno_target)
 		switch(iobuf_fill_from_fzp_data(&rbuf, rblk->fzp))
 		{
 			case 0:
+				if(rbuf.cmd==CMD_DATA_ZSTD
+				  && blkz_decompress(&rbuf))
+					goto end;
 				if(rbuf.cmd!=CMD_DATA)
 				{
 					logp("unknown cmd in %s: %c\n",
@@ -146,6 +176,7 @@ static int rblk_load_more_chunks(struct rblk *rblk, uint16_t datno_target)
 					goto end;
 				}
 				iobuf_move(&rblk->readbuf[rblk->rlen], &rbuf);
+				rblk->mem+=rblk->readbuf[rblk->rlen].len;
 				rblk_mem+=rblk->readbuf[rblk->rlen].len;
 				continue;
 			case 1:
@@ -159,6 +190,7 @@ static int rblk_load_more_chunks(struct rblk *rblk, uint16_t datno_target)
 	}
 	ret=0;
 end:
+	iobuf_free_content(&rbuf);
 	return ret;
 }
 
@@ -183,13 +215,22 @@ int rblk_retrieve_data(struct asfd *asfd, struct cntr *cntr,
 		}
 		rblk_hash_add(rblk);
 	}
+	else
+		rblk_hash_touch(rblk);
 
 	if(datno>=rblk->rlen)
 	{
 		// Need to load more from this data file.
+		rblk_misses++;
+		cntr_add_val(cntr, CMD_RBLK_MISS, 1);
 		if(rblk_load_more_chunks(rblk, datno))
 			return -1;
 	}
+	else
+	{
+		rblk_hits++;
+		cntr_add_val(cntr, CMD_RBLK_HIT, 1);
+	}
 
 	while(rblk_mem>rblk_mem_max)
 	{
@@ -198,6 +239,7 @@ int rblk_retrieve_data(struct asfd *asfd, struct cntr *cntr,
 			logw(asfd, cntr, "rblk_memory_max is too low!\n");
 			break;
 		}
+		cntr_add_val(cntr, CMD_RBLK_EVICT, 1);
 	}
 
 // printf("lookup: %s (%u)\n", savepathstr, datno);
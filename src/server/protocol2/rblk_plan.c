@@ -0,0 +1,222 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../hexmap.h"
+#include "../../log.h"
+#include "../../prepend.h"
+#include "../../sbuf.h"
+#include "../../protocol2/blk.h"
+#include "../manio.h"
+#include "rblk_plan.h"
+
+// Restore planner. A second reader goes through the manifest ahead of the
+// restore, collecting the data files that the blocks of the next window
+// are in. Once it has collected up to 'budget' bytes of data files, they
+// are sorted and the kernel is asked to start reading them in, so that by
+// the time rblk_retrieve_data() gets to them they are already in memory,
+// and the disk has read them in order rather than seeking about.
+// Another window is planned each time the restore gets half way through
+// the current one.
+// A window is also cut short after RBLK_PLAN_FILES_MAX data files, so that
+// missing or empty data files cannot make it read the whole manifest.
+// Failures here are not fatal - the restore just carries on without the
+// help.
+
+#define RBLK_PLAN_FILES_MAX	1024
+
+static struct manio *manio=NULL;
+static struct sbuf *sb=NULL;
+static struct blk *blk=NULL;
+static char *datpath=NULL;
+static size_t budget=0;
+static int (*want)(struct sbuf *sb, void *data)=NULL;
+static void *want_data=NULL;
+static int want_blocks=0;
+
+static uint64_t *keys=NULL;
+static size_t keys_len=0;
+static size_t keys_alloc=0;
+
+static uint64_t planned=0; // Blocks that the planner has gone through.
+static uint64_t consumed=0; // Blocks that the restore has gone through.
+static uint64_t replan_at=0;
+static uint64_t advised=0; // Data files asked for.
+static uint64_t windows=0;
+
+static void plan_stop(void)
+{
+	manio_close(&manio);
+	sbuf_free(&sb);
+	blk_free(&blk);
+}
+
+static char *get_data_file_path(uint64_t key)
+{
+	return prepend_s(datpath, uint64_to_savepathstr(key));
+}
+
+static size_t data_file_size(uint64_t key)
+{
+	size_t size=0;
+	struct stat statp;
+	char *path;
+	if(!(path=get_data_file_path(key)))
+		return 0;
+	if(!lstat(path, &statp))
+		size=(size_t)statp.st_size;
+	free_w(&path);
+	return size;
+}
+
+static void data_file_advise(uint64_t key)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int fd;
+	char *path;
+	if(!(path=get_data_file_path(key)))
+		return;
+	// A missing data file gets reported when the restore gets to it.
+	if((fd=open(path, O_RDONLY))>=0)
+	{
+		// Starts the read in the background. The pages stay in the
+		// cache after the file is closed.
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+		advised++;
+	}
+	free_w(&path);
+#endif
+}
+
+static int key_add(uint64_t key)
+{
+	if(keys_len==keys_alloc)
+	{
+		keys_alloc=keys_alloc?keys_alloc*2:256;
+		if(!(keys=(uint64_t *)realloc_w(keys,
+			keys_alloc*sizeof(uint64_t), __func__)))
+				return -1;
+	}
+	keys[keys_len++]=key;
+	return 0;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	return (x>y)-(x<y);
+}
+
+static void plan_window(void)
+{
+	size_t k;
+	size_t bytes=0;
+	uint64_t key;
+	uint64_t start=planned;
+
+	keys_len=0;
+	while(manio && bytes<budget && keys_len<RBLK_PLAN_FILES_MAX)
+	{
+		blk->got_save_path=0;
+		switch(manio_read_with_blk(manio, sb, blk))
+		{
+			case 0: break;
+			case 1: plan_stop();
+				continue;
+			default:
+				logp("Stopping restore read ahead\n");
+				plan_stop();
+				continue;
+		}
+		if(blk->got_save_path)
+		{
+			// Skipped blocks count too, because the restore steps
+			// past them as well.
+			planned++;
+			if(!want_blocks)
+				continue;
+			key=uint64_to_savepath_hash_key(blk->savepath);
+			// Blocks usually come from the same data file as the
+			// one before.
+			if(keys_len && keys[keys_len-1]==key)
+				continue;
+			if(key_add(key))
+			{
+				plan_stop();
+				break;
+			}
+			bytes+=data_file_size(key);
+			continue;
+		}
+		if(sb->path.buf && !sb->endfile.buf)
+			want_blocks=(sbuf_is_filedata(sb)
+				|| sbuf_is_vssdata(sb))
+			  && want(sb, want_data);
+		sbuf_free_content(sb);
+	}
+
+	qsort(keys, keys_len, sizeof(uint64_t), key_cmp);
+	for(k=0; k<keys_len; k++)
+		if(!k || keys[k]!=keys[k-1])
+			data_file_advise(keys[k]);
+
+	replan_at=start+(planned-start)/2;
+	windows++;
+}
+
+int rblk_plan_init(const char *manifest, const char *dpath,
+	size_t b, int w(struct sbuf *sb, void *data), void *data)
+{
+	rblk_plan_free();
+	if(!(datpath=strdup_w(dpath, __func__))
+	  || !(manio=manio_open(manifest, "rb", PROTO_2))
+	  || !(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc()))
+	{
+		rblk_plan_free();
+		return -1;
+	}
+	budget=b;
+	want=w;
+	want_data=data;
+	plan_window();
+	return 0;
+}
+
+// Called for each block that the restore reads from the manifest, whether it
+// retrieves the data for it or not.
+void rblk_plan_step(void)
+{
+	if(++consumed<replan_at || !manio)
+		return;
+	plan_window();
+}
+
+void rblk_plan_free(void)
+{
+	if(windows)
+		logp("Restore read ahead: %" PRIu64 " blocks, %" PRIu64
+			" data files, %" PRIu64 " windows\n",
+			planned, advised, windows);
+	plan_stop();
+	free_w(&datpath);
+	free_v((void **)&keys);
+	keys_len=0;
+	keys_alloc=0;
+	want_blocks=0;
+	planned=0;
+	consumed=0;
+	replan_at=0;
+	advised=0;
+	windows=0;
+}
+
+uint64_t rblk_plan_planned(void)
+{
+	return planned;
+}
+
+uint64_t rblk_plan_advised(void)
+{
+	return advised;
+}
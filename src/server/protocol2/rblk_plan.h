@@ -0,0 +1,14 @@
+#ifndef _RBLK_PLAN_H
+#define _RBLK_PLAN_H
+
+struct sbuf;
+
+extern int rblk_plan_init(const char *manifest, const char *datpath,
+	size_t budget, int want(struct sbuf *sb, void *data), void *data);
+extern void rblk_plan_step(void);
+extern void rblk_plan_free(void);
+
+extern uint64_t rblk_plan_planned(void);
+extern uint64_t rblk_plan_advised(void);
+
+#endif
@@ -24,6 +24,7 @@
 #include "protocol1/restore.h"
 #include "protocol2/dpth.h"
 #include "protocol2/rblk.h"
+#include "protocol2/rblk_plan.h"
 #include "protocol2/restore.h"
 #include "../protocol2/rabin/rabin.h"
 #include "rubble.h"
@@ -90,6 +91,20 @@ static int want_to_restore(int srestore, struct sbuf *sb,
 	  && (!regex || regex_check(regex, sb->path.buf));
 }
 
+struct plan_want
+{
+	int srestore;
+	regex_t *regex;
+	enum action act;
+	struct conf **cconfs;
+};
+
+static int plan_want_to_restore(struct sbuf *sb, void *data)
+{
+	struct plan_want *w=(struct plan_want *)data;
+	return want_to_restore(w->srestore, sb, w->regex, w->act, w->cconfs);
+}
+
 static int setup_cntr(struct asfd *asfd, const char *manifest,
 	regex_t *regex, int srestore, struct conf **cconfs, enum action act,
 	struct bu *bu)
@@ -436,6 +451,7 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	enum protocol protocol=get_protocol(cconfs);
 	struct cntr *cntr=get_cntr(cconfs);
 	struct iobuf interrupt;
+	struct plan_want plan_want={srestore, regex, act, cconfs};
 
 	iobuf_init(&interrupt);
 
@@ -460,6 +476,14 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	  || !(sb=sbuf_alloc(protocol)))
 		goto end;
 
+	// Read ahead through the manifest, so that the data files are read
+	// in before they are needed.
+	if(protocol==PROTO_2
+	  && rblk_plan_init(manifest, sdirs->data,
+		get_uint64_t(cconfs[OPT_RBLK_MEMORY_MAX]),
+		plan_want_to_restore, &plan_want))
+			logp("Could not start restore read ahead\n");
+
 	while(1)
 	{
 		iobuf_free_content(rbuf);
@@ -495,8 +519,7 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 
 		if(blk)
 			blk->got_save_path=0;
-		switch(manio_read_with_blk(manio,
-			sb, need_data->path.buf?blk:NULL))
+		switch(manio_read_with_blk(manio, sb, blk))
 		{
 			case 0: break; // Keep going.
 			case 1: ret=0; goto end; // Finished OK.
@@ -505,6 +528,14 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 
 		if(protocol==PROTO_2)
 		{
+			if(blk->got_save_path)
+			{
+				// The read ahead has to know about every block
+				// that goes past, including skipped ones.
+				rblk_plan_step();
+				if(!need_data->path.buf)
+					continue;
+			}
 			if(sb->endfile.buf)
 			{
 				if(act==ACTION_RESTORE && !last_ent_was_skipped)
@@ -594,6 +625,7 @@ end:
 	iobuf_free_content(rbuf);
 	iobuf_free_content(&interrupt);
 	manio_close(&manio);
+	rblk_plan_free();
 	return ret;
 }
 
@@ -11,6 +11,7 @@
 #include "protocol1/backup_phase4.h"
 #include "protocol2/backup_phase4.h"
 #include "sdirs.h"
+#include "backup_streams.h"
 #include "rubble.h"
 #include "timestamp.h"
 
@@ -219,6 +220,7 @@ static int recover_working(struct async *as,
 	struct stat statp;
 	char *phase1datatmp=NULL;
 	int resume_attempts=0;
+	int streams_interrupted=0;
 	int max_resume_attempts=get_int(cconfs[OPT_MAX_RESUME_ATTEMPTS]);
 	enum recovery_method recovery_method=get_e_recovery_method(
 		cconfs[OPT_WORKING_DIR_RECOVERY_METHOD]);
@@ -245,6 +247,13 @@ static int recover_working(struct async *as,
 		logp("Phase 1 has not completed.\n");
 		recovery_method=RECOVERY_METHOD_DELETE;
 	}
+	else if((streams_interrupted=backup_streams_interrupted(sdirs)))
+	{
+		if(streams_interrupted<0)
+			goto end;
+		logp("Phase 2 was using more than one stream.\n");
+		recovery_method=RECOVERY_METHOD_DELETE;
+	}
 	else
 	{
 		append_to_resume_file(sdirs->working);
@@ -6,6 +6,7 @@
 #include "../cntr.h"
 #include "../handy.h"
 #include "../fsops.h"
+#include "../fzp.h"
 #include "../iobuf.h"
 #include "../lock.h"
 #include "../log.h"
@@ -518,6 +519,8 @@ int run_action_server(struct async *as,
 {
 	int ret=-1;
         struct sdirs *sdirs=NULL;
+	// Manifests and indexes written from here on.
+	fzp_set_zstd_level(get_int(cconfs[OPT_COMPRESSION_ZSTD]));
         if((sdirs=sdirs_alloc())
           && !sdirs_init_from_confs(sdirs, cconfs))
 		ret=run_action_server_do(as,
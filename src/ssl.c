@@ -1,12 +1,29 @@
 #include "burp.h"
 #include "alloc.h"
 #include "conf.h"
+#include "fsops.h"
 #include "log.h"
+#include "prepend.h"
 #include "server/ca.h"
 #include "ssl.h"
 
 static const char *pass=NULL;
 
+// Where the client keeps the session that the server last gave it.
+static const char *session_file=NULL;
+
+// Clients that connect often, only to find that their backup is not due yet,
+// can skip the public key operations of a full handshake by resuming their
+// last session. The server uses stateless session tickets, because it forks a
+// child for each connection and so a session cache in memory would be lost.
+// The keys for the tickets are created along with the SSL_CTX in the server
+// parent, so the children all share them.
+static int session_id_context=1;
+
+// Counts of handshakes, from calloc_shared_w(), so that all of the forked
+// children add to them.
+static struct ssl_handshakes *handshakes=NULL;
+
 int ssl_do_accept(SSL *ssl)
 {
 	while(1)
@@ -125,6 +142,107 @@ static int ssl_load_keys_and_certs(SSL_CTX *ctx, struct conf **confs)
 	return 0;
 }
 
+SSL_SESSION *ssl_session_load(const char *path)
+{
+	FILE *fp=NULL;
+	SSL_SESSION *sess=NULL;
+	if(!path || !(fp=fopen(path, "rb")))
+		return NULL;
+	if(!(sess=PEM_read_SSL_SESSION(fp, NULL, NULL, NULL)))
+		logp("Could not read SSL session from %s\n", path);
+	fclose(fp);
+	return sess;
+}
+
+int ssl_session_save(SSL_SESSION *sess, const char *path)
+{
+	int fd=-1;
+	int ret=-1;
+	FILE *fp=NULL;
+	char *tmp=NULL;
+	char suffix[32]="";
+	// The extra backup streams are other processes saving their sessions
+	// at the same time, so each one needs its own temporary file.
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	if(!(tmp=prepend(path, suffix)))
+		goto end;
+	// The session has the keys in it, so keep it to ourselves.
+	if((fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR))<0)
+	{
+		logp("Could not open %s: %s\n", tmp, strerror(errno));
+		goto end;
+	}
+	if(!(fp=fdopen(fd, "wb")))
+	{
+		logp("Could not fdopen %s: %s\n", tmp, strerror(errno));
+		close_fd(&fd);
+		goto end;
+	}
+	if(!PEM_write_SSL_SESSION(fp, sess))
+	{
+		logp_ssl_err("Could not write SSL session to %s\n", tmp);
+		fclose(fp);
+		goto end;
+	}
+	if(fclose(fp))
+	{
+		logp("Could not close %s: %s\n", tmp, strerror(errno));
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	ret=0;
+end:
+	if(ret && tmp) unlink(tmp);
+	free_w(&tmp);
+	return ret;
+}
+
+// Called by openssl whenever the server gives the client a new session, which
+// for TLSv1.3 is some time after the handshake.
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	// A session made without our certificate is no good for resuming.
+	// This is the case when the client is waiting for its certificate
+	// signing request.
+	if(!SSL_get_certificate(ssl))
+		return 0;
+	ssl_session_save(sess, session_file);
+	// We did not keep a reference to the session.
+	return 0;
+}
+
+static void ssl_setup_sessions(SSL_CTX *ctx, struct conf **confs)
+{
+	int timeout=get_int(confs[OPT_SSL_SESSION_TIMEOUT]);
+
+	SSL_CTX_set_session_id_context(ctx,
+		(const uint8_t *)&session_id_context,
+		sizeof(session_id_context));
+
+	if(get_e_burp_mode(confs[OPT_BURP_MODE])==BURP_MODE_CLIENT)
+	{
+		if(!(session_file=get_string(confs[OPT_SSL_SESSION_FILE])))
+			return;
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+			| SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+		return;
+	}
+
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	if(timeout<=0)
+	{
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		return;
+	}
+	SSL_CTX_set_timeout(ctx, timeout);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	// The client only keeps the latest one.
+	SSL_CTX_set_num_tickets(ctx, 1);
+#endif
+}
+
 SSL_CTX *ssl_initialise_ctx(struct conf **confs)
 {
 	SSL_CTX *ctx=NULL;
@@ -153,6 +271,17 @@ SSL_CTX *ssl_initialise_ctx(struct conf **confs)
 
 	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3);
 
+	if(get_int(confs[OPT_SSL_KTLS]))
+	{
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		logp("This version of openssl cannot use kernel TLS, so config option '%s' will not work.\n", confs[OPT_SSL_KTLS]->field);
+#endif
+	}
+
+	ssl_setup_sessions(ctx, confs);
+
 	return ctx;
 }
 
@@ -161,6 +290,66 @@ void ssl_destroy_ctx(SSL_CTX *ctx)
 	SSL_CTX_free(ctx);
 }
 
+// Whether the kernel is doing the encryption for what gets sent. This is
+// only possible if ssl_ktls is on, and the kernel and the negotiated cipher
+// both support it.
+int ssl_ktls_send(SSL *ssl)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+	return 0;
+#endif
+}
+
+int ssl_handshakes_alloc_shared(void)
+{
+	if(handshakes) return 0;
+	if(!(handshakes=(struct ssl_handshakes *)
+		calloc_shared_w(sizeof(struct ssl_handshakes), __func__)))
+			return -1;
+	return 0;
+}
+
+void ssl_handshakes_free_shared(void)
+{
+	free_shared_v((void **)&handshakes, sizeof(struct ssl_handshakes));
+}
+
+struct ssl_handshakes *ssl_handshakes_get(void)
+{
+	return handshakes;
+}
+
+void ssl_handshake_done(SSL *ssl)
+{
+	uint64_t full;
+	uint64_t resumed;
+	int reused=SSL_session_reused(ssl);
+	if(ssl_ktls_send(ssl))
+		logp("Using kernel TLS for sending\n");
+	if(!handshakes)
+	{
+		if(reused) logp("Resumed SSL session\n");
+		return;
+	}
+	if(reused)
+		__sync_fetch_and_add(&handshakes->resumed, 1);
+	else
+		__sync_fetch_and_add(&handshakes->full, 1);
+	resumed=__sync_fetch_and_add(&handshakes->resumed, 0);
+	full=__sync_fetch_and_add(&handshakes->full, 0);
+	logp("SSL handshake %s (%" PRIu64 " resumed, %" PRIu64 " full)\n",
+		reused?"resumed":"full", resumed, full);
+}
+
+void ssl_handshakes_log(void)
+{
+	if(!handshakes) return;
+	logp("SSL handshakes: %" PRIu64 " resumed, %" PRIu64 " full\n",
+		handshakes->resumed, handshakes->full);
+}
+
 #ifndef HAVE_WIN32
 static void sanitise(char *buf)
 {
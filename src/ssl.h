@@ -4,11 +4,28 @@
 #include <openssl/ssl.h>
 #include "conf.h"
 
+// How many handshakes resumed an earlier session, and how many did not.
+struct ssl_handshakes
+{
+	uint64_t resumed;
+	uint64_t full;
+};
+
 extern int ssl_do_accept(SSL *ssl);
 extern SSL_CTX *ssl_initialise_ctx(struct conf **confs);
 extern void ssl_destroy_ctx(SSL_CTX *ctx);
+extern int ssl_ktls_send(SSL *ssl);
 extern int ssl_load_dh_params(SSL_CTX *ctx, struct conf **confs);
 extern void ssl_load_globals(void);
 extern int ssl_check_cert(SSL *ssl, struct conf **confs, struct conf **cconfs);
 
+extern SSL_SESSION *ssl_session_load(const char *path);
+extern int ssl_session_save(SSL_SESSION *sess, const char *path);
+
+extern int ssl_handshakes_alloc_shared(void);
+extern void ssl_handshakes_free_shared(void);
+extern struct ssl_handshakes *ssl_handshakes_get(void);
+extern void ssl_handshake_done(SSL *ssl);
+extern void ssl_handshakes_log(void);
+
 #endif
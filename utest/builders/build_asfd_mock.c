@@ -102,11 +102,51 @@ static int mock_parse_readbuf(__attribute__ ((unused)) struct asfd *asfd)
 	return 0;
 }
 
+static int mock_read_batch(__attribute__ ((unused)) struct asfd *asfd,
+	__attribute__ ((unused)) struct iobuf *vec,
+	__attribute__ ((unused)) size_t max)
+{
+	return 0;
+}
+
+static int mock_set_large_frames(struct asfd *asfd)
+{
+	asfd->frame_len=ASFD_LARGE_FRAME_LEN;
+	asfd->large_frames=1;
+	return 0;
+}
+
 static int mock_set_bulk_packets(struct asfd *asfd)
 {
 	return 0;
 }
 
+static char *mock_reserve_write_buffer(
+	__attribute__ ((unused)) struct asfd *asfd, size_t len)
+{
+	static char buf[ASFD_LARGE_FRAME_LEN];
+	fail_unless(len<=sizeof(buf));
+	return buf;
+}
+
+static int mock_commit_write_buffer(struct asfd *asfd, enum cmd cmd,
+	size_t len)
+{
+	struct iobuf wbuf;
+	iobuf_set(&wbuf, cmd, mock_reserve_write_buffer(asfd, len), len);
+	return do_asfd_assert_write(asfd, &wbuf);
+}
+
+static int mock_sendfile(__attribute__ ((unused)) struct asfd *asfd,
+	__attribute__ ((unused)) enum cmd cmd,
+	__attribute__ ((unused)) int fd,
+	__attribute__ ((unused)) off_t offset,
+	__attribute__ ((unused)) size_t len)
+{
+	// Makes the caller fall back to the write that is being asserted.
+	return 1;
+}
+
 struct asfd *asfd_mock_setup(struct ioevent_list *user_reads,
 	struct ioevent_list *user_writes)
 {
@@ -119,8 +159,13 @@ struct asfd *asfd_mock_setup(struct ioevent_list *user_reads,
 	asfd->append_all_to_write_buffer=
 		mock_asfd_assert_append_all_to_write_buffer;
 	asfd->parse_readbuf=mock_parse_readbuf;
+	asfd->read_batch=mock_read_batch;
 	asfd->simple_loop=asfd_simple_loop;
 	asfd->set_bulk_packets=mock_set_bulk_packets;
+	asfd->set_large_frames=mock_set_large_frames;
+	asfd->sendfile=mock_sendfile;
+	asfd->reserve_write_buffer=mock_reserve_write_buffer;
+	asfd->commit_write_buffer=mock_commit_write_buffer;
 	ioevent_list_init(user_reads);
 	ioevent_list_init(user_writes);
 	asfd->data1=(void *)user_reads;
@@ -0,0 +1,80 @@
+#include "../../test.h"
+#include "../../prng.h"
+#include "../../../src/alloc.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/client/protocol2/md5_pool.h"
+
+#define BLKS	2000
+
+static struct blk *blks[BLKS];
+
+static void setup(void)
+{
+	int i;
+	uint32_t j;
+	prng_init(0);
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless((blks[i]=blk_alloc_with_data(8192))!=NULL);
+		blks[i]->length=prng_next()%8192;
+		for(j=0; j<blks[i]->length; j++)
+			blks[i]->data[j]=(char)prng_next();
+	}
+}
+
+static void tear_down(void)
+{
+	int i;
+	for(i=0; i<BLKS; i++)
+		blk_free(&blks[i]);
+	alloc_check();
+}
+
+static void run_test(int threads)
+{
+	int i;
+	uint8_t expected[MD5_DIGEST_LENGTH];
+	setup();
+	fail_unless(!md5_pool_init(threads));
+	for(i=0; i<BLKS; i++)
+		fail_unless(!md5_pool_add(blks[i]));
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless(!md5_pool_wait(blks[i]));
+		MD5((unsigned char *)blks[i]->data, blks[i]->length, expected);
+		fail_unless(!memcmp(expected,
+			blks[i]->md5sum, MD5_DIGEST_LENGTH));
+	}
+	md5_pool_free();
+	tear_down();
+}
+
+START_TEST(test_md5_pool_no_threads)
+{
+	run_test(0);
+}
+END_TEST
+
+START_TEST(test_md5_pool_threads)
+{
+	run_test(1);
+	run_test(4);
+}
+END_TEST
+
+Suite *suite_client_protocol2_md5_pool(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_protocol2_md5_pool");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_md5_pool_no_threads);
+	tcase_add_test(tc_core, test_md5_pool_threads);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -397,6 +397,24 @@ static void setup_msg(struct asfd *asfd, struct conf **confs)
 	setup_extra_comms_end(asfd, &r, &w);
 }
 
+static struct asfd *large_frames_asfd=NULL;
+
+static void check_large_frames(struct conf **confs,
+	enum action action, const char *incexc)
+{
+	fail_unless(large_frames_asfd->large_frames==1);
+	fail_unless(large_frames_asfd->frame_len==ASFD_LARGE_FRAME_LEN);
+}
+
+static void setup_large_frames(struct asfd *asfd, struct conf **confs)
+{
+	int r=0; int w=0;
+	large_frames_asfd=asfd;
+	setup_extra_comms_begin(asfd, &r, &w, "large_frames");
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "large_frames");
+	setup_extra_comms_end(asfd, &r, &w);
+}
+
 static void check_rshash(struct conf **confs,
 	enum action action, const char *incexc)
 {
@@ -447,6 +465,7 @@ START_TEST(test_client_extra_comms)
 	run_test(0,  ACTION_BACKUP, setup_forceproto2, check_proto2);
 	run_test(-1, ACTION_BACKUP, setup_forceproto2_proto1, NULL);
 	run_test(0,  ACTION_BACKUP, setup_msg, check_msg);
+	run_test(0,  ACTION_BACKUP, setup_large_frames, check_large_frames);
 	run_test(0,  ACTION_BACKUP, setup_rshash, check_rshash);
 }
 END_TEST
@@ -27,6 +27,7 @@ int main(void)
 #endif
 #endif
 	srunner_add_suite(sr, suite_client_monitor_lline());
+	srunner_add_suite(sr, suite_client_protocol2_md5_pool());
 	srunner_add_suite(sr, suite_client_protocol2_rabin_read());
 #ifdef HAVE_XATTR
 	srunner_add_suite(sr, suite_client_xattr());
@@ -60,6 +61,9 @@ int main(void)
 	// These compile for Windows, but do not run correctly and the whole
 	// utest process crashes out.
 	srunner_add_suite(sr, suite_asfd());
+	srunner_add_suite(sr, suite_async());
+	srunner_add_suite(sr, suite_ratelimit());
+	srunner_add_suite(sr, suite_ssl());
 	srunner_add_suite(sr, suite_client_monitor());
 	srunner_add_suite(sr, suite_client_protocol1_backup_phase2());
 	srunner_add_suite(sr, suite_client_protocol2_backup_phase2());
@@ -79,6 +83,7 @@ int main(void)
 	srunner_add_suite(sr, suite_server_extra_comms());
 	srunner_add_suite(sr, suite_server_list());
 	srunner_add_suite(sr, suite_server_manio());
+	srunner_add_suite(sr, suite_server_prefork());
 	srunner_add_suite(sr, suite_server_monitor_browse());
 	srunner_add_suite(sr, suite_server_monitor_cache());
 	srunner_add_suite(sr, suite_server_monitor_cstat());
@@ -94,14 +99,21 @@ int main(void)
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase2());
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase4());
 	srunner_add_suite(sr, suite_server_protocol2_bsparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_candidate());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_cache());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_workers());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_chooser());
 	srunner_add_suite(sr,
 		suite_server_protocol2_champ_chooser_champ_server());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_dindex());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_hash());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_mindex());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_scores());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse_file());
 	srunner_add_suite(sr, suite_server_protocol2_dpth());
+	srunner_add_suite(sr, suite_server_protocol2_rblk());
+	srunner_add_suite(sr, suite_server_protocol2_rblk_plan());
 	srunner_add_suite(sr, suite_server_restore());
 	srunner_add_suite(sr, suite_server_resume());
 	srunner_add_suite(sr, suite_server_run_action());
@@ -1,5 +1,12 @@
 #include "../test.h"
 #include "../../src/alloc.h"
+#include "../../src/asfd.h"
+#include "../../src/async.h"
+#include "../../src/bfile.h"
+#include "../../src/fsops.h"
+#include "../../src/handy.h"
+#include "../../src/iobuf.h"
+#include "../../src/ratelimit.h"
 #include "../../src/protocol1/handy.h"
 
 static void tear_down(void)
@@ -40,12 +47,99 @@ START_TEST(test_send_whole_filel)
 		NULL, // cntr
 		NULL, // bfd
 		NULL, // extrameta
-		0 // elen
+		0, // elen
+		0 // use_sendfile
 	);
 	fail_unless(result==SEND_FATAL);
 }
 END_TEST
 
+#define SEND_PATH	"utest_protocol1_handy_send"
+
+static void read_one(struct async *as, struct asfd *r)
+{
+	while(!r->rbuf->buf)
+		fail_unless(!as->read_write(as));
+}
+
+// Sends a real file over a socket, with the data either going straight from
+// the file, or being read into the write buffer.
+static void do_test_send_whole_filel_real(int use_sendfile, int buffered)
+{
+	int sv[2];
+	FILE *fp;
+	size_t i;
+	size_t got=0;
+	uint64_t bytes=0;
+	struct BFILE bfd;
+	struct async *as;
+	struct asfd *w;
+	struct asfd *r;
+	MD5_CTX md5;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	static char buf[10000];
+
+	for(i=0; i<sizeof(buf); i++)
+		buf[i]='a'+i%26;
+	fail_unless((fp=fopen(SEND_PATH, "wb"))!=NULL);
+	fail_unless(fwrite(buf, 1, sizeof(buf), fp)==sizeof(buf));
+	fail_unless(!fclose(fp));
+	fail_unless(MD5_Init(&md5));
+	fail_unless(MD5_Update(&md5, buf, sizeof(buf)));
+	fail_unless(MD5_Final(checksum, &md5));
+
+	fail_unless((as=async_alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless((w=setup_asfd(as, "writer", &sv[0], -1))!=NULL);
+	fail_unless((r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+	w->attempt_reads=0;
+	// Rate limited writes go through the write buffer.
+	if(buffered)
+		fail_unless((w->rl=ratelimit_alloc(1024*1024*1024,
+			NULL, NULL))!=NULL);
+
+	bfile_init(&bfd, 0, NULL);
+	fail_unless(!bfd.open(&bfd, NULL, SEND_PATH, O_RDONLY, 0));
+	fail_unless(send_whole_filel(w,
+#ifdef HAVE_WIN32
+		CMD_FILE,
+#endif
+		SEND_PATH, 0, &bytes, NULL, &bfd, NULL, 0,
+		use_sendfile)==SEND_OK);
+	fail_unless(!bfd.close(&bfd, NULL));
+	fail_unless(bytes==sizeof(buf));
+	fail_unless(!asfd_flush_asio(w));
+
+	while(got<sizeof(buf))
+	{
+		read_one(as, r);
+		fail_unless(r->rbuf->cmd==CMD_APPEND);
+		fail_unless(r->rbuf->len<=4096);
+		fail_unless(!memcmp(r->rbuf->buf, buf+got, r->rbuf->len));
+		got+=r->rbuf->len;
+		iobuf_free_content(r->rbuf);
+	}
+	fail_unless(got==sizeof(buf));
+	read_one(as, r);
+	fail_unless(r->rbuf->cmd==CMD_END_FILE);
+	ck_assert_str_eq(r->rbuf->buf,
+		get_endfile_str(sizeof(buf), checksum));
+	iobuf_free_content(r->rbuf);
+
+	fail_unless(!recursive_delete(SEND_PATH));
+	async_asfd_free_all(&as);
+	tear_down();
+}
+
+START_TEST(test_send_whole_filel_real)
+{
+	do_test_send_whole_filel_real(1 /* use_sendfile */, 0 /* buffered */);
+	do_test_send_whole_filel_real(1 /* use_sendfile */, 1 /* buffered */);
+	do_test_send_whole_filel_real(0 /* use_sendfile */, 0 /* buffered */);
+}
+END_TEST
+
 Suite *suite_protocol1_handy(void)
 {
 	Suite *s;
@@ -58,6 +152,7 @@ Suite *suite_protocol1_handy(void)
 	tcase_add_test(tc_core, test_enc_setup_no_password);
 	tcase_add_test(tc_core, test_enc_setup_ok);
 	tcase_add_test(tc_core, test_send_whole_filel);
+	tcase_add_test(tc_core, test_send_whole_filel_real);
 
 	suite_add_tcase(s, tc_core);
 
@@ -1,5 +1,6 @@
 #include "../../test.h"
 #include "../../builders/build_file.h"
+#include "../../prng.h"
 #include "../../../src/alloc.h"
 #include "../../../src/asfd.h"
 #include "../../../src/client/protocol2/rabin_read.h"
@@ -101,6 +102,92 @@ START_TEST(test_rabin_blks_generate_empty_file)
 	alloc_check();
 }
 END_TEST
+
+#define RANDOM_FILE_LEN	(256*1024+123)
+
+static void build_random_file(const char *path, char *content)
+{
+	FILE *fp;
+	for(size_t i=0; i<RANDOM_FILE_LEN; i++)
+		content[i]=(char)prng_next();
+	build_file(path, "");
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	fail_unless(fwrite(content, RANDOM_FILE_LEN, 1, fp)==1);
+	fail_unless(!fclose(fp));
+}
+
+static void do_test_blks_generate(enum chunker chunker)
+{
+	int ret;
+	size_t pos=0;
+	struct blk *blk;
+	struct blist *blist;
+	struct sbuf *sb;
+	struct conf **confs;
+	char *myfile;
+	char *content;
+
+	alloc_check_init();
+	prng_init(0);
+	fail_unless((myfile=strdup_w(BASE "/myfile", __func__))!=NULL);
+	fail_unless((content=(char *)malloc(RANDOM_FILE_LEN))!=NULL);
+	fail_unless(!recursive_delete(BASE));
+	hexmap_init();
+	build_file(CONFFILE, MIN_CLIENT_CONF);
+	confs=setup_conf();
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	fail_unless((blist=blist_alloc())!=NULL);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	iobuf_from_str(&sb->path, CMD_FILE, myfile);
+	build_random_file(myfile, content);
+	fail_unless(rabin_open_file(
+		sb,
+		NULL, /*asfd*/
+		NULL, /*cntr*/
+		confs)==1);
+	fail_unless(!blks_generate_init());
+	blks_generate_set_chunker(chunker);
+
+	ret=blks_generate(sb, blist, 1/*just_opened*/);
+	while(!ret)
+		ret=blks_generate(sb, blist, 0/*just_opened*/);
+	fail_unless(ret==1);
+
+	fail_unless(sb->protocol2->bstart==blist->head);
+	fail_unless(sb->protocol2->bend==blist->tail);
+	for(blk=blist->head; blk; blk=blk->next)
+	{
+		fail_unless(blk->length<=RABIN_MAX);
+		if(blk->next)
+			fail_unless(blk->length>=RABIN_MIN);
+		fail_unless(!memcmp(blk->data, content+pos, blk->length));
+		fail_unless(blk_verify_fingerprint(blk->fingerprint,
+			blk->data, blk->length)==1);
+		pos+=blk->length;
+	}
+	fail_unless(pos==RANDOM_FILE_LEN);
+
+	blks_generate_free();
+	fail_unless(!rabin_close_file(sb, NULL/*asfd*/));
+	blist_free(&blist);
+	sbuf_free(&sb);
+	confs_free(&confs);
+	free(content);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+START_TEST(test_rabin_blks_generate_rabin)
+{
+	do_test_blks_generate(CHUNKER_RABIN);
+}
+END_TEST
+
+START_TEST(test_rabin_blks_generate_gear)
+{
+	do_test_blks_generate(CHUNKER_GEAR);
+}
+END_TEST
 #endif
 
 Suite *suite_protocol2_rabin_rabin(void)
@@ -115,6 +202,8 @@ Suite *suite_protocol2_rabin_rabin(void)
 	tcase_add_test(tc_core, test_rabin_blk_verify_fingerprint);
 #ifndef HAVE_WIN32
 	tcase_add_test(tc_core, test_rabin_blks_generate_empty_file);
+	tcase_add_test(tc_core, test_rabin_blks_generate_rabin);
+	tcase_add_test(tc_core, test_rabin_blks_generate_gear);
 #endif
 	suite_add_tcase(s, tc_core);
 
@@ -20,11 +20,25 @@ START_TEST(test_rconf_init)
 	fail_unless(rconf.blk_min  <  rconf.blk_max);
 	fail_unless(rconf.blk_avg  >= rconf.blk_min);
 	fail_unless(rconf.blk_avg  <= rconf.blk_max);
+	fail_unless(rconf.chunker==CHUNKER_RABIN);
 
 	tear_down();
 }
 END_TEST
 
+START_TEST(test_rconf_str_to_chunker)
+{
+	alloc_check_init();
+	fail_unless(str_to_chunker(NULL)==CHUNKER_RABIN);
+	fail_unless(str_to_chunker("rabin")==CHUNKER_RABIN);
+	fail_unless(str_to_chunker("gear")==CHUNKER_GEAR);
+	fail_unless(str_to_chunker("blah")==CHUNKER_UNSET);
+	ck_assert_str_eq(chunker_to_str(CHUNKER_RABIN), "rabin");
+	ck_assert_str_eq(chunker_to_str(CHUNKER_GEAR), "gear");
+	tear_down();
+}
+END_TEST
+
 Suite *suite_protocol2_rabin_rconf(void)
 {
 	Suite *s;
@@ -35,6 +49,7 @@ Suite *suite_protocol2_rabin_rconf(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_rconf_init);
+	tcase_add_test(tc_core, test_rconf_str_to_chunker);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -1,5 +1,8 @@
 #include "../test.h"
 #include "../../src/alloc.h"
+#include "../../src/cmd.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
 #include "../../src/hexmap.h"
 #include "../../src/iobuf.h"
 #include "../../src/protocol2/blk.h"
@@ -68,6 +71,128 @@ START_TEST(test_protocol2_blk_alloc_error)
 }
 END_TEST
 
+#define SIGFILE	"utest_blk_sig"
+
+static void set_sig(struct blk *blk, uint64_t fingerprint, uint64_t savepath)
+{
+	memset(blk, 0, sizeof(*blk));
+	blk->fingerprint=fingerprint;
+	md5str_to_bytes("6334c2ae05c2421c687f516772b817da", blk->md5sum);
+	blk->savepath=savepath;
+}
+
+static void assert_sig(struct iobuf *rbuf, struct blk *expected)
+{
+	struct blk got;
+	fail_unless(rbuf->cmd==CMD_SIG);
+	fail_unless(rbuf->len==IOBUF_SIG_BIN_LEN);
+	memset(&got, 0, sizeof(got));
+	fail_unless(!blk_set_from_iobuf_sig_and_savepath(&got, rbuf));
+	fail_unless(got.fingerprint==expected->fingerprint);
+	fail_unless(!memcmp(got.md5sum, expected->md5sum, MD5_DIGEST_LENGTH));
+	fail_unless(got.savepath==expected->savepath);
+}
+
+// A text record followed by binary ones, as a manifest would look when
+// it was started by an older version.
+static void write_sigs(struct blk *b1, struct blk *b2)
+{
+	struct fzp *fzp;
+	struct iobuf wbuf;
+	fail_unless((fzp=fzp_gzopen(SIGFILE, "wb"))!=NULL);
+	blk_to_iobuf_sig_and_savepath(b1, &wbuf);
+	fail_unless(!iobuf_send_msg_fzp(&wbuf, fzp));
+	fail_unless(!to_fzp_sig_and_savepath(fzp, b2));
+	fail_unless(!to_fzp_sig_and_savepath(fzp, b1));
+	fail_unless(!fzp_close(&fzp));
+}
+
+START_TEST(test_protocol2_blk_sig_bin)
+{
+	struct blk b1;
+	struct blk b2;
+	struct fzp *fzp;
+	struct iobuf rbuf;
+	alloc_check_init();
+	hexmap_init();
+	set_sig(&b1, 0xFEDCBA9876543210, 0x0001000200030004);
+	set_sig(&b2, 0x0A0B0C0D0E0F1011, 0x00000000FFFFFFFF);
+	write_sigs(&b1, &b2);
+	memset(&rbuf, 0, sizeof(rbuf));
+
+	// Binary records come back looking like text ones.
+	fail_unless((fzp=fzp_gzopen(SIGFILE, "rb"))!=NULL);
+	fail_unless(!iobuf_fill_from_fzp(&rbuf, fzp));
+	assert_sig(&rbuf, &b1);
+	iobuf_free_content(&rbuf);
+	fail_unless(!iobuf_fill_from_fzp(&rbuf, fzp));
+	assert_sig(&rbuf, &b2);
+	iobuf_free_content(&rbuf);
+	fail_unless(!iobuf_fill_from_fzp(&rbuf, fzp));
+	assert_sig(&rbuf, &b1);
+	iobuf_free_content(&rbuf);
+	fail_unless(iobuf_fill_from_fzp(&rbuf, fzp)==1);
+	fzp_close(&fzp);
+
+	fail_unless(!recursive_delete(SIGFILE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_sig_bin_no_alloc)
+{
+	struct blk b1;
+	struct blk b2;
+	struct fzp *fzp;
+	struct iobuf rbuf;
+	struct iobuf tmp;
+	char sig[IOBUF_SIG_BIN_LEN];
+	alloc_check_init();
+	hexmap_init();
+	set_sig(&b1, 0xFEDCBA9876543210, 0x0001000200030004);
+	set_sig(&b2, 0x0A0B0C0D0E0F1011, 0x00000000FFFFFFFF);
+	write_sigs(&b1, &b2);
+	memset(&rbuf, 0, sizeof(rbuf));
+
+	fail_unless((fzp=fzp_gzopen(SIGFILE, "rb"))!=NULL);
+	// The text record is read as usual.
+	fail_unless(!iobuf_fill_from_fzp_sig(&rbuf, fzp, sig));
+	assert_sig(&rbuf, &b1);
+	iobuf_free_content(&rbuf);
+	// The binary ones go straight into the caller's buffer.
+	fail_unless(iobuf_fill_from_fzp_sig(&rbuf, fzp, sig)==2);
+	fail_unless(rbuf.buf==NULL);
+	iobuf_set(&tmp, CMD_SIG, sig, IOBUF_SIG_BIN_LEN);
+	assert_sig(&tmp, &b2);
+	fail_unless(iobuf_fill_from_fzp_sig(&rbuf, fzp, sig)==2);
+	iobuf_set(&tmp, CMD_SIG, sig, IOBUF_SIG_BIN_LEN);
+	assert_sig(&tmp, &b1);
+	fail_unless(iobuf_fill_from_fzp_sig(&rbuf, fzp, sig)==1);
+	fzp_close(&fzp);
+
+	fail_unless(!recursive_delete(SIGFILE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_sig_bin_truncated)
+{
+	struct fzp *fzp;
+	struct iobuf rbuf;
+	const char rec[]={ CMD_SIG_BIN, 'a', 'b', 'c' };
+	alloc_check_init();
+	memset(&rbuf, 0, sizeof(rbuf));
+	fail_unless((fzp=fzp_gzopen(SIGFILE, "wb"))!=NULL);
+	fail_unless(fzp_write(fzp, rec, sizeof(rec))==sizeof(rec));
+	fail_unless(!fzp_close(&fzp));
+	fail_unless((fzp=fzp_gzopen(SIGFILE, "rb"))!=NULL);
+	fail_unless(iobuf_fill_from_fzp(&rbuf, fzp)==-1);
+	fzp_close(&fzp);
+	fail_unless(!recursive_delete(SIGFILE));
+	alloc_check();
+}
+END_TEST
+
 Suite *suite_protocol2_blk(void)
 {
 	Suite *s;
@@ -80,6 +205,9 @@ Suite *suite_protocol2_blk(void)
 	tcase_add_test(tc_core, test_protocol2_blk);
 	tcase_add_test(tc_core, test_protocol2_blk_length_errors);
 	tcase_add_test(tc_core, test_protocol2_blk_alloc_error);
+	tcase_add_test(tc_core, test_protocol2_blk_sig_bin);
+	tcase_add_test(tc_core, test_protocol2_blk_sig_bin_no_alloc);
+	tcase_add_test(tc_core, test_protocol2_blk_sig_bin_truncated);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -10,9 +10,15 @@
 #include "../../../src/hexmap.h"
 #include "../../../src/fsops.h"
 #include "../../../src/iobuf.h"
+#include "../../../src/prepend.h"
+#include "../../../src/ratelimit.h"
+#include "../../../src/server/backup_streams.h"
+#include "../../../src/server/manio.h"
 #include "../../../src/server/protocol1/backup_phase2.h"
 #include "../../../src/server/sdirs.h"
 #include "../../../src/slist.h"
+
+#include <sys/un.h>
 #include "../../builders/build_asfd_mock.h"
 #include "../../builders/build_file.h"
 
@@ -415,6 +421,230 @@ START_TEST(test_phase2_happy_path_changed_files)
 }
 END_TEST
 
+static struct asfd *stream_connect(struct async *as, struct sdirs *sdirs)
+{
+	int fd;
+	char *path;
+	struct asfd *asfd;
+	struct sockaddr_un addr;
+	fail_unless((path=prepend_s(sdirs->working, "streams.sock"))!=NULL);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	fail_unless(strlen(path)<sizeof(addr.sun_path));
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	free_w(&path);
+	fail_unless((fd=socket(AF_UNIX, SOCK_STREAM, 0))>=0);
+	fail_unless(!connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+	fail_unless((asfd=setup_asfd(as, "client stream", &fd, -1))!=NULL);
+	fail_unless(!asfd->set_large_frames(asfd));
+	return asfd;
+}
+
+static void client_free(struct async *as, struct asfd **asfd)
+{
+	if(!*asfd) return;
+	as->asfd_remove(as, *asfd);
+	asfd_close(*asfd);
+	asfd_free(asfd);
+}
+
+static void stream_say(struct async *as, struct asfd *c, struct stream *s,
+	const char *token)
+{
+	char msg[64];
+	snprintf(msg, sizeof(msg), "stream %s", token);
+	fail_unless(!c->write_str(c, CMD_GEN, msg));
+	while(!s->asfd->rbuf->buf)
+		fail_unless(!as->read_write(as));
+}
+
+START_TEST(test_phase2_streams_accept_join)
+{
+	int i;
+	int sv[2];
+	int lfd;
+	struct async *as;
+	struct sdirs *sdirs;
+	struct asfd *asfd;
+	struct asfd *lasfd;
+	struct asfd *c[4];
+	struct asfd *joined[2];
+	struct stream *streams;
+	const char *token="0123456789abcdef0123456789abcdef";
+	setup(&as, &sdirs, NULL);
+	build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
+	fail_unless(!sdirs_get_real_working_from_symlink(sdirs));
+
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless((asfd=setup_asfd(as, "main", &sv[0], -1))!=NULL);
+	fail_unless((asfd->rl=ratelimit_alloc(1000, NULL, NULL))!=NULL);
+	fail_unless((streams=streams_alloc(3, asfd, sdirs))!=NULL);
+	fail_unless((lfd=backup_streams_listen(sdirs->working))>=0);
+	fail_unless((lasfd=setup_asfd(as, "listen", &lfd, -1))!=NULL);
+	lasfd->fdtype=ASFD_FD_SERVER_LISTEN_MAIN;
+	fail_unless(!streams_all_here(streams, 3, time(NULL)));
+
+	// The right token.
+	c[0]=stream_connect(as, sdirs);
+	fail_unless(!streams_accept(as, lasfd, streams, 3));
+	fail_unless(streams[1].asfd!=NULL);
+	fail_unless(!streams[1].joined);
+	// All of the streams share the one limit.
+	fail_unless(streams[1].asfd->rl==asfd->rl);
+	stream_say(as, c[0], &streams[1], token);
+	stream_join(as, &streams[1], 1, token);
+	fail_unless(streams[1].joined);
+
+	// The wrong token.
+	c[1]=stream_connect(as, sdirs);
+	fail_unless(!streams_accept(as, lasfd, streams, 3));
+	fail_unless(streams[2].asfd!=NULL);
+	stream_say(as, c[1], &streams[2], "wrong");
+	stream_join(as, &streams[2], 2, token);
+	fail_unless(streams[2].asfd==NULL);
+	fail_unless(!streams[2].joined);
+	client_free(as, &c[1]);
+
+	// Still waiting for one, unless it has had long enough.
+	fail_unless(!streams_all_here(streams, 3, time(NULL)));
+	fail_unless(streams_all_here(streams, 3,
+		time(NULL)-BACKUP_STREAMS_JOIN_TIMEOUT));
+
+	// It can have another go.
+	c[2]=stream_connect(as, sdirs);
+	fail_unless(!streams_accept(as, lasfd, streams, 3));
+	stream_say(as, c[2], &streams[2], token);
+	stream_join(as, &streams[2], 2, token);
+	fail_unless(streams[2].joined);
+	fail_unless(streams_all_here(streams, 3, time(NULL)));
+
+	// No room for any more.
+	joined[0]=streams[1].asfd;
+	joined[1]=streams[2].asfd;
+	c[3]=stream_connect(as, sdirs);
+	fail_unless(!streams_accept(as, lasfd, streams, 3));
+	fail_unless(streams[1].asfd==joined[0]);
+	fail_unless(streams[2].asfd==joined[1]);
+
+	fail_unless(!streams_close(streams, 3));
+	streams_free(as, &streams, 3);
+	for(i=0; i<4; i++)
+		client_free(as, &c[i]);
+	client_free(as, &lasfd);
+	client_free(as, &asfd);
+	close(sv[1]);
+	tear_down(&as, &sdirs, NULL);
+}
+END_TEST
+
+START_TEST(test_phase2_streams_next)
+{
+	int i;
+	int next=0;
+	struct stream streams[3];
+	memset(streams, 0, sizeof(streams));
+	for(i=0; i<3; i++)
+	{
+		fail_unless((streams[i].asfd=asfd_alloc())!=NULL);
+		streams[i].joined=1;
+	}
+
+	// Taking turns when they are even.
+	fail_unless(stream_next(streams, 3, &next)==&streams[0]);
+	fail_unless(stream_next(streams, 3, &next)==&streams[1]);
+	fail_unless(stream_next(streams, 3, &next)==&streams[2]);
+	fail_unless(stream_next(streams, 3, &next)==&streams[0]);
+
+	// The one that the client has the least left to send on, even if
+	// there is more waiting to go out to it.
+	streams[0].outstanding=2;
+	streams[1].outstanding=1;
+	streams[2].outstanding=1;
+	streams[2].asfd->writebuflen=100;
+	fail_unless(stream_next(streams, 3, &next)==&streams[1]);
+	streams[1].outstanding=3;
+	fail_unless(stream_next(streams, 3, &next)==&streams[2]);
+
+	// Then the least waiting to go out.
+	streams[0].outstanding=1;
+	streams[1].outstanding=1;
+	streams[2].outstanding=1;
+	streams[0].asfd->writebuflen=50;
+	streams[1].asfd->writebuflen=10;
+	fail_unless(stream_next(streams, 3, &next)==&streams[1]);
+
+	// Not ones that are busy, or have not joined.
+	fail_unless((streams[1].p1b=sbuf_alloc(PROTO_1))!=NULL);
+	streams[2].joined=0;
+	fail_unless(stream_next(streams, 3, &next)==&streams[0]);
+	fail_unless((streams[0].p1b=sbuf_alloc(PROTO_1))!=NULL);
+	fail_unless(stream_next(streams, 3, &next)==NULL);
+
+	for(i=0; i<3; i++)
+	{
+		sbuf_free(&streams[i].p1b);
+		streams[i].asfd->writebuflen=0;
+		asfd_free(&streams[i].asfd);
+	}
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_phase2_streams_merge_changed)
+{
+	int i=0;
+	struct sbuf *s;
+	struct sbuf *sb;
+	struct manio *manio;
+	struct sdirs *sdirs;
+	struct slist *slist;
+	struct stream *streams;
+	char *changed[3];
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+	setup(NULL, &sdirs, NULL);
+	build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
+	fail_unless(!sdirs_get_real_working_from_symlink(sdirs));
+	slist=build_manifest(BASE "/manifest", PROTO_1, 30, 2);
+
+	// Each stream gets its own files in order, but which stream gets which
+	// file is all over the place.
+	fail_unless((streams=streams_alloc(3, NULL, sdirs))!=NULL);
+	for(s=slist->head; s; s=s->next)
+		fail_unless(!manio_write_sbuf(
+			streams[prng_next()%3].chmanio, s));
+	fail_unless(!streams_close(streams, 3));
+	for(i=0; i<3; i++)
+	{
+		fail_unless(is_reg_lstat(streams[i].changed)==1);
+		changed[i]=streams[i].changed;
+	}
+
+	fail_unless(!merge_changed(sdirs, streams, 3));
+	for(i=0; i<3; i++)
+		fail_unless(is_reg_lstat(changed[i])<=0);
+
+	fail_unless((sb=sbuf_alloc(PROTO_1))!=NULL);
+	fail_unless((manio=manio_open_phase2(sdirs->changed,
+		"rb", PROTO_1))!=NULL);
+	for(s=slist->head; s; s=s->next)
+	{
+		fail_unless(!manio_read(manio, sb));
+		ck_assert_str_eq(sb->path.buf, s->path.buf);
+		fail_unless(sb->path.cmd==s->path.cmd);
+		sbuf_free_content(sb);
+	}
+	fail_unless(manio_read(manio, sb)==1);
+	fail_unless(!manio_close(&manio));
+
+	sbuf_free(&sb);
+	streams_free(NULL, &streams, 3);
+	slist_free(&slist);
+	tear_down(NULL, &sdirs, NULL);
+}
+END_TEST
+
 Suite *suite_server_protocol1_backup_phase2(void)
 {
 	Suite *s;
@@ -438,6 +668,10 @@ Suite *suite_server_protocol1_backup_phase2(void)
 	tcase_add_test(tc_core, test_phase2_happy_path_no_files);
 	tcase_add_test(tc_core, test_phase2_happy_path_changed_files);
 
+	tcase_add_test(tc_core, test_phase2_streams_accept_join);
+	tcase_add_test(tc_core, test_phase2_streams_next);
+	tcase_add_test(tc_core, test_phase2_streams_merge_changed);
+
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,207 @@
+#include "../../../test.h"
+#include "../../../prng.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+
+#include <sys/time.h>
+
+static struct scores *scores=NULL;
+static struct incoming *in=NULL;
+
+static void setup(void)
+{
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((in=incoming_alloc())!=NULL);
+}
+
+static void tear_down(void)
+{
+	candidates_free();
+	sparse_delete_all();
+	scores_free(&scores);
+	incoming_free(&in);
+	alloc_check();
+}
+
+static struct candidate *add_candidate(uint64_t *fingerprints, int len)
+{
+	int i;
+	struct candidate *candidate;
+	fail_unless((candidate=candidates_add_new())!=NULL);
+	for(i=0; i<len; i++)
+		fail_unless(!sparse_add_candidate(&fingerprints[i],
+			candidate));
+	return candidate;
+}
+
+static void candidates_ready(void)
+{
+	fail_unless(!scores_grow(scores, candidates_len));
+	fail_unless(!sparse_prepare());
+}
+
+static void add_incoming(uint64_t *fingerprints, int len)
+{
+	int i;
+	for(i=0; i<len; i++)
+	{
+		fail_unless(!incoming_grow_maybe(in));
+		in->fingerprints[in->size-1]=fingerprints[i];
+	}
+	incoming_found_reset(in);
+}
+
+START_TEST(test_candidates_choose_champ)
+{
+	struct candidate *a;
+	struct candidate *b;
+	struct candidate *champ;
+	uint64_t fa[]={1, 2, 3};
+	uint64_t fb[]={2, 3, 4, 5};
+	uint64_t fc[]={5};
+	uint64_t fi[]={1, 2, 3, 4, 5, 6};
+
+	setup();
+	a=add_candidate(fa, 3);
+	b=add_candidate(fb, 4);
+	add_candidate(fc, 1);
+	candidates_ready();
+	add_incoming(fi, 6);
+
+	fail_unless((champ=candidates_choose_champ(in, NULL, scores))==b);
+	// Hooks that b has are now dealt with, so a should be next.
+	fail_unless((champ=candidates_choose_champ(in, champ, scores))==a);
+	fail_unless(!candidates_choose_champ(in, champ, scores));
+	fail_unless(in->found[0]);
+	fail_unless(!in->found[5]);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_prefers_newer)
+{
+	struct candidate *b;
+	uint64_t f[]={1, 2, 3};
+
+	setup();
+	add_candidate(f, 3);
+	b=add_candidate(f, 3);
+	candidates_ready();
+	add_incoming(f, 3);
+
+	fail_unless(candidates_choose_champ(in, NULL, scores)==b);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_deleted)
+{
+	struct candidate *a;
+	struct candidate *b;
+	uint64_t fa[]={1};
+	uint64_t fb[]={1, 2, 3};
+
+	setup();
+	a=add_candidate(fa, 1);
+	b=add_candidate(fb, 3);
+	candidates_ready();
+	add_incoming(fb, 3);
+
+	b->deleted=1;
+	fail_unless(candidates_choose_champ(in, NULL, scores)==a);
+	a->deleted=1;
+	fail_unless(!candidates_choose_champ(in, NULL, scores));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_no_candidates)
+{
+	uint64_t f[]={1, 2, 3};
+	setup();
+	candidates_ready();
+	add_incoming(f, 3);
+	fail_unless(!candidates_choose_champ(in, NULL, scores));
+	tear_down();
+}
+END_TEST
+
+#define BENCH_HOOKS		64
+#define BENCH_INCOMING		256
+#define BENCH_ROUNDS		10
+
+static double time_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+// Not a pass/fail test. Shows how long choosing champions takes as the
+// number of candidates goes up.
+static void benchmark_choose_champ(int count)
+{
+	int c;
+	int h;
+	int r;
+	double start;
+	uint64_t pool_size=(uint64_t)count*BENCH_HOOKS/4;
+	uint64_t f[BENCH_INCOMING];
+	struct candidate *champ;
+
+	setup();
+	prng_init(0);
+	for(c=0; c<count; c++)
+	{
+		for(h=0; h<BENCH_HOOKS; h++)
+			f[h]=prng_next64()%pool_size;
+		add_candidate(f, BENCH_HOOKS);
+	}
+	candidates_ready();
+	for(h=0; h<BENCH_INCOMING; h++)
+		f[h]=prng_next64()%pool_size;
+	add_incoming(f, BENCH_INCOMING);
+
+	start=time_now();
+	for(r=0; r<BENCH_ROUNDS; r++)
+	{
+		champ=NULL;
+		incoming_found_reset(in);
+		while((champ=candidates_choose_champ(in, champ, scores)))
+			;
+	}
+	printf("candidates_choose_champ: %7d candidates: %.6fs per segment\n",
+		count, (time_now()-start)/BENCH_ROUNDS);
+	tear_down();
+}
+
+START_TEST(test_candidates_choose_champ_benchmark)
+{
+	benchmark_choose_champ(1000);
+	benchmark_choose_champ(10000);
+	benchmark_choose_champ(50000);
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_candidate(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_candidate");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_candidates_choose_champ);
+	tcase_add_test(tc_core, test_candidates_choose_champ_prefers_newer);
+	tcase_add_test(tc_core, test_candidates_choose_champ_deleted);
+	tcase_add_test(tc_core, test_candidates_choose_champ_no_candidates);
+	tcase_add_test(tc_core, test_candidates_choose_champ_benchmark);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
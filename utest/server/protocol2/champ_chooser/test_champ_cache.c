@@ -0,0 +1,164 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/prepend.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_cache.h"
+#include "../../../../src/server/protocol2/champ_chooser/hash.h"
+#include "../../../../src/server/protocol2/champ_chooser/mindex.h"
+
+#define BASE	"utest_champ_cache"
+#define ENTRIES	100
+
+static void tear_down(void)
+{
+	champ_cache_free();
+	hash_delete_all();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+// Make a champion with a mindex. The manifest itself only needs to exist.
+static void make_champ(const char *champ, uint64_t offset)
+{
+	int i;
+	char *path;
+	struct fzp *fzp;
+	struct hash_strong entries[ENTRIES];
+
+	for(i=0; i<ENTRIES; i++)
+	{
+		entries[i].weak=offset+i;
+		entries[i].savepath=offset+i;
+		memset(entries[i].md5sum, i, MD5_DIGEST_LENGTH);
+	}
+	fail_unless((path=mindex_path_from_champ(BASE, champ))!=NULL);
+	fail_unless(!mindex_write(path, entries, ENTRIES));
+	free_w(&path);
+
+	fail_unless((path=prepend_s(BASE, champ))!=NULL);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	fail_unless(!fzp_close(&fzp));
+	free_w(&path);
+}
+
+static void delete_mindex(const char *champ)
+{
+	char *path;
+	fail_unless((path=mindex_path_from_champ(BASE, champ))!=NULL);
+	fail_unless(!unlink(path));
+	free_w(&path);
+}
+
+static void load_and_check(const char *champ, uint64_t offset,
+	uint64_t hits, uint64_t misses)
+{
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	fail_unless(champ_cache_load(champ, BASE)==HASH_RET_OK);
+	fail_unless(hash_count()==ENTRIES);
+	memset(md5sum, 5, MD5_DIGEST_LENGTH);
+	fail_unless(hash_strong_find(offset+5, md5sum)!=NULL);
+	fail_unless(champ_cache_hits()==hits);
+	fail_unless(champ_cache_misses()==misses);
+	hash_delete_all();
+}
+
+START_TEST(test_champ_cache_disabled)
+{
+	make_champ("c/manifest/00000000", 0);
+	champ_cache_init(0);
+	load_and_check("c/manifest/00000000", 0, 0, 0);
+	load_and_check("c/manifest/00000000", 0, 0, 0);
+	fail_unless(champ_cache_bytes()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_hit)
+{
+	make_champ("c/manifest/00000000", 0);
+	champ_cache_init(1024*1024);
+	load_and_check("c/manifest/00000000", 0, 0, 1);
+	fail_unless(champ_cache_bytes()>0);
+	// Remove the mindex, to show that the second load came from memory.
+	delete_mindex("c/manifest/00000000");
+	load_and_check("c/manifest/00000000", 0, 1, 1);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_evict)
+{
+	champ_cache_init(ENTRIES*sizeof(struct hash_strong)*2+1024);
+	make_champ("c/manifest/00000000", 0);
+	make_champ("c/manifest/00000001", 1000);
+	make_champ("c/manifest/00000002", 2000);
+	load_and_check("c/manifest/00000000", 0, 0, 1);
+	load_and_check("c/manifest/00000001", 1000, 0, 2);
+	// Use 0 again, so that 1 is the least recently used.
+	load_and_check("c/manifest/00000000", 0, 1, 2);
+	load_and_check("c/manifest/00000002", 2000, 1, 3);
+	load_and_check("c/manifest/00000000", 0, 2, 3);
+	load_and_check("c/manifest/00000001", 1000, 2, 4);
+	fail_unless(champ_cache_bytes()<=ENTRIES*sizeof(struct hash_strong)*2
+		+1024);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_too_big)
+{
+	champ_cache_init(10);
+	make_champ("c/manifest/00000000", 0);
+	load_and_check("c/manifest/00000000", 0, 0, 1);
+	fail_unless(champ_cache_bytes()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_deleted)
+{
+	char *path;
+	champ_cache_init(1024*1024);
+	make_champ("c/manifest/00000000", 0);
+	load_and_check("c/manifest/00000000", 0, 0, 1);
+	fail_unless((path=prepend_s(BASE, "c/manifest/00000000"))!=NULL);
+	fail_unless(!unlink(path));
+	free_w(&path);
+	fail_unless(champ_cache_load("c/manifest/00000000", BASE)
+		==HASH_RET_TEMP);
+	fail_unless(champ_cache_bytes()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_missing)
+{
+	champ_cache_init(1024*1024);
+	fail_unless(champ_cache_load("c/manifest/00000000", BASE)
+		==HASH_RET_TEMP);
+	fail_unless(champ_cache_bytes()==0);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_cache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_cache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_cache_disabled);
+	tcase_add_test(tc_core, test_champ_cache_hit);
+	tcase_add_test(tc_core, test_champ_cache_evict);
+	tcase_add_test(tc_core, test_champ_cache_too_big);
+	tcase_add_test(tc_core, test_champ_cache_deleted);
+	tcase_add_test(tc_core, test_champ_cache_missing);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -13,6 +13,7 @@
 #define BASE	"utest_server_protocol2_champ_chooser_candidate"
 #define SPARSE	BASE "/sparse"
 #define FRESH	BASE "/fresh"
+#define DELTAS	BASE "/sparse.d"
 
 static void tear_down(void)
 {
@@ -48,6 +49,36 @@ START_TEST(test_champ_chooser_init)
 }
 END_TEST
 
+// The deltas of the global sparse index get read after the main part.
+START_TEST(test_champ_chooser_init_deltas)
+{
+	struct scores *scores=NULL;
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+
+	fail_unless(!recursive_delete(BASE));
+
+	// Only deltas so far.
+	build_sparse_index(DELTAS "/0000000000000000", 2, 50);
+	build_sparse_index(DELTAS "/0000000000000001", 3, 50);
+	fail_unless((scores=champ_chooser_init(BASE))!=NULL);
+	fail_unless(candidates_len==5);
+	champ_chooser_free(&scores);
+
+	build_sparse_index(SPARSE, 10, 50);
+	fail_unless((scores=champ_chooser_init(BASE))!=NULL);
+	fail_unless(candidates_len==15);
+	ck_assert_str_eq(candidates[0]->path, "some/manifest/0");
+	ck_assert_str_eq(candidates[10]->path, "some/manifest/0");
+	ck_assert_str_eq(candidates[14]->path, "some/manifest/2");
+	fail_unless(scores->size>=15);
+	champ_chooser_free(&scores);
+
+	tear_down();
+}
+END_TEST
+
 Suite *suite_server_protocol2_champ_chooser_champ_chooser(void)
 {
 	Suite *s;
@@ -58,6 +89,7 @@ Suite *suite_server_protocol2_champ_chooser_champ_chooser(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_champ_chooser_init);
+	tcase_add_test(tc_core, test_champ_chooser_init_deltas);
 	suite_add_tcase(s, tc_core);
 
 	return s;
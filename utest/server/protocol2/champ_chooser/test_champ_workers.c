@@ -0,0 +1,251 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/asfd.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/hexmap.h"
+#include "../../../../src/prepend.h"
+#include "../../../../src/protocol2/blist.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_workers.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+
+#define BASE	"utest_champ_workers"
+#define CLIENTS	8
+#define BLKS	100
+#define CHAMP_BLKS	5000
+#define HOOK	0xF000000000000000ULL
+
+static struct asfd *setup_client(int c)
+{
+	int i;
+	char desc[32];
+	struct asfd *asfd;
+	struct blk *blk;
+
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	snprintf(desc, sizeof(desc), "client%d", c);
+	fail_unless((asfd->desc=strdup_w(desc, __func__))!=NULL);
+	fail_unless((asfd->blist=blist_alloc())!=NULL);
+	fail_unless((asfd->in=incoming_alloc())!=NULL);
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless((blk=blk_alloc())!=NULL);
+		blist_add_blk(asfd->blist, blk);
+		if(!asfd->blist->blk_to_dedup)
+			asfd->blist->blk_to_dedup=blk;
+		// Every other block is zero length, which is always got.
+		if(i%2)
+		{
+			blk->fingerprint=0;
+			memcpy(blk->md5sum, md5sum_of_empty_string,
+				MD5_DIGEST_LENGTH);
+		}
+		else
+		{
+			blk->fingerprint=c*BLKS+i+1;
+			memset(blk->md5sum, i, MD5_DIGEST_LENGTH);
+		}
+		blk->got=BLK_INCOMING;
+	}
+	return asfd;
+}
+
+static void check_client(struct asfd *asfd)
+{
+	int i=0;
+	struct blk *blk;
+	fail_unless(!asfd->deduplicating);
+	fail_unless(asfd->blist->blk_to_dedup==NULL);
+	fail_unless(asfd->in->size==0);
+	fail_unless(asfd->in->got==BLKS/2);
+	for(blk=asfd->blist->head; blk; blk=blk->next, i++)
+		fail_unless(blk->got==(i%2?BLK_GOT:BLK_NOT_GOT));
+	fail_unless(i==BLKS);
+}
+
+static void run_clients(int threads)
+{
+	int c;
+	struct asfd *asfd[CLIENTS];
+	struct scores *scores;
+
+	hexmap_init();
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!champ_workers_init(threads, "dummy", 1024*1024));
+	for(c=0; c<CLIENTS; c++)
+		asfd[c]=setup_client(c);
+
+	for(c=0; c<CLIENTS; c++)
+	{
+		fail_unless(!champ_workers_dispatch(asfd[c], "dummy", scores));
+		if(!champ_workers_count())
+			fail_unless(!asfd[c]->deduplicating);
+	}
+	fail_unless(!champ_workers_wait());
+	fail_unless(!champ_workers_outstanding());
+
+	for(c=0; c<CLIENTS; c++)
+	{
+		check_client(asfd[c]);
+		asfd_free(&asfd[c]);
+	}
+	champ_workers_free();
+	fail_unless(!champ_workers_count());
+	scores_free(&scores);
+	alloc_check();
+}
+
+START_TEST(test_champ_workers_inline)
+{
+	run_clients(0);
+}
+END_TEST
+
+START_TEST(test_champ_workers_threads)
+{
+	run_clients(4);
+}
+END_TEST
+
+// Every block of this champion is a hook, so that a client sending the
+// same fingerprints will choose it. There is no mindex, so the threads
+// have to read the manifest itself.
+static void make_champ(int c, struct scores *scores)
+{
+	int i;
+	char *path;
+	char champ[64];
+	struct blk blk;
+	struct fzp *fzp;
+
+	snprintf(champ, sizeof(champ), "c%d/manifest/00000000", c);
+	fail_unless((path=prepend_s(BASE, champ))!=NULL);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_gzopen(path, "wb"))!=NULL);
+	for(i=0; i<CHAMP_BLKS; i++)
+	{
+		memset(&blk, 0, sizeof(blk));
+		blk.fingerprint=HOOK|(c*CHAMP_BLKS+i+1);
+		memset(blk.md5sum, i, MD5_DIGEST_LENGTH);
+		blk.savepath=c*CHAMP_BLKS+i+1;
+		fail_unless(!to_fzp_sig_and_savepath(fzp, &blk));
+	}
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(!champ_workers_add_fresh(path, BASE, scores));
+	free_w(&path);
+}
+
+static struct asfd *setup_champ_client(int c)
+{
+	int i;
+	char desc[32];
+	struct asfd *asfd;
+	struct blk *blk;
+	struct incoming *in;
+
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	snprintf(desc, sizeof(desc), "client%d", c);
+	fail_unless((asfd->desc=strdup_w(desc, __func__))!=NULL);
+	fail_unless((asfd->blist=blist_alloc())!=NULL);
+	fail_unless((in=asfd->in=incoming_alloc())!=NULL);
+	for(i=0; i<CHAMP_BLKS; i++)
+	{
+		fail_unless(!incoming_grow_maybe(in));
+		in->fingerprints[in->size-1]=HOOK|(c*CHAMP_BLKS+i+1);
+		fail_unless((blk=blk_alloc())!=NULL);
+		blist_add_blk(asfd->blist, blk);
+		if(!asfd->blist->blk_to_dedup)
+			asfd->blist->blk_to_dedup=blk;
+		blk->fingerprint=HOOK|(c*CHAMP_BLKS+i+1);
+		memset(blk->md5sum, i, MD5_DIGEST_LENGTH);
+		blk->got=BLK_INCOMING;
+	}
+	return asfd;
+}
+
+static void check_champ_client(struct asfd *asfd, int c)
+{
+	int i=0;
+	struct blk *blk;
+	fail_unless(!asfd->deduplicating);
+	fail_unless(asfd->in->got==CHAMP_BLKS);
+	for(blk=asfd->blist->head; blk; blk=blk->next, i++)
+	{
+		fail_unless(blk->got==BLK_GOT);
+		fail_unless(blk->savepath==(uint64_t)(c*CHAMP_BLKS+i+1));
+	}
+	fail_unless(i==CHAMP_BLKS);
+}
+
+// The threads load their champions from disk at the same time.
+START_TEST(test_champ_workers_load_champs)
+{
+	int c;
+	int r;
+	struct asfd *asfd[CLIENTS];
+	struct scores *scores;
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!champ_workers_init(4, BASE, 1024*1024));
+	for(c=0; c<CLIENTS; c++)
+		make_champ(c, scores);
+	fail_unless(candidates_len==CLIENTS);
+
+	for(r=0; r<2; r++)
+	{
+		for(c=0; c<CLIENTS; c++)
+		{
+			asfd[c]=setup_champ_client(c);
+			fail_unless(!champ_workers_dispatch(asfd[c],
+				BASE, scores));
+		}
+		fail_unless(!champ_workers_wait());
+		for(c=0; c<CLIENTS; c++)
+		{
+			check_champ_client(asfd[c], c);
+			asfd_free(&asfd[c]);
+		}
+	}
+
+	champ_workers_free();
+	candidates_free();
+	sparse_delete_all();
+	scores_free(&scores);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_champ_workers_collect_nothing)
+{
+	fail_unless(!champ_workers_init(2, "dummy", 0));
+	fail_unless(!champ_workers_collect(1));
+	fail_unless(!champ_workers_wait());
+	champ_workers_free();
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_workers(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_workers");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_workers_inline);
+	tcase_add_test(tc_core, test_champ_workers_threads);
+	tcase_add_test(tc_core, test_champ_workers_load_champs);
+	tcase_add_test(tc_core, test_champ_workers_collect_nothing);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
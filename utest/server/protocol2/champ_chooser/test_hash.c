@@ -1,5 +1,7 @@
 #include "../../../test.h"
+#include "../../../prng.h"
 #include "../../../../src/alloc.h"
+#include "../../../../src/protocol2/blk.h"
 #include "../../../../src/server/protocol2/champ_chooser/hash.h"
 
 static void tear_down(void)
@@ -8,27 +10,97 @@ static void tear_down(void)
 	alloc_check();
 }
 
-START_TEST(test_hash_weak_add_alloc_error)
+static void set_blk(struct blk *blk, uint64_t fingerprint, uint8_t md5byte,
+	uint64_t savepath)
 {
-	uint64_t f0=0xFF11223344556699;
+	blk->fingerprint=fingerprint;
+	memset(blk->md5sum, md5byte, MD5_DIGEST_LENGTH);
+	blk->savepath=savepath;
+}
+
+START_TEST(test_hash_load_blk_alloc_error)
+{
+	struct blk blk;
+	set_blk(&blk, 0xFF11223344556699, 1, 2);
 	alloc_errors=1;
-	fail_unless(!hash_weak_add(f0));
+	fail_unless(hash_load_blk(&blk)==-1);
+	fail_unless(!hash_weak_find(blk.fingerprint));
 	tear_down();
 }
 END_TEST
 
-START_TEST(test_hash_weak_add)
+START_TEST(test_hash_weak_find)
 {
+	struct blk blk;
 	uint64_t f0=0xFF11223344556699;
 	uint64_t f1=0xFF11223344556690;
 	uint64_t f2=0xFF00112233445566;
 	uint64_t f3=0xFF001122AA445566;
-	fail_unless(hash_weak_add(f0)!=NULL);
-	fail_unless(hash_weak_add(f1)!=NULL);
-	fail_unless(hash_weak_find(f0)!=NULL);
-	fail_unless(hash_weak_find(f1)!=NULL);
-	fail_unless(hash_weak_find(f2)==NULL);
-	fail_unless(hash_weak_find(f3)==NULL);
+	set_blk(&blk, f0, 1, 2);
+	fail_unless(!hash_load_blk(&blk));
+	set_blk(&blk, f1, 1, 2);
+	fail_unless(!hash_load_blk(&blk));
+	fail_unless(hash_weak_find(f0));
+	fail_unless(hash_weak_find(f1));
+	fail_unless(!hash_weak_find(f2));
+	fail_unless(!hash_weak_find(f3));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_strong_find)
+{
+	struct blk blk;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	struct hash_strong *hash_strong;
+
+	// Same weak fingerprint, different md5sums.
+	set_blk(&blk, 0, 1, 10);
+	fail_unless(!hash_load_blk(&blk));
+	set_blk(&blk, 0, 2, 20);
+	fail_unless(!hash_load_blk(&blk));
+	// Duplicates are not added again.
+	set_blk(&blk, 0, 2, 30);
+	fail_unless(!hash_load_blk(&blk));
+	fail_unless(hash_count()==2);
+
+	memset(md5sum, 1, MD5_DIGEST_LENGTH);
+	fail_unless((hash_strong=hash_strong_find(0, md5sum))!=NULL);
+	fail_unless(hash_strong->savepath==10);
+	memset(md5sum, 2, MD5_DIGEST_LENGTH);
+	fail_unless((hash_strong=hash_strong_find(0, md5sum))!=NULL);
+	fail_unless(hash_strong->savepath==20);
+	memset(md5sum, 3, MD5_DIGEST_LENGTH);
+	fail_unless(hash_strong_find(0, md5sum)==NULL);
+	fail_unless(hash_strong_find(1, md5sum)==NULL);
+	tear_down();
+}
+END_TEST
+
+#define GROW_COUNT	200000
+
+START_TEST(test_hash_grow)
+{
+	int i;
+	struct blk blk;
+	struct hash_strong *hash_strong;
+
+	prng_init(0);
+	for(i=0; i<GROW_COUNT; i++)
+	{
+		set_blk(&blk, prng_next64(), (uint8_t)i, i);
+		fail_unless(!hash_load_blk(&blk));
+	}
+	fail_unless(hash_count()==GROW_COUNT);
+
+	prng_init(0);
+	for(i=0; i<GROW_COUNT; i++)
+	{
+		set_blk(&blk, prng_next64(), (uint8_t)i, i);
+		fail_unless((hash_strong=hash_strong_find(blk.fingerprint,
+			blk.md5sum))!=NULL);
+		fail_unless(hash_strong->savepath==(uint64_t)i);
+	}
 	tear_down();
 }
 END_TEST
@@ -48,8 +120,10 @@ Suite *suite_server_protocol2_champ_chooser_hash(void)
 
 	tc_core=tcase_create("Core");
 
-	tcase_add_test(tc_core, test_hash_weak_add_alloc_error);
-	tcase_add_test(tc_core, test_hash_weak_add);
+	tcase_add_test(tc_core, test_hash_load_blk_alloc_error);
+	tcase_add_test(tc_core, test_hash_weak_find);
+	tcase_add_test(tc_core, test_hash_strong_find);
+	tcase_add_test(tc_core, test_hash_grow);
 	tcase_add_test(tc_core, test_hash_load_fail_to_open);
 	suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,125 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/server/protocol2/champ_chooser/hash.h"
+#include "../../../../src/server/protocol2/champ_chooser/mindex.h"
+
+#define BASE	"utest_mindex"
+#define PATH	BASE "/manifest/mindex/00000000"
+
+static void tear_down(void)
+{
+	hash_delete_all();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void setup_entries(struct hash_strong *entries, int count)
+{
+	int i;
+	for(i=0; i<count; i++)
+	{
+		entries[i].weak=0xF000000000000000ULL+i;
+		entries[i].savepath=i*2;
+		memset(entries[i].md5sum, i, MD5_DIGEST_LENGTH);
+	}
+}
+
+START_TEST(test_mindex_write_and_load)
+{
+	int i;
+	struct hash_strong entries[100];
+	struct hash_strong *hash_strong;
+
+	setup_entries(entries, 100);
+	fail_unless(!mindex_write(PATH, entries, 100));
+	fail_unless(!mindex_load(PATH));
+	fail_unless(hash_count()==100);
+	for(i=0; i<100; i++)
+	{
+		fail_unless((hash_strong=hash_strong_find(entries[i].weak,
+			entries[i].md5sum))!=NULL);
+		fail_unless(hash_strong->savepath==entries[i].savepath);
+	}
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_mindex_write_and_load_empty)
+{
+	fail_unless(!mindex_write(PATH, NULL, 0));
+	fail_unless(!mindex_load(PATH));
+	fail_unless(hash_count()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_mindex_load_missing)
+{
+	fail_unless(mindex_load(PATH)==1);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_mindex_load_truncated)
+{
+	struct hash_strong entries[10];
+
+	setup_entries(entries, 10);
+	fail_unless(!mindex_write(PATH, entries, 10));
+	fail_unless(!truncate(PATH, sizeof(struct mindex_header)
+		+5*sizeof(struct hash_strong)));
+	fail_unless(mindex_load(PATH)==1);
+	fail_unless(hash_count()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_mindex_load_bad_magic)
+{
+	struct fzp *fzp;
+
+	fail_unless(!build_path_w(PATH));
+	fail_unless((fzp=fzp_open(PATH, "wb"))!=NULL);
+	fail_unless(fzp_printf(fzp, "this is not a mindex file\n")>0);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(mindex_load(PATH)==1);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_mindex_path_from_champ)
+{
+	char *path;
+	fail_unless((path=mindex_path_from_champ("dir",
+		"client/0000001 1970-01-01/manifest/00000003"))!=NULL);
+	ck_assert_str_eq(path,
+		"dir/client/0000001 1970-01-01/manifest/mindex/00000003");
+	free_w(&path);
+	fail_unless((path=mindex_path_from_champ(NULL, "00000003"))!=NULL);
+	ck_assert_str_eq(path, "mindex/00000003");
+	free_w(&path);
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_mindex(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_mindex");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_mindex_write_and_load);
+	tcase_add_test(tc_core, test_mindex_write_and_load_empty);
+	tcase_add_test(tc_core, test_mindex_load_missing);
+	tcase_add_test(tc_core, test_mindex_load_truncated);
+	tcase_add_test(tc_core, test_mindex_load_bad_magic);
+	tcase_add_test(tc_core, test_mindex_path_from_champ);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -53,6 +53,23 @@ START_TEST(test_scores_grow_alloc_error)
 }
 END_TEST
 
+START_TEST(test_scores_deleted)
+{
+	struct scores *scores=NULL;
+
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!scores_is_deleted(scores, 3));
+	fail_unless(!scores_add_deleted(scores, 3));
+	fail_unless(!scores_add_deleted(scores, 7));
+	fail_unless(scores_is_deleted(scores, 3));
+	fail_unless(scores_is_deleted(scores, 7));
+	fail_unless(!scores_is_deleted(scores, 5));
+	fail_unless(scores->deleted_len==2);
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
 Suite *suite_server_protocol2_champ_chooser_scores(void)
 {
 	Suite *s;
@@ -64,6 +81,7 @@ Suite *suite_server_protocol2_champ_chooser_scores(void)
 
 	tcase_add_test(tc_core, test_scores);
 	tcase_add_test(tc_core, test_scores_grow_alloc_error);
+	tcase_add_test(tc_core, test_scores_deleted);
 	suite_add_tcase(s, tc_core);
 
 	return s;
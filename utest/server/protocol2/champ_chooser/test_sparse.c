@@ -5,32 +5,67 @@
 
 static void tear_down(void)
 {
+	sparse_delete_all();
 	alloc_check();
 }
 
+static struct candidate *setup_candidate(uint32_t id)
+{
+	struct candidate *candidate;
+	fail_unless((candidate=candidate_alloc())!=NULL);
+	candidate->id=id;
+	return candidate;
+}
+
+static void assert_postings(uint64_t f, int level, uint32_t *expected,
+	size_t elen)
+{
+	size_t s;
+	size_t len;
+	uint32_t *ids;
+	ids=sparse_find(f, level, &len);
+	fail_unless(len==elen);
+	if(!elen)
+	{
+		fail_unless(ids==NULL);
+		return;
+	}
+	for(s=0; s<len; s++)
+		fail_unless(ids[s]==expected[s]);
+}
+
 START_TEST(test_sparse_add_alloc_error)
 {
 	uint64_t f0=0xFF11223344556699;
+	struct candidate *candidate=setup_candidate(0);
 	alloc_errors=1;
-	fail_unless(sparse_add_candidate(&f0, NULL)==-1);
+	fail_unless(sparse_add_candidate(&f0, candidate)==-1);
+	candidate_free(&candidate);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_add_null_candidate)
+{
+	uint64_t f0=0xFF11223344556699;
+	fail_unless(!sparse_add_candidate(&f0, NULL));
+	fail_unless(!sparse_prepare());
+	assert_postings(f0, 0, NULL, 0);
 	tear_down();
 }
 END_TEST
 
 START_TEST(test_sparse_add_one)
 {
-	struct sparse *sparse;
 	uint64_t f=0xFF11223344556677;
-	struct candidate *candidate;
+	uint32_t e[]={0};
+	struct candidate *candidate=setup_candidate(0);
 
-	fail_unless((candidate=candidate_alloc())!=NULL);
 	fail_unless(!sparse_add_candidate(&f, candidate));
+	fail_unless(!sparse_prepare());
+	assert_postings(f, 0, e, 1);
+	assert_postings(f, 1, NULL, 0);
 
-	fail_unless((sparse=sparse_find(&f))!=NULL);
-	fail_unless(sparse->size==1);
-	fail_unless(sparse->candidates[0]==candidate);
-
-	sparse_delete_all();
 	candidate_free(&candidate);
 	fail_unless(!candidate);
 	tear_down();
@@ -39,47 +74,118 @@ END_TEST
 
 START_TEST(test_sparse_add_many)
 {
-	struct sparse *sparse;
+	int i;
 	uint64_t f0=0xFF11223344556699;
 	uint64_t f1=0xFF11223344556677;
 	uint64_t f2=0xFF11223344556688;
-	struct candidate *candidate1;
-	struct candidate *candidate2;
-	struct candidate *candidate3;
-	struct candidate *candidate4;
-	struct candidate *candidate5;
-
-	fail_unless((candidate1=candidate_alloc())!=NULL);
-	fail_unless((candidate2=candidate_alloc())!=NULL);
-	fail_unless((candidate3=candidate_alloc())!=NULL);
-	fail_unless((candidate4=candidate_alloc())!=NULL);
-	fail_unless((candidate5=candidate_alloc())!=NULL);
-	fail_unless(!sparse_add_candidate(&f1, candidate1));
-	fail_unless(!sparse_add_candidate(&f1, candidate1));
-	fail_unless(!sparse_add_candidate(&f1, candidate2));
-	fail_unless(!sparse_add_candidate(&f2, candidate3));
-	fail_unless(!sparse_add_candidate(&f2, candidate4));
-	fail_unless(!sparse_add_candidate(&f2, candidate5)); // Try same again. 
-
-	fail_unless((sparse=sparse_find(&f0))==NULL);
-
-	fail_unless((sparse=sparse_find(&f1))!=NULL);
-	fail_unless(sparse->size==2);
-	fail_unless(sparse->candidates[0]==candidate1);
-	fail_unless(sparse->candidates[1]==candidate2);
-
-	fail_unless((sparse=sparse_find(&f2))!=NULL);
-	fail_unless(sparse->size==3);
-	fail_unless(sparse->candidates[0]==candidate3);
-	fail_unless(sparse->candidates[1]==candidate4);
-	fail_unless(sparse->candidates[2]==candidate5);
+	uint32_t e1[]={1, 2};
+	uint32_t e2[]={3, 4, 5};
+	struct candidate *c[6];
+
+	for(i=0; i<6; i++)
+		c[i]=setup_candidate(i);
+	fail_unless(!sparse_add_candidate(&f1, c[1]));
+	fail_unless(!sparse_add_candidate(&f1, c[1]));
+	fail_unless(!sparse_add_candidate(&f1, c[2]));
+	fail_unless(!sparse_add_candidate(&f2, c[3]));
+	fail_unless(!sparse_add_candidate(&f2, c[4]));
+	fail_unless(!sparse_add_candidate(&f2, c[5]));
+	fail_unless(!sparse_prepare());
+
+	assert_postings(f0, 0, NULL, 0);
+	assert_postings(f1, 0, e1, 2);
+	assert_postings(f2, 0, e2, 3);
+
+	for(i=0; i<6; i++)
+		candidate_free(&c[i]);
+	tear_down();
+}
+END_TEST
 
-	sparse_delete_all();
-	candidate_free(&candidate1);
-	candidate_free(&candidate2);
-	candidate_free(&candidate3);
-	candidate_free(&candidate4);
-	candidate_free(&candidate5);
+START_TEST(test_sparse_levels)
+{
+	int i;
+	uint64_t f0=0xFF11223344556699;
+	uint64_t f1=0xFF11223344556677;
+	uint32_t e0[]={0};
+	uint32_t e1[]={1};
+	uint32_t e12[]={1, 2};
+	struct candidate *c[4];
+
+	for(i=0; i<4; i++)
+		c[i]=setup_candidate(i);
+
+	// The first load goes into the main level.
+	fail_unless(!sparse_add_candidate(&f0, c[0]));
+	fail_unless(!sparse_prepare());
+
+	// Later ones go into the second level.
+	fail_unless(!sparse_add_candidate(&f0, c[1]));
+	fail_unless(!sparse_add_candidate(&f1, c[1]));
+	fail_unless(!sparse_prepare());
+	fail_unless(!sparse_add_candidate(&f1, c[2]));
+	fail_unless(!sparse_prepare());
+
+	// Fresh candidate that failed to load gets removed.
+	fail_unless(!sparse_add_candidate(&f0, c[3]));
+	sparse_delete_fresh_candidate(c[3]);
+	fail_unless(!sparse_prepare());
+
+	assert_postings(f0, 0, e0, 1);
+	assert_postings(f0, 1, e1, 1);
+	assert_postings(f1, 0, NULL, 0);
+	assert_postings(f1, 1, e12, 2);
+
+	for(i=0; i<4; i++)
+		candidate_free(&c[i]);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_merge)
+{
+	uint32_t i;
+	uint64_t f;
+	size_t len;
+	uint32_t *ids;
+	struct candidate *c0=setup_candidate(0);
+	struct candidate *c1=setup_candidate(1);
+
+	for(i=0; i<1000; i++)
+	{
+		f=0xF000000000000000ULL+i*2;
+		fail_unless(!sparse_add_candidate(&f, c0));
+	}
+	fail_unless(!sparse_prepare());
+
+	// Enough additions to force a merge into the main level.
+	for(i=0; i<70000; i++)
+	{
+		f=0xF000000000000000ULL+i;
+		fail_unless(!sparse_add_candidate(&f, c1));
+	}
+	fail_unless(!sparse_prepare());
+
+	for(i=0; i<70000; i++)
+	{
+		f=0xF000000000000000ULL+i;
+		fail_unless(sparse_find(f, 1, &len)==NULL);
+		fail_unless((ids=sparse_find(f, 0, &len))!=NULL);
+		if(i<2000 && !(i%2))
+		{
+			fail_unless(len==2);
+			fail_unless(ids[0]==0);
+			fail_unless(ids[1]==1);
+		}
+		else
+		{
+			fail_unless(len==1);
+			fail_unless(ids[0]==1);
+		}
+	}
+
+	candidate_free(&c0);
+	candidate_free(&c1);
 	tear_down();
 }
 END_TEST
@@ -94,8 +200,11 @@ Suite *suite_server_protocol2_champ_chooser_sparse(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_sparse_add_alloc_error);
+	tcase_add_test(tc_core, test_sparse_add_null_candidate);
 	tcase_add_test(tc_core, test_sparse_add_one);
 	tcase_add_test(tc_core, test_sparse_add_many);
+	tcase_add_test(tc_core, test_sparse_levels);
+	tcase_add_test(tc_core, test_sparse_merge);
 	suite_add_tcase(s, tc_core);
 
 	return s;
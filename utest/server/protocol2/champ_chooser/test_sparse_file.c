@@ -0,0 +1,228 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/cmd.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse_file.h"
+
+#define BASE		"utest_sparse_file"
+#define SPARSE		BASE "/sparse"
+#define SPARSE_IDX	BASE "/sparse.idx"
+#define MANIFESTS	20
+#define FINGERPRINTS	500
+
+static void tear_down(void)
+{
+	sparse_delete_all();
+	candidates_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+// Spread out, so that some of the deltas need several bytes.
+static uint64_t get_fingerprint(int f)
+{
+	return 0xF000000000000000ULL|((uint64_t)f*0x000123456789ULL);
+}
+
+// Manifest m contains fingerprint f if f is a multiple of m+1.
+static int contains(int m, int f)
+{
+	return !(f%(m+1));
+}
+
+static void build_sparse(int manifests)
+{
+	int m;
+	int f;
+	struct fzp *fzp;
+
+	fail_unless(!build_path_w(SPARSE));
+	fail_unless((fzp=fzp_gzopen(SPARSE, "wb"))!=NULL);
+	// Hooks before the first manifest get ignored.
+	fail_unless(!to_fzp_fingerprint(fzp, get_fingerprint(1)));
+	for(m=0; m<manifests; m++)
+	{
+		char mpath[256];
+		snprintf(mpath, sizeof(mpath), "some/manifest/%d", m);
+		fzp_printf(fzp, "%c%04lX%s\n",
+			CMD_MANIFEST, strlen(mpath), mpath);
+		// Go backwards, to check that they get sorted.
+		for(f=FINGERPRINTS-1; f>=0; f--)
+			if(contains(m, f))
+				fail_unless(!to_fzp_fingerprint(fzp,
+					get_fingerprint(f)));
+		// And a duplicate.
+		fail_unless(!to_fzp_fingerprint(fzp, get_fingerprint(0)));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void assert_postings(uint32_t *ids, size_t len, int f)
+{
+	int m;
+	size_t s=0;
+	if(!len)
+		fail_unless(ids==NULL);
+	for(m=0; m<MANIFESTS; m++)
+	{
+		if(!contains(m, f)) continue;
+		fail_unless(s<len);
+		fail_unless(ids[s++]==(uint32_t)m);
+	}
+	fail_unless(s==len);
+}
+
+START_TEST(test_sparse_file_generate_and_find)
+{
+	int f;
+	int m;
+	size_t len;
+	uint32_t *ids;
+	const char *cp;
+	struct sparse_file *sf=NULL;
+
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(MANIFESTS);
+	fail_unless(sparse_file_open(SPARSE, &sf)==1);
+	fail_unless(sf==NULL);
+	fail_unless(!sparse_file_generate(SPARSE));
+	fail_unless(!sparse_file_open(SPARSE, &sf));
+
+	fail_unless(sparse_file_candidates(sf)==MANIFESTS);
+	cp=sparse_file_paths(sf);
+	for(m=0; m<MANIFESTS; m++)
+	{
+		char mpath[256];
+		snprintf(mpath, sizeof(mpath), "some/manifest/%d", m);
+		ck_assert_str_eq(cp, mpath);
+		cp+=strlen(cp)+1;
+	}
+
+	for(f=0; f<FINGERPRINTS; f++)
+	{
+		ids=sparse_file_find(sf, get_fingerprint(f), &len);
+		assert_postings(ids, len, f);
+	}
+
+	// Ones that are not there.
+	fail_unless(!sparse_file_find(sf, 0, &len));
+	fail_unless(!len);
+	fail_unless(!sparse_file_find(sf, get_fingerprint(1)+1, &len));
+	fail_unless(!len);
+	fail_unless(!sparse_file_find(sf, UINT64_MAX, &len));
+	fail_unless(!len);
+
+	sparse_file_close(&sf);
+	fail_unless(sf==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_file_empty)
+{
+	size_t len;
+	struct sparse_file *sf=NULL;
+
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(0);
+	fail_unless(!sparse_file_generate(SPARSE));
+	fail_unless(!sparse_file_open(SPARSE, &sf));
+	fail_unless(sparse_file_candidates(sf)==0);
+	fail_unless(!sparse_file_find(sf, get_fingerprint(0), &len));
+	fail_unless(!len);
+	sparse_file_close(&sf);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_file_stale)
+{
+	struct sparse_file *sf=NULL;
+
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(MANIFESTS);
+	fail_unless(!sparse_file_generate(SPARSE));
+	// Written again, with different contents.
+	build_sparse(MANIFESTS-1);
+	fail_unless(sparse_file_open(SPARSE, &sf)==1);
+	fail_unless(sf==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_file_truncated)
+{
+	struct sparse_file *sf=NULL;
+
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(MANIFESTS);
+	fail_unless(!sparse_file_generate(SPARSE));
+	fail_unless(!truncate(SPARSE_IDX, 100));
+	fail_unless(sparse_file_open(SPARSE, &sf)==1);
+	fail_unless(sf==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_load_file)
+{
+	int f;
+	size_t len;
+	uint32_t *ids;
+	uint64_t fingerprint=get_fingerprint(7);
+	struct candidate *fresh;
+
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(MANIFESTS);
+	fail_unless(sparse_load_file(SPARSE)==1);
+	fail_unless(!sparse_file_generate(SPARSE));
+	fail_unless(!sparse_load_file(SPARSE));
+	fail_unless(candidates_len==MANIFESTS);
+	ck_assert_str_eq(candidates[3]->path, "some/manifest/3");
+	fail_unless(candidates[3]->id==3);
+	// Only once.
+	fail_unless(sparse_load_file(SPARSE)==1);
+
+	for(f=0; f<FINGERPRINTS; f++)
+	{
+		ids=sparse_find(get_fingerprint(f), SPARSE_LEVEL_FILE, &len);
+		assert_postings(ids, len, f);
+	}
+
+	// Fresh candidates go in memory, after the ones in the file.
+	fail_unless((fresh=candidates_add_new())!=NULL);
+	fail_unless(fresh->id==MANIFESTS);
+	fail_unless(!sparse_add_candidate(&fingerprint, fresh));
+	fail_unless(!sparse_prepare());
+	fail_unless((ids=sparse_find(fingerprint, 0, &len))!=NULL);
+	fail_unless(len==1);
+	fail_unless(ids[0]==MANIFESTS);
+	fail_unless(sparse_find(fingerprint, SPARSE_LEVEL_FILE, &len)!=NULL);
+	fail_unless(len==2);
+
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_sparse_file(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_sparse_file");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sparse_file_generate_and_find);
+	tcase_add_test(tc_core, test_sparse_file_empty);
+	tcase_add_test(tc_core, test_sparse_file_stale);
+	tcase_add_test(tc_core, test_sparse_file_truncated);
+	tcase_add_test(tc_core, test_sparse_load_file);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -4,11 +4,14 @@
 #include "../../../src/alloc.h"
 #include "../../../src/fsops.h"
 #include "../../../src/fzp.h"
+#include "../../../src/prepend.h"
 #include "../../../src/iobuf.h"
 #include "../../../src/protocol2/blist.h"
 #include "../../../src/protocol2/blk.h"
 #include "../../../src/server/manio.h"
+#include "../../../src/server/sdirs.h"
 #include "../../../src/server/protocol2/backup_phase4.h"
+#include "../../../src/server/protocol2/champ_chooser/champ_chooser.h"
 
 #define PATH	"utest_merge"
 
@@ -336,194 +339,287 @@ static void make_file_for_rename(const char *path)
 	fail_unless(!fclose(fp));
 }
 
-static int calls;
-static int max_calls;
+static char calls[1024];
 
-static int merge_callback_0(const char *dst, const char *srca, const char *srcb)
+// Records each merge as "dst<-src,src;", without the common prefix.
+static int merge_callback(const char *dst, const char **srcs, int scount)
 {
-	fail_unless(0==1);
+	int i;
+	size_t plen=strlen(PATH "/f/");
+	size_t len=strlen(calls);
+	fail_unless(scount>0);
+	snprintf(calls+len, sizeof(calls)-len, "%s<-", dst+plen);
+	for(i=0; i<scount; i++)
+	{
+		len=strlen(calls);
+		snprintf(calls+len, sizeof(calls)-len, "%s%c",
+			srcs[i]+plen, i+1<scount?',':';');
+	}
+	make_file_for_rename(dst);
 	return 0;
 }
 
-static int merge_callback_1(const char *dst, const char *srca, const char *srcb)
+static void merge_common(uint64_t fcount, uint64_t fan_in,
+	const char *expected)
 {
-	calls++;
-	ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-	fail_unless(srcb==NULL);
-	ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-	make_file_for_rename(PATH "/f/m1/00000000");
-	return 0;
+	uint64_t i;
+	char **srcs;
+	char tmp[32];
+	const char *final=PATH "/dst";
+	const char *fmanifest=PATH "/f";
+	setup();
+
+	calls[0]='\0';
+	fail_unless((srcs=(char **)calloc_w(fcount+1,
+		sizeof(char *), __func__))!=NULL);
+	for(i=0; i<fcount; i++)
+	{
+		snprintf(tmp, sizeof(tmp), "%s/sd/%08" PRIX64, fmanifest, i);
+		fail_unless((srcs[i]=strdup_w(tmp, __func__))!=NULL);
+	}
+	fail_unless(!merge_file_list(final, fmanifest, srcs, fcount,
+		fan_in, merge_callback));
+	ck_assert_str_eq(calls, expected);
+	fail_unless(is_reg_lstat(final)==(fcount?1:-1));
+	fail_unless(is_dir_lstat(PATH "/f/m1")<=0);
+	fail_unless(is_dir_lstat(PATH "/f/m2")<=0);
+	for(i=0; i<fcount; i++)
+		free_w(&srcs[i]);
+	free_v((void **)&srcs);
+	tear_down();
 }
 
-static int merge_callback_2(const char *dst, const char *srca, const char *srcb)
+START_TEST(test_merge_file_list)
 {
-	calls++;
-	ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-	ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-	ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-	make_file_for_rename(PATH "/f/m1/00000000");
-	return 0;
+	// fcount, fan_in, expected merges
+	merge_common(0, 2, "");
+	merge_common(1, 2, "m1/00000000<-sd/00000000;");
+	merge_common(2, 2, "m1/00000000<-sd/00000000,sd/00000001;");
+	merge_common(3, 2,
+		"m1/00000000<-sd/00000000,sd/00000001;"
+		"m1/00000001<-sd/00000002;"
+		"m2/00000000<-m1/00000000,m1/00000001;");
+	merge_common(5, 2,
+		"m1/00000000<-sd/00000000,sd/00000001;"
+		"m1/00000001<-sd/00000002,sd/00000003;"
+		"m1/00000002<-sd/00000004;"
+		"m2/00000000<-m1/00000000,m1/00000001;"
+		"m2/00000001<-m1/00000002;"
+		"m1/00000000<-m2/00000000,m2/00000001;");
+	merge_common(5, 3,
+		"m1/00000000<-sd/00000000,sd/00000001,sd/00000002;"
+		"m1/00000001<-sd/00000003,sd/00000004;"
+		"m2/00000000<-m1/00000000,m1/00000001;");
+	merge_common(9, 3,
+		"m1/00000000<-sd/00000000,sd/00000001,sd/00000002;"
+		"m1/00000001<-sd/00000003,sd/00000004,sd/00000005;"
+		"m1/00000002<-sd/00000006,sd/00000007,sd/00000008;"
+		"m2/00000000<-m1/00000000,m1/00000001,m1/00000002;");
 }
+END_TEST
 
-static int merge_callback_3(const char *dst, const char *srca, const char *srcb)
+START_TEST(test_merge_files_in_dir)
 {
-	calls++;
-	switch(calls)
-	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			make_file_for_rename(PATH "/f/m2/00000000");
-			break;
-		
-	}
-	return 0;
+	setup();
+	calls[0]='\0';
+	fail_unless(!merge_files_in_dir(PATH "/dst", PATH "/f", "sd", 0,
+		merge_callback));
+	ck_assert_str_eq(calls, "");
+	fail_unless(!merge_files_in_dir(PATH "/dst", PATH "/f", "sd", 4,
+		merge_callback));
+	// All in one go.
+	ck_assert_str_eq(calls, "m1/00000000<-"
+		"sd/00000000,sd/00000001,sd/00000002,sd/00000003;");
+	fail_unless(is_reg_lstat(PATH "/dst")==1);
+	tear_down();
 }
+END_TEST
+
+static uint64_t din5[3]={
+	0x0000000011110000,
+	0x1111222233370000,
+	0x1111222244440000
+};
 
-static int merge_callback_4(const char *dst, const char *srca, const char *srcb)
+static void build_dindexes_in_dir(const char *dir)
 {
-	calls++;
-	switch(calls)
+	char *path;
+	uint64_t *di[]={ din1, din2, din3, din4, din5 };
+	size_t dlen[]={ ARR_LEN(din1), ARR_LEN(din2), ARR_LEN(din3),
+		ARR_LEN(din4), ARR_LEN(din5) };
+	size_t i;
+	char tmp[16];
+	for(i=0; i<ARR_LEN(di); i++)
 	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			make_file_for_rename(PATH "/f/m2/00000000");
-			break;
-		
+		snprintf(tmp, sizeof(tmp), "%08" PRIX64, (uint64_t)i);
+		fail_unless((path=prepend_s(dir, tmp))!=NULL);
+		fail_unless(!build_path_w(path));
+		build_dindex(di[i], dlen[i], path);
+		free_w(&path);
 	}
-	return 0;
 }
 
-static int merge_callback_5(const char *dst, const char *srca, const char *srcb)
+static uint64_t ex3[13]={
+	0x0000000011100000,
+	0x0000000011110000,
+	0x1111222223330000,
+	0x1111222233330000,
+	0x1111222233350000,
+	0x1111222233370000,
+	0x1111222233390000,
+	0x1111222244440000,
+	0x1111222244540000,
+	0x123456789ABC0000,
+	0x123456889ABC0000,
+	0xFFFFFFFFFFFE0000,
+	0xFFFFFFFFFFFF0000
+};
+
+static void kmerge_dindexes_common(uint64_t fan_in)
 {
-	calls++;
-	switch(calls)
+	uint64_t i;
+	char *srcs[5];
+	char tmp[32];
+	setup();
+	build_dindexes_in_dir(PATH "/f/sd");
+	for(i=0; i<ARR_LEN(srcs); i++)
 	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000004");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000002");
-			break;
-		case 4:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			break;
-		case 5:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000001");
-			break;
-		case 6:
-			ck_assert_str_eq(srca, "utest_merge/f/m2/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m2/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			make_file_for_rename(PATH "/f/m1/00000000");
-			break;
+		snprintf(tmp, sizeof(tmp), PATH "/f/sd/%08" PRIX64, i);
+		fail_unless((srcs[i]=strdup_w(tmp, __func__))!=NULL);
 	}
-	return 0;
+	fail_unless(!merge_file_list(dst_path, PATH "/f", srcs,
+		ARR_LEN(srcs), fan_in, kmerge_dindexes));
+	check_result_di(ex3, ARR_LEN(ex3));
+	for(i=0; i<ARR_LEN(srcs); i++)
+		free_w(&srcs[i]);
+	tear_down();
 }
 
-static int merge_callback_6(const char *dst, const char *srca, const char *srcb)
+START_TEST(test_kmerge_dindexes)
 {
-	calls++;
-	switch(calls)
-	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000004");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000005");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000002");
-			break;
-		case 4:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			break;
-		case 5:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000001");
-			break;
-		case 6:
-			ck_assert_str_eq(srca, "utest_merge/f/m2/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m2/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			make_file_for_rename(PATH "/f/m1/00000000");
-			break;
-	}
-	return 0;
+	kmerge_dindexes_common(2);
+	kmerge_dindexes_common(3);
+	kmerge_dindexes_common(5);
 }
+END_TEST
 
-static void merge_common(uint64_t fcount, int set_max_calls,
-	int merge_callback(const char *dst, const char *srca, const char *srcb))
+START_TEST(test_kmerge_sparse_indexes)
 {
-	int r;
-	const char *final=PATH "/dst";
-	const char *fmanifest=PATH "/f";
-	const char *srcdir="sd";
+	struct sp src0[2];
+	struct sp src1[2];
+	struct sp src2[2];
+	struct sp dst[4];
+	const char *srcs[3]={
+		PATH "/src0",
+		PATH "/src1",
+		PATH "/src2"
+	};
 	setup();
+	init_sp(&src0[0], "aaaa", finga, ARR_LEN(finga));
+	init_sp(&src0[1], "bbb0", fingb, ARR_LEN(fingb));
+	init_sp(&src1[0], "bbb1", fingb, ARR_LEN(fingb));
+	init_sp(&src1[1], "ffff", fingf, ARR_LEN(fingf));
+	init_sp(&src2[0], "cccc", fingc, ARR_LEN(fingc));
+	init_sp(&src2[1], "fff2", fingf, ARR_LEN(fingf));
+	build_sparse_index(src0, ARR_LEN(src0), srcs[0]);
+	build_sparse_index(src1, ARR_LEN(src1), srcs[1]);
+	build_sparse_index(src2, ARR_LEN(src2), srcs[2]);
+
+	// Where they are the same, the one from the latest file wins.
+	init_sp(&dst[0], "aaaa", finga, ARR_LEN(finga));
+	init_sp(&dst[1], "bbb1", fingb, ARR_LEN(fingb));
+	init_sp(&dst[2], "cccc", fingc, ARR_LEN(fingc));
+	init_sp(&dst[3], "fff2", fingf, ARR_LEN(fingf));
+	fail_unless(!kmerge_sparse_indexes(dst_path, srcs, ARR_LEN(srcs)));
+	check_result(dst, ARR_LEN(dst));
+	tear_down();
+}
+END_TEST
+
+static void append_sparse(struct sp *sp, size_t len, struct lock *lock)
+{
+	build_sparse_index(sp, len, srca_path);
+	fail_unless(!append_to_global_sparse(srca_path, dst_path, lock));
+	fail_unless(!unlink(srca_path));
+}
 
-	calls=0;
-	max_calls=set_max_calls;
-	r=merge_files_in_dir(final, fmanifest, srcdir, fcount, merge_callback);
-	fail_unless(r==0);
-	fail_unless(calls==max_calls);
+static int count_deltas(void)
+{
+	int count=0;
+	struct strlist *s;
+	struct strlist *deltas=NULL;
+	fail_unless(!get_global_sparse_deltas(dst_path, &deltas));
+	for(s=deltas; s; s=s->next)
+		fail_unless(s->flag==count++);
+	strlists_free(&deltas);
+	return count;
+}
+
+START_TEST(test_global_sparse_deltas)
+{
+	struct sp sp[3];
+	struct sp ex[2];
+	struct lock *lock;
+	setup();
+	fail_unless((lock=try_to_get_sparse_lock(dst_path))!=NULL);
+	init_sp(&sp[0], "bbb0", fingb, ARR_LEN(fingb));
+	init_sp(&sp[1], "ffff/1", fingf, ARR_LEN(fingf));
+	init_sp(&sp[2], "bbb2", fingb, ARR_LEN(fingb));
+
+	fail_unless(!count_deltas());
+	fail_unless(!compact_global_sparse(dst_path, lock));
+	fail_unless(is_reg_lstat(dst_path)==-1);
+
+	append_sparse(&sp[0], 1, lock);
+	append_sparse(&sp[1], 1, lock);
+	append_sparse(&sp[2], 1, lock);
+	fail_unless(count_deltas()==3);
+	fail_unless(!global_sparse_needs_compacting(dst_path));
+	// Nothing has touched the main file.
+	fail_unless(is_reg_lstat(dst_path)==-1);
+
+	fail_unless(!compact_global_sparse(dst_path, lock));
+	fail_unless(!count_deltas());
+	fail_unless(is_reg_lstat(PATH "/dst.idx")==1);
+	init_sp(&ex[0], "bbb2", fingb, ARR_LEN(fingb));
+	init_sp(&ex[1], "ffff/1", fingf, ARR_LEN(fingf));
+	check_result(ex, ARR_LEN(ex));
+
+	// Sequence numbers start again once the deltas are gone.
+	append_sparse(&sp[0], 1, lock);
+	fail_unless(count_deltas()==1);
+	lock_release(lock);
+	lock_free(&lock);
+
+	// Removing a candidate deals with the deltas first.
+	fail_unless(!remove_from_global_sparse(dst_path, "rmanifest/ffff"));
+	fail_unless(!count_deltas());
+	init_sp(&ex[0], "bbb0", fingb, ARR_LEN(fingb));
+	check_result(ex, 1);
 	tear_down();
 }
+END_TEST
 
-START_TEST(test_merge_files_in_dir)
+START_TEST(test_global_sparse_needs_compacting)
 {
-	// fcount, set_max_calls, merge_callback
-	merge_common(0, 0, merge_callback_0);
-	merge_common(1, 1, merge_callback_1);
-	merge_common(2, 1, merge_callback_2);
-	merge_common(3, 3, merge_callback_3);
-	merge_common(4, 3, merge_callback_4);
-	merge_common(5, 6, merge_callback_5);
-	merge_common(6, 6, merge_callback_6);
+	int i;
+	struct sp sp[1];
+	struct lock *lock;
+	setup();
+	fail_unless((lock=try_to_get_sparse_lock(dst_path))!=NULL);
+	init_sp(&sp[0], "aaaa", finga, ARR_LEN(finga));
+	for(i=0; i<SPARSE_DELTAS_MAX; i++)
+	{
+		fail_unless(!global_sparse_needs_compacting(dst_path));
+		append_sparse(sp, 1, lock);
+	}
+	fail_unless(global_sparse_needs_compacting(dst_path)==1);
+	fail_unless(!compact_global_sparse(dst_path, lock));
+	fail_unless(!global_sparse_needs_compacting(dst_path));
+	check_result(sp, 1);
+	lock_release(lock);
+	lock_free(&lock);
+	tear_down();
 }
 END_TEST
 
@@ -545,7 +641,13 @@ Suite *suite_server_protocol2_backup_phase4(void)
 
 	tcase_add_test(tc_core, test_merge_dindexes_simple1);
 
+	tcase_add_test(tc_core, test_merge_file_list);
 	tcase_add_test(tc_core, test_merge_files_in_dir);
+	tcase_add_test(tc_core, test_kmerge_dindexes);
+	tcase_add_test(tc_core, test_kmerge_sparse_indexes);
+
+	tcase_add_test(tc_core, test_global_sparse_deltas);
+	tcase_add_test(tc_core, test_global_sparse_needs_compacting);
 	suite_add_tcase(s, tc_core);
 
 	return s;
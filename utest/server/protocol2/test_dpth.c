@@ -4,12 +4,16 @@
 #include <stdio.h>
 #include "../../test.h"
 #include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/cntr.h"
 #include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
 #include "../../../src/hexmap.h"
 #include "../../../src/iobuf.h"
 #include "../../../src/lock.h"
 #include "../../../src/prepend.h"
 #include "../../../src/server/protocol2/dpth.h"
+#include "../../../src/server/protocol2/rblk.h"
 #include "../../../src/protocol2/blk.h"
 #include "../../builders/build_file.h"
 
@@ -296,6 +300,77 @@ START_TEST(test_init)
 }
 END_TEST
 
+#ifdef HAVE_ZSTD
+static void write_data_to_dpth(struct dpth *dpth, const char *data, size_t len)
+{
+	struct iobuf wbuf;
+	struct blk *blk;
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepathstr_with_sig_to_uint64(dpth_protocol2_mk(dpth));
+	iobuf_set(&wbuf, CMD_DATA, (char *)data, len);
+	fail_unless(!dpth_protocol2_fwrite(dpth, &wbuf, blk));
+	fail_unless(!dpth_protocol2_incr_sig(dpth));
+	blk_free(&blk);
+}
+
+static void retrieve(struct cntr *cntr, int datno,
+	const char *expected, size_t len)
+{
+	struct blk blk;
+	char savepathstr[32];
+	memset(&blk, 0, sizeof(blk));
+	snprintf(savepathstr, sizeof(savepathstr),
+		"0000/0000/0000/%04X", datno);
+	blk.savepath=savepathstr_with_sig_to_uint64(savepathstr);
+	fail_unless(!rblk_retrieve_data(NULL, cntr, &blk, LOCKPATH));
+	fail_unless(blk.length==len);
+	fail_unless(!memcmp(blk.data, expected, len));
+}
+
+START_TEST(test_compressed_blocks)
+{
+	char cmd;
+	char big[4096];
+	struct stat statp;
+	struct fzp *fzp;
+	struct cntr *cntr;
+	struct dpth *dpth;
+	dpth=setup();
+	fail_unless(dpth_protocol2_init(dpth,
+		LOCKPATH,
+		TESTCLIENT,
+		CFILES,
+		MAX_STORAGE_SUBDIRS)==0);
+	dpth->compression=3;
+	memset(big, 'a', sizeof(big));
+
+	write_data_to_dpth(dpth, big, sizeof(big));
+	// Too small to be worth it, so stored as it is.
+	write_data_to_dpth(dpth, "abc", 3);
+	write_data_to_dpth(dpth, big, sizeof(big)/2);
+	fail_unless(!dpth_release_all(dpth));
+
+	fail_unless(!lstat(LOCKPATH "/0000/0000/0000", &statp));
+	fail_unless(statp.st_size<(off_t)sizeof(big)/2);
+	fail_unless((fzp=fzp_open(LOCKPATH "/0000/0000/0000", "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, &cmd, 1)==1);
+	fail_unless(cmd==CMD_DATA_ZSTD);
+	fail_unless(!fzp_close(&fzp));
+
+	// Restores get the original blocks back.
+	fail_unless((cntr=cntr_alloc())!=NULL);
+	fail_unless(!cntr_init(cntr, "utestclient", 0));
+	rblks_init(1024*1024);
+	retrieve(cntr, 2, big, sizeof(big)/2);
+	retrieve(cntr, 1, "abc", 3);
+	retrieve(cntr, 0, big, sizeof(big));
+	rblks_free();
+	cntr_free(&cntr);
+	tear_down(&dpth);
+}
+END_TEST
+#endif
+
 Suite *suite_server_protocol2_dpth(void)
 {
 	Suite *s;
@@ -309,6 +384,9 @@ Suite *suite_server_protocol2_dpth(void)
 	tcase_add_test(tc_core, test_simple_lock_with_existant_data_files);
 	tcase_add_test(tc_core, test_incr_sig);
 	tcase_add_test(tc_core, test_init);
+#ifdef HAVE_ZSTD
+	tcase_add_test(tc_core, test_compressed_blocks);
+#endif
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,199 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/cntr.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/iobuf.h"
+#include "../../../src/prepend.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/protocol2/rblk.h"
+
+#define BASE		"utest_rblk"
+
+// Only the bottom 32 bits differ, so these would all look the same if the
+// cache was not keyed on the whole data file path.
+#define DFILE_A		"0000/0000/0001"
+#define DFILE_B		"0000/0001/0001"
+#define DFILE_C		"0001/0000/0001"
+
+#define BLOCKS		4
+
+// Room for two data files, but not three.
+#define TWO_FILES	(DATA_FILE_SIG_MAX*sizeof(struct iobuf)*5/2)
+
+static struct cntr *cntr=NULL;
+
+static void setup(void)
+{
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((cntr=cntr_alloc())!=NULL);
+	fail_unless(!cntr_init(cntr, "utestclient", 0));
+}
+
+static void tear_down(void)
+{
+	rblks_free();
+	cntr_free(&cntr);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void build_data_file(const char *dfile)
+{
+	int b;
+	char *path;
+	struct fzp *fzp;
+	char data[64];
+	fail_unless((path=prepend_s(BASE, dfile))!=NULL);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	for(b=0; b<BLOCKS; b++)
+	{
+		snprintf(data, sizeof(data), "%s:%d", dfile, b);
+		fzp_printf(fzp, "%c%04X%s", CMD_DATA, strlen(data), data);
+	}
+	fail_unless(!fzp_close(&fzp));
+	free_w(&path);
+}
+
+static void retrieve(const char *dfile, int b)
+{
+	struct blk blk;
+	char savepathstr[32];
+	char expected[64];
+	memset(&blk, 0, sizeof(blk));
+	snprintf(savepathstr, sizeof(savepathstr), "%s/%04X", dfile, b);
+	snprintf(expected, sizeof(expected), "%s:%d", dfile, b);
+	blk.savepath=savepathstr_with_sig_to_uint64(savepathstr);
+	fail_unless(!rblk_retrieve_data(NULL, cntr, &blk, BASE));
+	fail_unless(blk.length==strlen(expected));
+	fail_unless(!strncmp(blk.data, expected, blk.length));
+}
+
+static void assert_counters(uint64_t hits, uint64_t misses,
+	uint64_t evictions)
+{
+	fail_unless(cntr->ent[(uint8_t)CMD_RBLK_HIT]->count==hits);
+	fail_unless(cntr->ent[(uint8_t)CMD_RBLK_MISS]->count==misses);
+	fail_unless(cntr->ent[(uint8_t)CMD_RBLK_EVICT]->count==evictions);
+}
+
+START_TEST(test_rblk_retrieve)
+{
+	int b;
+	setup();
+	build_data_file(DFILE_A);
+	build_data_file(DFILE_B);
+	build_data_file(DFILE_C);
+	rblks_init(TWO_FILES*100);
+
+	for(b=0; b<BLOCKS; b++)
+	{
+		retrieve(DFILE_A, b);
+		retrieve(DFILE_B, b);
+		retrieve(DFILE_C, b);
+	}
+	assert_counters(0, BLOCKS*3, 0);
+
+	// All in memory now.
+	for(b=BLOCKS-1; b>=0; b--)
+	{
+		retrieve(DFILE_C, b);
+		retrieve(DFILE_A, b);
+		retrieve(DFILE_B, b);
+	}
+	assert_counters(BLOCKS*3, BLOCKS*3, 0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_least_recently_used)
+{
+	setup();
+	build_data_file(DFILE_A);
+	build_data_file(DFILE_B);
+	build_data_file(DFILE_C);
+	rblks_init(TWO_FILES);
+
+	retrieve(DFILE_A, 0);
+	retrieve(DFILE_B, 0);
+	retrieve(DFILE_A, 0);
+	assert_counters(1, 2, 0);
+
+	// B is the least recently used, so it goes.
+	retrieve(DFILE_C, 0);
+	assert_counters(1, 3, 1);
+	retrieve(DFILE_A, 0);
+	assert_counters(2, 3, 1);
+
+	// Now C goes.
+	retrieve(DFILE_B, 0);
+	assert_counters(2, 4, 2);
+	retrieve(DFILE_A, 0);
+	retrieve(DFILE_B, 0);
+	assert_counters(4, 4, 2);
+	retrieve(DFILE_C, 0);
+	assert_counters(4, 5, 3);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_memory_max_too_low)
+{
+	setup();
+	build_data_file(DFILE_A);
+	build_data_file(DFILE_B);
+	rblks_init(1);
+
+	// Keeps the one that is in use.
+	retrieve(DFILE_A, 0);
+	retrieve(DFILE_A, 1);
+	retrieve(DFILE_B, 0);
+	retrieve(DFILE_A, 0);
+	assert_counters(0, 4, 2);
+	fail_unless(cntr->ent[(uint8_t)CMD_WARNING]->count==4);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_bad_compressed_block)
+{
+	char *path;
+	struct fzp *fzp;
+	struct blk blk;
+	setup();
+	fail_unless((path=prepend_s(BASE, DFILE_A))!=NULL);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	fzp_printf(fzp, "%c%04X%s", CMD_DATA_ZSTD, 4, "abcd");
+	fail_unless(!fzp_close(&fzp));
+	free_w(&path);
+	rblks_init(TWO_FILES);
+
+	memset(&blk, 0, sizeof(blk));
+	blk.savepath=savepathstr_with_sig_to_uint64(DFILE_A "/0000");
+	fail_unless(rblk_retrieve_data(NULL, cntr, &blk, BASE)==-1);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_rblk(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_rblk");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rblk_retrieve);
+	tcase_add_test(tc_core, test_rblk_least_recently_used);
+	tcase_add_test(tc_core, test_rblk_memory_max_too_low);
+	tcase_add_test(tc_core, test_rblk_bad_compressed_block);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
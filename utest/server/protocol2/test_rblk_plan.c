@@ -0,0 +1,188 @@
+#include "../../test.h"
+#include "../../builders/build.h"
+#include "../../prng.h"
+#include "../../../src/alloc.h"
+#include "../../../src/fsops.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/sbuf.h"
+#include "../../../src/slist.h"
+#include "../../../src/protocol2/blist.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/protocol2/rblk_plan.h"
+
+#define BASE		"utest_rblk_plan"
+#define MANIFEST	BASE "/manifest"
+#define DATA		BASE "/data"
+
+static void setup(void)
+{
+	prng_init(0);
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+}
+
+static void tear_down(struct slist **slist)
+{
+	slist_free(slist);
+	rblk_plan_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static int want_all(__attribute__ ((unused)) struct sbuf *sb,
+	__attribute__ ((unused)) void *data)
+{
+	return 1;
+}
+
+static int want_none(__attribute__ ((unused)) struct sbuf *sb,
+	__attribute__ ((unused)) void *data)
+{
+	return 0;
+}
+
+// Every other file, like a restore that only wants some of them.
+static int want_alternate(__attribute__ ((unused)) struct sbuf *sb,
+	void *data)
+{
+	int *count=(int *)data;
+	return (*count)++%2;
+}
+
+static uint64_t count_blocks(struct slist *slist)
+{
+	uint64_t count=0;
+	struct sbuf *sb;
+	struct blk *blk;
+	for(sb=slist->head; sb; sb=sb->next)
+	{
+		if(!sbuf_is_filedata(sb) && !sbuf_is_vssdata(sb))
+			continue;
+		for(blk=sb->protocol2->bstart;
+			blk && blk!=sb->protocol2->bend; blk=blk->next)
+				count++;
+	}
+	return count;
+}
+
+START_TEST(test_rblk_plan_all_in_one_window)
+{
+	struct slist *slist;
+	setup();
+	slist=build_manifest_with_data_files(MANIFEST, DATA, 20, 10);
+	fail_unless(!rblk_plan_init(MANIFEST, DATA, 1024*1024*1024,
+		want_all, NULL));
+	fail_unless(rblk_plan_planned()==count_blocks(slist));
+#ifdef POSIX_FADV_WILLNEED
+	fail_unless(rblk_plan_advised()>0);
+#endif
+	tear_down(&slist);
+}
+END_TEST
+
+START_TEST(test_rblk_plan_windows)
+{
+	uint64_t b;
+	uint64_t blocks;
+	uint64_t last=0;
+	int replanned=0;
+	struct slist *slist;
+	setup();
+	slist=build_manifest_with_data_files(MANIFEST, DATA, 20, 10);
+	blocks=count_blocks(slist);
+
+	// Tiny budget, so each window is one data file.
+	fail_unless(!rblk_plan_init(MANIFEST, DATA, 1, want_all, NULL));
+	fail_unless(rblk_plan_planned()<blocks);
+	for(b=0; b<blocks; b++)
+	{
+		// The planner keeps ahead of the restore.
+		fail_unless(rblk_plan_planned()>b);
+		if(rblk_plan_planned()!=last)
+		{
+			last=rblk_plan_planned();
+			replanned++;
+		}
+		rblk_plan_step();
+	}
+	fail_unless(replanned>1);
+	fail_unless(rblk_plan_planned()==blocks);
+	tear_down(&slist);
+}
+END_TEST
+
+// The restore steps past the blocks of the files that it skips, so the
+// planner has to count them too, or it falls behind.
+START_TEST(test_rblk_plan_windows_with_skipped)
+{
+	uint64_t b;
+	uint64_t blocks;
+	uint64_t last=0;
+	int count=0;
+	int replanned=0;
+	struct slist *slist;
+	setup();
+	slist=build_manifest_with_data_files(MANIFEST, DATA, 20, 10);
+	blocks=count_blocks(slist);
+
+	fail_unless(!rblk_plan_init(MANIFEST, DATA, 1, want_alternate, &count));
+	fail_unless(rblk_plan_planned()<blocks);
+	for(b=0; b<blocks; b++)
+	{
+		fail_unless(rblk_plan_planned()>b);
+		if(rblk_plan_planned()!=last)
+		{
+			last=rblk_plan_planned();
+			replanned++;
+		}
+		rblk_plan_step();
+	}
+	fail_unless(replanned>1);
+	fail_unless(rblk_plan_planned()==blocks);
+	tear_down(&slist);
+}
+END_TEST
+
+START_TEST(test_rblk_plan_want_none)
+{
+	struct slist *slist;
+	setup();
+	slist=build_manifest_with_data_files(MANIFEST, DATA, 20, 10);
+	fail_unless(!rblk_plan_init(MANIFEST, DATA, 1024*1024*1024,
+		want_none, NULL));
+	// It still goes past all of them.
+	fail_unless(rblk_plan_planned()==count_blocks(slist));
+	fail_unless(rblk_plan_advised()==0);
+	tear_down(&slist);
+}
+END_TEST
+
+START_TEST(test_rblk_plan_no_manifest)
+{
+	setup();
+	// Not fatal - there is just nothing to plan.
+	fail_unless(!rblk_plan_init(MANIFEST, DATA, 1024, want_all, NULL));
+	fail_unless(rblk_plan_planned()==0);
+	rblk_plan_step();
+	tear_down(NULL);
+}
+END_TEST
+
+Suite *suite_server_protocol2_rblk_plan(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_rblk_plan");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rblk_plan_all_in_one_window);
+	tcase_add_test(tc_core, test_rblk_plan_windows);
+	tcase_add_test(tc_core, test_rblk_plan_windows_with_skipped);
+	tcase_add_test(tc_core, test_rblk_plan_want_none);
+	tcase_add_test(tc_core, test_rblk_plan_no_manifest);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
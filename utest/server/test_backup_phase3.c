@@ -4,6 +4,7 @@
 #include "../../src/conffile.h"
 #include "../../src/fsops.h"
 #include "../../src/fzp.h"
+#include "../../src/iobuf.h"
 #include "../../src/msg.h"
 #include "../../src/server/backup_phase3.h"
 #include "../../src/server/sdirs.h"
@@ -162,8 +163,20 @@ static void do_generate_manifest(
 	else
 		fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
 	for(i=0; i<mlen; i++)
+	{
+		// Signatures that have been through the manio code come out
+		// as binary records.
+		if(compressed && m[i].cmd==CMD_SIG)
+		{
+			char c=CMD_SIG_BIN;
+			fail_unless(fzp_write(fzp, &c, 1)==1);
+			fail_unless(fzp_write(fzp, m[i].buf,
+				IOBUF_SIG_BIN_LEN)==IOBUF_SIG_BIN_LEN);
+			continue;
+		}
 		fail_unless(!send_msg_fzp(fzp,
 			m[i].cmd, m[i].buf, strlen(m[i].buf)));
+	}
 	fail_unless(!fzp_close(&fzp));
 }
 
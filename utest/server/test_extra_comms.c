@@ -163,7 +163,7 @@ static const char *get_features(enum protocol protocol, int srestore,
 	if(version && !strcmp(version, "1.4.40"))
 		old_version=1;
 
-	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:%s%smsg:%s%s", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
+	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:%s%smsg:%s%slarge_frames:", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
 	return features;
 }
 
@@ -489,6 +489,72 @@ static void checks_msg(struct conf **confs, struct conf **cconfs,
 	fail_unless(get_int(cconfs[OPT_MESSAGE])==1);
 }
 
+static struct asfd *large_frames_asfd=NULL;
+
+static void setup_large_frames(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	large_frames_asfd=asfd;
+	setup_simple(asfd, confs, cconfs, "large_frames", /*srestore*/0);
+}
+
+static void checks_large_frames(struct conf **confs, struct conf **cconfs,
+	const char *incexc, int srestore)
+{
+	fail_unless(large_frames_asfd->large_frames==1);
+	fail_unless(large_frames_asfd->frame_len==ASFD_LARGE_FRAME_LEN);
+}
+
+static void setup_backup_streams_begin(struct asfd *asfd,
+	struct conf **cconfs, int *r, int *w)
+{
+	char features[256]="";
+	common_confs(cconfs, PACKAGE_VERSION, PROTO_AUTO);
+	set_int(cconfs[OPT_BACKUP_STREAMS], 4);
+	asfd_mock_read(asfd, r, 0, CMD_GEN, "extra_comms_begin");
+	snprintf(features, sizeof(features), "%sbackup_streams=4:",
+		get_features(PROTO_AUTO, /*srestore*/0, PACKAGE_VERSION));
+	asfd_assert_write(asfd, w, 0, CMD_GEN, features);
+}
+
+static void setup_backup_streams(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	setup_backup_streams_begin(asfd, cconfs, &r, &w);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "backup_streams=3");
+	setup_send_features_proto_end(asfd, &r, &w);
+}
+
+static void checks_backup_streams(struct conf **confs, struct conf **cconfs,
+	const char *incexc, int srestore)
+{
+	fail_unless(get_int(cconfs[OPT_BACKUP_STREAMS])==3);
+}
+
+static void setup_backup_streams_none(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	setup_backup_streams_begin(asfd, cconfs, &r, &w);
+	setup_send_features_proto_end(asfd, &r, &w);
+}
+
+static void checks_backup_streams_none(struct conf **confs,
+	struct conf **cconfs, const char *incexc, int srestore)
+{
+	fail_unless(get_int(cconfs[OPT_BACKUP_STREAMS])==1);
+}
+
+static void setup_backup_streams_too_many(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	setup_backup_streams_begin(asfd, cconfs, &r, &w);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "backup_streams=5");
+	asfd_assert_write(asfd, &w, 0, CMD_ERROR, "Client is trying to use backup_streams=5 but server allows 4\n");
+}
+
 static void setup_counters_ok(struct asfd *asfd,
 	struct conf **confs, struct conf **cconfs)
 {
@@ -787,6 +853,10 @@ START_TEST(test_server_extra_comms)
 #endif
 	run_test(0, setup_counters_ok, checks_counters_ok);
 	run_test(0, setup_msg, checks_msg);
+	run_test(0, setup_large_frames, checks_large_frames);
+	run_test(0, setup_backup_streams, checks_backup_streams);
+	run_test(0, setup_backup_streams_none, checks_backup_streams_none);
+	run_test(-1, setup_backup_streams_too_many, NULL);
 	run_test(0, setup_uname, checks_uname);
 	run_test(0, setup_uname_is_windows, checks_uname_is_windows);
 	run_test(-1, setup_unexpected_feature, NULL);
@@ -14,6 +14,8 @@
 #include "../../src/slist.h"
 #include "../../src/protocol2/blk.h"
 #include "../../src/server/manio.h"
+#include "../../src/server/protocol2/champ_chooser/hash.h"
+#include "../../src/server/protocol2/champ_chooser/mindex.h"
 
 static const char *path="utest_manio";
 
@@ -276,6 +278,7 @@ static void check_paths(int i, int exists)
 	check_path(i, exists, NULL);
 	check_path(i, exists, "dindex");
 	check_path(i, exists, "hooks");
+	check_path(i, exists, "mindex");
 }
 
 static void check_hooks(int i, int fcount)
@@ -358,6 +361,41 @@ static void check_dindex(int i)
 	fail_unless(!fzp_close(&fzp));
 }
 
+static void check_mindex(int i)
+{
+	int ret;
+	int sigs=0;
+	struct fzp *fzp;
+	struct sbuf *sb;
+	struct blk *blk;
+	struct hash_strong *hash_strong;
+
+	fail_unless(!mindex_load(get_extra_path(i, "mindex")));
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless((blk=blk_alloc())!=NULL);
+
+	// Everything in the manifest chunk should be in the mindex.
+	fail_unless((fzp=fzp_gzopen(get_extra_path(i, NULL), "rb"))!=NULL);
+	while(!(ret=sbuf_fill_from_file(sb, fzp, blk)))
+	{
+		sbuf_free_content(sb);
+		if(!blk->got_save_path)
+			continue;
+		sigs++;
+		fail_unless((hash_strong=hash_strong_find(blk->fingerprint,
+			blk->md5sum))!=NULL);
+		fail_unless(hash_strong->savepath==blk->savepath);
+		blk->got_save_path=0;
+	}
+	fail_unless(ret==1);
+	fail_unless(sigs>0);
+	fail_unless(hash_count()<=(uint64_t)sigs);
+	fail_unless(!fzp_close(&fzp));
+	sbuf_free(&sb);
+	blk_free(&blk);
+	hash_delete_all();
+}
+
 START_TEST(test_man_protocol2_hooks)
 {
 	int i=0;
@@ -387,6 +425,7 @@ START_TEST(test_man_protocol2_hooks)
 		check_paths(i, 1 /* exist */);
 		check_hooks(i, (int)fcount);
 		check_dindex(i);
+		check_mindex(i);
 	}
 	check_paths(i, 0 /* do not exist */);
 
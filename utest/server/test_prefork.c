@@ -0,0 +1,198 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/server/prefork.h"
+
+static void make_job(struct prefork_job *job, int port)
+{
+	struct sockaddr_in *sin;
+	memset(job, 0, sizeof(*job));
+	job->port=port;
+	sin=(struct sockaddr_in *)&job->addr;
+	sin->sin_family=AF_INET;
+	sin->sin_port=htons(port);
+}
+
+START_TEST(test_prefork_send_recv)
+{
+	int fd=-1;
+	int sv[2];
+	int pfd[2];
+	char buf[8]="";
+	struct prefork_job job;
+	struct prefork_job got;
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless(!pipe(pfd));
+	make_job(&job, 4971);
+
+	fail_unless(!prefork_send(sv[0], pfd[1], &job));
+	close(pfd[1]);
+	fail_unless(!prefork_recv(sv[1], &fd, &got));
+	fail_unless(fd>=0);
+	fail_unless(got.port==4971);
+	fail_unless(!memcmp(&got.addr, &job.addr, sizeof(job.addr)));
+
+	// The received descriptor is the write end of the pipe.
+	fail_unless(write(fd, "hello", 5)==5);
+	close_fd(&fd);
+	fail_unless(read(pfd[0], buf, sizeof(buf))==5);
+	fail_unless(!strncmp(buf, "hello", 5));
+	fail_unless(!read(pfd[0], buf, sizeof(buf)));
+
+	close(pfd[0]);
+	close(sv[0]);
+	close(sv[1]);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_prefork_recv_eof)
+{
+	int fd=-1;
+	int sv[2];
+	struct prefork_job job;
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	close(sv[0]);
+	fail_unless(prefork_recv(sv[1], &fd, &job)==1);
+	fail_unless(fd==-1);
+	close(sv[1]);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_prefork_recv_no_fd)
+{
+	int fd=-1;
+	int sv[2];
+	struct prefork_job job;
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	make_job(&job, 4971);
+	fail_unless(write(sv[0], &job, sizeof(job))==(ssize_t)sizeof(job));
+	fail_unless(prefork_recv(sv[1], &fd, &job)==-1);
+	fail_unless(fd==-1);
+	close(sv[0]);
+	close(sv[1]);
+	alloc_check();
+}
+END_TEST
+
+static void add_worker(pid_t pid, int *ctl_peer)
+{
+	int sv[2];
+	int pfd[2];
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless(!pipe(pfd));
+	fail_unless(!prefork_add(pid, &sv[0], &pfd[0]));
+	fail_unless(sv[0]==-1);
+	fail_unless(pfd[0]==-1);
+	*ctl_peer=sv[1];
+	close(pfd[1]);
+}
+
+START_TEST(test_prefork_idle_list)
+{
+	int fd=-1;
+	int peer[3];
+	struct prefork_job job;
+	struct prefork_worker *worker;
+
+	fail_unless(!prefork_idle());
+	fail_unless(prefork_take()==NULL);
+	add_worker(100, &peer[0]);
+	add_worker(101, &peer[1]);
+	add_worker(102, &peer[2]);
+	fail_unless(prefork_idle()==3);
+
+	prefork_reaped(101);
+	fail_unless(prefork_idle()==2);
+	// Not one of ours.
+	prefork_reaped(999);
+	fail_unless(prefork_idle()==2);
+
+	fail_unless((worker=prefork_take())!=NULL);
+	fail_unless(worker->pid==102);
+	fail_unless(prefork_idle()==1);
+	prefork_worker_free(&worker);
+	fail_unless(worker==NULL);
+
+	prefork_free_all();
+	fail_unless(!prefork_idle());
+
+	// The workers would see that they are not wanted.
+	fail_unless(prefork_recv(peer[0], &fd, &job)==1);
+	fail_unless(prefork_recv(peer[1], &fd, &job)==1);
+	fail_unless(prefork_recv(peer[2], &fd, &job)==1);
+	close(peer[0]);
+	close(peer[1]);
+	close(peer[2]);
+	alloc_check();
+}
+END_TEST
+
+// A real worker process, given the server end of a connection.
+START_TEST(test_prefork_worker)
+{
+	int sv[2];
+	int conn[2];
+	int status;
+	pid_t pid;
+	char buf[32]="";
+	struct prefork_job job;
+
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, conn));
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+			break;
+		case 0:
+		{
+			int fd=-1;
+			struct prefork_job got;
+			close(sv[0]);
+			close(conn[0]);
+			close(conn[1]);
+			if(prefork_recv(sv[1], &fd, &got))
+				exit(1);
+			snprintf(buf, sizeof(buf), "port %d", got.port);
+			if(write(fd, buf, strlen(buf))!=(ssize_t)strlen(buf))
+				exit(2);
+			exit(0);
+		}
+		default:
+			break;
+	}
+	close(sv[1]);
+	make_job(&job, 4971);
+	fail_unless(!prefork_send(sv[0], conn[1], &job));
+	close(conn[1]);
+	close(sv[0]);
+
+	fail_unless(read(conn[0], buf, sizeof(buf))==9);
+	fail_unless(!strncmp(buf, "port 4971", 9));
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	close(conn[0]);
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_server_prefork(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_prefork");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_prefork_send_recv);
+	tcase_add_test(tc_core, test_prefork_recv_eof);
+	tcase_add_test(tc_core, test_prefork_recv_no_fd);
+	tcase_add_test(tc_core, test_prefork_idle_list);
+	tcase_add_test(tc_core, test_prefork_worker);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
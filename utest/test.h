@@ -62,6 +62,7 @@ extern void assert_xattr(const char *expected,
 
 Suite *suite_alloc(void);
 Suite *suite_asfd(void);
+Suite *suite_async(void);
 Suite *suite_attribs(void);
 Suite *suite_base64(void);
 Suite *suite_client_acl(void);
@@ -76,6 +77,7 @@ Suite *suite_client_monitor_lline(void);
 Suite *suite_client_monitor_status_client_ncurses(void);
 Suite *suite_client_protocol1_backup_phase2(void);
 Suite *suite_client_protocol2_backup_phase2(void);
+Suite *suite_client_protocol2_md5_pool(void);
 Suite *suite_client_protocol2_rabin_read(void);
 Suite *suite_client_restore(void);
 Suite *suite_client_xattr(void);
@@ -95,6 +97,7 @@ Suite *suite_protocol2_rabin_rabin(void);
 Suite *suite_protocol2_rabin_rconf(void);
 Suite *suite_protocol2_rabin_win(void);
 Suite *suite_protocol2_sbuf_protocol2(void);
+Suite *suite_ratelimit(void);
 Suite *suite_server_auth(void);
 Suite *suite_server_autoupgrade(void);
 Suite *suite_server_ca(void);
@@ -104,6 +107,7 @@ Suite *suite_server_delete(void);
 Suite *suite_server_extra_comms(void);
 Suite *suite_server_list(void);
 Suite *suite_server_manio(void);
+Suite *suite_server_prefork(void);
 Suite *suite_server_monitor_browse(void);
 Suite *suite_server_monitor_cache(void);
 Suite *suite_server_monitor_cstat(void);
@@ -124,14 +128,22 @@ Suite *suite_server_protocol1_restore(void);
 Suite *suite_server_protocol2_backup_phase2(void);
 Suite *suite_server_protocol2_backup_phase4(void);
 Suite *suite_server_protocol2_bsparse(void);
+Suite *suite_server_protocol2_champ_chooser_candidate(void);
+Suite *suite_server_protocol2_champ_chooser_champ_cache(void);
+Suite *suite_server_protocol2_champ_chooser_champ_workers(void);
 Suite *suite_server_protocol2_champ_chooser_champ_chooser(void);
 Suite *suite_server_protocol2_champ_chooser_champ_server(void);
 Suite *suite_server_protocol2_champ_chooser_dindex(void);
 Suite *suite_server_protocol2_champ_chooser_hash(void);
+Suite *suite_server_protocol2_champ_chooser_mindex(void);
 Suite *suite_server_protocol2_champ_chooser_scores(void);
 Suite *suite_server_protocol2_champ_chooser_sparse(void);
+Suite *suite_server_protocol2_champ_chooser_sparse_file(void);
 Suite *suite_server_protocol2_dpth(void);
+Suite *suite_server_protocol2_rblk(void);
+Suite *suite_server_protocol2_rblk_plan(void);
 Suite *suite_slist(void);
+Suite *suite_ssl(void);
 Suite *suite_times(void);
 
 #endif
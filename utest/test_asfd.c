@@ -2,6 +2,9 @@
 #include "../src/alloc.h"
 #include "../src/asfd.h"
 #include "../src/async.h"
+#include "../src/fsops.h"
+#include "../src/iobuf.h"
+#include "../src/ratelimit.h"
 #include "../src/ssl.h"
 
 static struct async *setup(void)
@@ -181,6 +184,446 @@ START_TEST(test_setup_asfd_twice)
 }
 END_TEST
 
+static double time_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static size_t frame_len(int f, size_t max)
+{
+	return ((size_t)f*7919)%max+1;
+}
+
+static void frame_fill(char *buf, int f, size_t len)
+{
+	size_t i;
+	for(i=0; i<len; i++)
+		buf[i]='a'+(f+i)%26;
+}
+
+static void frame_check(struct iobuf *iobuf, int f, size_t max)
+{
+	static char buf[ASFD_LARGE_FRAME_LEN];
+	size_t len=frame_len(f, max);
+	frame_fill(buf, f, len);
+	fail_unless(iobuf->cmd==CMD_DATA);
+	fail_unless(iobuf->len==len);
+	fail_unless(!memcmp(iobuf->buf, buf, len));
+}
+
+static void send_frames(int fd, int frames, size_t max, int large)
+{
+	int f;
+	struct iobuf wbuf;
+	struct async *as;
+	struct asfd *w;
+	static char buf[ASFD_LARGE_FRAME_LEN];
+
+	as=setup();
+	fail_unless((w=setup_asfd(as, "writer", &fd, -1))!=NULL);
+	if(large)
+		fail_unless(!w->set_large_frames(w));
+	for(f=0; f<frames; )
+	{
+		// Fill the write buffer before each write.
+		size_t len=frame_len(f, max);
+		frame_fill(buf, f, len);
+		iobuf_set(&wbuf, CMD_DATA, buf, len);
+		switch(w->append_all_to_write_buffer(w, &wbuf))
+		{
+			case APPEND_OK: f++; continue;
+			case APPEND_BLOCKED: break;
+			default: fail_unless(0);
+		}
+		fail_unless(!as->write(as));
+	}
+	fail_unless(!asfd_flush_asio(w));
+	async_asfd_free_all(&as);
+}
+
+enum read_mode
+{
+	READ_RBUF=0,
+	READ_VIEW,
+	READ_BATCH
+};
+
+// Gets whatever is left in the read buffer after rbuf. Returns the number
+// of frames got.
+static int read_rest(struct asfd *r, int got, int frames, size_t max,
+	enum read_mode mode)
+{
+	int i;
+	int n;
+	int start=got;
+	struct iobuf vec[ASFD_READ_BATCH];
+	while(got<frames)
+	{
+		if(mode==READ_VIEW)
+			n=r->read_view(r, &vec[0]);
+		else
+			n=r->read_batch(r, vec, ASFD_READ_BATCH);
+		fail_unless(n>=0);
+		if(!n)
+			break;
+		for(i=0; i<n; i++)
+			frame_check(&vec[i], got++, max);
+	}
+	return got-start;
+}
+
+// Sends 'frames' frames of up to 'max' bytes from a child process, and
+// reads them in. Returns the number of frames that were got as views
+// rather than copies in rbuf.
+static int do_transfer(int frames, size_t max, enum read_mode mode,
+	int large)
+{
+	int got=0;
+	int viewed=0;
+	int status;
+	int sv[2];
+	pid_t pid;
+	struct async *as;
+	struct asfd *r;
+
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+		case 0:
+			close(sv[1]);
+			send_frames(sv[0], frames, max, large);
+			_exit(0);
+		default:
+			close(sv[0]);
+			break;
+	}
+
+	as=setup();
+	fail_unless((r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+	if(large)
+		fail_unless(!r->set_large_frames(r));
+	while(got<frames)
+	{
+		int n;
+		fail_unless(!as->read_write(as));
+		if(!r->rbuf->buf)
+			continue;
+		frame_check(r->rbuf, got++, max);
+		iobuf_free_content(r->rbuf);
+		if(mode==READ_RBUF)
+			continue;
+		n=read_rest(r, got, frames, max, mode);
+		got+=n;
+		viewed+=n;
+	}
+	fail_unless(!r->readbuflen);
+	tear_down(&as);
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	return viewed;
+}
+
+START_TEST(test_asfd_transfer)
+{
+	do_transfer(5000, ZCHUNK, READ_RBUF, 0 /* large */);
+	do_transfer(20000, 30, READ_RBUF, 0 /* large */);
+}
+END_TEST
+
+START_TEST(test_asfd_read_view)
+{
+	fail_unless(do_transfer(5000, ZCHUNK, READ_VIEW, 0 /* large */)>0);
+	fail_unless(do_transfer(20000, 30, READ_VIEW, 0 /* large */)>0);
+}
+END_TEST
+
+START_TEST(test_asfd_read_batch)
+{
+	fail_unless(do_transfer(5000, ZCHUNK, READ_BATCH, 0 /* large */)>0);
+	fail_unless(do_transfer(20000, 30, READ_BATCH, 0 /* large */)>0);
+}
+END_TEST
+
+START_TEST(test_asfd_read_view_errors)
+{
+	int fd=100;
+	struct async *as;
+	struct asfd *asfd;
+	struct iobuf view;
+	as=setup();
+	fail_unless((asfd=setup_asfd_linebuf_read(as, "desc", &fd))!=NULL);
+	fail_unless(asfd->read_view(asfd, &view)==-1);
+	fail_unless(asfd->read_batch(asfd, &view, 1)==-1);
+	tear_down(&as);
+
+	fd=100;
+	as=setup();
+	fail_unless((asfd=setup_asfd(as, "desc", &fd, -1))!=NULL);
+	fail_unless(!asfd->read_view(asfd, &view));
+	fail_unless(!asfd->read_batch(asfd, &view, 1));
+	iobuf_from_str(asfd->rbuf, CMD_GEN, (char *)"blah");
+	fail_unless(asfd->read_view(asfd, &view)==-1);
+	fail_unless(asfd->read_batch(asfd, &view, 1)==-1);
+	iobuf_init(asfd->rbuf);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_asfd_large_frames)
+{
+	do_transfer(500, ASFD_LARGE_FRAME_LEN, READ_RBUF, 1 /* large */);
+	fail_unless(do_transfer(500, ASFD_LARGE_FRAME_LEN,
+		READ_BATCH, 1 /* large */)>0);
+	fail_unless(do_transfer(20000, 30, READ_VIEW, 1 /* large */)>0);
+}
+END_TEST
+
+static void fill_readbuf(struct asfd *asfd, const char *buf, size_t len)
+{
+	memcpy(asfd->readbuf, buf, len);
+	asfd->readbufstart=0;
+	asfd->readbuflen=len;
+}
+
+START_TEST(test_asfd_frame_too_big)
+{
+	int fd=100;
+	struct async *as;
+	struct asfd *asfd;
+	struct iobuf wbuf;
+	static char buf[ASFD_LARGE_FRAME_LEN*2];
+	as=setup();
+	fail_unless((asfd=setup_asfd(as, "desc", &fd, -1))!=NULL);
+
+	// Does not fit in four hex digits.
+	iobuf_set(&wbuf, CMD_APPEND, buf, 0x10000);
+	fail_unless(asfd->append_all_to_write_buffer(asfd, &wbuf)
+		==APPEND_ERROR);
+	// Would never fit in the read buffer.
+	fill_readbuf(asfd, "aFFFF", 5);
+	fail_unless(asfd->parse_readbuf(asfd)==-1);
+
+	fail_unless(!asfd->set_large_frames(asfd));
+	fail_unless(asfd->bufmaxsize>ASFD_LARGE_FRAME_LEN*2);
+	iobuf_set(&wbuf, CMD_APPEND, buf, 0x10000);
+	fail_unless(asfd->append_all_to_write_buffer(asfd, &wbuf)
+		==APPEND_OK);
+	asfd->writebuflen=0;
+	iobuf_set(&wbuf, CMD_APPEND, buf, sizeof(buf));
+	fail_unless(asfd->append_all_to_write_buffer(asfd, &wbuf)
+		==APPEND_ERROR);
+	fill_readbuf(asfd, "a\x7F\xFF\xFF\xFF", 5);
+	fail_unless(asfd->parse_readbuf(asfd)==-1);
+	fill_readbuf(asfd, "a\x00\x00\x00\x02hi", 7);
+	fail_unless(!asfd->parse_readbuf(asfd));
+	fail_unless(asfd->rbuf->cmd==CMD_APPEND);
+	ck_assert_str_eq(asfd->rbuf->buf, "hi");
+	iobuf_free_content(asfd->rbuf);
+	tear_down(&as);
+}
+END_TEST
+
+#define SENDFILE_PATH	"utest_asfd_sendfile"
+
+static void read_frame(struct async *as, struct asfd *r,
+	enum cmd cmd, const char *buf, size_t len)
+{
+	while(!r->rbuf->buf)
+		fail_unless(!as->read_write(as));
+	fail_unless(r->rbuf->cmd==cmd);
+	fail_unless(r->rbuf->len==len);
+	fail_unless(!memcmp(r->rbuf->buf, buf, len));
+	iobuf_free_content(r->rbuf);
+}
+
+static void do_test_asfd_sendfile(int large)
+{
+	int fd;
+	int sv[2];
+	FILE *fp;
+	struct async *as;
+	struct asfd *w;
+	struct asfd *r;
+	struct iobuf wbuf;
+	static char buf[3000];
+
+	frame_fill(buf, 0, sizeof(buf));
+	fail_unless((fp=fopen(SENDFILE_PATH, "wb"))!=NULL);
+	fail_unless(fwrite(buf, 1, sizeof(buf), fp)==sizeof(buf));
+	fail_unless(!fclose(fp));
+	fail_unless((fd=open(SENDFILE_PATH, O_RDONLY))>=0);
+
+	as=setup();
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless((w=setup_asfd(as, "writer", &sv[0], -1))!=NULL);
+	fail_unless((r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+	w->attempt_reads=0;
+	if(large)
+	{
+		fail_unless(!w->set_large_frames(w));
+		fail_unless(!r->set_large_frames(r));
+	}
+
+	// Something already waiting in the write buffer goes first.
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"before");
+	fail_unless(w->append_all_to_write_buffer(w, &wbuf)==APPEND_OK);
+	fail_unless(!w->sendfile(w, CMD_APPEND, fd, 0, 1000));
+	fail_unless(!w->sendfile(w, CMD_APPEND, fd, 1000, 2000));
+	fail_unless(!w->writebuflen);
+	// Three five byte headers.
+	fail_unless(w->sent==15+6+sizeof(buf));
+	// The file offset is left alone.
+	fail_unless(lseek(fd, 0, SEEK_CUR)==0);
+
+	read_frame(as, r, CMD_GEN, "before", 6);
+	read_frame(as, r, CMD_APPEND, buf, 1000);
+	read_frame(as, r, CMD_APPEND, buf+1000, 2000);
+
+	// Off the end of the file.
+	fail_unless(w->sendfile(w, CMD_APPEND, fd, 2500, 1000)==-1);
+
+	close(fd);
+	fail_unless(!recursive_delete(SENDFILE_PATH));
+	tear_down(&as);
+}
+
+START_TEST(test_asfd_sendfile)
+{
+	do_test_asfd_sendfile(0 /* large */);
+	do_test_asfd_sendfile(1 /* large */);
+}
+END_TEST
+
+// A file that does not fit in the socket buffer must not hold up what the
+// other asfds have to write. Neither fits in its socket buffer, and the
+// reader only drains the file after it has got all of the other message.
+START_TEST(test_asfd_sendfile_does_not_block_others)
+{
+	int fd;
+	int sv[2];
+	int sv2[2];
+	int status;
+	int sndbuf=4096;
+	pid_t pid;
+	FILE *fp;
+	struct async *as;
+	struct asfd *w;
+	struct asfd *w2;
+	struct iobuf wbuf;
+	size_t len=ASFD_LARGE_FRAME_LEN;
+	static char buf[ASFD_LARGE_FRAME_LEN];
+	static char other[30000];
+
+	frame_fill(buf, 0, sizeof(buf));
+	frame_fill(other, 1, sizeof(other));
+	fail_unless((fp=fopen(SENDFILE_PATH, "wb"))!=NULL);
+	fail_unless(fwrite(buf, 1, sizeof(buf), fp)==sizeof(buf));
+	fail_unless(!fclose(fp));
+	fail_unless((fd=open(SENDFILE_PATH, O_RDONLY))>=0);
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv2));
+	fail_unless(!setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF,
+		&sndbuf, sizeof(sndbuf)));
+	fail_unless(!setsockopt(sv2[0], SOL_SOCKET, SO_SNDBUF,
+		&sndbuf, sizeof(sndbuf)));
+
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		char b[4096];
+		ssize_t r;
+		size_t got=0;
+		alarm(20);
+		close(sv[0]);
+		close(sv2[0]);
+		while(got<sizeof(other)+5)
+		{
+			if((r=read(sv2[1], b, sizeof(b)))<=0)
+				_exit(1);
+			got+=r;
+		}
+		got=0;
+		while((r=read(sv[1], b, sizeof(b)))>0)
+			got+=r;
+		_exit(got==len+5?0:1);
+	}
+	close(sv[1]);
+	close(sv2[1]);
+
+	as=setup();
+	fail_unless((w=setup_asfd(as, "writer", &sv[0], -1))!=NULL);
+	fail_unless((w2=setup_asfd(as, "other", &sv2[0], -1))!=NULL);
+	w->attempt_reads=0;
+	w2->attempt_reads=0;
+	w->set_timeout(w, 5);
+	fail_unless(!w->set_large_frames(w));
+
+	iobuf_set(&wbuf, CMD_APPEND, other, sizeof(other));
+	fail_unless(w2->append_all_to_write_buffer(w2, &wbuf)==APPEND_OK);
+	fail_unless(!w->sendfile(w, CMD_APPEND, fd, 0, len));
+	fail_unless(!w->sendfile_len);
+	fail_unless(w->sent==len+5);
+
+	close(fd);
+	tear_down(&as);
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	fail_unless(!recursive_delete(SENDFILE_PATH));
+}
+END_TEST
+
+START_TEST(test_asfd_sendfile_fallback)
+{
+	int fd=100;
+	struct async *as;
+	struct asfd *asfd;
+	as=setup();
+	fail_unless((asfd=setup_asfd(as, "desc", &fd, -1))!=NULL);
+
+	// Rate limited writes have to go through the write buffer.
+	fail_unless((asfd->rl=ratelimit_alloc(1000, NULL, NULL))!=NULL);
+	fail_unless(asfd->sendfile(asfd, CMD_APPEND, 0, 0, 10)==1);
+	ratelimit_free(&asfd->rl);
+
+	as->doing_estimate=1;
+	fail_unless(asfd->sendfile(asfd, CMD_APPEND, 0, 0, 10)==1);
+	as->doing_estimate=0;
+	fail_unless(!asfd->writebuflen);
+	tear_down(&as);
+}
+END_TEST
+
+static void benchmark(const char *what, int frames, size_t max,
+	enum read_mode mode, int large)
+{
+	double start;
+	double taken;
+	start=time_now();
+	do_transfer(frames, max, mode, large);
+	taken=time_now()-start;
+	printf("asfd %-5s: %6zu byte frames: %9.0f frames/s %7.1f MB/s\n",
+		what, max/2, frames/taken,
+		(double)frames*(max/2)/taken/(1024*1024));
+}
+
+// Not a pass/fail test. Shows the throughput of small frames, like
+// signatures and data requests, and of full data chunks.
+START_TEST(test_asfd_benchmark)
+{
+	benchmark("rbuf", 200000, 40, READ_RBUF, 0 /* large */);
+	benchmark("view", 200000, 40, READ_VIEW, 0 /* large */);
+	benchmark("batch", 200000, 40, READ_BATCH, 0 /* large */);
+	benchmark("rbuf", 20000, ZCHUNK, READ_RBUF, 0 /* large */);
+	benchmark("view", 20000, ZCHUNK, READ_VIEW, 0 /* large */);
+	benchmark("batch", 20000, ZCHUNK, READ_BATCH, 0 /* large */);
+	benchmark("large", 1000, ASFD_LARGE_FRAME_LEN, READ_RBUF, 1 /* large */);
+}
+END_TEST
+
 Suite *suite_asfd(void)
 {
 	Suite *s;
@@ -200,6 +643,16 @@ Suite *suite_asfd(void)
 	tcase_add_test(tc_core, test_setup_asfd_stdout);
 	tcase_add_test(tc_core, test_setup_asfd_twice);
 	tcase_add_test(tc_core, test_setup_asfd_ncurses_stdin);
+	tcase_add_test(tc_core, test_asfd_transfer);
+	tcase_add_test(tc_core, test_asfd_read_view);
+	tcase_add_test(tc_core, test_asfd_read_batch);
+	tcase_add_test(tc_core, test_asfd_read_view_errors);
+	tcase_add_test(tc_core, test_asfd_large_frames);
+	tcase_add_test(tc_core, test_asfd_frame_too_big);
+	tcase_add_test(tc_core, test_asfd_sendfile);
+	tcase_add_test(tc_core, test_asfd_sendfile_does_not_block_others);
+	tcase_add_test(tc_core, test_asfd_sendfile_fallback);
+	tcase_add_test(tc_core, test_asfd_benchmark);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,296 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/async.h"
+#include "../src/fsops.h"
+#include "../src/fzp.h"
+#include "../src/iobuf.h"
+
+#include <sys/resource.h>
+
+#define BASE		"utest_async"
+#define PAIRS		64
+
+static struct async *setup(int epoll)
+{
+	struct async *as;
+	if(epoll)
+		fail_unless((as=async_alloc_epoll())!=NULL);
+	else
+		fail_unless((as=async_alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	as->settimers(as, 0, 100000);
+	return as;
+}
+
+static void tear_down(struct async **as)
+{
+	async_asfd_free_all(as);
+	alloc_check();
+}
+
+static void setup_pair(struct async *as, struct asfd **w, struct asfd **r,
+	int fd_min)
+{
+	int sv[2];
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	if(fd_min)
+	{
+		int i;
+		for(i=0; i<2; i++)
+		{
+			int fd;
+			fail_unless((fd=fcntl(sv[i], F_DUPFD, fd_min))>=fd_min);
+			close(sv[i]);
+			sv[i]=fd;
+		}
+	}
+	fail_unless((*w=setup_asfd(as, "writer", &sv[0], -1))!=NULL);
+	fail_unless((*r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+	(*w)->attempt_reads=0;
+}
+
+static void do_test_exchange(int epoll, int fd_min)
+{
+	int i;
+	int got=0;
+	char msg[32];
+	struct async *as;
+	struct asfd *w[PAIRS];
+	struct asfd *r[PAIRS];
+	as=setup(epoll);
+	for(i=0; i<PAIRS; i++)
+		setup_pair(as, &w[i], &r[i], fd_min);
+
+	// Every other one, so that some readers have nothing to read.
+	for(i=0; i<PAIRS; i+=2)
+	{
+		struct iobuf wbuf;
+		snprintf(msg, sizeof(msg), "message %d", i);
+		iobuf_from_str(&wbuf, CMD_GEN, msg);
+		fail_unless(w[i]->append_all_to_write_buffer(w[i], &wbuf)
+			==APPEND_OK);
+	}
+
+	while(got<PAIRS/2)
+	{
+		fail_unless(!as->read_write(as));
+		for(i=0; i<PAIRS; i++)
+		{
+			if(!r[i]->rbuf->buf)
+				continue;
+			fail_unless(!(i%2));
+			snprintf(msg, sizeof(msg), "message %d", i);
+			fail_unless(r[i]->rbuf->cmd==CMD_GEN);
+			ck_assert_str_eq(r[i]->rbuf->buf, msg);
+			iobuf_free_content(r[i]->rbuf);
+			got++;
+		}
+	}
+	for(i=0; i<PAIRS; i++)
+		fail_unless(!w[i]->writebuflen);
+	tear_down(&as);
+}
+
+START_TEST(test_async_select_exchange)
+{
+	do_test_exchange(0 /* epoll */, 0 /* fd_min */);
+}
+END_TEST
+
+START_TEST(test_async_epoll_exchange)
+{
+	do_test_exchange(1 /* epoll */, 0 /* fd_min */);
+}
+END_TEST
+
+START_TEST(test_async_epoll_beyond_fd_setsize)
+{
+	struct rlimit rl;
+	int fd_min=FD_SETSIZE+16;
+	fail_unless(!getrlimit(RLIMIT_NOFILE, &rl));
+	if(rl.rlim_cur<(rlim_t)fd_min+PAIRS*2+16)
+	{
+		if(rl.rlim_max<(rlim_t)fd_min+PAIRS*2+16)
+			return; // Not allowed here.
+		rl.rlim_cur=fd_min+PAIRS*2+16;
+		fail_unless(!setrlimit(RLIMIT_NOFILE, &rl));
+	}
+	do_test_exchange(1 /* epoll */, fd_min);
+}
+END_TEST
+
+// More than the socket buffers can hold, so the writer has to wait for
+// the reader to make room, and then get another edge.
+START_TEST(test_async_epoll_bulk)
+{
+	int i;
+	int sent=0;
+	int got=0;
+	int wanted=2000;
+	char data[4096];
+	struct asfd *w;
+	struct asfd *r;
+	struct async *as;
+	as=setup(1 /* epoll */);
+	setup_pair(as, &w, &r, 0);
+	for(i=0; i<(int)sizeof(data)-1; i++)
+		data[i]='a'+(i%26);
+	data[sizeof(data)-1]='\0';
+
+	while(got<wanted)
+	{
+		if(sent<wanted)
+		{
+			struct iobuf wbuf;
+			iobuf_from_str(&wbuf, CMD_DATA, data);
+			switch(w->append_all_to_write_buffer(w, &wbuf))
+			{
+				case APPEND_OK: sent++; break;
+				case APPEND_BLOCKED: break;
+				default: fail_unless(0);
+			}
+		}
+		fail_unless(!as->read_write(as));
+		if(!r->rbuf->buf)
+			continue;
+		fail_unless(r->rbuf->len==sizeof(data)-1);
+		fail_unless(!memcmp(r->rbuf->buf, data, r->rbuf->len));
+		iobuf_free_content(r->rbuf);
+		got++;
+	}
+	fail_unless(w->sent==r->rcvd);
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_async_epoll_remove)
+{
+	struct asfd *w;
+	struct asfd *r;
+	struct asfd *w2;
+	struct asfd *r2;
+	struct async *as;
+	as=setup(1 /* epoll */);
+	setup_pair(as, &w, &r, 0);
+	setup_pair(as, &w2, &r2, 0);
+
+	fail_unless(!w->write_str(w, CMD_GEN, "one"));
+	as->asfd_remove(as, r);
+	fail_unless(!w2->write_str(w2, CMD_GEN, "two"));
+	fail_unless(!r2->read(r2));
+	ck_assert_str_eq(r2->rbuf->buf, "two");
+	iobuf_free_content(r2->rbuf);
+	fail_unless(!w->writebuflen);
+	fail_unless(r->rbuf->buf==NULL);
+	fail_unless(!r->rcvd);
+
+	asfd_free(&r);
+	tear_down(&as);
+}
+END_TEST
+
+static void setup_tcp_pair(int *a, int *b)
+{
+	int l;
+	struct sockaddr_in addr;
+	socklen_t len=sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	fail_unless((l=socket(AF_INET, SOCK_STREAM, 0))>=0);
+	fail_unless(!bind(l, (struct sockaddr *)&addr, sizeof(addr)));
+	fail_unless(!listen(l, 1));
+	fail_unless(!getsockname(l, (struct sockaddr *)&addr, &len));
+	fail_unless((*a=socket(AF_INET, SOCK_STREAM, 0))>=0);
+	fail_unless(!connect(*a, (struct sockaddr *)&addr, sizeof(addr)));
+	fail_unless((*b=accept(l, NULL, NULL))>=0);
+	close(l);
+}
+
+// An exception on one fd must not lose the edges that came with it for the
+// others, because they are not given again.
+START_TEST(test_async_epoll_exception_keeps_others)
+{
+	int i;
+	int a;
+	int b;
+	int sv[2];
+	struct asfd *oob;
+	struct asfd *r;
+	struct async *as;
+	const char *frame="c0003two";
+	as=setup(1 /* epoll */);
+	setup_tcp_pair(&a, &b);
+	fail_unless((oob=setup_asfd(as, "oob", &b, -1))!=NULL);
+	fail_unless(send(a, "x", 1, MSG_OOB)==1);
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless(write(sv[0], frame, strlen(frame))==(ssize_t)strlen(frame));
+	fail_unless((r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+
+	fail_unless(as->read_write(as)==-1);
+	fail_unless(oob->want_to_remove);
+	as->asfd_remove(as, oob);
+	asfd_close(oob);
+	asfd_free(&oob);
+
+	for(i=0; i<10 && !r->rbuf->buf; i++)
+		fail_unless(!as->read_write(as));
+	fail_unless(r->rbuf->buf!=NULL);
+	ck_assert_str_eq(r->rbuf->buf, "two");
+	iobuf_free_content(r->rbuf);
+	close(a);
+	close(sv[0]);
+	tear_down(&as);
+}
+END_TEST
+
+// Regular files cannot go in the epoll interest set.
+START_TEST(test_async_epoll_regular_file)
+{
+	int fd;
+	struct asfd *asfd;
+	struct async *as;
+	struct fzp *fzp;
+	char buf[32]="";
+	const char *path=BASE "/file";
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(path));
+	as=setup(1 /* epoll */);
+	fail_unless((fd=open(path, O_WRONLY|O_CREAT, 0666))>=0);
+	fail_unless((asfd=setup_asfd_linebuf_write(as, "file", &fd))!=NULL);
+#ifdef HAVE_SYS_EPOLL_H
+	fail_unless(asfd->always_ready);
+#endif
+	fail_unless(!asfd->write_str(asfd, CMD_GEN, "hello\n"));
+	tear_down(&as);
+
+	fail_unless((fzp=fzp_open(path, "rb"))!=NULL);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))!=NULL);
+	ck_assert_str_eq(buf, "hello\n");
+	fzp_close(&fzp);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_async(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("async");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_async_select_exchange);
+	tcase_add_test(tc_core, test_async_epoll_exchange);
+	tcase_add_test(tc_core, test_async_epoll_beyond_fd_setsize);
+	tcase_add_test(tc_core, test_async_epoll_bulk);
+	tcase_add_test(tc_core, test_async_epoll_remove);
+	tcase_add_test(tc_core, test_async_epoll_regular_file);
+	tcase_add_test(tc_core, test_async_epoll_exception_keeps_others);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
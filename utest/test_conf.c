@@ -28,6 +28,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_CA_SERVER_NAME:
 		case OPT_CA_BURP_CA:
 		case OPT_CA_CSR_DIR:
+		case OPT_SSL_SESSION_FILE:
 		case OPT_CA_CRL:
 		case OPT_PEER_VERSION:
 		case OPT_CLIENT_LOCKDIR:
@@ -67,6 +68,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_N_SUCCESS_SCRIPT:
 		case OPT_N_FAILURE_SCRIPT:
 		case OPT_DEDUP_GROUP:
+		case OPT_CHUNKER:
 		case OPT_VSS_DRIVES:
 		case OPT_REGEX:
 		case OPT_RESTORE_CLIENT:
@@ -74,6 +76,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_string(c[o])==NULL);
 			break;
 		case OPT_RATELIMIT:
+		case OPT_RATELIMIT_GLOBAL:
 			fail_unless(get_float(c[o])==0);
 			break;
 		case OPT_CLIENT_IS_WINDOWS:
@@ -110,12 +113,19 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_PORT_LIST:
 		case OPT_PORT_DELETE:
 		case OPT_MAX_RESUME_ATTEMPTS:
+		case OPT_MD5_THREADS:
+		case OPT_CHAMP_THREADS:
+		case OPT_PREFORK:
+		case OPT_NETWORK_BUFFER_SIZE:
+		case OPT_SSL_KTLS:
+		case OPT_COMPRESSION_ZSTD:
 			fail_unless(get_int(c[o])==0);
 			break;
 		case OPT_DAEMON:
 		case OPT_STDOUT:
 		case OPT_FORK:
 		case OPT_ENABLED:
+		case OPT_BACKUP_STREAMS:
 		case OPT_DIRECTORY_TREE:
 		case OPT_PASSWORD_CHECK:
 		case OPT_LIBRSYNC:
@@ -138,6 +148,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_int(c[o])==1);
 			break;
 		case OPT_NETWORK_TIMEOUT:
+		case OPT_SSL_SESSION_TIMEOUT:
 			fail_unless(get_int(c[o])==60*60*2);
 			break;
 		case OPT_SSL_COMPRESSION:
@@ -166,6 +177,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_S_SCRIPT_POST_ARG:
 		case OPT_S_SCRIPT_ARG:
 		case OPT_TIMER_ARG:
+		case OPT_RATELIMIT_SCHEDULE:
 		case OPT_N_SUCCESS_ARG:
 		case OPT_N_FAILURE_ARG:
 		case OPT_RESTORE_CLIENTS:
@@ -205,6 +217,9 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_RBLK_MEMORY_MAX:
 			fail_unless(get_uint64_t(c[o])==256*1024*1024);
 			break;
+		case OPT_CHAMP_CACHE_MAX:
+			fail_unless(get_uint64_t(c[o])==64*1024*1024);
+			break;
 		case OPT_WORKING_DIR_RECOVERY_METHOD:
 			fail_unless(get_e_recovery_method(c[o])==
 				RECOVERY_METHOD_DELETE);
@@ -383,6 +383,53 @@ START_TEST(test_server_conf)
 }
 END_TEST
 
+START_TEST(test_server_conf_compression)
+{
+	struct conf **confs=NULL;
+	setup(&confs, NULL);
+	build_file(CONFFILE, MIN_SERVER_CONF
+		"compression=zlib5\n"
+		"compression=zstd7\n");
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	// The zlib level is kept for the network.
+	fail_unless(get_int(confs[OPT_COMPRESSION])==5);
+	fail_unless(get_int(confs[OPT_COMPRESSION_ZSTD])==7);
+	tear_down(NULL, &confs);
+
+	setup(&confs, NULL);
+	build_file(CONFFILE, MIN_SERVER_CONF
+		"compression=zstd\n");
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	fail_unless(get_int(confs[OPT_COMPRESSION])==9);
+	fail_unless(get_int(confs[OPT_COMPRESSION_ZSTD])==3);
+	tear_down(NULL, &confs);
+}
+END_TEST
+
+static const char *compression_failures[] = {
+	"compression=zstd0\n",
+	"compression=zstd20\n",
+	"compression=zstd123\n",
+	"compression=zstdx\n",
+	"compression=zlib10\n",
+};
+
+START_TEST(test_server_conf_compression_failures)
+{
+	struct conf **confs=NULL;
+	FOREACH(compression_failures)
+	{
+		char buf[4096];
+		snprintf(buf, sizeof(buf), "%s%s",
+			MIN_SERVER_CONF, compression_failures[i]);
+		setup(&confs, NULL);
+		build_file(CONFFILE, buf);
+		fail_unless(conf_load_global_only(CONFFILE, confs)==-1);
+		tear_down(NULL, &confs);
+	}
+}
+END_TEST
+
 START_TEST(test_server_port_conf_one_max_child)
 {
 	struct conf **confs=NULL;
@@ -694,6 +741,20 @@ static void notify_assertions(struct conf **cconfs)
 
 #define MIN_CLIENTCONFDIR_BUF "# comment\n"
 
+START_TEST(test_clientconfdir_compression)
+{
+	struct conf **globalcs=NULL;
+	struct conf **cconfs=NULL;
+	clientconfdir_setup(&globalcs, &cconfs,
+		MIN_SERVER_CONF "compression=zstd9\n",
+		"compression=gzip3\n");
+	fail_unless(get_int(globalcs[OPT_COMPRESSION_ZSTD])==9);
+	fail_unless(get_int(cconfs[OPT_COMPRESSION])==3);
+	fail_unless(!get_int(cconfs[OPT_COMPRESSION_ZSTD]));
+	tear_down(&globalcs, &cconfs);
+}
+END_TEST
+
 START_TEST(test_clientconfdir_conf)
 {
 	struct strlist *s;
@@ -942,6 +1003,9 @@ Suite *suite_conffile(void)
 	tcase_add_test(tc_core, test_client_conf_ports_no_opt_port_and_all);
 	tcase_add_test(tc_core, test_client_conf_ports_none);
 	tcase_add_test(tc_core, test_server_conf);
+	tcase_add_test(tc_core, test_server_conf_compression);
+	tcase_add_test(tc_core, test_server_conf_compression_failures);
+	tcase_add_test(tc_core, test_clientconfdir_compression);
 	tcase_add_test(tc_core, test_server_port_conf_one_max_child);
 	tcase_add_test(tc_core, test_server_port_conf_too_many_max_child);
 	tcase_add_test(tc_core, test_server_port_conf_few_max_child);
@@ -198,6 +198,148 @@ START_TEST(test_fzp_gztruncate)
 }
 END_TEST
 
+#ifdef HAVE_ZSTD
+START_TEST(test_fzp_zstdread)
+{
+	do_read_tests(fzp_zstdopen);
+}
+END_TEST
+
+START_TEST(test_fzp_zstdseek)
+{
+	// Like old zlib, it will not seek beyond the end when reading.
+	fzp_gzopen_old_zlib_seek_hack=1;
+	do_seek_tests(fzp_zstdopen);
+}
+END_TEST
+
+static int file_starts_with(const char *magic, size_t len)
+{
+	int ret;
+	char buf[4];
+	FILE *fp;
+	fail_unless((fp=fopen(file, "rb"))!=NULL);
+	ret=fread(buf, 1, len, fp)==len && !memcmp(buf, magic, len);
+	fclose(fp);
+	return ret;
+}
+
+static int is_gzip(void)
+{
+	return file_starts_with("\x1f\x8b", 2);
+}
+
+static int is_zstd(void)
+{
+	return file_starts_with("\x28\xb5\x2f\xfd", 4);
+}
+
+static void append_and_check(const char *to_append, const char *expected)
+{
+	char buf[64]="";
+	struct fzp *fzp;
+	size_t len=strlen(to_append);
+	fail_unless((fzp=fzp_zopen(file, "ab"))!=NULL);
+	fail_unless(fzp_write(fzp, to_append, len)==len);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless((fzp=fzp_gzopen(file, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))==(int)strlen(expected));
+	fail_unless(fzp_eof(fzp));
+	fail_unless(!fzp_close(&fzp));
+	ck_assert_str_eq(expected, buf);
+}
+
+// Files that were written either way can be read with fzp_gzopen().
+START_TEST(test_fzp_zstd_gzopen_reads)
+{
+	alloc_check_init();
+	setup_for_read(fzp_zstdopen, content);
+	fail_unless(is_zstd());
+	FOREACH(rd) read_checks(fzp_gzopen, &rd[i]);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_fzp_zopen)
+{
+	alloc_check_init();
+	unlink(file);
+
+	fzp_set_zstd_level(0);
+	setup_for_read(fzp_zopen, content);
+	fail_unless(is_gzip());
+	// Existing files keep their format.
+	fzp_set_zstd_level(3);
+	append_and_check("xyz", "0123456789abcdefgxyz");
+	fail_unless(is_gzip());
+
+	setup_for_read(fzp_zopen, content);
+	fail_unless(is_zstd());
+	append_and_check("xyz", "0123456789abcdefgxyz");
+	append_and_check("", "0123456789abcdefgxyz");
+	fzp_set_zstd_level(0);
+	append_and_check("!", "0123456789abcdefgxyz!");
+	fail_unless(is_zstd());
+
+	// A new file, appended to.
+	unlink(file);
+	fzp_set_zstd_level(19);
+	append_and_check("abc", "abc");
+	fail_unless(is_zstd());
+	fzp_set_zstd_level(0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_fzp_zstd_lines)
+{
+	char buf[8]="";
+	struct fzp *fzp;
+	alloc_check_init();
+	fail_unless((fzp=fzp_zstdopen(file, "wb"))!=NULL);
+	fail_unless(fzp_printf(fzp, "%s\n%d\n", "line one", 2)==11);
+	fail_unless(!fzp_flush(fzp));
+	fail_unless(fzp_printf(fzp, "end")==3);
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless((fzp=fzp_gzopen(file, "rb"))!=NULL);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==buf);
+	ck_assert_str_eq("line on", buf);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==buf);
+	ck_assert_str_eq("e\n", buf);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==buf);
+	ck_assert_str_eq("2\n", buf);
+	fail_unless(fzp_tell(fzp)==11);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==buf);
+	ck_assert_str_eq("end", buf);
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==NULL);
+	fail_unless(fzp_eof(fzp));
+	// Back to the start.
+	fail_unless(!fzp_seek(fzp, 9, SEEK_SET));
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==buf);
+	ck_assert_str_eq("2\n", buf);
+	fail_unless(!fzp_close(&fzp));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_fzp_zstd_truncated)
+{
+	char buf[32];
+	struct stat statp;
+	struct fzp *fzp;
+	alloc_check_init();
+	setup_for_read(fzp_zstdopen, content);
+	fail_unless(!lstat(file, &statp));
+	fail_unless(!truncate(file, statp.st_size-2));
+	fail_unless((fzp=fzp_gzopen(file, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, sizeof(buf))==-1);
+	fail_unless(!fzp_close(&fzp));
+	tear_down();
+}
+END_TEST
+#endif
+
 START_TEST(test_fzp_null_pointer)
 {
 	struct fzp *fzp=NULL;
@@ -239,6 +381,14 @@ Suite *suite_fzp(void)
 	tcase_add_test(tc_core, test_fzp_truncate);
 	tcase_add_test(tc_core, test_fzp_gztruncate);
 	tcase_add_test(tc_core, test_fzp_null_pointer);
+#endif
+#ifdef HAVE_ZSTD
+	tcase_add_test(tc_core, test_fzp_zstdread);
+	tcase_add_test(tc_core, test_fzp_zstdseek);
+	tcase_add_test(tc_core, test_fzp_zstd_gzopen_reads);
+	tcase_add_test(tc_core, test_fzp_zopen);
+	tcase_add_test(tc_core, test_fzp_zstd_lines);
+	tcase_add_test(tc_core, test_fzp_zstd_truncated);
 #endif
 	suite_add_tcase(s, tc_core);
 
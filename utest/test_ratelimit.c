@@ -0,0 +1,318 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/async.h"
+#include "../src/conf.h"
+#include "../src/iobuf.h"
+#include "../src/ratelimit.h"
+#include "../src/strlist.h"
+
+#define START		1000000
+
+START_TEST(test_rlbucket_quota)
+{
+	struct rlbucket bucket;
+	memset(&bucket, 0, sizeof(bucket));
+	bucket.rate=1000;
+
+	// A full burst to begin with.
+	fail_unless(rlbucket_quota(&bucket, START)==100);
+	fail_unless(!rlbucket_wait(&bucket, START));
+	rlbucket_consume(&bucket, START, 100);
+	fail_unless(!rlbucket_quota(&bucket, START));
+	fail_unless(rlbucket_wait(&bucket, START)==RATELIMIT_BURST_USEC/2);
+
+	// Half way there.
+	fail_unless(!rlbucket_quota(&bucket, START+10000));
+	fail_unless(rlbucket_wait(&bucket, START+10000)==40000);
+	fail_unless(rlbucket_quota(&bucket, START+50000)==50);
+	rlbucket_consume(&bucket, START+50000, 10);
+	fail_unless(rlbucket_wait(&bucket, START+50000)==10000);
+
+	// Does not save up more than a burst.
+	fail_unless(rlbucket_quota(&bucket, START*10)==100);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_rlbucket_unlimited)
+{
+	struct rlbucket bucket;
+	memset(&bucket, 0, sizeof(bucket));
+	rlbucket_consume(&bucket, START, 1024*1024);
+	fail_unless(rlbucket_quota(&bucket, START)==SIZE_MAX);
+	fail_unless(!rlbucket_wait(&bucket, START));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_rlbucket_clock_went_back)
+{
+	struct rlbucket bucket;
+	memset(&bucket, 0, sizeof(bucket));
+	bucket.rate=1000;
+	rlbucket_consume(&bucket, START*1000, 100);
+	fail_unless(!rlbucket_quota(&bucket, START*1000));
+	// Would otherwise have to wait for a very long time.
+	fail_unless(rlbucket_quota(&bucket, START)==100);
+	fail_unless(!rlbucket_wait(&bucket, START));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_rlbucket_shared)
+{
+	int status;
+	pid_t pid;
+	struct rlbucket *bucket;
+	fail_unless((bucket=rlbucket_alloc_shared(1000))!=NULL);
+	fail_unless(rlbucket_quota(bucket, START)==100);
+
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+			break;
+		case 0:
+			rlbucket_consume(bucket, START, 100);
+			exit(0);
+		default:
+			fail_unless(waitpid(pid, &status, 0)==pid);
+			fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+			break;
+	}
+
+	// The child used up the parent's quota too.
+	fail_unless(!rlbucket_quota(bucket, START));
+	rlbucket_free_shared(&bucket);
+	fail_unless(bucket==NULL);
+	alloc_check();
+}
+END_TEST
+
+static void consume_in_child(struct ratelimit *rl, size_t bytes)
+{
+	int status;
+	pid_t pid;
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+			break;
+		case 0:
+			ratelimit_consume(rl, bytes);
+			exit(0);
+		default:
+			fail_unless(waitpid(pid, &status, 0)==pid);
+			fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+			break;
+	}
+}
+
+// Like the extra streams of a backup, which are forked from the client.
+START_TEST(test_ratelimit_share)
+{
+	struct ratelimit *rl;
+	fail_unless((rl=ratelimit_alloc(1000, NULL, NULL))!=NULL);
+
+	// Not shared, so the child only uses up its own copy.
+	consume_in_child(rl, 100);
+	fail_unless(ratelimit_quota(rl, 1000)>0);
+
+	fail_unless(!ratelimit_share(rl));
+	fail_unless(rl->shared!=NULL);
+	fail_unless(!ratelimit_share(rl));
+	consume_in_child(rl, 100);
+	fail_unless(!ratelimit_quota(rl, 1000));
+
+	ratelimit_free(&rl);
+	alloc_check();
+}
+END_TEST
+
+static float mbps(float rate)
+{
+	return (rate*1024*1024)/8;
+}
+
+START_TEST(test_ratelimit_schedule)
+{
+	float rate;
+	struct strlist *schedule=NULL;
+	fail_unless(!strlist_add(&schedule, "2:Mon,Tue,09,10", 0));
+	fail_unless(!strlist_add(&schedule, "0:sat,sun,09,10,11", 0));
+	fail_unless(!strlist_add(&schedule, "4:Mon,Tue,Wed,10,11", 0));
+
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Mon", "09", &rate));
+	fail_unless(rate==mbps(2));
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Tue", "10", &rate));
+	fail_unless(rate==mbps(2));
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Mon", "11", &rate));
+	fail_unless(rate==mbps(4));
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Sat", "11", &rate));
+	fail_unless(rate==0);
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Thu", "10", &rate));
+	fail_unless(rate==1);
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Mon", "12", &rate));
+	fail_unless(rate==1);
+	strlists_free(&schedule);
+
+	fail_unless(!strlist_add(&schedule, "0.5:always", 0));
+	fail_unless(!ratelimit_schedule_rate(schedule, 1, "Wed", "23", &rate));
+	fail_unless(rate==mbps(0.5));
+	strlists_free(&schedule);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_ratelimit_schedule_bad)
+{
+	float rate;
+	struct strlist *schedule=NULL;
+	fail_unless(!strlist_add(&schedule, "Mon,Tue,09,10", 0));
+	fail_unless(ratelimit_schedule_rate(schedule, 1, "Mon", "09", &rate));
+	fail_unless(ratelimit_alloc(1, schedule, NULL)==NULL);
+	strlists_free(&schedule);
+
+	fail_unless(!strlist_add(&schedule, "1:always", 0));
+	fail_unless(!strlist_add(&schedule, "-1:Mon,09", 0));
+	fail_unless(ratelimit_alloc(1, schedule, NULL)==NULL);
+	strlists_free(&schedule);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_ratelimit_setup)
+{
+	struct asfd *asfd;
+	struct conf **confs;
+	struct rlbucket global;
+	memset(&global, 0, sizeof(global));
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	asfd->fd=-1;
+
+	// Nothing to limit.
+	fail_unless(!ratelimit_setup(asfd, confs, NULL));
+	fail_unless(asfd->rl==NULL);
+	fail_unless(!ratelimit_setup(asfd, confs, &global));
+	fail_unless(asfd->rl==NULL);
+
+	global.rate=1000;
+	fail_unless(!ratelimit_setup(asfd, confs, &global));
+	fail_unless(asfd->rl!=NULL);
+	fail_unless(asfd->rl->global==&global);
+	fail_unless(!asfd->rl->bucket.rate);
+
+	fail_unless(!set_float(confs[OPT_RATELIMIT], 500));
+	fail_unless(!ratelimit_setup(asfd, confs, NULL));
+	fail_unless(asfd->rl->global==NULL);
+	fail_unless(asfd->rl->bucket.rate==500);
+
+	fail_unless(!set_float(confs[OPT_RATELIMIT], 0));
+	fail_unless(!add_to_strlist(confs[OPT_RATELIMIT_SCHEDULE],
+		"8:always", 0));
+	fail_unless(!ratelimit_setup(asfd, confs, NULL));
+	fail_unless(asfd->rl->bucket.rate==mbps(8));
+
+	asfd_free(&asfd);
+	confs_free(&confs);
+	alloc_check();
+}
+END_TEST
+
+#define RATE		(400*1024)
+#define TO_SEND		(100*1024)
+
+// The writer is held back, but the reader keeps going in the same loop.
+static void do_test_ratelimit_async(int epoll)
+{
+	int sv[2];
+	size_t sent=0;
+	size_t got=0;
+	uint64_t start;
+	uint64_t elapsed;
+	char data[4096];
+	struct asfd *w;
+	struct asfd *r;
+	struct async *as;
+
+	if(epoll)
+		fail_unless((as=async_alloc_epoll())!=NULL);
+	else
+		fail_unless((as=async_alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	as->settimers(as, 1, 0);
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fail_unless((w=setup_asfd(as, "writer", &sv[0], -1))!=NULL);
+	fail_unless((r=setup_asfd(as, "reader", &sv[1], -1))!=NULL);
+	w->attempt_reads=0;
+	fail_unless((w->rl=ratelimit_alloc(RATE, NULL, NULL))!=NULL);
+	memset(data, 'a', sizeof(data)-1);
+	data[sizeof(data)-1]='\0';
+
+	start=ratelimit_clock();
+	while(got<TO_SEND)
+	{
+		if(sent<TO_SEND)
+		{
+			struct iobuf wbuf;
+			iobuf_from_str(&wbuf, CMD_DATA, data);
+			switch(w->append_all_to_write_buffer(w, &wbuf))
+			{
+				case APPEND_OK: sent+=sizeof(data)-1; break;
+				case APPEND_BLOCKED: break;
+				default: fail_unless(0);
+			}
+		}
+		fail_unless(!as->read_write(as));
+		if(!r->rbuf->buf)
+			continue;
+		got+=r->rbuf->len;
+		iobuf_free_content(r->rbuf);
+	}
+	elapsed=ratelimit_clock()-start;
+
+	// The first burst goes straight away.
+	fail_unless(elapsed>=(uint64_t)(TO_SEND-RATE/10)*1000000/RATE);
+	fail_unless(elapsed<2000000);
+	async_asfd_free_all(&as);
+	alloc_check();
+}
+
+START_TEST(test_ratelimit_async_select)
+{
+	do_test_ratelimit_async(0 /* epoll */);
+}
+END_TEST
+
+START_TEST(test_ratelimit_async_epoll)
+{
+	do_test_ratelimit_async(1 /* epoll */);
+}
+END_TEST
+
+Suite *suite_ratelimit(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("ratelimit");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rlbucket_quota);
+	tcase_add_test(tc_core, test_rlbucket_unlimited);
+	tcase_add_test(tc_core, test_rlbucket_clock_went_back);
+	tcase_add_test(tc_core, test_rlbucket_shared);
+	tcase_add_test(tc_core, test_ratelimit_share);
+	tcase_add_test(tc_core, test_ratelimit_schedule);
+	tcase_add_test(tc_core, test_ratelimit_schedule_bad);
+	tcase_add_test(tc_core, test_ratelimit_setup);
+	tcase_add_test(tc_core, test_ratelimit_async_select);
+	tcase_add_test(tc_core, test_ratelimit_async_epoll);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
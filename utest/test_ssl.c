@@ -0,0 +1,187 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/conf.h"
+#include "../src/fsops.h"
+#include "../src/ssl.h"
+
+#define BASE		"utest_ssl"
+#define SESSION_FILE	BASE "/session.pem"
+
+static SSL_SESSION *build_session(void)
+{
+	SSL *ssl;
+	SSL_CTX *ctx;
+	SSL_SESSION *sess;
+	const uint8_t id[]="0123456789abcdef";
+	const uint8_t key[]="0123456789abcdef0123456789abcdef"
+		"0123456789abcdef";
+	fail_unless((ctx=SSL_CTX_new(SSLv23_method()))!=NULL);
+	fail_unless((ssl=SSL_new(ctx))!=NULL);
+	fail_unless((sess=SSL_SESSION_new())!=NULL);
+	fail_unless(SSL_SESSION_set_cipher(sess,
+		sk_SSL_CIPHER_value(SSL_get_ciphers(ssl), 0))==1);
+	fail_unless(SSL_SESSION_set_protocol_version(sess, TLS1_2_VERSION)==1);
+	fail_unless(SSL_SESSION_set1_id(sess, id, sizeof(id)-1)==1);
+	fail_unless(SSL_SESSION_set1_master_key(sess, key, sizeof(key)-1)==1);
+	SSL_SESSION_set_time(sess, time(NULL));
+	SSL_SESSION_set_timeout(sess, 7200);
+	SSL_free(ssl);
+	SSL_CTX_free(ctx);
+	return sess;
+}
+
+START_TEST(test_ssl_session_save_load)
+{
+	char tmp[64];
+	struct stat statp;
+	unsigned int len;
+	SSL_SESSION *sess;
+	SSL_SESSION *got;
+	const uint8_t *id;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	sess=build_session();
+
+	fail_unless(ssl_session_load(SESSION_FILE)==NULL);
+	fail_unless(!ssl_session_save(sess, SESSION_FILE));
+	fail_unless(!lstat(SESSION_FILE, &statp));
+	fail_unless((statp.st_mode & 0777)==0600);
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", SESSION_FILE, (int)getpid());
+	fail_unless(is_reg_lstat(tmp)<=0);
+
+	fail_unless((got=ssl_session_load(SESSION_FILE))!=NULL);
+	id=SSL_SESSION_get_id(got, &len);
+	fail_unless(len==16);
+	fail_unless(!memcmp(id, "0123456789abcdef", 16));
+	fail_unless(SSL_SESSION_get_timeout(got)==7200);
+	SSL_SESSION_free(got);
+
+	// Overwrites the last one.
+	fail_unless(!ssl_session_save(sess, SESSION_FILE));
+	fail_unless((got=ssl_session_load(SESSION_FILE))!=NULL);
+	SSL_SESSION_free(got);
+
+	SSL_SESSION_free(sess);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+// Like the extra streams of a backup, which each save their session.
+START_TEST(test_ssl_session_save_concurrent)
+{
+	int i;
+	int j;
+	int status;
+	pid_t pids[4];
+	SSL_SESSION *sess;
+	SSL_SESSION *got;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	sess=build_session();
+
+	for(i=0; i<4; i++)
+	{
+		switch((pids[i]=fork()))
+		{
+			case -1:
+				fail_unless(0);
+				break;
+			case 0:
+				for(j=0; j<50; j++)
+					if(ssl_session_save(sess, SESSION_FILE))
+						exit(1);
+				exit(0);
+			default:
+				break;
+		}
+	}
+	for(i=0; i<4; i++)
+	{
+		fail_unless(waitpid(pids[i], &status, 0)==pids[i]);
+		fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	}
+	fail_unless((got=ssl_session_load(SESSION_FILE))!=NULL);
+	SSL_SESSION_free(got);
+
+	SSL_SESSION_free(sess);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_ssl_session_load_bad)
+{
+	FILE *fp;
+	fail_unless(ssl_session_load(NULL)==NULL);
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless((fp=fopen(SESSION_FILE, "wb"))!=NULL);
+	fprintf(fp, "not a session\n");
+	fclose(fp);
+	fail_unless(ssl_session_load(SESSION_FILE)==NULL);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_ssl_handshakes_shared)
+{
+	int status;
+	pid_t pid;
+	SSL *ssl;
+	SSL_CTX *ctx;
+	struct ssl_handshakes *handshakes;
+	fail_unless((ctx=SSL_CTX_new(SSLv23_method()))!=NULL);
+	fail_unless((ssl=SSL_new(ctx))!=NULL);
+
+	// Nothing to count with.
+	ssl_handshake_done(ssl);
+	fail_unless(ssl_handshakes_get()==NULL);
+
+	fail_unless(!ssl_handshakes_alloc_shared());
+	fail_unless((handshakes=ssl_handshakes_get())!=NULL);
+	ssl_handshake_done(ssl);
+	switch((pid=fork()))
+	{
+		case -1:
+			fail_unless(0);
+			break;
+		case 0:
+			ssl_handshake_done(ssl);
+			exit(0);
+		default:
+			fail_unless(waitpid(pid, &status, 0)==pid);
+			fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+			break;
+	}
+
+	// The child added to the parent's count.
+	fail_unless(handshakes->full==2);
+	fail_unless(!handshakes->resumed);
+	ssl_handshakes_free_shared();
+	fail_unless(ssl_handshakes_get()==NULL);
+
+	SSL_free(ssl);
+	SSL_CTX_free(ctx);
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_ssl(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("ssl");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_ssl_session_save_load);
+	tcase_add_test(tc_core, test_ssl_session_save_concurrent);
+	tcase_add_test(tc_core, test_ssl_session_load_bad);
+	tcase_add_test(tc_core, test_ssl_handshakes_shared);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}